@@ -2,16 +2,98 @@
 #include "flinalg/LinalgIO.h"
 #include "flinalg/DenseMatrix.h"
 #include "flinalg/DenseVector.h"
+#include "hdprocess/BatchProcess.h"
 #include "hdprocess/HDProcessor.h"
 #include "hdprocess/HDProcessResultSerializer.h"
+#include "hdprocess/LandmarkAgreement.h"
+#include "hdprocess/ParameterSweep.h"
 #include "dataset/Precision.h"
 #include "tclap/CmdLine.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
 
 using namespace FortranLinalg;
 
 void writeData(HDProcessResult *result, std::string path);
 
+// comma separated list of numbers
+template <typename T>
+std::vector<T> parseList(const std::string &list) {
+  std::vector<T> values;
+  std::stringstream ss(list);
+  for (std::string item; std::getline(ss, item, ',');) {
+    values.push_back(std::atof(item.c_str()));
+  }
+  return values;
+}
+
+/**
+ * Prints the stability summary of a parameter sweep as tab separated rows.
+ */
+void printSweep(SweepResult &result, const std::vector<Precision> &sigmas) {
+  std::cout << "setting\tknn\tsmooth\tlevels\tstableLevel\tstableCrystals\tstableGap";
+  for (Precision sigma : sigmas) {
+    std::cout << "\terror(sigma=" << sigma << ")";
+  }
+  std::cout << std::endl;
+  for (unsigned int c = 0; c < result.summaries.size(); c++) {
+    SweepSummary &summary = result.summaries[c];
+    std::cout << c << "\t" << summary.knn << "\t" << summary.sigmaSmooth << "\t" << summary.persistence.size()
+              << "\t" << summary.stableLevel << "\t" << summary.crystalCounts[summary.stableLevel] << "\t"
+              << summary.stableGap;
+    for (Precision error : summary.regressionErrors) {
+      std::cout << "\t" << error;
+    }
+    std::cout << std::endl;
+  }
+  std::cout << std::endl << "setting\tsetting\tadjustedRand" << std::endl;
+  for (auto &agreement : result.agreements) {
+    std::cout << agreement.first << "\t" << agreement.second << "\t" << agreement.adjustedRand << std::endl;
+  }
+}
+
+/**
+ * Prints the agreement of a landmark complex with the exact complex as tab
+ * separated rows.
+ */
+void printAgreement(const std::vector<LandmarkAgreement> &agreements) {
+  std::cout << "persistence\texactCrystals\tapproximateCrystals\tadjustedRand\textremaError" << std::endl;
+  for (auto &agreement : agreements) {
+    std::cout << agreement.persistence << "\t" << agreement.exactCrystals << "\t" << agreement.approximateCrystals
+              << "\t" << agreement.adjustedRand << "\t" << agreement.extremaError << std::endl;
+  }
+}
+
+/**
+ * Processes one job of a batch manifest with the command line settings as
+ * defaults for the parameters it leaves out.
+ */
+void processJob(const BatchJob &job, DenseMatrix<Precision> &x, DenseVector<Precision> &y, int knn, int nSamples,
+                int persistence, bool random, Precision sigma, Precision smooth) {
+  knn = job.intParameter("knn", knn);
+  nSamples = job.intParameter("samples", nSamples);
+  persistence = job.intParameter("persistence", persistence);
+  sigma = job.precisionParameter("sigma", sigma);
+  smooth = job.precisionParameter("smooth", smooth);
+  HDProcessor processor;
+  std::unique_ptr<HDProcessResult> result;
+  int nLandmarks = job.intParameter("landmarks", 0);
+  if (nLandmarks > 0) {
+    auto selection = job.flag("landmark-density") ? LandmarkSelection::Density : LandmarkSelection::Farthest;
+    LandmarkMSComplex<Precision> landmarks(x, y, nLandmarks, knn, selection, smooth > 0, smooth * smooth);
+    result = processor.processLandmarks(landmarks, x, y, knn, nSamples, persistence, sigma);
+    landmarks.deallocate();
+  } else {
+    result = processor.process(x, y, knn, nSamples, persistence, random || job.flag("random"), sigma, smooth);
+  }
+  HDProcessResultSerializer::write(result.get(), job.output + "/");
+}
+
 /**
  * HDVisProcess application entry point.
  */
@@ -25,11 +107,17 @@ int main(int argc, char **argv){
   TCLAP::ValueArg<std::string> xArg("x" /* flag */, "domain" /* name */,
       "Filename for Data points in domain" /* description */,
       true /* required */, "", "string");
-  cmd.add(xArg);
+
+  TCLAP::ValueArg<std::string> batchArg("" /* flag */, "batch" /* name */,
+      "Instead of -x and -f, process the jobs of this manifest, one per line as "
+      "'name domain function [knn=.. samples=.. persistence=.. sigma=.. smooth=.. random landmarks=.. "
+      "landmark-density]', into output_dir/name; jobs completed by an earlier run are skipped" /* description */,
+      true /* required */, "" /* default */, "string" /* type */);
+  cmd.xorAdd(xArg, batchArg);
 
   TCLAP::ValueArg<std::string> fArg("f" /* flag */, "function" /* name */,
       "f(x), Filename for function value for each data point in X" /* description */,
-      true /* required */, "", "string");
+      false /* required */, "", "string");
   cmd.add(fArg);
 
   TCLAP::ValueArg<std::string> outArg("o" /* flag */, "output_dir" /* name */,
@@ -63,6 +151,55 @@ int main(int argc, char **argv){
       false /* required */, 0 /* default */, "double" /* type */);
   cmd.add(smoothArg);
 
+  TCLAP::ValueArg<std::string> sweepKnnArg("" /* flag */, "sweep-knn" /* name */,
+      "Instead of processing, sweep these comma separated knn and print the stability "
+      "of each setting" /* description */,
+      false /* required */, "" /* default */, "list" /* type */);
+  cmd.add(sweepKnnArg);
+
+  TCLAP::ValueArg<std::string> sweepSmoothArg("" /* flag */, "sweep-smooth" /* name */,
+      "Comma separated smooth values of the sweep, default is --smooth" /* description */,
+      false /* required */, "" /* default */, "list" /* type */);
+  cmd.add(sweepSmoothArg);
+
+  TCLAP::ValueArg<std::string> sweepSigmaArg("" /* flag */, "sweep-sigma" /* name */,
+      "Comma separated regression sigma values of the sweep, default is --sigma" /* description */,
+      false /* required */, "" /* default */, "list" /* type */);
+  cmd.add(sweepSigmaArg);
+
+  TCLAP::ValueArg<int> landmarksArg("" /* flag */, "landmarks" /* name */,
+      "Approximate the complex on this many landmarks and assign all other points "
+      "through their nearest landmarks, 0 for the exact complex; --random is not applied" /* description */,
+      false /* required */, 0 /* default */, "integer" /* type */);
+  cmd.add(landmarksArg);
+
+  TCLAP::SwitchArg landmarkDensityArg("" /* flag */, "landmark-density" /* name */,
+      "Choose landmarks relative to the local point spacing instead of farthest point sampling" /* description */,
+      false /* required */);
+  cmd.add(landmarkDensityArg);
+
+  TCLAP::ValueArg<std::string> agreementArg("" /* flag */, "agreement" /* name */,
+      "With --landmarks, also compute the exact complex and print the agreement with it at these "
+      "comma separated persistences in [0,1]" /* description */,
+      false /* required */, "" /* default */, "list" /* type */);
+  cmd.add(agreementArg);
+
+  TCLAP::ValueArg<int> workersArg("" /* flag */, "workers" /* name */,
+      "Number of worker processes of --batch, default = 1" /* description */,
+      false /* required */, 1 /* default */, "integer" /* type */);
+  cmd.add(workersArg);
+
+  TCLAP::ValueArg<int> threadsArg("" /* flag */, "worker-threads" /* name */,
+      "Threads of each --batch worker, default = hardware threads / workers" /* description */,
+      false /* required */, 0 /* default */, "integer" /* type */);
+  cmd.add(threadsArg);
+
+  TCLAP::ValueArg<int> memoryArg("" /* flag */, "worker-memory" /* name */,
+      "Memory limit of each --batch worker in MB, including the mapped inputs; "
+      "jobs exceeding it fail, default = no limit" /* description */,
+      false /* required */, 0 /* default */, "integer" /* type */);
+  cmd.add(memoryArg);
+
 
   try {
     cmd.parse( argc, argv );
@@ -71,11 +208,82 @@ int main(int argc, char **argv){
     return -1;
   }
 
+  if (batchArg.isSet()) {
+    try {
+      auto jobs = BatchProcess::readManifest(batchArg.getValue(), outArg.getValue());
+      BatchProcess batch(jobs, std::max(1, workersArg.getValue()), std::max(0, threadsArg.getValue()),
+                         (size_t) std::max(0, memoryArg.getValue()) << 20);
+      BatchSummary summary = batch.run([&](const BatchJob &job, DenseMatrix<Precision> &x, DenseVector<Precision> &y) {
+        processJob(job, x, y, knnArg.getValue(), samplesArg.getValue(), pArg.getValue(), randArg.getValue(),
+                   sigmaArg.getValue(), smoothArg.getValue());
+        std::cout << job.name << ": done" << std::endl;
+      });
+      std::cout << summary.completed << " completed, " << summary.skipped << " skipped, "
+                << summary.failed.size() << " failed" << std::endl;
+      for (auto &name : summary.failed) {
+        std::cout << "failed: " << name << std::endl;
+      }
+      return summary.failed.empty() ? 0 : 1;
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+      return -1;
+    }
+  }
+
+  if (!fArg.isSet()) {
+    std::cerr << "error: -f is required with -x" << std::endl;
+    return -1;
+  }
+
   // Load Input Data
   // TODO: Move into a data loading library
   DenseMatrix<Precision> x = LinalgIO<Precision>::readMatrix(xArg.getValue());
   DenseVector<Precision> y = LinalgIO<Precision>::readVector(fArg.getValue());
 
+  if (!sweepKnnArg.getValue().empty()) {
+    auto knns = parseList<int>(sweepKnnArg.getValue());
+    auto smooths = sweepSmoothArg.getValue().empty() ? std::vector<Precision>{(Precision) smoothArg.getValue()}
+                                                     : parseList<Precision>(sweepSmoothArg.getValue());
+    auto sigmas = sweepSigmaArg.getValue().empty() ? std::vector<Precision>{sigmaArg.getValue()}
+                                                   : parseList<Precision>(sweepSigmaArg.getValue());
+    try {
+      ParameterSweep sweep = ParameterSweep::fromSamples(x, *std::max_element(knns.begin(), knns.end()));
+      SweepResult result = sweep.run(y, knns, smooths, sigmas, x);
+      printSweep(result, sigmas);
+      sweep.deallocate();
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+      return -1;
+    }
+    return 0;
+  }
+
+  if (landmarksArg.getValue() > 0) {
+    std::unique_ptr<HDProcessResult> result;
+    try {
+      auto selection = landmarkDensityArg.getValue() ? LandmarkSelection::Density : LandmarkSelection::Farthest;
+      Precision smooth = smoothArg.getValue();
+      LandmarkMSComplex<Precision> landmarks(x, y, landmarksArg.getValue(), knnArg.getValue(), selection,
+                                             smooth > 0, smooth * smooth);
+      if (!agreementArg.getValue().empty()) {
+        NNMSComplex<Precision> exact(x, y, knnArg.getValue(), smooth > 0, 0.01, smooth * smooth);
+        printAgreement(LandmarkAgreement::measure(exact, landmarks, y, parseList<Precision>(agreementArg.getValue())));
+        exact.cleanup();
+      }
+      HDProcessor processor;
+      result = processor.processLandmarks(landmarks, x, y, knnArg.getValue(), samplesArg.getValue(),
+                                          pArg.getValue(), sigmaArg.getValue());
+      landmarks.deallocate();
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+      return -1;
+    }
+    std::cout << "Saving landmark process result..." << std::endl;
+    HDProcessResultSerializer::write(result.get(), outArg.getValue());
+    std::cout << "Done." << std::endl;
+    return 0;
+  }
+
   HDProcessResult *result = nullptr;
   try {
     HDProcessor processor;
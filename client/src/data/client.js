@@ -181,9 +181,14 @@ class Client {
    * @param {string} category design parameter or qoi
    * @param {string} fieldname
    * @param {number} k number of neighbors.
+   * @param {number} landmarks optional number of landmarks to approximate
+   *     the decomposition on, 0 for the exact decomposition.
+   * @param {boolean} landmarkdensity optional, choose landmarks relative to
+   *     the local sample spacing.
    * @return {Promise}
    */
-  fetchMorseSmaleDecomposition(datasetId, category, fieldname, metric, knn, datasigma, curvesigma, noise, depth, curvepoints, normalize) {
+  fetchMorseSmaleDecomposition(datasetId, category, fieldname, metric, knn, datasigma, curvesigma, noise, depth, curvepoints, normalize,
+    landmarks, landmarkdensity) {
     let command = {
       name: 'fetchMorseSmaleDecomposition',
       datasetId: datasetId,
@@ -197,6 +202,8 @@ class Client {
       depth: depth,
       curvepoints: curvepoints,
       normalize: normalize,
+      landmarks: landmarks,
+      landmarkdensity: landmarkdensity,
     };
     return this._createCommandPromise(command);
   }
@@ -396,6 +403,122 @@ class Client {
     return this._createCommandPromise(command);
   }
 
+  /**
+   * Wasserstein-2 distances between Gaussian summaries of the crystals of a
+   * range of persistence levels, one matrix over all their crystals.
+   * @param {string} datasetId
+   * @param {number} minPersistence
+   * @param {number} maxPersistence
+   * @param {number} rank number of principal variances kept, 0 for all.
+   * @return {Promise}
+   */
+  fetchCrystalDistances(datasetId, minPersistence, maxPersistence, rank = 0) {
+    let command = {
+      name: 'fetchCrystalDistances',
+      datasetId: datasetId,
+      minPersistence: minPersistence,
+      maxPersistence: maxPersistence,
+      rank: rank,
+    };
+    return this._createCommandPromise(command);
+  }
+
+  /**
+   * Fetch the persistence of the Morse-Smale complexes of all fields of a
+   * category, computed together over one knn graph.
+   * @param {string} datasetId
+   * @param {string} category 'qoi' or 'parameter'.
+   * @param {string} metric distance metric of the knn graph.
+   * @param {number} knn number of nearest neighbors.
+   * @return {Promise}
+   */
+  fetchMorseSmaleFieldSummary(datasetId, category, metric, knn) {
+    let command = {
+      name: 'fetchMorseSmaleFieldSummary',
+      datasetId: datasetId,
+      category: category,
+      metric: metric,
+      knn: knn,
+    };
+    return this._createCommandPromise(command);
+  }
+
+  /**
+   * Fetch the stability of the decomposition of a field over a grid of
+   * parameters.
+   * @param {string} datasetId
+   * @param {string} category 'qoi' or 'parameter'.
+   * @param {string} fieldname
+   * @param {string} metric distance metric of the knn graph.
+   * @param {Array<number>} knns numbers of nearest neighbors.
+   * @param {Array<number>} datasigmas data smoothing bandwidths.
+   * @param {Array<number>} curvesigmas regression curve bandwidths.
+   * @return {Promise}
+   */
+  fetchParameterSweep(datasetId, category, fieldname, metric, knns, datasigmas, curvesigmas) {
+    let command = {
+      name: 'fetchParameterSweep',
+      datasetId: datasetId,
+      category: category,
+      fieldname: fieldname,
+      metric: metric,
+      knns: knns,
+      datasigmas: datasigmas,
+      curvesigmas: curvesigmas,
+    };
+    return this._createCommandPromise(command);
+  }
+
+  /**
+   * Fetch the agreement of the landmark approximation of a decomposition
+   * with the exact decomposition.
+   * @param {string} datasetId
+   * @param {string} category 'qoi' or 'parameter'.
+   * @param {string} fieldname
+   * @param {number} knn number of nearest neighbors.
+   * @param {number} landmarks number of landmarks.
+   * @param {boolean} landmarkdensity choose landmarks relative to the local
+   *     sample spacing.
+   * @param {Array<number>} persistences persistence thresholds in [0,1].
+   * @return {Promise}
+   */
+  fetchLandmarkAgreement(datasetId, category, fieldname, knn, landmarks, landmarkdensity, persistences) {
+    let command = {
+      name: 'fetchLandmarkAgreement',
+      datasetId: datasetId,
+      category: category,
+      fieldname: fieldname,
+      knn: knn,
+      landmarks: landmarks,
+      landmarkdensity: landmarkdensity,
+      persistences: persistences,
+    };
+    return this._createCommandPromise(command);
+  }
+
+  /**
+   * Add samples to the dataset and update its current decomposition.
+   * @param {string} datasetId
+   * @param {Array<Array<number>>} parameters parameter values of each new sample.
+   * @param {Array<Array<number>>} qois qoi values of each new sample.
+   * @param {Object} distances for each metric, the distances of each new
+   *     sample to all samples, the existing ones first.
+   * @param {Array<Array<number>>} geometry coordinates of each new sample, if
+   *     the dataset has geometry.
+   * @return {Promise}
+   */
+  insertSamples(datasetId, parameters, qois, distances, geometry) {
+    let command = {
+      name: 'insertSamples',
+      datasetId: datasetId,
+      parameters: parameters,
+      qois: qois,
+      distances: distances,
+      geometry: geometry,
+    };
+    return this._createCommandPromise(command);
+  }
+
   fetchModelsList(datasetId) {
     const command = {
       name: 'fetchModelsList',
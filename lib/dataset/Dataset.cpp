@@ -77,4 +77,139 @@ Eigen::Map<Eigen::VectorXf> Dataset::getFieldvalues(const std::string &name, Fie
   return Eigen::Map<Eigen::VectorXf>(NULL, 0);
 }
 
+namespace {
+
+// values followed by more values
+FortranLinalg::DenseVector<Precision> appended(FortranLinalg::DenseVector<Precision> &values,
+                                               FortranLinalg::DenseMatrix<Precision> &more, unsigned int row) {
+  FortranLinalg::DenseVector<Precision> ret(values.N() + more.N());
+  std::copy(values.data(), values.data() + values.N(), ret.data());
+  for (unsigned int i = 0; i < more.N(); i++) {
+    ret(values.N() + i) = more(row, i);
+  }
+  return ret;
+}
+
+} // namespace
+
+/*
+ * appendSamples
+ * adds samples, e.g. new runs of an adaptive sampling campaign. Column j of
+ * distances[metric] holds the distances of all samples, the existing ones
+ * first, to new sample j. Normalized fields are recomputed, and precomputed
+ * embeddings place each new sample at its nearest existing sample until they
+ * are recomputed. New samples without a thumbnail show the one of that
+ * sample as well. Metrics given only as neighbor graphs can't be extended.
+ */
+void Dataset::appendSamples(FortranLinalg::DenseMatrix<Precision> &parameters,
+                            FortranLinalg::DenseMatrix<Precision> &qois,
+                            std::map<std::string, FortranLinalg::DenseMatrix<Precision>> &distances,
+                            FortranLinalg::DenseMatrix<Precision> geometry,
+                            const std::vector<Image> &thumbnails) {
+  unsigned int n0 = m_sampleCount;
+  unsigned int n = parameters.N();
+  if (parameters.M() != m_parameters.size() || qois.M() != m_qois.size() || qois.N() != n)
+    throw std::runtime_error("appendSamples: new samples need a value for each of the " +
+                             std::to_string(m_parameters.size()) + " parameters and " +
+                             std::to_string(m_qois.size()) + " qois");
+  if (!m_neighborGraphs.empty())
+    throw std::runtime_error("appendSamples: metrics given as neighbor graphs can't be extended");
+  for (auto &metric : m_distances) {
+    auto d = distances.find(metric.first);
+    if (d == distances.end() || d->second.M() != n0 + n || d->second.N() != n)
+      throw std::runtime_error("appendSamples: need " + std::to_string(n0 + n) + " x " + std::to_string(n) +
+                               " distances for metric " + metric.first);
+  }
+  if (m_hasGeometryMatrix && (geometry.M() != m_geometryMatrix.M() || geometry.N() != n))
+    throw std::runtime_error("appendSamples: need the geometry of the new samples");
+  if (!thumbnails.empty() && (thumbnails.size() != n || m_thumbnails.size() != n0))
+    throw std::runtime_error("appendSamples: need one thumbnail per sample");
+  if (thumbnails.empty() && !m_thumbnails.empty() && m_distances.empty())
+    throw std::runtime_error("appendSamples: need the thumbnails of the new samples");
+
+  // thumbnails are placed using the existing distances, before they grow
+  if (!thumbnails.empty()) {
+    m_thumbnails.insert(m_thumbnails.end(), thumbnails.begin(), thumbnails.end());
+  }
+  else if (!m_thumbnails.empty()) {
+    auto &Dnew = distances.at(m_distances.begin()->first);
+    for (unsigned int j = 0; j < n; j++) {
+      Precision *column = Dnew.data() + (size_t) j * (n0 + n);
+      unsigned int nearest = std::min_element(column, column + n0) - column;
+      m_thumbnails.push_back(m_thumbnails.at(nearest));
+    }
+  }
+
+  for (unsigned int i = 0; i < m_parameters.size(); i++) {
+    auto values = appended(m_parameters[i], parameters, i);
+    m_parameters[i].deallocate();
+    m_normalized_parameters[i].deallocate();
+    m_parameters[i] = values;
+    m_normalized_parameters[i] = normalize(values);
+  }
+  for (unsigned int i = 0; i < m_qois.size(); i++) {
+    auto values = appended(m_qois[i], qois, i);
+    m_qois[i].deallocate();
+    m_normalized_qois[i].deallocate();
+    m_qois[i] = values;
+    m_normalized_qois[i] = normalize(values);
+  }
+
+  if (m_hasGeometryMatrix) {
+    FortranLinalg::DenseMatrix<Precision> grown(m_geometryMatrix.M(), n0 + n);
+    std::copy(m_geometryMatrix.data(), m_geometryMatrix.data() + (size_t) m_geometryMatrix.M() * n0, grown.data());
+    std::copy(geometry.data(), geometry.data() + (size_t) geometry.M() * n, grown.data() + (size_t) m_geometryMatrix.M() * n0);
+    m_geometryMatrix.deallocate();
+    m_geometryMatrix = grown;
+  }
+
+  for (auto &metric : m_distances) {
+    auto &D = metric.second;
+    auto &Dnew = distances.at(metric.first);
+    FortranLinalg::DenseMatrix<Precision> grown(n0 + n, n0 + n);
+    for (unsigned int j = 0; j < n0; j++) {
+      std::copy(D.data() + (size_t) j * n0, D.data() + (size_t) (j + 1) * n0, grown.data() + (size_t) j * (n0 + n));
+    }
+    for (unsigned int j = 0; j < n; j++) {
+      for (unsigned int i = 0; i < n0 + n; i++) {
+        grown(i, n0 + j) = Dnew(i, j);
+        grown(n0 + j, i) = Dnew(i, j);
+      }
+    }
+
+    // new samples take the position of their nearest existing sample
+    if (m_embeddings.find(metric.first) != m_embeddings.end()) {
+      for (auto &embedding : m_embeddings.at(metric.first)) {
+        FortranLinalg::DenseMatrix<Precision> placed(n0 + n, embedding.N());
+        for (unsigned int j = 0; j < n; j++) {
+          Precision *column = Dnew.data() + (size_t) j * (n0 + n);
+          unsigned int nearest = std::min_element(column, column + n0) - column;
+          for (unsigned int c = 0; c < embedding.N(); c++) {
+            placed(n0 + j, c) = embedding(nearest, c);
+          }
+        }
+        for (unsigned int c = 0; c < embedding.N(); c++) {
+          for (unsigned int i = 0; i < n0; i++) {
+            placed(i, c) = embedding(i, c);
+          }
+        }
+        embedding.deallocate();
+        embedding = placed;
+      }
+    }
+    D.deallocate();
+    D = grown;
+  }
+
+  // modelsets keep a copy of the values of their field
+  for (auto &metric : m_models) {
+    for (auto &field : metric.second) {
+      for (auto &modelset : field.second) {
+        modelset->setFieldvals(getFieldvalues(field.first, Fieldtype::Unknown, false));
+      }
+    }
+  }
+  m_sampleCount = n0 + n;
+}
+
 } // dspacex
@@ -3,9 +3,11 @@
 #include "flinalg/Linalg.h"
 #include "flinalg/LinalgIO.h"
 #include "dataset/Precision.h"
+#include "graph/KNNGraph.h"
 #include "imageutils/Image.h"
 #include "pmodels/Modelset.h"
 
+#include <map>
 #include <vector>
 
 namespace dspacex {
@@ -73,6 +75,18 @@ class Dataset {
     else throw std::runtime_error("unknown distance matrix requested");
   }
 
+  bool hasNeighborGraph(std::string metric) const {
+    return m_neighborGraphs.find(metric) != m_neighborGraphs.end();
+  }
+
+  // sparse knn graph for metrics given as neighbors instead of a distance matrix
+  KNNGraph<Precision>& getNeighborGraph(std::string metric) {
+    if (hasNeighborGraph(metric)) {
+      return m_neighborGraphs.at(metric);
+    }
+    else throw std::runtime_error("unknown neighbor graph requested");
+  }
+
   FortranLinalg::DenseVector<Precision>& getQoiVector(int i, bool normalized = false) {
     return normalized ? m_normalized_qois[i] : m_qois[i];
   }
@@ -118,6 +132,15 @@ class Dataset {
     return m_name;
   }
 
+  // live datasets grow by batches of samples written to their append log
+  bool hasAppendLog() const {
+    return !m_appendLogPath.empty();
+  }
+
+  const std::string& getAppendLogPath() const {
+    return m_appendLogPath;
+  }
+
   std::vector<Image> getThumbnails() {
     return m_thumbnails;
   }
@@ -141,10 +164,18 @@ class Dataset {
   Eigen::Map<Eigen::VectorXf> getFieldvalues(const std::string &name, Fieldtype type = Fieldtype::Unknown,
                                              bool normalized = false);
 
+  /// add samples given by their parameters and qois (one column per new sample), their distances to all samples
+  /// for every distance matrix, their coordinates if the dataset has a geometry matrix and their thumbnails
+  void appendSamples(FortranLinalg::DenseMatrix<Precision> &parameters, FortranLinalg::DenseMatrix<Precision> &qois,
+                     std::map<std::string, FortranLinalg::DenseMatrix<Precision>> &distances,
+                     FortranLinalg::DenseMatrix<Precision> geometry = FortranLinalg::DenseMatrix<Precision>(),
+                     const std::vector<Image> &thumbnails = std::vector<Image>());
+
  private:
   int m_sampleCount;
   std::string m_name;
   std::vector<Image> m_thumbnails;
+  std::string m_appendLogPath;  // directory of appended sample batches, empty if not live
 
   std::vector<std::string> m_qoiNames;
   std::vector<std::string> m_parameterNames;
@@ -155,6 +186,7 @@ class Dataset {
 
   std::vector<std::string> m_distanceMetricNames;
   std::map<std::string, FortranLinalg::DenseMatrix<Precision>> m_distances; // distances per metric
+  std::map<std::string, KNNGraph<Precision>> m_neighborGraphs;              // knn graphs per metric
 
   std::map<std::string, std::vector<std::string>> m_embeddingNames;                       // embedding names per metric
   std::map<std::string, std::vector<FortranLinalg::DenseMatrix<Precision>>> m_embeddings; // embeddings per metric
@@ -105,14 +105,17 @@ std::unique_ptr<Dataset> DatasetLoader::loadDataset(const std::string &basePath)
     }
   }
   
+  FortranLinalg::DenseMatrix<Precision> geometry;
   if (config["geometry"]) {
-    auto geometry = DatasetLoader::parseGeometry(config, basePath);
+    geometry = DatasetLoader::parseGeometry(config, basePath);
     builder.withGeometryMatrix(geometry);
   }
 
   if (config["distances"]) {
     auto distances = DatasetLoader::parseDistances(config, basePath);
     builder.withDistances(distances);
+    auto graphs = DatasetLoader::parseNeighborGraphs(config, basePath, geometry, sampleCount);
+    builder.withNeighborGraphs(graphs);
   }
 
   if (config["embeddings"]) {
@@ -134,9 +137,106 @@ std::unique_ptr<Dataset> DatasetLoader::loadDataset(const std::string &basePath)
     builder.withThumbnails(thumbnails);
   }
 
+  if (config["appendLog"]) {
+    builder.withAppendLog(DatasetLoader::parseAppendLog(config, basePath));
+  }
+
   return builder.build();
 }
 
+/*
+ * Appends one batch of samples written to the append log of a live dataset.
+ * A batch is a yaml file like a dataset config, whose files are relative to
+ * it, with the new samples' count, parameters and qois (csv with a column
+ * per field of the dataset), for every distance matrix their distances to
+ * all samples (one row per new sample, the existing samples first), their
+ * geometry if the dataset has one, and optionally the list of their
+ * thumbnail files:
+ *
+ *   samples:
+ *     count: 2
+ *   parameters:
+ *     file: parameters.csv
+ *   qois:
+ *     file: qois.csv
+ *   distances:
+ *     - metric: euclidean
+ *       file: distances.csv
+ *   thumbnails:
+ *     files: [images/100.png, images/101.png]
+ *
+ * Returns the number of samples appended.
+ */
+int DatasetLoader::appendBatch(Dataset &dataset, const std::string &batchPath) {
+  YAML::Node batch = YAML::LoadFile(batchPath);
+  int sampleCount = DatasetLoader::parseSampleCount(batch);
+  if (sampleCount <= 0) {
+    return 0;
+  }
+
+  auto parameters = parseBatchFields(batch["parameters"], batchPath, dataset.getParameterNames(), sampleCount);
+  auto qois = parseBatchFields(batch["qois"], batchPath, dataset.getQoiNames(), sampleCount);
+
+  // one column per new sample, as Dataset::appendSamples expects
+  std::map<std::string, FortranLinalg::DenseMatrix<Precision>> distances;
+  if (batch["distances"]) {
+    for (auto distance : DatasetLoader::parseDistances(batch, batchPath)) {
+      auto &D = distance.second;
+      int total = dataset.numberOfSamples() + sampleCount;
+      bool rowPerSample = D.M() == sampleCount && D.N() == total;
+      if (!rowPerSample && (D.M() != total || D.N() != sampleCount)) {
+        throw std::runtime_error("Batch distances for metric " + distance.first + " do not match sample count.");
+      }
+      distances[distance.first] = rowPerSample ? FortranLinalg::Linalg<Precision>::Transpose(D) : D;
+      if (rowPerSample) {
+        D.deallocate();
+      }
+    }
+  }
+
+  FortranLinalg::DenseMatrix<Precision> geometry;
+  if (batch["geometry"]) {
+    if (!batch["geometry"]["file"]) {
+      throw std::runtime_error("Batch missing 'geometry.file' field.");
+    }
+    geometry = readMatrix(batchPath, batch["geometry"]["file"].as<std::string>(), "geometry");
+    if (geometry.M() == sampleCount && geometry.N() != sampleCount) {
+      auto columns = FortranLinalg::Linalg<Precision>::Transpose(geometry);
+      geometry.deallocate();
+      geometry = columns;
+    }
+  }
+
+  std::vector<Image> thumbnails;
+  if (batch["thumbnails"]) {
+    const YAML::Node &files = batch["thumbnails"]["files"];
+    if (!files || !files.IsSequence()) {
+      throw std::runtime_error("Batch 'thumbnails.files' field missing or not a list.");
+    }
+    for (auto i = 0; i < files.size(); i++) {
+      thumbnails.push_back(Image(filepath(batchPath, files[i].as<std::string>()), false/*decompress*/));
+    }
+  }
+
+  // the dataset copies what it appends
+  auto deallocate = [&]() {
+    parameters.deallocate();
+    qois.deallocate();
+    geometry.deallocate();
+    for (auto &distance : distances) {
+      distance.second.deallocate();
+    }
+  };
+  try {
+    dataset.appendSamples(parameters, qois, distances, geometry, thumbnails);
+  } catch (...) {
+    deallocate();
+    throw;
+  }
+  deallocate();
+  return sampleCount;
+}
+
 std::string DatasetLoader::getDatasetName(const std::string &basePath) {
   YAML::Node config = YAML::LoadFile(basePath);
   std::string name = DatasetLoader::parseName(config);
@@ -586,32 +686,148 @@ std::vector<DistancePair> DatasetLoader::parseDistances(const YAML::Node &config
     }
     std::string metric = node["metric"].as<std::string>();
 
+    // metrics given as a knn graph are read by parseNeighborGraphs
+    if (!node["file"] && node["neighbors"]) {
+      continue;
+    }
     if (!node["file"]) {
       throw std::runtime_error("Dataset config missing 'distances.file' field.");
     }
     std::string filename = node["file"].as<std::string>();
+    distances.push_back(DistancePair(metric, readMatrix(basePath, filename, "distances")));
+  }
+
+  return distances;
+}
+
+/*
+ * Sparse knn graphs for 'distances' entries with a 'neighbors' field instead of a
+ * 'file'. The graph is read from indices/distances files with one row (or column)
+ * per sample, or computed from the geometry when only 'k' is given.
+ */
+std::vector<NeighborGraphPair> DatasetLoader::parseNeighborGraphs(const YAML::Node &config,
+                                                                  const std::string &basePath,
+                                                                  FortranLinalg::DenseMatrix<Precision> &geometry,
+                                                                  int sampleCount) {
+  std::vector<NeighborGraphPair> graphs;
+  const YAML::Node &distancesNode = config["distances"];
+  for (auto i = 0; i < distancesNode.size(); i++) {
+    const YAML::Node &node = distancesNode[i];
+    if (node["file"] || !node["neighbors"]) {
+      continue;
+    }
+    std::string metric = node["metric"].as<std::string>();
+    const YAML::Node &neighbors = node["neighbors"];
+
+    if (neighbors["indices"]) {
+      if (!neighbors["distances"]) {
+        throw std::runtime_error("Dataset config missing 'distances.neighbors.distances' field.");
+      }
+      auto indices = readMatrix(basePath, neighbors["indices"].as<std::string>(), "neighbor indices");
+      auto dists = readMatrix(basePath, neighbors["distances"].as<std::string>(), "neighbor distances");
+      if (indices.M() != dists.M() || indices.N() != dists.N()) {
+        throw std::runtime_error("Dataset config neighbor indices and distances for metric " + metric +
+                                 " differ in size.");
+      }
 
-    auto format = InputFormat(filename);
-    if (verboseLoad) std::cout << "Loading " << format << " from distances filename " << filename << std::endl;
-    switch (format.type) {
-      case InputFormat::LINALG_DENSEMATRIX:
-        distances.push_back(DistancePair(metric, FortranLinalg::LinalgIO<Precision>::readMatrix(filepath(basePath, filename))));
-        break;
-      case InputFormat::CSV:
-        distances.push_back(DistancePair(metric, HDProcess::loadCSVMatrix(filepath(basePath, filename))));
-        break;
-      case InputFormat::BIN:
-      {
-        auto dist = IO::readBinMatrix<Precision, Eigen::ColMajor>(filepath(basePath, filename));
-        distances.push_back(DistancePair(metric, toDenseMatrix<Precision>(dist)));
+      // stored with one row per sample, transpose to one column per sample
+      bool rowPerSample = indices.M() == sampleCount && indices.N() != sampleCount;
+      if (!rowPerSample && indices.N() != sampleCount) {
+        throw std::runtime_error("Dataset config neighbors for metric " + metric + " do not match sample count.");
+      }
+      unsigned k = rowPerSample ? indices.N() : indices.M();
+      FortranLinalg::DenseMatrix<int> knn(k, sampleCount);
+      FortranLinalg::DenseMatrix<Precision> knnd(k, sampleCount);
+      for (unsigned s = 0; s < sampleCount; s++) {
+        for (unsigned j = 0; j < k; j++) {
+          knn(j, s) = (int) (rowPerSample ? indices(s, j) : indices(j, s));
+          knnd(j, s) = rowPerSample ? dists(s, j) : dists(j, s);
+        }
+      }
+      indices.deallocate();
+      dists.deallocate();
+      graphs.push_back(NeighborGraphPair(metric, KNNGraph<Precision>(knn, knnd)));
+    }
+    else if (neighbors["k"]) {
+      if (geometry.N() == 0) {
+        throw std::runtime_error("Dataset config neighbors for metric " + metric +
+                                 " need 'indices' and 'distances' files or a geometry to compute them from.");
       }
-        break;
-      default:
-        throw std::runtime_error("Dataset config specifies unsupported distances format: " + std::string(format));
+      time_point<Clock> start = Clock::now();
+      graphs.push_back(NeighborGraphPair(metric, KNNGraph<Precision>::fromSamples(geometry, neighbors["k"].as<int>())));
+      std::cout << "computed " << neighbors["k"].as<int>() << "-nearest neighbor graph for metric " << metric
+                << " (" << duration_cast<milliseconds>(Clock::now() - start).count() << " ms)\n";
+    }
+    else {
+      throw std::runtime_error("Dataset config missing 'distances.neighbors.indices' or 'distances.neighbors.k' field.");
     }
   }
 
-  return distances;
+  return graphs;
+}
+
+FortranLinalg::DenseMatrix<Precision> DatasetLoader::readMatrix(const std::string &basePath,
+                                                                const std::string &filename,
+                                                                const std::string &what) {
+  auto format = InputFormat(filename);
+  if (verboseLoad) std::cout << "Loading " << format << " from " << what << " filename " << filename << std::endl;
+  switch (format.type) {
+    case InputFormat::LINALG_DENSEMATRIX:
+      return FortranLinalg::LinalgIO<Precision>::readMatrix(filepath(basePath, filename));
+    case InputFormat::CSV:
+      return HDProcess::loadCSVMatrix(filepath(basePath, filename));
+    case InputFormat::BIN:
+    {
+      auto matrix = IO::readBinMatrix<Precision, Eigen::ColMajor>(filepath(basePath, filename));
+      return toDenseMatrix<Precision>(matrix);
+    }
+    default:
+      throw std::runtime_error("Dataset config specifies unsupported " + what + " format: " + std::string(format));
+  }
+}
+
+/*
+ * Directory of the append log of a live dataset, relative to its config.
+ */
+std::string DatasetLoader::parseAppendLog(const YAML::Node &config, const std::string &basePath) {
+  if (!config["appendLog"]["directory"]) {
+    throw std::runtime_error("Dataset config missing 'appendLog.directory' field.");
+  }
+  return filepath(basePath, config["appendLog"]["directory"].as<std::string>());
+}
+
+/*
+ * Values of the named fields for the samples of a batch, one row per field in
+ * the order of names and one column per sample.
+ */
+FortranLinalg::DenseMatrix<Precision> DatasetLoader::parseBatchFields(const YAML::Node &node,
+                                                                      const std::string &basePath,
+                                                                      const std::vector<std::string> &names,
+                                                                      int sampleCount) {
+  FortranLinalg::DenseMatrix<Precision> values(names.size(), sampleCount);
+  if (names.empty()) {
+    return values;
+  }
+  if (!node) {
+    values.deallocate();
+    throw std::runtime_error("Batch missing values of its fields.");
+  }
+  auto fields = parseFields(node, basePath);
+  for (unsigned i = 0; i < names.size(); i++) {
+    auto field = std::find_if(fields.begin(), fields.end(), [&](const FieldNameValuePair &f) {
+      return f.first == names[i];
+    });
+    if (field == fields.end() || field->second.N() != sampleCount) {
+      values.deallocate();
+      for (auto &f : fields) f.second.deallocate();
+      throw std::runtime_error("Batch needs " + std::to_string(sampleCount) + " values of field " + names[i] + ".");
+    }
+    for (int j = 0; j < sampleCount; j++) {
+      values(i, j) = field->second(j);
+    }
+  }
+  for (auto &f : fields) f.second.deallocate();
+  return values;
 }
 
 std::string DatasetLoader::createThumbnailPath(const std::string& imageBasePath, int index,
@@ -702,6 +918,17 @@ DatasetBuilder& DatasetBuilder::withGeometryMatrix(FortranLinalg::DenseMatrix<Pr
   return (*this);
 }
 
+DatasetBuilder& DatasetBuilder::withNeighborGraphs(std::vector<NeighborGraphPair>& graphs) {
+  for (auto graph : graphs) {
+    auto metric = graph.first;
+    if (!m_dataset->hasDistanceMetric(metric)) {
+      m_dataset->m_distanceMetricNames.push_back(metric);
+    }
+    m_dataset->m_neighborGraphs[metric] = graph.second;
+  }
+  return (*this);
+}
+
 DatasetBuilder& DatasetBuilder::withDistances(std::vector<DistancePair>& distances) {
   for (auto dist : distances) {
     auto metric = dist.first;
@@ -765,5 +992,10 @@ DatasetBuilder& DatasetBuilder::withThumbnails(std::vector<Image> thumbnails) {
   return (*this);
 }
 
+DatasetBuilder& DatasetBuilder::withAppendLog(std::string path) {
+  m_dataset->m_appendLogPath = path;
+  return (*this);
+}
+
 
 } // dspacex
@@ -17,12 +17,16 @@ using FieldNameValuePair = std::pair<std::string, FortranLinalg::DenseVector<Pre
 using EmbeddingPair = std::pair<std::string, FortranLinalg::DenseMatrix<Precision>>;       // embedding name to embedding matrix
 using DistancePair = std::pair<std::string, FortranLinalg::DenseMatrix<Precision>>;        // metric name to distance matrix
 using ModelMapPair = std::pair<std::string, ModelMap>;                         // metric name to map of fields to modelsets
+using NeighborGraphPair = std::pair<std::string, KNNGraph<Precision>>;         // metric name to knn graph
 
 class DatasetLoader {
 public:
   static std::unique_ptr<Dataset> loadDataset(const std::string &basePath);
   static std::string getDatasetName(const std::string &basePath);
 
+  // append the samples of one batch file of the append log of a live dataset
+  static int appendBatch(Dataset &dataset, const std::string &batchPath);
+
   // load models on demand for interpolation since they can be very large
   static void parseModel(const std::string &modelPath, Model &m, const std::vector<ValueIndexPair> &sample_indices);
 
@@ -48,9 +52,19 @@ private:
   static std::unique_ptr<MSModelset> parseModelset(const YAML::Node& model, const std::string& basePath);
 
   static std::vector<DistancePair> parseDistances(const YAML::Node &config, const std::string &basePath);
+  static std::vector<NeighborGraphPair> parseNeighborGraphs(const YAML::Node &config, const std::string &basePath,
+                                                            FortranLinalg::DenseMatrix<Precision> &geometry,
+                                                            int sampleCount);
+  static FortranLinalg::DenseMatrix<Precision> readMatrix(const std::string &basePath, const std::string &filename,
+                                                          const std::string &what);
 
   static std::vector<Image> parseThumbnails(const YAML::Node &config, const std::string &basePath);
 
+  static std::string parseAppendLog(const YAML::Node &config, const std::string &basePath);
+  static FortranLinalg::DenseMatrix<Precision> parseBatchFields(const YAML::Node &node, const std::string &basePath,
+                                                                const std::vector<std::string> &names,
+                                                                int sampleCount);
+
   static std::string createThumbnailPath(const std::string& imageBasePath,
       int index, const std::string imageSuffix, unsigned int indexOffset,
       bool padZeros, unsigned int thumbnailCount);
@@ -66,12 +80,14 @@ public:
   DatasetBuilder& withSampleCount(int count);
   DatasetBuilder& withGeometryMatrix(FortranLinalg::DenseMatrix<Precision> &geometryMatrix);
   DatasetBuilder& withDistances(std::vector<DistancePair>& distances);
+  DatasetBuilder& withNeighborGraphs(std::vector<NeighborGraphPair>& graphs);
   DatasetBuilder& withParameter(std::string name, FortranLinalg::DenseVector<Precision> &parameter);
   DatasetBuilder& withQoi(std::string name, FortranLinalg::DenseVector<Precision> &qoi);
   DatasetBuilder& withEmbeddings(std::string metric, std::vector<EmbeddingPair>& embeddings);
   DatasetBuilder& withModelsets(std::string metric, ModelMap& modelsets);
   DatasetBuilder& withName(std::string name);
   DatasetBuilder& withThumbnails(std::vector<Image> thumbnails);
+  DatasetBuilder& withAppendLog(std::string path);
     
 private:
   std::unique_ptr<Dataset> m_dataset;
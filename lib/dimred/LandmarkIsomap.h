@@ -0,0 +1,114 @@
+#ifndef LANDMARKISOMAP_H
+#define LANDMARKISOMAP_H
+
+#include "flinalg/DenseMatrix.h"
+#include "flinalg/DenseVector.h"
+#include "flinalg/SparseMatrix.h"
+#include "flinalg/SymmetricEigensystem.h"
+#include "graph/GraphAlgorithms.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Landmark Isomap (de Silva & Tenenbaum, 2003): geodesic distances from a
+// few farthest point landmarks only, classical MDS on the landmarks and
+// distance based triangulation of all other samples. Needs O(landmarks * N)
+// memory instead of the N x N matrix of Isomap and MetricMDS.
+template <typename TPrecision>
+class LandmarkIsomap {
+  public:
+    LandmarkIsomap(unsigned int nLandmarks = 100) : nl(nLandmarks) {};
+
+    FortranLinalg::DenseMatrix<TPrecision> embedAdj(FortranLinalg::SparseMatrix<TPrecision> &adj, int ndims) {
+      using namespace FortranLinalg;
+      unsigned int n = adj.N();
+      unsigned int L = std::min(std::max<unsigned int>(nl, ndims), n);
+
+      // farthest point landmarks on the graph, starting from sample 0;
+      // unreachable samples are farthest so every component gets a landmark
+      DenseMatrix<TPrecision> G(L, n);
+      std::vector<TPrecision> minDist(n, std::numeric_limits<TPrecision>::max());
+      landmarks.assign(1, 0);
+      for (unsigned int l = 0; l < L; l++) {
+        typename GraphAlgorithms<TPrecision>::Path path = GraphAlgorithms<TPrecision>::dijkstra(adj, landmarks[l]);
+        for (unsigned int i = 0; i < n; i++) {
+          G(l, i) = path.d[i];
+          minDist[i] = std::min(minDist[i], path.d[i]);
+        }
+        delete[] path.d;
+        delete[] path.p;
+        if (l + 1 < L) {
+          landmarks.push_back(std::max_element(minDist.begin(), minDist.end()) - minDist.begin());
+        }
+      }
+
+      // disconnected pairs are placed at the largest finite distance
+      TPrecision maxFinite = 0;
+      for (size_t i = 0; i < (size_t) L * n; i++) {
+        if (G.data()[i] < std::numeric_limits<TPrecision>::max()) {
+          maxFinite = std::max(maxFinite, G.data()[i]);
+        }
+      }
+      for (size_t i = 0; i < (size_t) L * n; i++) {
+        TPrecision d = std::min(G.data()[i], maxFinite);
+        G.data()[i] = d * d;
+      }
+
+      // classical MDS of the landmarks
+      DenseMatrix<TPrecision> B(L, L);
+      DenseVector<TPrecision> mean(L);
+      for (unsigned int a = 0; a < L; a++) {
+        mean(a) = 0;
+        for (unsigned int b = 0; b < L; b++) {
+          B(a, b) = G(a, landmarks[b]);
+          mean(a) += B(a, b);
+        }
+        mean(a) /= L;
+      }
+      TPrecision total = 0;
+      for (unsigned int a = 0; a < L; a++) {
+        total += mean(a);
+      }
+      total /= L;
+      for (unsigned int a = 0; a < L; a++) {
+        for (unsigned int b = 0; b < L; b++) {
+          B(a, b) = -0.5 * (B(a, b) - mean(a) - mean(b) + total);
+        }
+      }
+      SymmetricEigensystem<TPrecision> eigs(B, L - ndims + 1, L);
+      B.deallocate();
+
+      // triangulate every sample from its distances to the landmarks, rows
+      // ordered by ascending eigenvalue as in MetricMDS
+      DenseMatrix<TPrecision> embed(ndims, n);
+      for (int k = 0; k < ndims; k++) {
+        TPrecision ew = eigs.ew(k);
+        for (unsigned int i = 0; i < n; i++) {
+          TPrecision x = 0;
+          if (ew > 0) {
+            for (unsigned int l = 0; l < L; l++) {
+              x += eigs.ev(l, k) * (G(l, i) - mean(l));
+            }
+            x *= -0.5 / std::sqrt(ew);
+          }
+          embed(k, i) = x;
+        }
+      }
+
+      eigs.cleanup();
+      mean.deallocate();
+      G.deallocate();
+      return embed;
+    };
+
+    // landmarks of the last embedding
+    const std::vector<int> &getLandmarks() const { return landmarks; };
+
+  private:
+    unsigned int nl;
+    std::vector<int> landmarks;
+};
+
+#endif
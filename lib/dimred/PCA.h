@@ -3,13 +3,23 @@
 
 #include "flinalg/Linalg.h"
 #include "flinalg/SymmetricEigensystem.h"
+#include "flinalg/RandomSVD.h"
 #include "flinalg/DenseVector.h"
 #include "flinalg/DenseMatrix.h"
 
+#include <algorithm>
+#include <random>
+
 
 template <typename TPrecision>
 class PCA {
   public:
+    //Covariance solves the eigensystem of the covariance, or of the gram
+    //matrix of the samples if there are fewer samples than dimensions.
+    //Randomized finds the leading components from a randomized SVD of the
+    //centered data, which never forms either matrix. Auto picks by shape.
+    enum class Solver { Auto, Covariance, Randomized };
+
     //Constructs PCA to project and unproject vectors, covariance is not known.
     PCA(FortranLinalg::DenseMatrix<TPrecision> &evecs, FortranLinalg::DenseVector<TPrecision> &evals,
         FortranLinalg::DenseVector<TPrecision> &m):data(PCA<TPrecision>::dataDummy)
@@ -25,7 +35,7 @@ class PCA {
 
 
     PCA(FortranLinalg::DenseMatrix<TPrecision> &samples, unsigned int ndims,
-        bool subtractMean = true) : data(samples) {
+        bool subtractMean = true, Solver solver = Solver::Auto) : data(samples) {
       rowCov = data.M() > data.N();
 
       if (subtractMean) {
@@ -33,17 +43,37 @@ class PCA {
         FortranLinalg::Linalg<TPrecision>::SubtractColumnwise(data, mean, data);
       }
 
-      // Build covariance.
-      computeCovariance(samples);
-
-      if (ndims == 0 || ndims > covariance.N()) {
-        nProjectionDimensions = covariance.N();
+      unsigned int nCovariance = rowCov ? data.N() : data.M();
+      if (ndims == 0 || ndims > nCovariance) {
+        nProjectionDimensions = nCovariance;
       } else {
         nProjectionDimensions = ndims;
       }
       buffer = FortranLinalg::DenseVector<TPrecision>(nProjectionDimensions);
 
-      computePC();
+      if (solver == Solver::Auto) {
+        solver = chooseSolver(data.M(), data.N(), nProjectionDimensions);
+      }
+      if (solver == Solver::Randomized) {
+        computeRandomizedPC();
+      } else {
+        // Build covariance.
+        computeCovariance(samples);
+        computePC();
+      }
+    };
+
+    //The covariance costs about min(m, n)^2 max(m, n) to form and min(m, n)^3
+    //to reduce, the randomized SVD about 2 (powerIterations + 1) l m n for a
+    //range of l = ndims + oversampling columns. Its thin products run well
+    //below the speed of the covariance product, so it only pays off once the
+    //smaller dimension of the m x n data is a few dozen times l.
+    static Solver chooseSolver(unsigned int m, unsigned int n, unsigned int ndims) {
+      unsigned int l = ndims + oversampling;
+      if (std::min(m, n) >= randomizedRatio * l) {
+        return Solver::Randomized;
+      }
+      return Solver::Covariance;
     };
 
     FortranLinalg::DenseMatrix<TPrecision> &getCovariance() {
@@ -242,6 +272,13 @@ class PCA {
 
 
   private:
+    //columns of the random range beyond ndims and power iterations refining
+    //it, which keep the leading components accurate when the spectrum decays
+    //slowly
+    static const unsigned int oversampling = 10;
+    static const int powerIterations = 2;
+    static const unsigned int randomizedRatio = 32;
+
     static FortranLinalg::DenseMatrix<TPrecision> dataDummy;
     FortranLinalg::DenseVector<TPrecision> buffer;
     bool rowCov;
@@ -294,6 +331,35 @@ class PCA {
     };
 
 
+    //Leading components from the SVD of the centered data restricted to a
+    //randomized range, in the ascending order of computePC. The test matrix
+    //is seeded so layouts are reproducible.
+    void computeRandomizedPC(){
+      using namespace FortranLinalg;
+
+      unsigned int l = std::min(nProjectionDimensions + oversampling, std::min(data.M(), data.N()));
+      DenseMatrix<TPrecision> N(data.N(), l);
+      std::mt19937 generator(5489u);
+      std::normal_distribution<TPrecision> normal;
+      TPrecision *nptr = N.data();
+      for(unsigned int i=0; i<N.M()*N.N(); i++){
+        nptr[i] = normal(generator);
+      }
+
+      RandomSVD<TPrecision> svd(data, N, powerIterations);
+      N.deallocate();
+
+      ev = DenseMatrix<TPrecision>(data.M(), nProjectionDimensions);
+      ew = DenseVector<TPrecision>(nProjectionDimensions);
+      for(unsigned int i=0; i<ev.N(); i++){
+        unsigned int j = ev.N() - 1 - i;
+        Linalg<TPrecision>::SetColumn(ev, i, svd.U, j);
+        ew(i) = svd.S(j) * svd.S(j) / (TPrecision)(data.N()-1.0);
+      }
+      svd.deallocate();
+    };
+
+
     void computeCovariance(FortranLinalg::Matrix<TPrecision> &data){
       using namespace FortranLinalg;
       if(rowCov){
@@ -374,5 +440,11 @@ class PCA {
 
 template <typename TPrecision>
 FortranLinalg::DenseMatrix<TPrecision> PCA<TPrecision>::dataDummy;
+template <typename TPrecision>
+const unsigned int PCA<TPrecision>::oversampling;
+template <typename TPrecision>
+const int PCA<TPrecision>::powerIterations;
+template <typename TPrecision>
+const unsigned int PCA<TPrecision>::randomizedRatio;
 
 #endif
@@ -7,6 +7,7 @@
 #include "TangentEpsilonNeighborhood.h"
 #include "TangentKNNNeighborhood.h"
 #include "KNNNeighborhood.h"
+#include "HNSWNeighborhood.h"
 
 #include "MetricTensorKNNNeighborhood.h"
 
@@ -25,6 +26,7 @@ int main(int argc, char **argv){
     std::cout << "  2 = TangentEpsilonNeighborhood, param = epsilon" << std::endl;
     std::cout << "  3 = TangentKNNNeighborhood, param = knn" << std::endl;
     std::cout << "  4 = MetricTensorKNNNeighborhood, params = knn alpha" << std::endl;
+    std::cout << "  5 = HNSWNeighborhood (approximate knn), param = knn" << std::endl;
     std::cout << std::endl;
 
     return 0;
@@ -55,6 +57,9 @@ int main(int argc, char **argv){
   else if(ntype == 4){
     nh = new MetricTensorKNNNeighborhood<Precision>(atoi(argv[5]), atof(argv[6]),MAX);
   }
+  else if(ntype == 5){
+    nh = new HNSWNeighborhood<Precision>(atoi(argv[5]), MAX);
+  }
   else{
     std::cout << "not a valid neighborhoodtype" << std::endl;
     return 1;
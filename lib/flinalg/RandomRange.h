@@ -35,7 +35,23 @@ class RandomRange{
         }
       }
 
-      
+      DenseMatrix<TPrecision> Q = FindRange(X, N, nPowerIt);
+
+      N.deallocate();
+      if(center){
+        X.deallocate();
+      }
+
+      return Q;
+
+    };
+
+
+    //Range of X from the given X.N() x d random test matrix N, so callers
+    //can choose the generator and seed
+    static DenseMatrix<TPrecision> FindRange(DenseMatrix<TPrecision> X,
+        DenseMatrix<TPrecision> N, int nPowerIt = 0){
+
       DenseMatrix<TPrecision> Q = Linalg<TPrecision>::Multiply(X, N);
       Linalg<TPrecision>::QR_inplace(Q);
 
@@ -51,12 +67,6 @@ class RandomRange{
         }
         Z.deallocate();
       }
-      
-
-      N.deallocate();
-      if(center){
-        X.deallocate();
-      }
 
       return Q;
 
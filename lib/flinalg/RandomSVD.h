@@ -35,17 +35,8 @@ class RandomSVD{
       
       DenseMatrix<TPrecision> Q =
         RandomRange<TPrecision>::FindRange(X,d,nPowerIt);
+      compute(X, Q);
 
-      DenseMatrix<TPrecision> B = Linalg<TPrecision>::Multiply(Q, X, true);
-
-      SVD<TPrecision> svd(B, false);
-      S = svd.S;
-      U = Linalg<TPrecision>::Multiply(Q, svd.U);
-
-      svd.U.deallocate();
-      svd.Vt.deallocate();
-      Q.deallocate();
-      B.deallocate();
       if(center){
         X.deallocate();
       }
@@ -53,6 +44,16 @@ class RandomSVD{
     };
 
 
+    //SVD of the range found from the given X.N() x d random test matrix N,
+    //X is not centered
+    RandomSVD(DenseMatrix<TPrecision> X, DenseMatrix<TPrecision> N, int
+        nPowerIt = 0){
+      DenseMatrix<TPrecision> Q =
+        RandomRange<TPrecision>::FindRange(X, N, nPowerIt);
+      compute(X, Q);
+    };
+
+
 
     void deallocate(){
       U.deallocate();
@@ -61,6 +62,21 @@ class RandomSVD{
     };
 
 
+  private:
+
+    void compute(DenseMatrix<TPrecision> X, DenseMatrix<TPrecision> Q){
+      DenseMatrix<TPrecision> B = Linalg<TPrecision>::Multiply(Q, X, true);
+
+      SVD<TPrecision> svd(B, false);
+      S = svd.S;
+      U = Linalg<TPrecision>::Multiply(Q, svd.U);
+
+      svd.U.deallocate();
+      svd.Vt.deallocate();
+      Q.deallocate();
+      B.deallocate();
+    };
+
 };
 
 }
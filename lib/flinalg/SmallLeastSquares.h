@@ -0,0 +1,358 @@
+#ifndef SMALLLEASTSQUARES_H
+#define SMALLLEASTSQUARES_H
+
+#include <math.h>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+
+namespace FortranLinalg{
+
+
+
+//Weighted least squares for a sequence of small problems with a few unknowns
+//and many right hand sides, as the local linear fits of kernel regression:
+//minimizes sum_i w_i^2 (a_i x - b_i)^2 over rows added one at a time.
+//Rows are accumulated into the normal equations in double precision and
+//solved by Cholesky; if the normal equations are ill-conditioned the problem
+//is solved from its rows by a column pivoted Householder QR instead, giving
+//the minimum norm solution of rank deficient problems as gelsd does.
+//Workspaces are allocated once for all problems.
+template <typename TPrecision>
+class SmallLeastSquares{
+
+  public:
+
+    SmallLeastSquares(unsigned int maxRows = 0, unsigned int n = 0, unsigned int nrhs = 0):
+      maxRows(maxRows), n(n), nrhs(nrhs), m(0){
+      rows.resize(maxRows * n);
+      weights.resize(maxRows);
+      rhs.resize(maxRows);
+      G.resize(n * n);
+      H.resize(n * nrhs);
+      clear();
+    };
+
+    //Starts a new problem
+    void clear(){
+      m = 0;
+      std::fill(G.begin(), G.end(), 0.0);
+      std::fill(H.begin(), H.end(), 0.0);
+    };
+
+    //Adds the row w * [a, b] with a of n unknowns and b of nrhs values; b is
+    //referenced until the problem is solved
+    void addRow(const TPrecision *a, TPrecision w, const TPrecision *b){
+      if(m >= maxRows){
+        throw "SmallLeastSquares: more rows than allocated";
+      }
+      double *r = &rows[m * n];
+      for(unsigned int j=0; j<n; j++){
+        r[j] = w * (double) a[j];
+      }
+      weights[m] = w;
+      rhs[m] = b;
+      m++;
+
+      for(unsigned int j=0; j<n; j++){
+        for(unsigned int l=j; l<n; l++){
+          G[j*n + l] += r[j] * r[l];
+        }
+        double *h = &H[j * nrhs];
+        double rw = r[j] * w;
+        for(unsigned int c=0; c<nrhs; c++){
+          h[c] += rw * b[c];
+        }
+      }
+    };
+
+    //Solves the current problem into the column major n x nrhs x and, if
+    //given, the nrhs weighted sums of squared residuals into sse. Returns
+    //false if the normal equations were ill-conditioned and QR was used.
+    bool solve(TPrecision *x, TPrecision *sse = NULL){
+      X.resize(n * nrhs);
+      bool cholesky = solveNormalEquations();
+      if(!cholesky){
+        solveQR();
+      }
+      for(unsigned int j=0; j<n; j++){
+        for(unsigned int c=0; c<nrhs; c++){
+          x[c*n + j] = X[j*nrhs + c];
+        }
+      }
+
+      if(sse != NULL){
+        residual.assign(nrhs, 0.0);
+        e.resize(nrhs);
+        for(unsigned int i=0; i<m; i++){
+          const double *r = &rows[i * n];
+          const TPrecision *b = rhs[i];
+          double w = weights[i];
+          for(unsigned int c=0; c<nrhs; c++){
+            e[c] = w * b[c];
+          }
+          for(unsigned int j=0; j<n; j++){
+            const double *x = &X[j * nrhs];
+            for(unsigned int c=0; c<nrhs; c++){
+              e[c] -= r[j] * x[c];
+            }
+          }
+          for(unsigned int c=0; c<nrhs; c++){
+            residual[c] += e[c] * e[c];
+          }
+        }
+        for(unsigned int c=0; c<nrhs; c++){
+          sse[c] = residual[c];
+        }
+      }
+      return cholesky;
+    };
+
+
+
+  private:
+
+    unsigned int maxRows;
+    unsigned int n;
+    unsigned int nrhs;
+    unsigned int m;
+
+    //weighted rows of the design, row major, their weights and right hand sides
+    std::vector<double> rows;
+    std::vector<double> weights;
+    std::vector<const TPrecision *> rhs;
+
+    //upper triangle of the normal equations and their right hand sides, one
+    //row of nrhs values per unknown
+    std::vector<double> G;
+    std::vector<double> H;
+
+    //solution, one row of nrhs values per unknown, and its residuals
+    std::vector<double> X;
+    std::vector<double> e;
+    std::vector<double> residual;
+
+    //workspaces of the QR fallback
+    std::vector<double> Q;
+    std::vector<double> tau;
+    std::vector<double> T;
+    std::vector<double> t;
+    std::vector<unsigned int> perm;
+
+
+    //In place Cholesky factorization of the upper triangle of the k x k
+    //row major a into the upper triangle of R with a = R^T R. Returns an
+    //estimate of the condition number of a with unit diagonal, which bounds
+    //the error of the factorization independent of the scale of the
+    //unknowns, infinite if a is not positive definite.
+    static double cholesky(double *a, unsigned int k, unsigned int lda){
+      double dmin = std::numeric_limits<double>::max();
+      double dmax = 0;
+      for(unsigned int j=0; j<k; j++){
+        double d = a[j*lda + j];
+        double scale = sqrt(d);
+        for(unsigned int i=0; i<j; i++){
+          d -= a[i*lda + j] * a[i*lda + j];
+        }
+        if(!(d > 0)){
+          return std::numeric_limits<double>::infinity();
+        }
+        d = sqrt(d);
+        a[j*lda + j] = d;
+        for(unsigned int l=j+1; l<k; l++){
+          double s = a[j*lda + l];
+          for(unsigned int i=0; i<j; i++){
+            s -= a[i*lda + j] * a[i*lda + l];
+          }
+          a[j*lda + l] = s / d;
+        }
+        dmin = std::min(dmin, d / scale);
+        dmax = std::max(dmax, d / scale);
+      }
+      return k == 0 ? 1 : (dmax / dmin) * (dmax / dmin);
+    };
+
+    //Solves R^T R y = y in place for the nrhs rows of y, with R from
+    //cholesky
+    static void choleskySolve(const double *R, unsigned int k, unsigned int lda, double *y, unsigned int nrhs){
+      for(unsigned int j=0; j<k; j++){
+        double *yj = &y[j * nrhs];
+        for(unsigned int i=0; i<j; i++){
+          const double *yi = &y[i * nrhs];
+          double r = R[i*lda + j];
+          for(unsigned int c=0; c<nrhs; c++){
+            yj[c] -= r * yi[c];
+          }
+        }
+        double d = R[j*lda + j];
+        for(unsigned int c=0; c<nrhs; c++){
+          yj[c] /= d;
+        }
+      }
+      for(unsigned int j=k; j-- > 0; ){
+        double *yj = &y[j * nrhs];
+        for(unsigned int l=j+1; l<k; l++){
+          const double *yl = &y[l * nrhs];
+          double r = R[j*lda + l];
+          for(unsigned int c=0; c<nrhs; c++){
+            yj[c] -= r * yl[c];
+          }
+        }
+        double d = R[j*lda + j];
+        for(unsigned int c=0; c<nrhs; c++){
+          yj[c] /= d;
+        }
+      }
+    };
+
+    //Normal equations lose about cond(G) times the precision of double, so
+    //Cholesky is used while that stays below the square root of it, that is
+    //for designs with a scaled condition number below about 1e4
+    bool solveNormalEquations(){
+      if(m < n){
+        return false;
+      }
+      double condition = cholesky(G.data(), n, n);
+      if(!(condition < 1 / sqrt(std::numeric_limits<double>::epsilon()))){
+        return false;
+      }
+      std::copy(H.begin(), H.end(), X.begin());
+      choleskySolve(G.data(), n, n, X.data(), nrhs);
+      return true;
+    };
+
+    //Column pivoted Householder QR of the weighted rows; R is truncated where
+    //its diagonal falls below the machine precision of TPrecision relative to
+    //the first, as gelsd truncates small singular values
+    void solveQR(){
+      unsigned int k = std::min(m, n);
+      Q.resize((size_t) m * n);
+      tau.resize(k);
+      perm.resize(n);
+      t.resize(std::max(m, n));
+      for(unsigned int i=0; i<m; i++){
+        for(unsigned int j=0; j<n; j++){
+          Q[j*m + i] = rows[i*n + j];
+        }
+      }
+      for(unsigned int j=0; j<n; j++){
+        perm[j] = j;
+      }
+
+      for(unsigned int j=0; j<k; j++){
+        //pivot the remaining column of largest norm into j
+        unsigned int p = j;
+        double pnorm = -1;
+        for(unsigned int l=j; l<n; l++){
+          double norm = 0;
+          for(unsigned int i=j; i<m; i++){
+            norm += Q[l*m + i] * Q[l*m + i];
+          }
+          if(norm > pnorm){
+            pnorm = norm;
+            p = l;
+          }
+        }
+        if(p != j){
+          std::swap_ranges(&Q[j*m], &Q[j*m] + m, &Q[p*m]);
+          std::swap(perm[j], perm[p]);
+        }
+
+        //reflector zeroing Q(j+1:m, j), stored below the diagonal
+        double *v = &Q[j*m];
+        double alpha = v[j];
+        double norm = sqrt(pnorm);
+        if(norm == 0){
+          tau[j] = 0;
+          continue;
+        }
+        double beta = alpha > 0 ? -norm : norm;
+        tau[j] = (beta - alpha) / beta;
+        for(unsigned int i=j+1; i<m; i++){
+          v[i] /= alpha - beta;
+        }
+        v[j] = beta;
+        for(unsigned int l=j+1; l<n; l++){
+          double *q = &Q[l*m];
+          double s = q[j];
+          for(unsigned int i=j+1; i<m; i++){
+            s += v[i] * q[i];
+          }
+          s *= tau[j];
+          q[j] -= s;
+          for(unsigned int i=j+1; i<m; i++){
+            q[i] -= s * v[i];
+          }
+        }
+      }
+
+      unsigned int rank = 0;
+      double tol = std::numeric_limits<TPrecision>::epsilon() * fabs(k > 0 ? Q[0] : 0);
+      while(rank < k && fabs(Q[rank*m + rank]) > tol){
+        rank++;
+      }
+
+      //The minimum norm solution of the rank x n trapezoid R is R^T z with
+      //R R^T z = Q^T b, factored once for all right hand sides
+      if(rank < n){
+        T.assign(rank * rank, 0.0);
+        for(unsigned int i=0; i<rank; i++){
+          for(unsigned int l=i; l<rank; l++){
+            double s = 0;
+            for(unsigned int j=l; j<n; j++){
+              s += Q[j*m + i] * Q[j*m + l];
+            }
+            T[i*rank + l] = s;
+          }
+        }
+        cholesky(T.data(), rank, rank);
+      }
+
+      for(unsigned int c=0; c<nrhs; c++){
+        for(unsigned int i=0; i<m; i++){
+          t[i] = weights[i] * rhs[i][c];
+        }
+        for(unsigned int j=0; j<k; j++){
+          const double *v = &Q[j*m];
+          double s = t[j];
+          for(unsigned int i=j+1; i<m; i++){
+            s += v[i] * t[i];
+          }
+          s *= tau[j];
+          t[j] -= s;
+          for(unsigned int i=j+1; i<m; i++){
+            t[i] -= s * v[i];
+          }
+        }
+
+        if(rank == n){
+          for(unsigned int j=n; j-- > 0; ){
+            double s = t[j];
+            for(unsigned int l=j+1; l<n; l++){
+              s -= Q[l*m + j] * t[l];
+            }
+            t[j] = s / Q[j*m + j];
+          }
+        }
+        else{
+          choleskySolve(T.data(), rank, rank, t.data(), 1);
+          for(unsigned int j=n; j-- > 0; ){
+            double s = 0;
+            for(unsigned int i=0; i<rank && i<=j; i++){
+              s += Q[j*m + i] * t[i];
+            }
+            t[j] = s;
+          }
+        }
+        for(unsigned int j=0; j<n; j++){
+          X[perm[j]*nrhs + c] = t[j];
+        }
+      }
+    };
+
+};
+
+}
+
+#endif
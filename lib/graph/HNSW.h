@@ -0,0 +1,471 @@
+#ifndef HNSW_H
+#define HNSW_H
+
+#include "flinalg/DenseMatrix.h"
+#include "utils/Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// Tuning knobs for HNSW; larger values trade speed for recall
+struct HNSWParameters {
+  // links per node on the upper layers, twice as many on the base layer
+  unsigned int M = 16;
+  // candidate list size while inserting
+  unsigned int efConstruction = 200;
+  // candidate list size while querying, raised to k if smaller
+  unsigned int efSearch = 64;
+  // seed for the layer assignment
+  unsigned int seed = 100;
+};
+
+
+/**
+ * Hierarchical navigable small world graph (Malkov & Yashunin, 2018) over
+ * the columns of a DenseMatrix for approximate k-nearest neighbor queries
+ * under the squared Euclidean distance. Unlike the kd-tree it does not
+ * degrade with the dimension, and unlike Distance::computeKNN it never
+ * visits all pairs of samples.
+ *
+ * Samples are inserted in parallel; queries do not modify the index and can
+ * run concurrently. The index holds a copy of the coordinates so it can be
+ * saved and loaded without the original data.
+ */
+template <typename TPrecision>
+class HNSW {
+  public:
+    HNSW(FortranLinalg::DenseMatrix<TPrecision> &data,
+         HNSWParameters parameters = HNSWParameters())
+        : dim(data.M()), n(data.N()), params(parameters),
+          points(data.data(), data.data() + (size_t) data.M() * data.N()) {
+      params.M = std::max(2u, params.M);
+      build();
+    };
+
+    // loads an index written by save
+    explicit HNSW(const std::string &filename) {
+      std::ifstream in(filename, std::ios::binary);
+      if (!in) {
+        throw std::runtime_error("unable to open HNSW index " + filename);
+      }
+      char magic[4];
+      uint32_t precision;
+      in.read(magic, 4);
+      read(in, precision);
+      if (!in || std::string(magic, 4) != "HNSW" || precision != sizeof(TPrecision)) {
+        throw std::runtime_error(filename + " is not an HNSW index of matching precision");
+      }
+      read(in, dim);
+      read(in, n);
+      read(in, params.M);
+      read(in, params.efConstruction);
+      read(in, params.efSearch);
+      read(in, params.seed);
+      read(in, maxLevel);
+      read(in, entry);
+      if (!in || params.M < 2 || (n > 0 && (entry < 0 || entry >= (int) n || maxLevel < 0))) {
+        throw std::runtime_error("HNSW index " + filename + " has an invalid header");
+      }
+      points.resize((size_t) dim * n);
+      in.read((char *) points.data(), points.size() * sizeof(TPrecision));
+      links.resize(n);
+      for (unsigned int i = 0; i < n; i++) {
+        uint32_t nLayers;
+        read(in, nLayers);
+        if (!in || nLayers == 0 || nLayers > (uint32_t) maxLevel + 1 ||
+            (i == (unsigned int) entry && nLayers != (uint32_t) maxLevel + 1)) {
+          throw std::runtime_error("HNSW index " + filename + " has invalid layers for node " + std::to_string(i));
+        }
+        links[i].resize(nLayers);
+        for (unsigned int layer = 0; layer < nLayers; layer++) {
+          uint32_t count;
+          read(in, count);
+          if (!in || count > maxLinks(layer)) {
+            throw std::runtime_error("HNSW index " + filename + " has too many links for node " + std::to_string(i));
+          }
+          links[i][layer].resize(count);
+          in.read((char *) links[i][layer].data(), count * sizeof(int));
+        }
+      }
+      if (!in) {
+        throw std::runtime_error("HNSW index " + filename + " is truncated");
+      }
+      // searches follow links without checking, so each must reach a node
+      // present on its layer
+      for (unsigned int i = 0; i < n; i++) {
+        for (unsigned int layer = 0; layer < links[i].size(); layer++) {
+          for (int neighbor : links[i][layer]) {
+            if (neighbor < 0 || neighbor >= (int) n || layer >= links[neighbor].size()) {
+              throw std::runtime_error("HNSW index " + filename + " links node " + std::to_string(i) +
+                                       " to invalid node " + std::to_string(neighbor));
+            }
+          }
+        }
+      }
+    };
+
+    void save(const std::string &filename) const {
+      std::ofstream out(filename, std::ios::binary);
+      if (!out) {
+        throw std::runtime_error("unable to write HNSW index " + filename);
+      }
+      out.write("HNSW", 4);
+      write(out, (uint32_t) sizeof(TPrecision));
+      write(out, dim);
+      write(out, n);
+      write(out, params.M);
+      write(out, params.efConstruction);
+      write(out, params.efSearch);
+      write(out, params.seed);
+      write(out, maxLevel);
+      write(out, entry);
+      out.write((const char *) points.data(), points.size() * sizeof(TPrecision));
+      for (auto &node : links) {
+        write(out, (uint32_t) node.size());
+        for (auto &layer : node) {
+          write(out, (uint32_t) layer.size());
+          out.write((const char *) layer.data(), layer.size() * sizeof(int));
+        }
+      }
+      if (!out) {
+        throw std::runtime_error("failed writing HNSW index " + filename);
+      }
+    };
+
+    unsigned int dimension() const { return dim; };
+    unsigned int size() const { return n; };
+    const HNSWParameters &parameters() const { return params; };
+
+    // only affects queries, the graph is unchanged
+    void setEfSearch(unsigned int ef) { params.efSearch = ef; };
+
+    // approximate k nearest neighbors of query (dim values), sorted by
+    // increasing (squared distance, index); slots beyond the sample count
+    // are set to index -1 at distance max
+    void knn(const TPrecision *query, unsigned int k, int *indices, TPrecision *dists) const {
+      // kept per thread across queries and indices, grown to the largest
+      static thread_local VisitedList visited(0);
+      visited.grow(n);
+      std::vector<std::pair<TPrecision, int>> result;
+      search(query, k, visited, result);
+      store(result, k, indices, dists);
+    };
+
+    // knn.M() approximate nearest neighbors of every indexed sample,
+    // including the sample itself, with squared distances; queries run in
+    // parallel
+    void computeKNN(FortranLinalg::DenseMatrix<int> &knn,
+                    FortranLinalg::DenseMatrix<TPrecision> &dists) const {
+      unsigned int k = knn.M();
+      Parallel::forEachChunk(0, n, [&](long first, long last) {
+        VisitedList visited(n);
+        std::vector<std::pair<TPrecision, int>> result;
+        for (long i = first; i < last; i++) {
+          search(point(i), k, visited, result);
+          store(result, k, &knn(0, i), &dists(0, i));
+        }
+      }, 256);
+    };
+
+    static void computeKNN(FortranLinalg::DenseMatrix<TPrecision> &data,
+                           FortranLinalg::DenseMatrix<int> &knn,
+                           FortranLinalg::DenseMatrix<TPrecision> &dists,
+                           HNSWParameters parameters = HNSWParameters()) {
+      HNSW<TPrecision> index(data, parameters);
+      index.computeKNN(knn, dists);
+    };
+
+  private:
+    typedef std::pair<TPrecision, int> Candidate;
+
+    // generation tagged visited flags, reset in O(1) per search
+    struct VisitedList {
+      VisitedList(unsigned int size) : tags(size, 0), generation(0) {};
+      // new tags are 0, older than any generation after the next reset
+      void grow(unsigned int size) {
+        if (tags.size() < size) {
+          tags.resize(size, 0);
+        }
+      };
+      void reset() {
+        if (++generation == 0) {
+          std::fill(tags.begin(), tags.end(), 0);
+          generation = 1;
+        }
+      };
+      bool visit(int i) {
+        if (tags[i] == generation) {
+          return false;
+        }
+        tags[i] = generation;
+        return true;
+      };
+      std::vector<unsigned int> tags;
+      unsigned int generation;
+    };
+
+    unsigned int dim = 0, n = 0;
+    HNSWParameters params;
+    std::vector<TPrecision> points;
+    // links[node][layer], layer 0 is the base layer
+    std::vector<std::vector<std::vector<int>>> links;
+    int maxLevel = -1;
+    int entry = -1;
+    // per node locks, only used while building
+    std::unique_ptr<std::mutex[]> locks;
+
+    const TPrecision *point(int i) const {
+      return points.data() + (size_t) i * dim;
+    };
+
+    TPrecision distance(const TPrecision *a, const TPrecision *b) const {
+      TPrecision d = 0;
+      for (unsigned int j = 0; j < dim; j++) {
+        TPrecision diff = a[j] - b[j];
+        d += diff * diff;
+      }
+      return d;
+    };
+
+    unsigned int maxLinks(int layer) const {
+      return layer == 0 ? 2 * params.M : params.M;
+    };
+
+    void build() {
+      if (n == 0) {
+        return;
+      }
+
+      // draw the layers up front so the entry point is known before the
+      // parallel insertion starts
+      std::mt19937 rng(params.seed);
+      std::uniform_real_distribution<double> uniform(0, 1);
+      double mL = 1 / std::log((double) params.M);
+      links.resize(n);
+      for (unsigned int i = 0; i < n; i++) {
+        int level = (int) (-std::log(1 - uniform(rng)) * mL);
+        links[i].resize(level + 1);
+        if (level > maxLevel) {
+          maxLevel = level;
+          entry = i;
+        }
+      }
+
+      // inserting the top node first keeps the entry point fixed
+      locks.reset(new std::mutex[n]);
+      Parallel::forEachChunk(0, n, [&](long first, long last) {
+        VisitedList visited(n);
+        std::vector<Candidate> candidates;
+        for (long i = first; i < last; i++) {
+          if (i != entry) {
+            insert(i, visited, candidates);
+          }
+        }
+      }, 64);
+      locks.reset();
+    };
+
+    void insert(int node, VisitedList &visited, std::vector<Candidate> &candidates) {
+      const TPrecision *q = point(node);
+      int level = links[node].size() - 1;
+      Candidate ep(distance(q, point(entry)), entry);
+      for (int layer = maxLevel; layer > level; layer--) {
+        ep = greedy(q, ep, layer, true);
+      }
+
+      for (int layer = std::min(level, maxLevel); layer >= 0; layer--) {
+        searchLayer(q, ep, params.efConstruction, layer, visited, candidates, true);
+        std::sort(candidates.begin(), candidates.end());
+        ep = candidates.front();
+
+        std::vector<int> selected = selectNeighbors(candidates, params.M);
+        {
+          // a concurrent insertion that started from this node on an upper
+          // layer may already have linked back to it here, keep those links
+          std::lock_guard<std::mutex> lock(locks[node]);
+          std::vector<int> &list = links[node][layer];
+          if (list.empty()) {
+            list = selected;
+          }
+          else {
+            for (int i : selected) {
+              if (std::find(list.begin(), list.end(), i) == list.end()) {
+                list.push_back(i);
+              }
+            }
+            prune(node, layer);
+          }
+        }
+        for (int neighbor : selected) {
+          connect(neighbor, node, layer);
+        }
+      }
+    };
+
+    // adds a back link, pruning the neighbor's list if it overflows
+    void connect(int from, int to, int layer) {
+      std::lock_guard<std::mutex> lock(locks[from]);
+      links[from][layer].push_back(to);
+      prune(from, layer);
+    };
+
+    // shrinks an overflowing link list with the selection heuristic; the
+    // caller holds the node's lock
+    void prune(int node, int layer) {
+      std::vector<int> &list = links[node][layer];
+      if (list.size() <= maxLinks(layer)) {
+        return;
+      }
+      std::vector<Candidate> candidates;
+      candidates.reserve(list.size());
+      const TPrecision *p = point(node);
+      for (int i : list) {
+        candidates.push_back(Candidate(distance(p, point(i)), i));
+      }
+      std::sort(candidates.begin(), candidates.end());
+      list = selectNeighbors(candidates, maxLinks(layer));
+    };
+
+    // neighbor selection heuristic: keeps a candidate only if it is closer
+    // to the base point than to every neighbor already kept, which favors
+    // links in diverse directions; candidates must be sorted
+    std::vector<int> selectNeighbors(const std::vector<Candidate> &candidates,
+                                     unsigned int count) const {
+      std::vector<int> selected;
+      for (const Candidate &c : candidates) {
+        if (selected.size() >= count) {
+          break;
+        }
+        bool keep = true;
+        for (int s : selected) {
+          if (distance(point(c.second), point(s)) < c.first) {
+            keep = false;
+            break;
+          }
+        }
+        if (keep) {
+          selected.push_back(c.second);
+        }
+      }
+      return selected;
+    };
+
+    void neighbors(int node, int layer, bool locking, std::vector<int> &out) const {
+      if (locking) {
+        std::lock_guard<std::mutex> lock(locks[node]);
+        out = links[node][layer];
+      }
+      else {
+        out = links[node][layer];
+      }
+    };
+
+    Candidate greedy(const TPrecision *q, Candidate current, int layer, bool locking) const {
+      std::vector<int> list;
+      for (bool changed = true; changed; ) {
+        changed = false;
+        neighbors(current.second, layer, locking, list);
+        for (int i : list) {
+          Candidate c(distance(q, point(i)), i);
+          if (c < current) {
+            current = c;
+            changed = true;
+          }
+        }
+      }
+      return current;
+    };
+
+    // best first search on one layer; result holds the ef closest nodes
+    // found, unordered
+    void searchLayer(const TPrecision *q, Candidate ep, unsigned int ef, int layer,
+                     VisitedList &visited, std::vector<Candidate> &result,
+                     bool locking) const {
+      visited.reset();
+      visited.visit(ep.second);
+      std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> frontier;
+      frontier.push(ep);
+      result.assign(1, ep);
+
+      std::vector<int> list;
+      while (!frontier.empty()) {
+        Candidate c = frontier.top();
+        if (result.size() >= ef && c.first > result.front().first) {
+          break;
+        }
+        frontier.pop();
+        neighbors(c.second, layer, locking, list);
+        for (int i : list) {
+          if (!visited.visit(i)) {
+            continue;
+          }
+          Candidate next(distance(q, point(i)), i);
+          if (result.size() < ef || next < result.front()) {
+            frontier.push(next);
+            result.push_back(next);
+            std::push_heap(result.begin(), result.end());
+            if (result.size() > ef) {
+              std::pop_heap(result.begin(), result.end());
+              result.pop_back();
+            }
+          }
+        }
+      }
+    };
+
+    void search(const TPrecision *q, unsigned int k, VisitedList &visited,
+                std::vector<Candidate> &result) const {
+      result.clear();
+      if (n == 0 || k == 0) {
+        return;
+      }
+      Candidate ep(distance(q, point(entry)), entry);
+      for (int layer = maxLevel; layer > 0; layer--) {
+        ep = greedy(q, ep, layer, false);
+      }
+      searchLayer(q, ep, std::max(k, params.efSearch), 0, visited, result, false);
+      std::sort(result.begin(), result.end());
+      if (result.size() > k) {
+        result.resize(k);
+      }
+    };
+
+    static void store(const std::vector<Candidate> &result, unsigned int k,
+                      int *indices, TPrecision *dists) {
+      for (unsigned int j = 0; j < k; j++) {
+        if (j < result.size()) {
+          dists[j] = result[j].first;
+          indices[j] = result[j].second;
+        }
+        else {
+          dists[j] = std::numeric_limits<TPrecision>::max();
+          indices[j] = -1;
+        }
+      }
+    };
+
+    template <typename T>
+    static void read(std::istream &in, T &value) {
+      in.read((char *) &value, sizeof(T));
+    };
+
+    template <typename T>
+    static void write(std::ostream &out, const T &value) {
+      out.write((const char *) &value, sizeof(T));
+    };
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef HNSWNEIGHBORHOOD_H
+#define HNSWNEIGHBORHOOD_H
+
+#include "graph/HNSW.h"
+#include "graph/Neighborhood.h"
+#include "flinalg/DenseMatrix.h"
+#include "flinalg/SparseMatrix.h"
+
+#include <cmath>
+#include <limits>
+
+
+// Symmetric knn graph like KNNNeighborhood, with the neighbors found
+// through an HNSW index instead of all pairs of samples
+template <typename TPrecision>
+class HNSWNeighborhood : public Neighborhood<TPrecision> {
+  public:
+    HNSWNeighborhood(unsigned int k, TPrecision value = std::numeric_limits<TPrecision>::max(),
+                     HNSWParameters parameters = HNSWParameters()) :
+                               knn(k), val(value), params(parameters){};
+
+    FortranLinalg::SparseMatrix<TPrecision> generateNeighborhood(
+        FortranLinalg::Matrix<TPrecision> &data){
+      using FortranLinalg::DenseMatrix;
+      using FortranLinalg::SparseMatrix;
+
+      // the index needs contiguous columns
+      DenseMatrix<TPrecision> *dense = dynamic_cast<DenseMatrix<TPrecision> *>(&data);
+      DenseMatrix<TPrecision> copy;
+      if (dense == nullptr) {
+        copy = DenseMatrix<TPrecision>(data.M(), data.N());
+        for (unsigned int j = 0; j < data.N(); j++) {
+          for (unsigned int i = 0; i < data.M(); i++) {
+            copy(i, j) = data(i, j);
+          }
+        }
+        dense = &copy;
+      }
+
+      DenseMatrix<int> knns(knn, data.N());
+      DenseMatrix<TPrecision> knnDists(knn, data.N());
+      HNSW<TPrecision>::computeKNN(*dense, knns, knnDists, params);
+
+      SparseMatrix<TPrecision> adj(data.N(), data.N(), val);
+      for(unsigned int i=0; i< adj.N(); i++){
+        typename SparseMatrix<TPrecision>::SparseEntry *entry = adj.getEntries(i);
+        for(unsigned int k=0; k < knn; k++){
+          int j = knns(k, i);
+          if (j < 0 || j == (int) i) {
+            continue;
+          }
+          TPrecision d = std::sqrt(knnDists(k, i));
+          entry->operator[](j) = d;
+          adj.getEntries(j)->operator[](i) = d;
+        }
+      }
+
+      if (dense == &copy) {
+        copy.deallocate();
+      }
+      knns.deallocate();
+      knnDists.deallocate();
+      return adj;
+    };
+
+  private:
+    unsigned int knn;
+    TPrecision val;
+    HNSWParameters params;
+};
+
+#endif
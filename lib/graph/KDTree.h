@@ -0,0 +1,219 @@
+#ifndef KDTREE_H
+#define KDTREE_H
+
+#include "flinalg/DenseMatrix.h"
+#include "utils/Parallel.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+
+/**
+ * Kd-tree over the columns of a DenseMatrix for k-nearest neighbor queries
+ * under the squared Euclidean distance. Replaces the ANN wrapper, which is
+ * double only and keeps its search state in globals: the tree is immutable
+ * after construction so any number of threads can query it concurrently.
+ *
+ * Queries are exact for eps = 0; for eps > 0 a subtree is skipped once it
+ * cannot contain a point closer than (1+eps) times the current k-th neighbor
+ * distance, i.e. the same approximation guarantee ANN gives.
+ */
+template <typename TPrecision>
+class KDTree {
+  public:
+    // builds the tree over the columns of data; the coordinates are copied
+    KDTree(FortranLinalg::DenseMatrix<TPrecision> &data, unsigned int leafSize = 16)
+          : dim(data.M()), n(data.N()), index(data.N()) {
+      std::iota(index.begin(), index.end(), 0);
+      leafSize = std::max(1u, leafSize);
+      if (n > 0) {
+        build(data.data(), 0, n, leafSize);
+      }
+
+      // store coordinates in leaf order so leaf scans are contiguous
+      points.resize((size_t) dim * n);
+      inverse.resize(n);
+      for (unsigned int i = 0; i < n; i++) {
+        inverse[index[i]] = i;
+        TPrecision *col = data.data() + (size_t) index[i] * dim;
+        std::copy(col, col + dim, points.begin() + (size_t) i * dim);
+      }
+    };
+
+    unsigned int dimension() const { return dim; };
+    unsigned int size() const { return n; };
+
+    // k nearest neighbors of query (dim values), sorted by increasing
+    // (squared distance, index); slots beyond the sample count are set to
+    // index -1 at distance max
+    void knn(const TPrecision *query, unsigned int k, int *indices,
+             TPrecision *dists, double eps = 0) const {
+      std::vector<std::pair<TPrecision, int>> heap;
+      std::vector<TPrecision> offsets;
+      search(query, k, eps, heap, offsets);
+      store(heap, k, indices, dists);
+    };
+
+    // knn.M() nearest neighbors of every sample the tree was built from,
+    // including the sample itself, with squared distances; queries run in
+    // parallel
+    void computeKNN(FortranLinalg::DenseMatrix<int> &knn,
+                    FortranLinalg::DenseMatrix<TPrecision> &dists,
+                    double eps = 0) const {
+      unsigned int k = knn.M();
+      Parallel::forEachChunk(0, n, [&](long first, long last) {
+        // reuse query workspace across the chunk
+        std::vector<std::pair<TPrecision, int>> heap;
+        std::vector<TPrecision> offsets;
+        for (long i = first; i < last; i++) {
+          const TPrecision *query = points.data() + (size_t) inverse[i] * dim;
+          search(query, k, eps, heap, offsets);
+          store(heap, k, &knn(0, i), &dists(0, i));
+        }
+      }, 64);
+    };
+
+    // all-samples knn for the columns of data, drop-in for
+    // ANNWrapper::computeANN
+    static void computeKNN(FortranLinalg::DenseMatrix<TPrecision> &data,
+                           FortranLinalg::DenseMatrix<int> &knn,
+                           FortranLinalg::DenseMatrix<TPrecision> &dists,
+                           double eps = 0) {
+      KDTree<TPrecision> tree(data);
+      tree.computeKNN(knn, dists, eps);
+    };
+
+  private:
+    struct Node {
+      // split dimension, -1 for leaves
+      int splitDim;
+      TPrecision split;
+      // children for inner nodes, index range [begin, end) for leaves
+      int left, right;
+    };
+
+    unsigned int dim, n;
+    std::vector<Node> nodes;
+    // tree order -> sample index
+    std::vector<int> index;
+    // coordinates in tree order
+    std::vector<TPrecision> points;
+    // sample index -> tree order
+    std::vector<int> inverse;
+
+    static void store(const std::vector<std::pair<TPrecision, int>> &heap, unsigned int k,
+                      int *indices, TPrecision *dists) {
+      for (unsigned int j = 0; j < k; j++) {
+        if (j < heap.size()) {
+          dists[j] = heap[j].first;
+          indices[j] = heap[j].second;
+        }
+        else {
+          dists[j] = std::numeric_limits<TPrecision>::max();
+          indices[j] = -1;
+        }
+      }
+    };
+
+    // splits [begin, end) at the median of its widest dimension
+    int build(const TPrecision *data, int begin, int end, unsigned int leafSize) {
+      auto coordinate = [&](unsigned int d, int i) { return data[(size_t) i * dim + d]; };
+      int id = nodes.size();
+      nodes.push_back(Node());
+      if (end - begin <= (int) leafSize) {
+        nodes[id].splitDim = -1;
+        nodes[id].left = begin;
+        nodes[id].right = end;
+        return id;
+      }
+
+      int splitDim = 0;
+      TPrecision spread = -1;
+      for (unsigned int d = 0; d < dim; d++) {
+        TPrecision lo = coordinate(d, index[begin]);
+        TPrecision hi = lo;
+        for (int i = begin + 1; i < end; i++) {
+          TPrecision v = coordinate(d, index[i]);
+          lo = std::min(lo, v);
+          hi = std::max(hi, v);
+        }
+        if (hi - lo > spread) {
+          spread = hi - lo;
+          splitDim = d;
+        }
+      }
+
+      int mid = begin + (end - begin) / 2;
+      std::nth_element(index.begin() + begin, index.begin() + mid, index.begin() + end,
+          [&](int a, int b) { return coordinate(splitDim, a) < coordinate(splitDim, b); });
+
+      nodes[id].splitDim = splitDim;
+      nodes[id].split = coordinate(splitDim, index[mid]);
+      int left = build(data, begin, mid, leafSize);
+      int right = build(data, mid, end, leafSize);
+      nodes[id].left = left;
+      nodes[id].right = right;
+      return id;
+    };
+
+    void search(const TPrecision *query, unsigned int k, double eps,
+                std::vector<std::pair<TPrecision, int>> &heap,
+                std::vector<TPrecision> &offsets) const {
+      heap.clear();
+      offsets.assign(dim, 0);
+      if (n > 0 && k > 0) {
+        TPrecision maxErr = (TPrecision) ((1 + eps) * (1 + eps));
+        search(0, query, k, maxErr, 0, heap, offsets);
+      }
+      std::sort_heap(heap.begin(), heap.end());
+    };
+
+    // offsets holds the per-dimension distance from the query to the cell
+    // of node, rd their sum of squares (ANN's incremental distance)
+    void search(int node, const TPrecision *query, unsigned int k, TPrecision maxErr,
+                TPrecision rd, std::vector<std::pair<TPrecision, int>> &heap,
+                std::vector<TPrecision> &offsets) const {
+      const Node &nd = nodes[node];
+      if (nd.splitDim < 0) {
+        for (int i = nd.left; i < nd.right; i++) {
+          const TPrecision *p = points.data() + (size_t) i * dim;
+          TPrecision d = 0;
+          for (unsigned int j = 0; j < dim; j++) {
+            TPrecision diff = p[j] - query[j];
+            d += diff * diff;
+          }
+          std::pair<TPrecision, int> candidate(d, index[i]);
+          if (heap.size() < k) {
+            heap.push_back(candidate);
+            std::push_heap(heap.begin(), heap.end());
+          }
+          else if (candidate < heap.front()) {
+            std::pop_heap(heap.begin(), heap.end());
+            heap.back() = candidate;
+            std::push_heap(heap.begin(), heap.end());
+          }
+        }
+        return;
+      }
+
+      TPrecision diff = query[nd.splitDim] - nd.split;
+      int nearChild = diff < 0 ? nd.left : nd.right;
+      int farChild = diff < 0 ? nd.right : nd.left;
+      search(nearChild, query, k, maxErr, rd, heap, offsets);
+
+      TPrecision old = offsets[nd.splitDim];
+      TPrecision farRd = rd - old * old + diff * diff;
+      // ties at the k-th distance are resolved by index, so they still have
+      // to be visited in exact mode
+      if (heap.size() < k || farRd * maxErr <= heap.front().first) {
+        offsets[nd.splitDim] = diff;
+        search(farChild, query, k, maxErr, farRd, heap, offsets);
+        offsets[nd.splitDim] = old;
+      }
+    };
+};
+
+#endif
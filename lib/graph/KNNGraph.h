@@ -0,0 +1,139 @@
+#ifndef KNNGRAPH_H
+#define KNNGRAPH_H
+
+#include "flinalg/DenseMatrix.h"
+#include "flinalg/SparseMatrix.h"
+#include "graph/HNSW.h"
+#include "graph/KDTree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/**
+ * Sparse k-nearest neighbor graph, the only neighborhood input the
+ * Morse-Smale pipeline needs. Column i of indices/distances holds the
+ * neighbors of sample i by increasing distance, without i itself, in the
+ * same layout Distance::findKNN produces from a full distance matrix.
+ */
+template <typename TPrecision>
+class KNNGraph {
+  public:
+    KNNGraph() {};
+
+    // takes ownership of a k x N neighbor list; self entries are dropped and
+    // each column is sorted, so any precomputed graph can be passed in
+    KNNGraph(FortranLinalg::DenseMatrix<int> knn, FortranLinalg::DenseMatrix<TPrecision> knnd) {
+      if (knn.M() != knnd.M() || knn.N() != knnd.N()) {
+        throw std::runtime_error("knn graph indices and distances differ in size");
+      }
+      unsigned int n = knn.N();
+      bool hasSelf = false;
+      for (unsigned int i = 0; i < n && !hasSelf; i++) {
+        for (unsigned int j = 0; j < knn.M(); j++) {
+          hasSelf = hasSelf || knn(j, i) == (int) i;
+        }
+      }
+      unsigned int k = hasSelf ? knn.M() - 1 : knn.M();
+
+      indices = FortranLinalg::DenseMatrix<int>(k, n);
+      distances = FortranLinalg::DenseMatrix<TPrecision>(k, n);
+      std::vector<std::pair<TPrecision, int>> column;
+      for (unsigned int i = 0; i < n; i++) {
+        column.clear();
+        for (unsigned int j = 0; j < knn.M(); j++) {
+          int neighbor = knn(j, i);
+          if (neighbor < 0 || neighbor >= (int) n) {
+            throw std::runtime_error("knn graph references sample " + std::to_string(neighbor) +
+                                     " of " + std::to_string(n));
+          }
+          if (neighbor != (int) i) {
+            column.push_back(std::make_pair(knnd(j, i), neighbor));
+          }
+        }
+        std::sort(column.begin(), column.end());
+        // a column that did not list its sample is one neighbor longer
+        column.resize(std::min<size_t>(column.size(), k));
+        if (column.size() < k) {
+          throw std::runtime_error("knn graph lists too few neighbors for sample " + std::to_string(i));
+        }
+        for (unsigned int j = 0; j < k; j++) {
+          distances(j, i) = column[j].first;
+          indices(j, i) = column[j].second;
+        }
+      }
+      knn.deallocate();
+      knnd.deallocate();
+    };
+
+    // Euclidean knn graph of the columns of X, exact through a kd-tree for
+    // low dimensional data and approximate through HNSW otherwise
+    static KNNGraph<TPrecision> fromSamples(FortranLinalg::DenseMatrix<TPrecision> &X, unsigned int k,
+                                            unsigned int maxTreeDimension = 16) {
+      k = std::min(k, X.N() - 1);
+      FortranLinalg::DenseMatrix<int> knn(k + 1, X.N());
+      FortranLinalg::DenseMatrix<TPrecision> knnd(k + 1, X.N());
+      if (X.M() <= maxTreeDimension) {
+        KDTree<TPrecision>::computeKNN(X, knn, knnd);
+      }
+      else {
+        HNSW<TPrecision>::computeKNN(X, knn, knnd);
+      }
+      // both return squared distances
+      TPrecision *d = knnd.data();
+      for (size_t i = 0; i < (size_t) knnd.M() * knnd.N(); i++) {
+        d[i] = std::sqrt(d[i]);
+      }
+      return KNNGraph<TPrecision>(knn, knnd);
+    };
+
+    unsigned int k() { return indices.M(); };
+    unsigned int N() { return indices.N(); };
+
+    // throws if the graph holds fewer than knn neighbors per sample
+    void checkNeighbors(unsigned int knn) {
+      if (knn > k()) {
+        throw std::runtime_error("requested " + std::to_string(knn) + " neighbors from a " +
+                                 std::to_string(k()) + "-nearest neighbor graph");
+      }
+    };
+
+    // copies of the first knn.M() neighbors of every sample
+    void select(FortranLinalg::DenseMatrix<int> &knn, FortranLinalg::DenseMatrix<TPrecision> &knnd) {
+      checkNeighbors(knn.M());
+      for (unsigned int i = 0; i < N(); i++) {
+        for (unsigned int j = 0; j < knn.M(); j++) {
+          knn(j, i) = indices(j, i);
+          knnd(j, i) = distances(j, i);
+        }
+      }
+    };
+
+    // symmetric adjacency of the graph, as KNNNeighborhood builds it
+    FortranLinalg::SparseMatrix<TPrecision> adjacency(
+        TPrecision value = std::numeric_limits<TPrecision>::max()) {
+      FortranLinalg::SparseMatrix<TPrecision> adj(N(), N(), value);
+      for (unsigned int i = 0; i < N(); i++) {
+        for (unsigned int j = 0; j < k(); j++) {
+          adj.set(i, indices(j, i), distances(j, i));
+          adj.set(indices(j, i), i, distances(j, i));
+        }
+      }
+      return adj;
+    };
+
+    void deallocate() {
+      indices.deallocate();
+      distances.deallocate();
+    };
+
+    FortranLinalg::DenseMatrix<int> indices;
+    FortranLinalg::DenseMatrix<TPrecision> distances;
+};
+
+#endif
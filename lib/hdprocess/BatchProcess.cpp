@@ -0,0 +1,324 @@
+#include "BatchProcess.h"
+
+#include "flinalg/LinalgIO.h"
+#include "utils/Parallel.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace FortranLinalg;
+
+namespace {
+
+const std::string k_completeMarker = ".done";
+
+std::string directoryOf(const std::string &path) {
+  size_t end = path.find_last_of('/');
+  return end == std::string::npos ? "" : path.substr(0, end + 1);
+}
+
+std::string resolve(const std::string &path, const std::string &directory) {
+  return path.empty() || path[0] == '/' ? path : directory + path;
+}
+
+void makeDirectories(const std::string &path) {
+  for (size_t end = path.find('/', 1); ; end = path.find('/', end + 1)) {
+    std::string prefix = path.substr(0, end);
+    if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+      throw std::runtime_error("BatchProcess: unable to create " + prefix + ": " + std::strerror(errno));
+    }
+    if (end == std::string::npos) {
+      return;
+    }
+  }
+}
+
+// "Key: value" lines of a DenseMatrix or DenseVector header
+std::map<std::string, std::string> readHeader(const std::string &header, const std::string &type) {
+  std::ifstream file(header);
+  std::string line;
+  if (!std::getline(file, line) || line != type) {
+    throw std::runtime_error("BatchProcess: " + header + " is not a " + type + " header");
+  }
+  std::map<std::string, std::string> fields;
+  while (std::getline(file, line)) {
+    size_t colon = line.find(':');
+    if (colon != std::string::npos) {
+      size_t start = line.find_first_not_of(' ', colon + 1);
+      fields[line.substr(0, colon)] = start == std::string::npos ? "" : line.substr(start);
+    }
+  }
+  return fields;
+}
+
+}
+
+/**
+ * A copy-on-write mapping of the data file of a header, or none if the data
+ * needs converting and is read by each job instead.
+ */
+struct BatchProcess::MappedFile {
+  void *address = MAP_FAILED;
+  size_t length = 0;
+  unsigned int rows = 0;
+  unsigned int columns = 0;
+
+  ~MappedFile() {
+    if (address != MAP_FAILED) {
+      munmap(address, length);
+    }
+  }
+};
+
+int BatchJob::intParameter(const std::string &key, int defaultValue) const {
+  auto value = parameters.find(key);
+  return value == parameters.end() ? defaultValue : std::atoi(value->second.c_str());
+}
+
+Precision BatchJob::precisionParameter(const std::string &key, Precision defaultValue) const {
+  auto value = parameters.find(key);
+  return value == parameters.end() ? defaultValue : std::atof(value->second.c_str());
+}
+
+bool BatchJob::flag(const std::string &key) const {
+  auto value = parameters.find(key);
+  return value != parameters.end() && value->second != "0" && value->second != "false";
+}
+
+/**
+ * Reads the jobs of a manifest; the output of each job is the directory
+ * outputDir/name.
+ */
+std::vector<BatchJob> BatchProcess::readManifest(const std::string &manifest, const std::string &outputDir) {
+  std::ifstream file(manifest);
+  if (!file) {
+    throw std::runtime_error("BatchProcess: unable to read manifest " + manifest);
+  }
+  std::string directory = directoryOf(manifest);
+  std::string output = outputDir.empty() || outputDir.back() == '/' ? outputDir : outputDir + "/";
+  std::vector<BatchJob> jobs;
+  std::set<std::string> names;
+  std::string line;
+  for (unsigned int number = 1; std::getline(file, line); number++) {
+    std::stringstream fields(line);
+    BatchJob job;
+    if (!(fields >> job.name) || job.name[0] == '#') {
+      continue;
+    }
+    if (!(fields >> job.domain >> job.function)) {
+      throw std::runtime_error("BatchProcess: line " + std::to_string(number) + " of " + manifest +
+                               " needs a name, a domain and a function");
+    }
+    if (!names.insert(job.name).second || job.name.find('/') != std::string::npos) {
+      throw std::runtime_error("BatchProcess: job name " + job.name + " on line " + std::to_string(number) +
+                               " is not unique or contains a /");
+    }
+    for (std::string parameter; fields >> parameter;) {
+      size_t equals = parameter.find('=');
+      if (equals == std::string::npos) {
+        job.parameters[parameter] = "1";
+      } else {
+        job.parameters[parameter.substr(0, equals)] = parameter.substr(equals + 1);
+      }
+    }
+    job.domain = resolve(job.domain, directory);
+    job.function = resolve(job.function, directory);
+    job.output = output + job.name;
+    jobs.push_back(job);
+  }
+  return jobs;
+}
+
+BatchProcess::BatchProcess(std::vector<BatchJob> jobs, unsigned int workers, unsigned int threads,
+                           size_t memoryLimit) :
+  jobs(jobs), workers(std::max(1u, workers)), threads(threads), memoryLimit(memoryLimit) {
+  if (this->threads == 0) {
+    this->threads = std::max(1u, std::thread::hardware_concurrency() / this->workers);
+  }
+}
+
+BatchProcess::~BatchProcess() = default;
+
+bool BatchProcess::isComplete(const BatchJob &job) {
+  return access((job.output + "/" + k_completeMarker).c_str(), F_OK) == 0;
+}
+
+/**
+ * Maps the data of a column major header with Precision elements; other data
+ * is left for LinalgIO.
+ */
+std::shared_ptr<BatchProcess::MappedFile> BatchProcess::map(const std::string &header, bool matrix) {
+  auto mapped = inputs.find(header);
+  if (mapped != inputs.end()) {
+    return mapped->second;
+  }
+  auto file = std::make_shared<MappedFile>();
+  auto fields = readHeader(header, matrix ? "DenseMatrix" : "DenseVector");
+  if (std::atoi(fields["ElementSize"].c_str()) != sizeof(Precision) || std::atoi(fields["RowMajor"].c_str()) != 0) {
+    return inputs[header] = file;
+  }
+  if (matrix) {
+    std::sscanf(fields["Size"].c_str(), "%u x %u", &file->rows, &file->columns);
+  } else {
+    file->rows = std::atoi(fields["Size"].c_str());
+    file->columns = 1;
+  }
+  file->length = (size_t) file->rows * file->columns * sizeof(Precision);
+  if (file->length == 0) {
+    return inputs[header] = file;
+  }
+
+  std::string data = resolve(fields["DataFile"], directoryOf(header));
+  int descriptor = open(data.c_str(), O_RDONLY);
+  struct stat status;
+  if (descriptor < 0 || fstat(descriptor, &status) != 0 || (size_t) status.st_size < file->length) {
+    if (descriptor >= 0) {
+      close(descriptor);
+    }
+    throw std::runtime_error("BatchProcess: " + data + " is missing or shorter than its header " + header);
+  }
+  // writable but private, so a job changing its inputs only copies the pages it changes
+  file->address = mmap(nullptr, file->length, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+  close(descriptor);
+  if (file->address == MAP_FAILED) {
+    throw std::runtime_error("BatchProcess: unable to map " + data + ": " + std::strerror(errno));
+  }
+  return inputs[header] = file;
+}
+
+/**
+ * Runs all incomplete jobs, each in a worker process.
+ */
+BatchSummary BatchProcess::run(Task task) {
+  BatchSummary summary;
+  std::vector<const BatchJob *> pending;
+  for (auto &job : jobs) {
+    if (isComplete(job)) {
+      summary.skipped++;
+      continue;
+    }
+    try {
+      map(job.domain, true);
+      map(job.function, false);
+      pending.push_back(&job);
+    } catch (const std::exception &e) {
+      std::cerr << job.name << ": " << e.what() << std::endl;
+      summary.failed.push_back(job.name);
+    }
+  }
+
+  std::map<pid_t, const BatchJob *> running;
+  auto next = pending.begin();
+  while (next != pending.end() || !running.empty()) {
+    if (next != pending.end() && running.size() < workers) {
+      std::cout.flush();
+      std::cerr.flush();
+      pid_t pid = fork();
+      if (pid == 0) {
+        runJob(**next, task);
+      }
+      if (pid < 0) {
+        if (running.empty()) {
+          throw std::runtime_error(std::string("BatchProcess: unable to start a worker: ") + std::strerror(errno));
+        }
+      } else {
+        running[pid] = *next++;
+        continue;
+      }
+    }
+
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(std::string("BatchProcess: waiting for workers failed: ") + std::strerror(errno));
+    }
+    auto finished = running.find(pid);
+    if (finished == running.end()) {
+      continue;
+    }
+    const BatchJob &job = *finished->second;
+    running.erase(finished);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0 && isComplete(job)) {
+      summary.completed++;
+    } else {
+      if (WIFSIGNALED(status)) {
+        std::cerr << job.name << ": worker killed by signal " << WTERMSIG(status) << std::endl;
+      }
+      summary.failed.push_back(job.name);
+    }
+  }
+  return summary;
+}
+
+/**
+ * Body of a worker process, never returns.
+ */
+void BatchProcess::runJob(const BatchJob &job, Task &task) {
+  int exitCode = 0;
+  try {
+    // the parent may have cached its own count before forking
+    Parallel::setThreadCount(threads);
+    setenv("DSPACEX_NUM_THREADS", std::to_string(threads).c_str(), 1);
+    // the worker inherits the mappings of every pending job; keep only its own
+    // so the memory limit counts its inputs and not the whole manifest's
+    std::shared_ptr<MappedFile> domainFile = inputs[job.domain], functionFile = inputs[job.function];
+    inputs.clear();
+    if (memoryLimit > 0) {
+      struct rlimit limit;
+      limit.rlim_cur = limit.rlim_max = memoryLimit;
+      if (setrlimit(RLIMIT_AS, &limit) != 0) {
+        throw std::runtime_error(std::string("unable to limit memory: ") + std::strerror(errno));
+      }
+    }
+    makeDirectories(job.output);
+
+    auto &domain = *domainFile;
+    auto &function = *functionFile;
+    DenseMatrix<Precision> x = domain.address != MAP_FAILED
+        ? DenseMatrix<Precision>(domain.rows, domain.columns, (Precision *) domain.address)
+        : LinalgIO<Precision>::readMatrix(job.domain);
+    DenseVector<Precision> y = function.address != MAP_FAILED
+        ? DenseVector<Precision>(function.rows, (Precision *) function.address)
+        : LinalgIO<Precision>::readVector(job.function);
+    if (x.N() != y.N()) {
+      throw std::runtime_error("domain has " + std::to_string(x.N()) + " samples and function " +
+                               std::to_string(y.N()) + " values");
+    }
+
+    task(job, x, y);
+    std::ofstream marker(job.output + "/" + k_completeMarker);
+    if (!(marker << job.name << std::endl)) {
+      throw std::runtime_error("unable to mark the job complete");
+    }
+  } catch (const std::bad_alloc &) {
+    std::cerr << job.name << ": out of memory" << std::endl;
+    exitCode = 1;
+  } catch (const std::exception &e) {
+    std::cerr << job.name << ": " << e.what() << std::endl;
+    exitCode = 1;
+  } catch (const char *e) {
+    std::cerr << job.name << ": " << e << std::endl;
+    exitCode = 1;
+  }
+  std::cout.flush();
+  std::cerr.flush();
+  _exit(exitCode);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "flinalg/DenseMatrix.h"
+#include "flinalg/DenseVector.h"
+#include "dataset/Precision.h"
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * One field of one dataset with its processing parameters, a line of a batch
+ * manifest.
+ */
+struct BatchJob {
+  std::string name;                              // unique, names the output directory
+  std::string domain;                            // DenseMatrix header of the samples
+  std::string function;                          // DenseVector header of the field
+  std::string output;                            // directory the result is written to
+  std::map<std::string, std::string> parameters;
+
+  int intParameter(const std::string &key, int defaultValue) const;
+  Precision precisionParameter(const std::string &key, Precision defaultValue) const;
+  bool flag(const std::string &key) const;
+};
+
+struct BatchSummary {
+  unsigned int completed = 0;
+  unsigned int skipped = 0;                      // completed by an earlier run
+  std::vector<std::string> failed;               // names of the failed jobs
+};
+
+/**
+ * Runs the jobs of a manifest in local worker processes, one process per job
+ * and at most `workers` at a time.
+ *
+ * A manifest has one job per line, `name domain function [key=value ...]`,
+ * with relative paths taken from the manifest's directory; empty lines and
+ * lines starting with # are skipped. Inputs are memory mapped copy-on-write
+ * once before the workers start, so jobs of the same dataset share its pages
+ * instead of each reading it. A job is complete once its task returned and
+ * the `.done` marker in its output directory is written; a new run over the
+ * same output skips complete jobs, so an interrupted run resumes where it
+ * stopped. A job that fails, runs out of memory or dies is reported and left
+ * for the next run.
+ */
+class BatchProcess {
+ public:
+  typedef std::function<void(const BatchJob &job, FortranLinalg::DenseMatrix<Precision> &x,
+                             FortranLinalg::DenseVector<Precision> &y)> Task;
+
+  static std::vector<BatchJob> readManifest(const std::string &manifest, const std::string &outputDir);
+
+  /**
+   * @param[in] workers Number of worker processes.
+   * @param[in] threads Threads of each worker, 0 to split the hardware threads
+   *            among the workers.
+   * @param[in] memoryLimit Address space of each worker in bytes, including
+   *            the mapped inputs of its own job, 0 for no limit.
+   */
+  BatchProcess(std::vector<BatchJob> jobs, unsigned int workers, unsigned int threads = 0,
+               size_t memoryLimit = 0);
+  ~BatchProcess();
+
+  BatchSummary run(Task task);
+
+  static bool isComplete(const BatchJob &job);
+
+ private:
+  struct MappedFile;
+
+  std::shared_ptr<MappedFile> map(const std::string &header, bool matrix);
+  void runJob(const BatchJob &job, Task &task);
+
+  std::vector<BatchJob> jobs;
+  unsigned int workers;
+  unsigned int threads;
+  size_t memoryLimit;
+  std::map<std::string, std::shared_ptr<MappedFile>> inputs;
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+
+/**
+ * Indices 0..n-1 grouped by a key in compressed rows, built by one counting
+ * sort pass: the indices with key k are begin(k)..end(k), in increasing
+ * order. Groups the samples of a partition by crystal and the crystals of a
+ * persistence level by extremum.
+ */
+class Buckets {
+ public:
+  Buckets() = default;
+
+  /**
+   * @param[in] n Number of indices.
+   * @param[in] nKeys Number of keys, all keys are below it.
+   * @param[in] key Key of an index, called twice per index.
+   */
+  template<typename Key>
+  Buckets(unsigned int n, unsigned int nKeys, Key key) : m_offsets(nKeys + 1, 0), m_indices(n) {
+    for (unsigned int i = 0; i < n; i++) {
+      m_offsets[key(i) + 1]++;
+    }
+    for (unsigned int k = 0; k < nKeys; k++) {
+      m_offsets[k + 1] += m_offsets[k];
+    }
+    std::vector<unsigned int> next(m_offsets.begin(), m_offsets.end() - 1);
+    for (unsigned int i = 0; i < n; i++) {
+      m_indices[next[key(i)]++] = i;
+    }
+  }
+
+  unsigned int keys() const { return m_offsets.empty() ? 0 : m_offsets.size() - 1; }
+  unsigned int size(unsigned int key) const { return m_offsets[key + 1] - m_offsets[key]; }
+  const unsigned int *begin(unsigned int key) const { return m_indices.data() + m_offsets[key]; }
+  const unsigned int *end(unsigned int key) const { return m_indices.data() + m_offsets[key + 1]; }
+
+ private:
+  std::vector<unsigned int> m_offsets;
+  std::vector<unsigned int> m_indices;
+};
@@ -12,6 +12,7 @@
 #include "kernelstats/FirstOrderKernelRegression.h"
 #include "morsesmale/NNMSComplex.h"
 #include "dataset/Precision.h"
+#include "utils/Parallel.h"
 #include "utils/Random.h"
 
 #include <map>
@@ -24,13 +25,14 @@
 template <typename SampleType, typename MetricType> 
 class HDGenericProcessor : public HDProcessor {
  public:
+  // Rows are computed in parallel, so metric.distance must be safe to call concurrently.
   FortranLinalg::DenseMatrix<Precision> computeDistances(std::vector<SampleType*> &samples, MetricType &metric) {
     FortranLinalg::DenseMatrix<Precision> distances(samples.size(), samples.size());
-    for (unsigned int i = 0; i < samples.size(); i++) {
-      for (unsigned int j = i; j < samples.size(); j++) {
-        distances(i,j) = distances(j,i) = metric.distance(*(samples[i]), *(samples[j]));        
-      }      
-    }
+    Parallel::forEach(0, samples.size(), [&](long i) {
+        for (unsigned int j = i; j < samples.size(); j++) {
+          distances(i,j) = distances(j,i) = metric.distance(*(samples[i]), *(samples[j]));
+        }
+      });
     return distances;
   }
 };
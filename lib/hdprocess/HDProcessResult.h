@@ -2,6 +2,7 @@
 
 #include "flinalg/Linalg.h"
 #include "dataset/Precision.h"
+#include "morsesmale/MergeHierarchy.h"
 #include <vector>
 #include <map>
 
@@ -16,6 +17,7 @@ struct HDProcessResult {
   FortranLinalg::DenseMatrix<Precision> X;                 // Geom.data.hdr
   std::vector<Precision> Y;                                // Function.data.hdr (field value)
   FortranLinalg::DenseVector<int> regressionSampleCount;   
+  MergeHierarchy<Precision> hierarchy;                     // merge tree of all persistence levels
 
   // loadData
   std::vector<Eigen::MatrixXi> crystals;            // Crystals_[level].data.hdr
@@ -1,12 +1,14 @@
 #include "HDProcessor.h"
+#include "kernelstats/SortedKernelDensity.h"
+#include "utils/Parallel.h"
 
-Precision MAX = std::numeric_limits<Precision>::max();
-
-//coordinate center
-int globalMin = -1;
+#include <random>
 
 using namespace FortranLinalg;
 
+// Largest error of the sample densities relative to summing the kernel over all samples
+const Precision k_densityTolerance = 1e-6;
+
 /**
  * Process the input data and generate all data files necessary for visualization.
  * @param[in] d Distances Matrix containing pairwise distances between samples.
@@ -26,6 +28,7 @@ std::unique_ptr<HDProcessResult>  HDProcessor::processOnMetric(
 
   // Initialize processing result output object.
   m_result.reset(new HDProcessResult());
+  clearRegressions();
 
   // Embed Distance Metric into 3D space
   EuclideanMetric<Precision> metric;
@@ -44,9 +47,167 @@ std::unique_ptr<HDProcessResult>  HDProcessor::processOnMetric(
      
   // Compute Morse-Smale complex    
   NNMSComplex<Precision> msComplex(d, field, knn, dataSmoothSigma > 0, dataSmoothSigma*dataSmoothSigma, true /*compute distances version*/);
-  
-  // Store persistence levels
+
+  analyzeComplex(msComplex, knn, nSamples, persistenceArg, invRegressionSigma);
+
+  // detach and return processed result
+  return std::move(m_result);
+}
+
+/**
+ * Process a sparse k-nearest neighbor graph without any N x N distance matrix.
+ * The 3D embedding that processOnMetric obtains from MDS on all distances is
+ * replaced by landmark Isomap on the graph geodesics.
+ * @param[in] graph k-nearest neighbor graph of the samples (k >= knn).
+ * @param[in] field Vector containing field values for each sample.
+ * @param[in] knn Number of nearest neighbor for Morse-Samle complex computation.
+ * @param[in] nSamples Number of samples for regression curve. 
+ * @param[in] persistence Number of persistence levels to compute.
+ * @param[in] random Whether to apply random noise to input function.
+ * @param[in] invRegressionSigma Bandwidth for inverse regression (curve smoothing)
+ * @param[in] dataSmoothSigma data smoothing (filter out noise)
+ * @param[in] landmarks Number of landmarks for the embedding.
+ */
+std::unique_ptr<HDProcessResult>  HDProcessor::processOnGraph(
+    KNNGraph<Precision> &graph, DenseVector<Precision> field,
+    int knn, int nSamples, int persistenceArg, bool random,
+    Precision invRegressionSigma, Precision dataSmoothSigma, unsigned int landmarks) {
+
+  // Initialize processing result output object.
+  m_result.reset(new HDProcessResult());
+  clearRegressions();
+
+  // Embed graph geodesics into 3D space
+  SparseMatrix<Precision> adj = graph.adjacency();
+  LandmarkIsomap<Precision> isomap(landmarks);
+  Xall = isomap.embedAdj(adj, 3);
+  adj.deallocate();
+  yall = field;
+
+  // Add noise to yall in case of equivalent values 
+  if (random) {
+    addNoise(yall);
+  }
+
+  // Compute Morse-Smale complex    
+  NNMSComplex<Precision> msComplex(graph, field, knn, dataSmoothSigma > 0, dataSmoothSigma*dataSmoothSigma);
+
+  analyzeComplex(msComplex, knn, nSamples, persistenceArg, invRegressionSigma);
+
+  // detach and return processed result
+  return std::move(m_result);
+}
+
+/**
+ * Analyze a complex computed elsewhere, e.g. kept up to date by
+ * IncrementalMSComplex as samples are added. Regressions of crystals whose
+ * samples did not change since the previous processComplex call are reused,
+ * so x must keep the coordinates of the samples of that call.
+ * @param[in] msComplex Morse-Smale complex of the samples.
+ * @param[in] x Matrix containing the coordinates of the samples.
+ * @param[in] y Vector containing field values for each sample.
+ * @param[in] knn Number of nearest neighbor of the complex.
+ * @param[in] nSamples Number of samples for regression curve. 
+ * @param[in] persistence Number of persistence levels to compute.
+ * @param[in] invRegressionSigma Bandwidth for inverse regression (curve smoothing)
+ */
+std::unique_ptr<HDProcessResult>  HDProcessor::processComplex(
+    NNMSComplex<Precision> &msComplex, DenseMatrix<Precision> x, DenseVector<Precision> y,
+    int knn, int nSamples, int persistenceArg, Precision invRegressionSigma) {
+
+  // Initialize processing result output object.
+  m_result.reset(new HDProcessResult());
+  if (!m_reuseRegressions || m_regressionSigma != invRegressionSigma || m_regressionSamples != nSamples) {
+    clearRegressions();
+  }
+  m_reuseRegressions = true;
+  m_regressionSigma = invRegressionSigma;
+  m_regressionSamples = nSamples;
+  for (auto &regression : m_regressions) {
+    regression.second.used = false;
+  }
+
+  Xall = x;
+  yall = y;
+  analyzeComplex(msComplex, knn, nSamples, persistenceArg, invRegressionSigma);
+
+  // Keep the regressions of the current crystals only
+  for (auto it = m_regressions.begin(); it != m_regressions.end();) {
+    if (it->second.used) {
+      ++it;
+      continue;
+    }
+    it->second.deallocate();
+    it = m_regressions.erase(it);
+  }
+
+  // detach and return processed result
+  return std::move(m_result);
+}
+
+/**
+ * Process an approximate complex of many samples computed on landmarks, see
+ * LandmarkMSComplex. The crystal regressions and layouts are computed from
+ * the landmarks only, while the crystal partitions, extrema, nearest
+ * neighbors (the nearest landmarks) and steepest paths of the result refer
+ * to all samples. The merge hierarchy is the one of the landmark complex.
+ * @param[in] landmarks Landmark complex of the samples.
+ * @param[in] x Matrix containing the coordinates of all samples.
+ * @param[in] y Vector containing field values for each sample.
+ * @param[in] knn Number of nearest neighbor of the complex.
+ * @param[in] nSamples Number of samples for regression curve.
+ * @param[in] persistence Number of persistence levels to compute.
+ * @param[in] invRegressionSigma Bandwidth for inverse regression (curve smoothing)
+ */
+std::unique_ptr<HDProcessResult>  HDProcessor::processLandmarks(
+    LandmarkMSComplex<Precision> &landmarks, DenseMatrix<Precision> x, DenseVector<Precision> y,
+    int knn, int nSamples, int persistenceArg, Precision invRegressionSigma) {
+  if (x.N() != landmarks.N() || y.N() != landmarks.N()) {
+    throw std::runtime_error("processLandmarks: samples differ from those of the landmark complex");
+  }
+
+  // Initialize processing result output object.
+  m_result.reset(new HDProcessResult());
+  clearRegressions();
+  m_reuseRegressions = false;
+
+  Xall = landmarks.getLandmarkCoordinates();
+  yall = landmarks.getLandmarkValues();
+  analyzeComplex(landmarks.getComplex(), knn, nSamples, persistenceArg, invRegressionSigma);
+
+  // Refer to all samples instead of the landmarks
+  m_result->X.deallocate();
+  m_result->X = Linalg<Precision>::Copy(x);
+  m_result->Y = std::vector<Precision>(y.data(), y.data() + y.N());
+  m_result->knn.deallocate();
+  m_result->knn = Linalg<int>::Copy(landmarks.getNearestLandmarks());
+  auto &steepest = landmarks.getSteepest();
+  m_result->knng = Eigen::Map<Eigen::MatrixXi>(steepest.data(), steepest.M(), steepest.N());
+  auto &samples = landmarks.getLandmarks();
+  for (auto &extremum : m_result->extremaIndex) {
+    extremum = samples[extremum];
+  }
+  auto &hierarchy = landmarks.getComplex().getHierarchy();
+  for (unsigned int level = 0; level < persistence.N(); level++) {
+    if (!m_result->extrema[level].empty()) {
+      landmarks.crystalsAt(hierarchy.levelOf(persistence(level)), m_result->extrema[level],
+                           m_result->crystalPartitions[level]);
+    }
+  }
+
+  // detach and return processed result
+  return std::move(m_result);
+}
+
+/**
+ * Store the complex and compute the analysis of its persistence levels,
+ * shared by processOnMetric and processOnGraph. Expects Xall and yall set.
+ */
+void HDProcessor::analyzeComplex(NNMSComplex<Precision> &msComplex,
+    int knn, int nSamples, int persistenceArg, Precision invRegressionSigma) {
+  // Store persistence levels and the merge tree they come from
   persistence = msComplex.getPersistence();
+  m_result->hierarchy = msComplex.getHierarchy();
 
   // Store Nearest Neighbors and their paths of steepest ascent/descent
   m_result->knn = msComplex.getNearestNeighbors();
@@ -121,12 +282,7 @@ std::unique_ptr<HDProcessResult>  HDProcessor::processOnMetric(
   m_result->extrema.resize(persistence.N());
   
   // Compute inverse regression curves and additional information for each crystal
-  for (unsigned int persistenceLevel = start; persistenceLevel < persistence.N(); persistenceLevel++){
-    computeAnalysisForLevel(msComplex, persistenceLevel, nSamples, invRegressionSigma, true /*computeRegression*/, knn);
-  }
-
-  // detach and return processed result
-  return std::move(m_result);
+  computeAnalysis(msComplex, start, nSamples, invRegressionSigma, true /*computeRegression*/, knn);
 }
 
 /**
@@ -148,6 +304,7 @@ std::unique_ptr<HDProcessResult>  HDProcessor::process(
 
   // Initialize processing result output object.
   m_result.reset(new HDProcessResult());
+  clearRegressions();
 
   // Store input data as member variables.
   Xall = x;
@@ -160,127 +317,114 @@ std::unique_ptr<HDProcessResult>  HDProcessor::process(
      
   // Compute Morse-Smale complex
   NNMSComplex<Precision> msComplex(Xall, yall, knn, dataSmoothSigma > 0, 0.01, dataSmoothSigma*dataSmoothSigma);
-  
-  // Store persistence levels
-  persistence = msComplex.getPersistence();
-
-  // Store Nearest Neighbors
-  m_result->knn = msComplex.getNearestNeighbors();
-
-  
-  // Save geometry and function
-  m_result->X = Linalg<Precision>::Copy(Xall);
-  m_result->Y = std::vector<Precision>(yall.data(), yall.data() + yall.N());
-
-  // Scale persistence to be in [0,1]
-  // TODO: Is this just doing a normalization?
-  DenseVector<Precision> pScaled(persistence.N());
-  Precision fmax = Linalg<Precision>::Max(yall);
-  Precision fmin = Linalg<Precision>::Min(yall);
-  Precision frange = fmax - fmin;
-  for (unsigned int i=0; i < persistence.N(); i++) {
-    pScaled(i) = persistence(i) / frange;    // TODO: Shouldn't this also subtract fmin?
-  }
-  pScaled(pScaled.N()-1) = 1;                // TODO: Determine why is this set to 1?
-  
-  // Store Scled Persistence Data
-  m_result->scaledPersistence = Linalg<Precision>::Copy(pScaled);
-  
 
-  // Read number of persistence levels to compute visualization for
-  int nlevels = persistenceArg;
-  int start = 0;
-  if (nlevels > 0) {
-    start = persistence.N() - nlevels;
-  }
-  if (start < 0) {
-    start = 0;
-  }
-
-  // Save start persistence
-  DenseVector<Precision> pStart(1);
-  pStart(0) = start;
+  analyzeComplex(msComplex, knn, nSamples, persistenceArg, invRegressionSigma);
 
-  // Save number of requested regression samples
-  DenseVector<int> regressionSampleCount(1);
-  regressionSampleCount(1) = nSamples;
-  m_result->regressionSampleCount = Linalg<int>::Copy(regressionSampleCount);
-
-  // Store Min Level (Starting Level)
-  m_result->minLevel = Linalg<Precision>::Copy(pStart);
-
-  // Resize Stores for Saving Persistence Level information
-  m_result->crystals.resize(persistence.N());
-  m_result->crystalPartitions.resize(persistence.N());
-
-  // Regression Stores
-  m_result->extremaValues.resize(persistence.N());  
-  m_result->extremaWidths.resize(persistence.N());
-  m_result->R.resize(persistence.N());
-  m_result->gradR.resize(persistence.N());
-  m_result->Rvar.resize(persistence.N());
-  m_result->mdists.resize(persistence.N());
-  m_result->fmean.resize(persistence.N());
-  m_result->spdf.resize(persistence.N());
+  // detach and return processed result
+  return std::move(m_result);
+}
 
-  // Layout Stores
-  m_result->PCAExtremaLayout.resize(persistence.N());  
-  m_result->PCALayout.resize(persistence.N());
-  m_result->PCA2ExtremaLayout.resize(persistence.N());
-  m_result->PCA2Layout.resize(persistence.N());
-  m_result->IsoExtremaLayout.resize(persistence.N());
-  m_result->IsoLayout.resize(persistence.N());
+/**
+ * Compute analysis for the persistence levels from start on. The crystals of
+ * consecutive levels are collected in order, since merging the complex is
+ * sequential, and then regressed in parallel across crystals and levels;
+ * the layouts of each level follow in order as well. Results do not depend
+ * on the number of threads.
+ * @param[in] msComplex A computed Morse-Smale complex.
+ * @param[in] start The first persistence level to analyze.
+ * @param[in] nSamples Number of samples for regression curve.
+ * @param[in] sigma Bandwidth for inverse regression.
+ */
+void HDProcessor::computeAnalysis(NNMSComplex<Precision> &msComplex, unsigned int start,
+    int nSamples, Precision sigma, bool computeRegression, unsigned knn) {
+  // layouts are aligned to those of the first level of this analysis only
+  m_globalMin = -1;
+  extsOrig.clear();
+  extremaPosPCA.deallocate();
+  extremaPosPCA2.deallocate();
+  extremaPosIso.deallocate();
+  unsigned int persistenceLevel = start;
+  while (persistenceLevel < persistence.N()) {
+    // levels with enough crystals between them to keep all threads busy
+    std::vector<LevelAnalysis> levels;
+    std::vector<std::pair<unsigned int, unsigned int>> regressions;
+    while (persistenceLevel < persistence.N() && regressions.size() < Parallel::threadCount()) {
+      LevelAnalysis level;
+      if (collectCrystals(msComplex, persistenceLevel++, nSamples, sigma, computeRegression, level)) {
+        for (unsigned int crystalIndex = 0; crystalIndex < level.crystals.N(); crystalIndex++) {
+          if (!reuseRegression(level, crystalIndex, nSamples)) {
+            regressions.push_back(std::make_pair(levels.size(), crystalIndex));
+          }
+        }
+        levels.push_back(level);
+      }
+    }
 
-  
-  // Compute inverse regression curves and additional information for each crystal
-  for (unsigned int persistenceLevel = start; persistenceLevel < persistence.N(); persistenceLevel++){
-    computeAnalysisForLevel(msComplex, persistenceLevel, nSamples, invRegressionSigma, true /*computeRegression*/, knn);
+    Parallel::forEach(0, regressions.size(), [&](long r) {
+      computeRegressionForCrystal(levels[regressions[r].first], regressions[r].second, sigma, nSamples);
+    });
+
+    for (auto &level : levels) {
+      // Keep the regressions for the next processComplex call
+      for (unsigned int crystalIndex = 0; crystalIndex < level.regressions.size(); crystalIndex++) {
+        CrystalRegression &regression = level.regressions[crystalIndex];
+        if (regression.used) {
+          CrystalKey key(level.Xi[crystalIndex], level.yci[crystalIndex],
+                         level.crystals(0, crystalIndex), level.crystals(1, crystalIndex));
+          auto kept = m_regressions.insert(std::make_pair(key, regression));
+          if (!kept.second) {
+            regression.deallocate();  // the same crystal regressed on another level
+          }
+        }
+      }
+      computeLayoutsForLevel(level, nSamples, knn);
+    }
   }
-
-  // detach and return processed result
-  return std::move(m_result);
 }
 
 /**
- * Compute analysis for a single persistence level.
+ * Collect the crystals of a single persistence level and the samples each is
+ * regressed on.
  * @param[in] msComplex A computed Morse-Smale complex.
  * @param[in] persistenceLevel The persistence level to regress.
- * @param[in] nSamples Number of samples for regression curve.  
+ * @param[in] nSamples Number of samples for regression curve.
  * @param[in] sigma Bandwidth for inverse regression.
+ * @param[out] level The crystals of the level, ready for regression.
+ * Returns false if there is nothing more to compute for the level.
  */
-void HDProcessor::computeAnalysisForLevel(NNMSComplex<Precision> &msComplex,
-    unsigned int persistenceLevel, int nSamples, Precision sigma, bool computeRegression, unsigned knn) {
+bool HDProcessor::collectCrystals(NNMSComplex<Precision> &msComplex,
+    unsigned int persistenceLevel, int nSamples, Precision sigma, bool computeRegression, LevelAnalysis &level) {
   // Number of extrema in current crystal
   // int nExt = persistence.N() - persistenceLevel + 1;      // jonbronson commented out 8/16/17
   msComplex.mergePersistence(persistence(persistenceLevel));
-  crystalIDs.deallocate();
-  crystalIDs = msComplex.getPartitions();
-  crystals.deallocate();
-  crystals = msComplex.getCrystals();
+  DenseVector<int> crystalIDs = msComplex.getPartitions();
+  DenseMatrix<int> crystals = msComplex.getCrystals();
+  level.persistenceLevel = persistenceLevel;
+  level.crystals = crystals;
 
   // Find global minimum as refernce point for aligning subsequent persistence levels
-  if (globalMin == -1) {
+  if (m_globalMin == -1) {
     double tmp = std::numeric_limits<Precision>::max();
     for (unsigned int i=0; i < crystals.N(); i++) {
       if (tmp > yall(crystals(1, i))) {
-        globalMin = crystals(1, i);
-        tmp = yall(globalMin);
+        m_globalMin = crystals(1, i);
+        tmp = yall(m_globalMin);
       }
     }
-  }      
+  }
 
   // Compute map of extrema to extremaID
-  exts.clear();
+  map_i_i &exts = level.exts;
   int eID = 0;
   for (int e=0; e<2; e++){
     for (unsigned int i=0; i<crystals.N(); i++){
       int extrema = crystals(e, i);
       // Check if this extrema is already in the list
       map_i_i_it it = exts.find(extrema);
-      if (it == exts.end()){         
+      if (it == exts.end()){
         exts[extrema] = eID;
         ++eID;
-      }  
+      }
     }
   }
 
@@ -292,7 +436,7 @@ void HDProcessor::computeAnalysisForLevel(NNMSComplex<Precision> &msComplex,
     for (unsigned int j=0; j < crystalTmp.M(); j++) {
       crystalTmp(j, i) = exts[crystals(j, i)];         // TODO: What is this transformation? 11/9/17
     }
-  } 
+  }
 
   // Store Crystals in Result
   m_result->crystals[persistenceLevel].resize(crystalTmp.N(), crystalTmp.M());
@@ -305,42 +449,42 @@ void HDProcessor::computeAnalysisForLevel(NNMSComplex<Precision> &msComplex,
   // store crystals' extrema for this persistence level
   m_result->extrema[persistenceLevel] = msComplex.getExtrema();
 
-  crystalTmp.deallocate();   
+  crystalTmp.deallocate();
 
-  // Grab and Store Extrema Function Values 
+  // Grab and Store Extrema Function Values
   DenseVector<Precision> Ef(nExt);
   for (map_i_i_it it = exts.begin(); it != exts.end(); ++it) {
     int eID = it->second;
-    int eIndex = it->first;    
+    int eIndex = it->first;
     Ef(eID) = yall(eIndex);
   }
-  m_result->extremaValues[persistenceLevel] = Linalg<Precision>::Copy(Ef);  
+  m_result->extremaValues[persistenceLevel] = Linalg<Precision>::Copy(Ef);
   Ef.deallocate();
 
 
   // std::cout << std::endl << "PersistenceLevel: " << persistenceLevel << std::endl;
   // std::cout << "# of Crystals: " << crystals.N() << std::endl;
   // std::cout << "=================================" << std::endl << std::endl;
-  
+
   if (!computeRegression) {
     // Create and return fake data for now.
     // Resize Stores for Regression Information
     m_result->R[persistenceLevel].resize(crystals.N());
     m_result->gradR[persistenceLevel].resize(crystals.N());
     m_result->Rvar[persistenceLevel].resize(crystals.N());
-    m_result->mdists[persistenceLevel].resize(crystals.N());  
-    m_result->fmean[persistenceLevel].resize(crystals.N());  
-    m_result->spdf[persistenceLevel].resize(crystals.N());  
+    m_result->mdists[persistenceLevel].resize(crystals.N());
+    m_result->fmean[persistenceLevel].resize(crystals.N());
+    m_result->spdf[persistenceLevel].resize(crystals.N());
 
     // Resize Stores with Layout Information
     m_result->IsoLayout[persistenceLevel].resize(crystals.N());
     m_result->PCALayout[persistenceLevel].resize(crystals.N());
     m_result->PCA2Layout[persistenceLevel].resize(crystals.N());
-        
+
     // m_result->extremaWidths[persistenceLevel]
     DenseVector<Precision> fakeVector(nExt);
-    DenseMatrix<Precision> fakeLayoutMatrix(2, nSamples);    
-    m_result->extremaWidths[persistenceLevel] = Linalg<Precision>::Copy(fakeVector);  
+    DenseMatrix<Precision> fakeLayoutMatrix(2, nSamples);
+    m_result->extremaWidths[persistenceLevel] = Linalg<Precision>::Copy(fakeVector);
 
     for (unsigned int crystalIndex = 0; crystalIndex < crystals.N(); crystalIndex++) {
       m_result->IsoLayout[persistenceLevel][crystalIndex] = Linalg<Precision>::Copy(fakeLayoutMatrix);
@@ -363,7 +507,9 @@ void HDProcessor::computeAnalysisForLevel(NNMSComplex<Precision> &msComplex,
       m_result->spdf[persistenceLevel][crystalIndex] = Linalg<Precision>::Copy(fakeSpdf);
     }
 
-    return;
+    crystalIDs.deallocate();
+    crystals.deallocate();
+    return false;
   }
 
   // ------------------------------------------------------------
@@ -371,54 +517,62 @@ void HDProcessor::computeAnalysisForLevel(NNMSComplex<Precision> &msComplex,
   // ------------------------------------------------------------
   //std::cout << "Before Regression: crystals.N() = " << crystals.N() << std::endl;
 
-  DenseMatrix<Precision> S(Xall.M(), crystals.N()*nSamples + nExt);
-  std::vector<DenseMatrix<Precision>> ScrystalIDs(crystals.N());  
-  std::vector<DenseMatrix<Precision>> XpcrystalIDs(crystals.N());  
-  DenseVector<Precision> eWidths(exts.size());
-  Linalg<Precision>::Zero(eWidths);
+  level.S = DenseMatrix<Precision>(Xall.M(), crystals.N()*nSamples + nExt);
+  level.ScrystalIDs.resize(crystals.N());
+  level.regressions.resize(crystals.N());
 
-  std::vector<std::vector<unsigned int>> Xi(crystals.N());
-  std::vector<std::vector<unsigned int>> Xiorig(crystals.N());
-  std::vector<std::vector<Precision>> yci(crystals.N());
-
-  // Compute regression for each Morse-Smale crystal
-  for (unsigned int crystalIndex = 0; crystalIndex < crystals.N(); ++crystalIndex) {
-    for (unsigned int i=0; i< crystalIDs.N(); i++) {
-      if (crystalIDs(i) == (int) crystalIndex) {
-        Xiorig[crystalIndex].push_back(i);
-        Xi[crystalIndex].push_back(i);
-        yci[crystalIndex].push_back(yall(i));
-      }
+  std::vector<std::vector<unsigned int>> &Xi = level.Xi;
+  std::vector<std::vector<Precision>> &yci = level.yci;
+  Xi.resize(crystals.N());
+  yci.resize(crystals.N());
+
+  // Samples of each Morse-Smale crystal
+  Buckets members(crystalIDs.N(), crystals.N(), [&](unsigned int i) { return crystalIDs(i); });
+  crystalIDs.deallocate();
+  for (unsigned int crystalIndex = 0; crystalIndex < crystals.N(); crystalIndex++) {
+    Xi[crystalIndex].assign(members.begin(crystalIndex), members.end(crystalIndex));
+    for (unsigned int index : Xi[crystalIndex]) {
+      yci[crystalIndex].push_back(yall(index));
     }
   }
 
+  // Crystals sharing a maximum or a minimum touch
+  std::vector<int> extIDs(2 * crystals.N());
+  for (unsigned int i = 0; i < crystals.N(); i++) {
+    extIDs[2*i] = exts[crystals(0, i)];
+    extIDs[2*i + 1] = exts[crystals(1, i)];
+  }
+  level.maxima = Buckets(crystals.N(), nExt, [&](unsigned int i) { return extIDs[2*i]; });
+  level.minima = Buckets(crystals.N(), nExt, [&](unsigned int i) { return extIDs[2*i + 1]; });
 
+  // Add points of touching crystals within sigma of the shared extrema, in
+  // increasing order of the touching crystal
   for (unsigned int a = 0; a < crystals.N(); a++) {
-    for (unsigned int b = 0; b < crystals.N(); b++) {
-      if (a == b) continue;
-      int ea1 = crystals(0, a);
-      int ea2 = crystals(1, a);
-      int eb1 = crystals(0, b);
-      int eb2 = crystals(1, b);
-      bool touch = false;
-      Precision val = 0;
-      if (ea1 == eb1 ) {
-        val = yall(ea1);
-        touch = true;
+    const unsigned int *maxB = level.maxima.begin(extIDs[2*a]);
+    const unsigned int *maxEnd = level.maxima.end(extIDs[2*a]);
+    const unsigned int *minB = level.minima.begin(extIDs[2*a + 1]);
+    const unsigned int *minEnd = level.minima.end(extIDs[2*a + 1]);
+    while (maxB != maxEnd || minB != minEnd) {
+      unsigned int b;
+      Precision val;
+      if (minB == minEnd || (maxB != maxEnd && *maxB < *minB)) {
+        b = *maxB++;
+        val = yall(crystals(0, a));
       }
-      if (ea2 == eb2) {
-        val = yall(ea2);
-        touch = true;
+      else {
+        // the shared minimum if both are shared
+        if (maxB != maxEnd && *maxB == *minB) {
+          maxB++;
+        }
+        b = *minB++;
+        val = yall(crystals(1, a));
       }
-      // Add points within sigma of extrema to this points.
-      if (touch) {
-        for (unsigned int i = 0; i < Xiorig[b].size(); i++) {
-          unsigned int index = Xiorig[b][i];
-          if (fabs(val - yall(index)) < 2*sigma) {
-            Xi[a].push_back(index);
-            yci[a].push_back(val + val - yall(index));
-          }
-        } 
+      if (a == b) continue;
+      for (const unsigned int *index = members.begin(b); index != members.end(b); index++) {
+        if (fabs(val - yall(*index)) < 2*sigma) {
+          Xi[a].push_back(*index);
+          yci[a].push_back(val + val - yall(*index));
+        }
       }
     }
   }
@@ -427,13 +581,37 @@ void HDProcessor::computeAnalysisForLevel(NNMSComplex<Precision> &msComplex,
   m_result->R[persistenceLevel].resize(crystals.N());
   m_result->gradR[persistenceLevel].resize(crystals.N());
   m_result->Rvar[persistenceLevel].resize(crystals.N());
-  m_result->mdists[persistenceLevel].resize(crystals.N());  
-  m_result->fmean[persistenceLevel].resize(crystals.N());  
-  m_result->spdf[persistenceLevel].resize(crystals.N());  
+  m_result->mdists[persistenceLevel].resize(crystals.N());
+  m_result->fmean[persistenceLevel].resize(crystals.N());
+  m_result->spdf[persistenceLevel].resize(crystals.N());
+  return true;
+}
 
-  // Regression for each crystal of current persistence level.
+/**
+ * Compute the extrema widths and layouts of a persistence level once all its
+ * crystals are regressed.
+ */
+void HDProcessor::computeLayoutsForLevel(LevelAnalysis &level, int nSamples, unsigned knn) {
+  unsigned int persistenceLevel = level.persistenceLevel;
+  crystals = level.crystals;
+  exts = level.exts;
+  int nExt = exts.size();
+  DenseMatrix<Precision> &S = level.S;
+  std::vector<DenseMatrix<Precision>> &ScrystalIDs = level.ScrystalIDs;
+
+  // Compute maximal extrema widths
+  DenseVector<Precision> eWidths(nExt);
+  Linalg<Precision>::Zero(eWidths);
   for (unsigned int crystalIndex = 0; crystalIndex < crystals.N(); crystalIndex++) {
-    computeRegressionForCrystal(crystalIndex, persistenceLevel, sigma, nSamples, Xi, yci, ScrystalIDs, S, eWidths);
+    DenseVector<Precision> &pdist = m_result->mdists[persistenceLevel][crystalIndex];
+    int e1ID = exts[crystals(0, crystalIndex)];
+    int e2ID = exts[crystals(1, crystalIndex)];
+    if (eWidths(e2ID) < pdist(0)) {
+      eWidths(e2ID) = pdist(0);
+    }
+    if (eWidths(e1ID) < pdist(nSamples-1)) {
+      eWidths(e1ID) = pdist(nSamples-1);
+    }
   }
 
   // Store Maximal ExtremaWidths in Result
@@ -443,59 +621,57 @@ void HDProcessor::computeAnalysisForLevel(NNMSComplex<Precision> &msComplex,
 
   // Add extremal points to S for computing layout
   int count = 0;
-  for (map_i_i_it it = exts.begin(); it != exts.end(); ++it) { 
+  for (map_i_i_it it = exts.begin(); it != exts.end(); ++it) {
     count++;
     // std::cout << "Adding extremal point #" << count << std::endl;
     // Average the end points of all curves with that extremea
     DenseVector<Precision> out(Xall.M());
     Linalg<Precision>::Zero(out);
-    int n = 0;
-    for (int e = 0; e<2; e++) {
-      for (unsigned int k=0; k < crystals.N(); k++) {
-        if (crystals(e, k) == it->first){
-          if (e == 0 ) {
-            Linalg<Precision>::Add(out, ScrystalIDs[k], nSamples-1, out); 
-          }
-          else {
-            Linalg<Precision>::Add(out, ScrystalIDs[k], 0, out);
-          }
-          n++;
-        }
-      }
+    int n = level.maxima.size(it->second) + level.minima.size(it->second);
+    for (const unsigned int *k = level.maxima.begin(it->second); k != level.maxima.end(it->second); k++) {
+      Linalg<Precision>::Add(out, ScrystalIDs[*k], nSamples-1, out);
+    }
+    for (const unsigned int *k = level.minima.begin(it->second); k != level.minima.end(it->second); k++) {
+      Linalg<Precision>::Add(out, ScrystalIDs[*k], 0, out);
     }
     // Add averaged extrema to S
     Linalg<Precision>::Scale(out, 1.f/n, out);
     Linalg<Precision>::SetColumn(S, nSamples*crystals.N()+it->second, out);
     out.deallocate();
-  }  
+  }
 
-  //----- Complete PCA layout 
-  computePCALayout(S, nExt, nSamples, persistenceLevel);      
+  //----- Complete PCA layout
+  computePCALayout(S, nExt, nSamples, persistenceLevel);
 
   //----- PCA extrema / PCA curves layout
   computePCAExtremaLayout(S, ScrystalIDs, nExt, nSamples, persistenceLevel);
 
-  //----- Isomap extrema / PCA curves layout 
+  //----- Isomap extrema / PCA curves layout
   computeIsomapLayout(S, ScrystalIDs, nExt, nSamples, persistenceLevel, knn);
 
 
   S.deallocate();
-  for (unsigned int i=0; i < crystals.N(); i++) { 
+  for (unsigned int i=0; i < crystals.N(); i++) {
     ScrystalIDs[i].deallocate();
-    XpcrystalIDs[i].deallocate();    
   }
+  level.crystals.deallocate();
+  crystals = DenseMatrix<int>();
 }
 
 /**
  * Computes regression curves for each crystal of specified persistence level.
+ * Crystals of any level can be regressed concurrently.
  * TODO(jonbronson):  We will need an abstraction for computing regression that
  *                    doesn't rely on using the X matrix of samples.
  */
 void HDProcessor::computeRegressionForCrystal(
-    unsigned int crystalIndex, unsigned int persistenceLevel, Precision sigma, int nSamples, 
-    std::vector<std::vector<unsigned int>> &Xi, std::vector<std::vector<Precision>> &yci,
-    std::vector<DenseMatrix<Precision>> &ScrystalIDs, DenseMatrix<Precision> &S,
-    DenseVector<Precision> &eWidths) {
+    LevelAnalysis &level, unsigned int crystalIndex, Precision sigma, int nSamples) {
+  unsigned int persistenceLevel = level.persistenceLevel;
+  std::vector<std::vector<unsigned int>> &Xi = level.Xi;
+  std::vector<std::vector<Precision>> &yci = level.yci;
+  std::vector<DenseMatrix<Precision>> &ScrystalIDs = level.ScrystalIDs;
+  DenseMatrix<Precision> &S = level.S;
+
   // Extract samples and function values from crystalIDs
   DenseMatrix<Precision> X(Xall.M(), Xi[crystalIndex].size());
   DenseMatrix<Precision> y(1, X.N());
@@ -503,19 +679,19 @@ void HDProcessor::computeRegressionForCrystal(
   for (unsigned int i=0; i< X.N(); i++){
     unsigned int index = Xi[crystalIndex][i];
     indexes.push_back(index);
-    Linalg<Precision>::SetColumn(X, i, Xall, index);  
+    Linalg<Precision>::SetColumn(X, i, Xall, index);
     y(0, i) = yci[crystalIndex][i];
   }
 
-  
+
   // Compute Rgeression curve
   // std::cout << "Computing regression curve for crystalID " << crystalIndex << std::endl;
   // std::cout << X.N() << " points" << std::endl;
 
   GaussianKernel<Precision> kernel(sigma, 1);
   FirstOrderKernelRegression<Precision> kr(X, y, kernel, 1000);
-     
-  /*      
+
+  /*
     //Get locations
     DenseMatrix<Precision> Zend = y;
     DenseVector<Precision> yv(1);
@@ -530,62 +706,50 @@ void HDProcessor::computeRegressionForCrystal(
   */
 
   // Compute min and max function value
-  int e1 = crystals(0, crystalIndex);
-  int e2 = crystals(1, crystalIndex);
-  int e1ID = exts[e1];
-  int e2ID = exts[e2];
+  int e1 = level.crystals(0, crystalIndex);
+  int e2 = level.crystals(1, crystalIndex);
   Precision zmax = yall(e1);
   Precision zmin = yall(e2);
 
   // Create samples (regressed in input space) between min and max function values
-  DenseVector<Precision> z(1);
   DenseVector<Precision> pdist(nSamples);
-  DenseVector<Precision> tmp(Xall.M());
   DenseMatrix<Precision> Zp(1, nSamples);
+  for (int k=0; k < nSamples; k++) {
+    Zp(0, k) = zmin + (zmax-zmin) * ( k/ (nSamples-1.f) );
+  }
   ScrystalIDs[crystalIndex] = DenseMatrix<Precision>(Xall.M(), nSamples);
-  DenseMatrix<Precision> gStmp(Xall.M(), 1);
   DenseMatrix<Precision> gradS(Xall.M(), nSamples);
-  DenseVector<Precision> sdev( Xall.M() );
   DenseMatrix<Precision> Svar(Xall.M(), nSamples);
+  kr.evaluate(Zp, ScrystalIDs[crystalIndex], gradS, &Svar);
   for (int k=0; k < nSamples; k++) {
-    z(0) = zmin + (zmax-zmin) * ( k/ (nSamples-1.f) );
-    Zp(0, k) = z(0);
-    kr.evaluate(z, tmp, gStmp, sdev.data());
     pdist(k) = 0;
-    for (unsigned int q = 0; q < sdev.N(); q++) {
-      pdist(k) += sdev(q);
-      sdev(q) = sqrt(sdev(q));
+    for (unsigned int q = 0; q < Svar.M(); q++) {
+      pdist(k) += Svar(q, k);
+      Svar(q, k) = sqrt(Svar(q, k));
     }
     pdist(k) = sqrt(pdist(k));
-    
-    Linalg<Precision>::SetColumn(S, crystalIndex*nSamples + k, tmp);
-    Linalg<Precision>::SetColumn(ScrystalIDs[crystalIndex], k, tmp);
-    Linalg<Precision>::SetColumn(Svar, k, sdev);
-    Linalg<Precision>::SetColumn(gradS, k, gStmp, 0);
-  }
-  sdev.deallocate();
-  z.deallocate();
-  tmp.deallocate();
-  
+    Linalg<Precision>::SetColumn(S, crystalIndex*nSamples + k, ScrystalIDs[crystalIndex], k);
+  }
+  kr.cleanup();
+
   // Store Regression Info in Results
   m_result->R[persistenceLevel][crystalIndex] = Linalg<Precision>::Copy(ScrystalIDs[crystalIndex]);
   m_result->gradR[persistenceLevel][crystalIndex] = Linalg<Precision>::Copy(gradS);
   m_result->Rvar[persistenceLevel][crystalIndex] = Linalg<Precision>::Copy(Svar);
   m_result->mdists[persistenceLevel][crystalIndex] = Linalg<Precision>::Copy(pdist);
 
-  gradS.deallocate(); 
-  Svar.deallocate();
-
-  // Compute maximal extrema widths
-  if (eWidths(e2ID) < pdist(0)) {
-    eWidths(e2ID) = pdist(0); 
-  }
-  if (eWidths(e1ID) < pdist(nSamples-1)) {
-    eWidths(e1ID) = pdist(nSamples-1); 
+  CrystalRegression &regression = level.regressions[crystalIndex];
+  if (m_reuseRegressions) {
+    regression.R = Linalg<Precision>::Copy(ScrystalIDs[crystalIndex]);
+    regression.gradR = Linalg<Precision>::Copy(gradS);
+    regression.Rvar = Linalg<Precision>::Copy(Svar);
+    regression.mdists = Linalg<Precision>::Copy(pdist);
   }
 
+  gradS.deallocate();
+  Svar.deallocate();
   pdist.deallocate();
-  
+
   // Compute function value mean at sampled locations
   DenseVector<Precision> fmean(Zp.N());
   for (unsigned int i=0; i < Zp.N(); i++) {
@@ -594,38 +758,101 @@ void HDProcessor::computeRegressionForCrystal(
 
   // Store means in result object.
   m_result->fmean[persistenceLevel][crystalIndex] = Linalg<Precision>::Copy(fmean);
-  fmean.deallocate();
+  if (m_reuseRegressions) {
+    regression.fmean = fmean;
+  }
+  else {
+    fmean.deallocate();
+  }
 
-  // Compute sample density.
+  // Compute sample density, within k_densityTolerance of the sum over all samples.
+  DenseVector<Precision> density(Zp.N());
   DenseVector<Precision> spdf(Zp.N());
+  SortedKernelDensity<Precision> kd(y.data(), y.N(), kernel, k_densityTolerance);
   for (unsigned int i=0; i < Zp.N(); i++) {
-    Precision sum = 0;
-    for (unsigned int j=0; j < y.N(); j++) {
-      Precision k = kernel.f(Zp, i, y, j);
-      sum += k;
-    } 
+    Precision sum = kd.p(Zp(0, i));
+    density(i) = sum;
     spdf(i) = sum/Xall.N();
   }
 
   // Store sample density in result object.
-  m_result->spdf[persistenceLevel][crystalIndex] = Linalg<Precision>::Copy(spdf);  
-  spdf.deallocate(); 
- 
+  m_result->spdf[persistenceLevel][crystalIndex] = Linalg<Precision>::Copy(spdf);
+  spdf.deallocate();
+
+  // Keep the regression for the next processComplex call, see computeAnalysis
+  if (m_reuseRegressions) {
+    regression.density = density;
+    regression.used = true;
+  }
+  else {
+    density.deallocate();
+  }
+
 
   X.deallocate();
   Zp.deallocate();
   y.deallocate();
 }
 
+/**
+ * Fill in the regression of a crystal from the previous processComplex call
+ * if it was fit to the same samples. Returns false if there is none.
+ */
+bool HDProcessor::reuseRegression(LevelAnalysis &level, unsigned int crystalIndex, int nSamples) {
+  if (!m_reuseRegressions) {
+    return false;
+  }
+  unsigned int persistenceLevel = level.persistenceLevel;
+  int e1 = level.crystals(0, crystalIndex);
+  int e2 = level.crystals(1, crystalIndex);
+  auto it = m_regressions.find(CrystalKey(level.Xi[crystalIndex], level.yci[crystalIndex], e1, e2));
+  if (it == m_regressions.end()) {
+    return false;
+  }
+  CrystalRegression &regression = it->second;
+  regression.used = true;
+
+  level.ScrystalIDs[crystalIndex] = Linalg<Precision>::Copy(regression.R);
+  for (int k=0; k < nSamples; k++) {
+    Linalg<Precision>::SetColumn(level.S, crystalIndex*nSamples + k, regression.R, k);
+  }
+  m_result->R[persistenceLevel][crystalIndex] = Linalg<Precision>::Copy(regression.R);
+  m_result->gradR[persistenceLevel][crystalIndex] = Linalg<Precision>::Copy(regression.gradR);
+  m_result->Rvar[persistenceLevel][crystalIndex] = Linalg<Precision>::Copy(regression.Rvar);
+  m_result->mdists[persistenceLevel][crystalIndex] = Linalg<Precision>::Copy(regression.mdists);
+  m_result->fmean[persistenceLevel][crystalIndex] = Linalg<Precision>::Copy(regression.fmean);
+
+  // the density is relative to the current number of samples
+  DenseVector<Precision> spdf(regression.density.N());
+  for (unsigned int i=0; i < spdf.N(); i++) {
+    spdf(i) = regression.density(i)/Xall.N();
+  }
+  m_result->spdf[persistenceLevel][crystalIndex] = spdf;
+  return true;
+}
+
+/**
+ * Drop the regressions kept by processComplex.
+ */
+void HDProcessor::clearRegressions() {
+  for (auto &regression : m_regressions) {
+    regression.second.deallocate();
+  }
+  m_regressions.clear();
+  m_reuseRegressions = false;
+}
+
 /**
  * Add small pertubations to data achieve general position / avoid pathological cases.
  */
 void HDProcessor::addNoise(DenseVector<Precision> &v) {
   std::cerr << "Adding noise to M-S field...\n";
-  Random<Precision> rand;
+  // a generator of its own, as other processors may be adding noise concurrently
+  std::mt19937 generator(std::random_device{}());
+  std::uniform_real_distribution<double> uniform(0, 1);
   double a = 0.00000001 *( Linalg<Precision>::Max(v) - Linalg<Precision>::Min(v));
   for (unsigned int i=0; i < v.N(); i++) {
-    v(i) += rand.Uniform() * a;
+    v(i) += uniform(generator) * a;
   }
 }
 
@@ -637,8 +864,8 @@ void HDProcessor::fit(DenseMatrix<Precision> &E, DenseMatrix<Precision> &Efit) {
   DenseMatrix<Precision> Eorig(exts.size(), 2);
   DenseMatrix<Precision> Enew(exts.size(), 2);
 
-  int e1 = exts[globalMin];
-  int e2 = extsOrig[globalMin];
+  int e1 = exts[m_globalMin];
+  int e2 = extsOrig[m_globalMin];
 
   for( map_i_i_it it = exts.begin(); it != exts.end(); ++it){
     int i1 = it->second;
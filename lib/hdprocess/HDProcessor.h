@@ -1,14 +1,18 @@
 #pragma once
 
 #include "dimred/Isomap.h"
+#include "dimred/LandmarkIsomap.h"
 #include "dimred/PCA.h"
 #include "flinalg/Linalg.h"
 #include "flinalg/LinalgIO.h"
 #include "flinalg/DenseMatrix.h"
 #include "flinalg/DenseVector.h"
+#include "graph/KNNGraph.h"
 #include "graph/KNNNeighborhood.h"
+#include "Buckets.h"
 #include "HDProcessResult.h"
 #include "kernelstats/FirstOrderKernelRegression.h"
+#include "morsesmale/LandmarkMSComplex.h"
 #include "morsesmale/NNMSComplex.h"
 #include "dataset/Precision.h"
 #include "utils/Random.h"
@@ -18,6 +22,7 @@
 #include <algorithm>
 #include <map>
 #include <string>
+#include <tuple>
 #include <vector>
 
 /**
@@ -33,18 +38,29 @@ class HDProcessor {
     FortranLinalg::DenseVector<Precision> qoi,
     int knn, int nSamples, int persistence, bool random,
     Precision sigmaArg, Precision sigmaSmooth);
+  std::unique_ptr<HDProcessResult>  processOnGraph(KNNGraph<Precision> &graph,
+    FortranLinalg::DenseVector<Precision> qoi,
+    int knn, int nSamples, int persistence, bool random,
+    Precision sigmaArg, Precision sigmaSmooth, unsigned int landmarks = 100);
+  std::unique_ptr<HDProcessResult>  processComplex(NNMSComplex<Precision> &msComplex,
+    FortranLinalg::DenseMatrix<Precision> x, FortranLinalg::DenseVector<Precision> y,
+    int knn, int nSamples, int persistence, Precision sigmaArg);
+  std::unique_ptr<HDProcessResult>  processLandmarks(LandmarkMSComplex<Precision> &landmarks,
+    FortranLinalg::DenseMatrix<Precision> x, FortranLinalg::DenseVector<Precision> y,
+    int knn, int nSamples, int persistence, Precision sigmaArg);
  
 
  private:  
-  void computeAnalysisForLevel(NNMSComplex<Precision> &msComplex, 
-    unsigned int persistenceLevel, int nSamples, Precision sigma, bool computeRegression = true, unsigned knn = 10);
-  void computeRegressionForCrystal(unsigned int crystalIndex, unsigned int persistenceLevel, 
-    Precision sigma, int nSamples,
-    std::vector<std::vector<unsigned int>> &Xi,
-    std::vector<std::vector<Precision>> &yci, 
-    std::vector<FortranLinalg::DenseMatrix<Precision>> &ScrystalIDS,
-    FortranLinalg::DenseMatrix<Precision> &S,
-    FortranLinalg::DenseVector<Precision> &eWidths);
+  void analyzeComplex(NNMSComplex<Precision> &msComplex,
+    int knn, int nSamples, int persistenceArg, Precision sigma);
+  struct LevelAnalysis;
+  void computeAnalysis(NNMSComplex<Precision> &msComplex, unsigned int start,
+    int nSamples, Precision sigma, bool computeRegression = true, unsigned knn = 10);
+  bool collectCrystals(NNMSComplex<Precision> &msComplex, unsigned int persistenceLevel,
+    int nSamples, Precision sigma, bool computeRegression, LevelAnalysis &level);
+  void computeRegressionForCrystal(LevelAnalysis &level, unsigned int crystalIndex,
+    Precision sigma, int nSamples);
+  void computeLayoutsForLevel(LevelAnalysis &level, int nSamples, unsigned knn);
   void computePCALayout(FortranLinalg::DenseMatrix<Precision> &S, 
     int nExt, int nSamples, unsigned int persistenceLevel);
   void computePCAExtremaLayout(FortranLinalg::DenseMatrix<Precision> &S, 
@@ -53,10 +69,12 @@ class HDProcessor {
   void computeIsomapLayout(FortranLinalg::DenseMatrix<Precision> &S, 
     std::vector<FortranLinalg::DenseMatrix<Precision>> &ScrystalIDs, 
     int nExt, int nSamples, unsigned int persistenceLevel, unsigned knn);
+  bool reuseRegression(LevelAnalysis &level, unsigned int crystalIndex, int nSamples);
+  void clearRegressions();
   void fit(FortranLinalg::DenseMatrix<Precision> &E, FortranLinalg::DenseMatrix<Precision> &Efit);
   void addNoise(FortranLinalg::DenseVector<Precision> &v);
 
-  FortranLinalg::DenseVector<int> crystalIDs;
+  // crystals and extrema of the level whose layouts are computed
   FortranLinalg::DenseMatrix<int> crystals;
   FortranLinalg::DenseVector<Precision> persistence;
   FortranLinalg::DenseMatrix<Precision> Xall;
@@ -85,4 +103,51 @@ class HDProcessor {
   typedef map_i_i::iterator map_i_i_it; 
   map_i_i exts;
   map_i_i extsOrig;
+
+  // first global minimum, reference point for aligning the layouts of
+  // subsequent persistence levels
+  int m_globalMin = -1;
+
+  // Regression of a crystal kept by processComplex for the next call, by
+  // the samples and values it was fit to and its max and min
+  typedef std::tuple<std::vector<unsigned int>, std::vector<Precision>, int, int> CrystalKey;
+  struct CrystalRegression {
+    FortranLinalg::DenseMatrix<Precision> R;
+    FortranLinalg::DenseMatrix<Precision> gradR;
+    FortranLinalg::DenseMatrix<Precision> Rvar;
+    FortranLinalg::DenseVector<Precision> mdists;
+    FortranLinalg::DenseVector<Precision> fmean;
+    FortranLinalg::DenseVector<Precision> density;  // spdf before dividing by the number of samples
+    bool used = false;
+
+    void deallocate() {
+      R.deallocate();
+      gradR.deallocate();
+      Rvar.deallocate();
+      mdists.deallocate();
+      fmean.deallocate();
+      density.deallocate();
+    }
+  };
+
+  // Crystals of a persistence level, the samples each is regressed on and
+  // their regressions, while the crystals of several levels are regressed
+  // in parallel
+  struct LevelAnalysis {
+    unsigned int persistenceLevel;
+    FortranLinalg::DenseMatrix<int> crystals;
+    map_i_i exts;
+    Buckets maxima;                               // crystals of each extremum ID, by their maximum
+    Buckets minima;                               // and by their minimum
+    std::vector<std::vector<unsigned int>> Xi;
+    std::vector<std::vector<Precision>> yci;
+    std::vector<FortranLinalg::DenseMatrix<Precision>> ScrystalIDs;
+    FortranLinalg::DenseMatrix<Precision> S;      // regression curves, then the extrema, for the layouts
+    std::vector<CrystalRegression> regressions;   // computed regressions to keep, if any
+  };
+
+  bool m_reuseRegressions = false;
+  Precision m_regressionSigma = 0;
+  int m_regressionSamples = 0;
+  std::map<CrystalKey, CrystalRegression> m_regressions;
 };
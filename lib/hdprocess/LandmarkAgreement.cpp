@@ -0,0 +1,56 @@
+#include "LandmarkAgreement.h"
+
+#include "flinalg/Linalg.h"
+#include "ParameterSweep.h"
+
+#include <cmath>
+#include <stdexcept>
+
+using namespace FortranLinalg;
+
+/**
+ * Compares the complexes at the levels the scaled persistence thresholds
+ * select in each of them, i.e. at the same absolute persistence.
+ * @param[in] exact Complex of all samples.
+ * @param[in] approximate Landmark complex of the same samples.
+ * @param[in] y Function value of each sample.
+ * @param[in] persistences Thresholds scaled by the range of y.
+ */
+std::vector<LandmarkAgreement> LandmarkAgreement::measure(NNMSComplex<Precision> &exact,
+                                                          LandmarkMSComplex<Precision> &approximate,
+                                                          DenseVector<Precision> &y,
+                                                          const std::vector<Precision> &persistences) {
+  auto &hierarchy = exact.getHierarchy();
+  if (hierarchy.sampleCount() != approximate.N() || y.N() != approximate.N()) {
+    throw std::runtime_error("LandmarkAgreement: complexes of different samples");
+  }
+  auto &landmarkHierarchy = approximate.getComplex().getHierarchy();
+  Precision frange = Linalg<Precision>::Max(y) - Linalg<Precision>::Min(y);
+
+  std::vector<LandmarkAgreement> agreements;
+  std::vector<std::pair<int, int>> pairs, extrema;
+  std::vector<int> crystalIDs, partition, approximatePartition;
+  for (Precision persistence : persistences) {
+    LandmarkAgreement agreement;
+    agreement.persistence = persistence;
+
+    unsigned int level = hierarchy.levelOf(persistence * frange);
+    hierarchy.crystalsAt(level, pairs, crystalIDs);
+    hierarchy.partitions(level, partition);
+    approximate.crystalsAt(landmarkHierarchy.levelOf(persistence * frange), extrema, approximatePartition);
+    agreement.exactCrystals = pairs.size();
+    agreement.approximateCrystals = extrema.size();
+    agreement.adjustedRand = ParameterSweep::adjustedRand(partition, approximatePartition);
+
+    auto &extremaIndex = hierarchy.getExtremaIndex();
+    double error = 0;
+    for (unsigned int i = 0; i < partition.size(); i++) {
+      auto &p = pairs[partition[i]];
+      auto &e = extrema[approximatePartition[i]];
+      error += std::fabs(y(extremaIndex[p.first]) - y(e.first)) + std::fabs(y(extremaIndex[p.second]) - y(e.second));
+    }
+    agreement.extremaError = frange > 0 ? error / (2 * partition.size() * frange) : 0;
+    agreements.push_back(agreement);
+  }
+  return agreements;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "flinalg/DenseVector.h"
+#include "morsesmale/LandmarkMSComplex.h"
+#include "morsesmale/NNMSComplex.h"
+#include "dataset/Precision.h"
+
+#include <vector>
+
+/**
+ * Agreement of a landmark complex with the exact complex of all samples at
+ * one persistence threshold, for checking the approximation on datasets
+ * where both can be computed.
+ */
+struct LandmarkAgreement {
+  Precision persistence;            // scaled to [0,1] as by HDProcessor
+  unsigned int exactCrystals;
+  unsigned int approximateCrystals;
+  Precision adjustedRand;           // of the crystal partitions of all samples
+  Precision extremaError;           // mean over samples of the value differences of the
+                                    // maxima and minima they flow to, relative to the range
+
+  // agreement at each scaled persistence threshold
+  static std::vector<LandmarkAgreement> measure(NNMSComplex<Precision> &exact,
+                                                LandmarkMSComplex<Precision> &approximate,
+                                                FortranLinalg::DenseVector<Precision> &y,
+                                                const std::vector<Precision> &persistences);
+};
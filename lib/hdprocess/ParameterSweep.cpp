@@ -0,0 +1,261 @@
+#include "ParameterSweep.h"
+
+#include "flinalg/Linalg.h"
+#include "kernelstats/FirstOrderKernelRegression.h"
+#include "kernelstats/GaussianKernel.h"
+#include "metrics/Distance.h"
+#include "morsesmale/NNMSComplex.h"
+#include "utils/Parallel.h"
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+using namespace FortranLinalg;
+
+/**
+ * Sweep over neighborhoods of a distance matrix, as processOnMetric.
+ * @param[in] distances Pairwise distances between samples.
+ * @param[in] maxKnn Largest knn that will be swept.
+ */
+ParameterSweep::ParameterSweep(DenseMatrix<Precision> &distances, int maxKnn) {
+  maxKnn = std::max(1, std::min<int>(maxKnn, distances.N()));
+  KNN = DenseMatrix<int>(maxKnn, distances.N());
+  KNND = DenseMatrix<Precision>(maxKnn, distances.N());
+  Distance<Precision>::findKNN(distances, KNN, KNND);
+}
+
+/**
+ * Sweep over neighborhoods of a knn graph, as processOnGraph; knn can go up
+ * to graph.k().
+ */
+ParameterSweep::ParameterSweep(KNNGraph<Precision> &graph) {
+  KNN = Linalg<int>::Copy(graph.indices);
+  KNND = Linalg<Precision>::Copy(graph.distances);
+}
+
+/**
+ * Sweep over Euclidean neighborhoods of coordinates, where the neighbors of
+ * each sample include itself. The neighbors are found as by the complex
+ * process builds, NNMSComplex(X, ...) with the same eps and search, so a
+ * setting gives the complex of process with it.
+ * @param[in] X Coordinates of the samples.
+ * @param[in] maxKnn Largest knn that will be swept.
+ * @param[in] eps Approximation of the kd-tree search.
+ * @param[in] search Nearest neighbor search.
+ */
+ParameterSweep ParameterSweep::fromSamples(DenseMatrix<Precision> &X, int maxKnn, double eps,
+                                           NNSearch search) {
+  ParameterSweep sweep;
+  maxKnn = std::max(1, std::min<int>(maxKnn, X.N()));
+  sweep.KNN = DenseMatrix<int>(maxKnn, X.N());
+  sweep.KNND = DenseMatrix<Precision>(maxKnn, X.N());
+  NNMSComplex<Precision>::computeKNN(X, sweep.KNN, sweep.KNND, eps, search);
+  return sweep;
+}
+
+void ParameterSweep::deallocate() {
+  KNN.deallocate();
+  KNND.deallocate();
+}
+
+/**
+ * Computes the complex of every knn and sigmaSmooth setting and summarizes
+ * its stability.
+ * @param[in] field Function value of each sample.
+ * @param[in] knns Numbers of nearest neighbors, at most maxKnn().
+ * @param[in] sigmaSmooths Data smoothing bandwidths, 0 for no smoothing.
+ * @param[in] sigmaArgs Inverse regression bandwidths. The regression error of
+ *            each is the squared residual of the crystal regression curves at
+ *            the stable level relative to the total variance of X.
+ * @param[in] X Sample coordinates for the regression, none to skip it.
+ * @param[in] regressionSamples Residuals evaluated per crystal.
+ */
+SweepResult ParameterSweep::run(DenseVector<Precision> &field, const std::vector<int> &knns,
+                                const std::vector<Precision> &sigmaSmooths, const std::vector<Precision> &sigmaArgs,
+                                DenseMatrix<Precision> X, unsigned int regressionSamples) {
+  if (field.N() != KNN.N()) {
+    throw std::runtime_error("ParameterSweep: field has " + std::to_string(field.N()) + " values for " +
+                             std::to_string(KNN.N()) + " samples");
+  }
+  if (X.N() > 0 && X.N() != KNN.N()) {
+    throw std::runtime_error("ParameterSweep: coordinates differ in size from the samples");
+  }
+  for (int knn : knns) {
+    if (knn < 1 || knn > (int) KNN.M()) {
+      throw std::runtime_error("ParameterSweep: knn " + std::to_string(knn) + " outside of [1, " +
+                               std::to_string(KNN.M()) + "]");
+    }
+  }
+
+  // neighbor prefixes and their reverse edges, shared by all sigmaSmooth
+  std::vector<DenseMatrix<int>> knnPrefix(knns.size());
+  std::vector<DenseMatrix<Precision>> knndPrefix(knns.size());
+  std::vector<std::vector<size_t>> reverseStart(knns.size());
+  std::vector<std::vector<size_t>> reverse(knns.size());
+  for (unsigned int k = 0; k < knns.size(); k++) {
+    knnPrefix[k] = DenseMatrix<int>(knns[k], KNN.N());
+    knndPrefix[k] = DenseMatrix<Precision>(knns[k], KNN.N());
+    for (unsigned int i = 0; i < KNN.N(); i++) {
+      for (int j = 0; j < knns[k]; j++) {
+        knnPrefix[k](j, i) = KNN(j, i);
+        knndPrefix[k](j, i) = KNND(j, i);
+      }
+    }
+    NNMSComplex<Precision>::reverseEdges(knnPrefix[k], reverseStart[k], reverse[k]);
+  }
+
+  Precision frange = Linalg<Precision>::Max(field) - Linalg<Precision>::Min(field);
+  SweepResult result;
+  result.summaries.resize(knns.size() * sigmaSmooths.size());
+  std::vector<std::vector<int>> partitions(result.summaries.size());
+  Parallel::forEach(0, result.summaries.size(), [&](long c) {
+    unsigned int k = c / sigmaSmooths.size();
+    Precision sigmaSmooth = sigmaSmooths[c % sigmaSmooths.size()];
+    NNMSComplex<Precision> msComplex(knnPrefix[k], knndPrefix[k], reverseStart[k], reverse[k], field,
+                                     sigmaSmooth > 0, sigmaSmooth * sigmaSmooth);
+    auto &hierarchy = msComplex.getHierarchy();
+
+    SweepSummary &summary = result.summaries[c];
+    summary.knn = knns[k];
+    summary.sigmaSmooth = sigmaSmooth;
+    std::vector<std::pair<int, int>> pairs;
+    std::vector<int> crystalIDs;
+    for (unsigned int level = 0; level < hierarchy.levelCount(); level++) {
+      // the last level is at persistence max(), set to 1 as by HDProcessor
+      bool last = level + 1 == hierarchy.levelCount();
+      summary.persistence.push_back(last || frange == 0 ? 1 : hierarchy.persistence(level) / frange);
+      hierarchy.crystalsAt(level, pairs, crystalIDs);
+      summary.crystalCounts.push_back(pairs.size());
+    }
+
+    // level l holds for thresholds in (persistence(l - 1), persistence(l)];
+    // the single crystal of the last level is not a candidate
+    summary.stableLevel = 0;
+    summary.stableGap = summary.persistence[0];
+    for (unsigned int level = 1; level + 1 < summary.persistence.size(); level++) {
+      Precision gap = summary.persistence[level] - summary.persistence[level - 1];
+      if (gap > summary.stableGap) {
+        summary.stableGap = gap;
+        summary.stableLevel = level;
+      }
+    }
+    hierarchy.partitions(summary.stableLevel, partitions[c]);
+    msComplex.cleanup();
+  });
+
+  if (X.N() > 0) {
+    for (auto &summary : result.summaries) {
+      summary.regressionErrors.resize(sigmaArgs.size());
+    }
+    Parallel::forEach(0, result.summaries.size() * sigmaArgs.size(), [&](long t) {
+      unsigned int c = t / sigmaArgs.size();
+      unsigned int a = t % sigmaArgs.size();
+      result.summaries[c].regressionErrors[a] =
+          regressionError(X, field, partitions[c], sigmaArgs[a], regressionSamples);
+    });
+  }
+
+  // settings one knn or one sigmaSmooth step apart
+  for (unsigned int c = 0; c < result.summaries.size(); c++) {
+    unsigned int s = c % sigmaSmooths.size();
+    if (s + 1 < sigmaSmooths.size()) {
+      result.agreements.push_back({c, c + 1, adjustedRand(partitions[c], partitions[c + 1])});
+    }
+    unsigned int next = c + sigmaSmooths.size();
+    if (next < result.summaries.size()) {
+      result.agreements.push_back({c, next, adjustedRand(partitions[c], partitions[next])});
+    }
+  }
+
+  for (unsigned int k = 0; k < knns.size(); k++) {
+    knnPrefix[k].deallocate();
+    knndPrefix[k].deallocate();
+  }
+  return result;
+}
+
+/**
+ * Adjusted Rand index of two partitions of the same samples: 1 for equal
+ * partitions, 0 for the agreement expected by chance.
+ */
+Precision ParameterSweep::adjustedRand(const std::vector<int> &a, const std::vector<int> &b) {
+  if (a.size() != b.size()) {
+    throw std::runtime_error("ParameterSweep: partitions of different sizes");
+  }
+  auto pairs = [](double n) { return n * (n - 1) / 2; };
+  std::unordered_map<int, double> aCounts, bCounts;
+  std::unordered_map<long long, double> joint;
+  for (size_t i = 0; i < a.size(); i++) {
+    aCounts[a[i]]++;
+    bCounts[b[i]]++;
+    joint[((long long) a[i] << 32) | (unsigned int) b[i]]++;
+  }
+  double index = 0, aPairs = 0, bPairs = 0;
+  for (auto &count : joint) index += pairs(count.second);
+  for (auto &count : aCounts) aPairs += pairs(count.second);
+  for (auto &count : bCounts) bPairs += pairs(count.second);
+  double expected = aPairs * bPairs / std::max(1.0, pairs(a.size()));
+  double maximum = (aPairs + bPairs) / 2;
+  if (maximum == expected) {
+    return 1;
+  }
+  return (index - expected) / (maximum - expected);
+}
+
+/**
+ * Relative residual of the inverse regression curves of the crystals of a
+ * partition, evaluated at up to regressionSamples samples per crystal.
+ */
+Precision ParameterSweep::regressionError(DenseMatrix<Precision> &X, DenseVector<Precision> &field,
+                                          const std::vector<int> &partition, Precision sigma,
+                                          unsigned int regressionSamples) {
+  int nCrystals = partition.empty() ? 0 : *std::max_element(partition.begin(), partition.end()) + 1;
+  std::vector<std::vector<unsigned int>> members(nCrystals);
+  for (unsigned int i = 0; i < partition.size(); i++) {
+    members[partition[i]].push_back(i);
+  }
+  DenseVector<Precision> mean = Linalg<Precision>::SumColumns(X);
+  Linalg<Precision>::Scale(mean, 1.0 / X.N(), mean);
+
+  double residual = 0;
+  double total = 0;
+  for (auto &crystal : members) {
+    if (crystal.size() < 2) {
+      continue;
+    }
+    DenseMatrix<Precision> Xc(X.M(), crystal.size());
+    DenseMatrix<Precision> yc(1, crystal.size());
+    for (unsigned int i = 0; i < crystal.size(); i++) {
+      Linalg<Precision>::SetColumn(Xc, i, X, crystal[i]);
+      yc(0, i) = field(crystal[i]);
+    }
+    GaussianKernel<Precision> kernel(sigma, 1);
+    FirstOrderKernelRegression<Precision> kr(Xc, yc, kernel, 1000);
+    unsigned int stride = std::max<size_t>(1, crystal.size() / std::max(1u, regressionSamples));
+    DenseMatrix<Precision> z(1, (crystal.size() + stride - 1) / stride);
+    for (unsigned int k = 0; k < z.N(); k++) {
+      z(0, k) = yc(0, k * stride);
+    }
+    DenseMatrix<Precision> r(X.M(), z.N());
+    DenseMatrix<Precision> J(X.M(), z.N());
+    kr.evaluate(z, r, J);
+    for (unsigned int k = 0; k < z.N(); k++) {
+      unsigned int i = k * stride;
+      for (unsigned int d = 0; d < X.M(); d++) {
+        residual += (Xc(d, i) - r(d, k)) * (Xc(d, i) - r(d, k));
+        total += (Xc(d, i) - mean(d)) * (Xc(d, i) - mean(d));
+      }
+    }
+    kr.cleanup();
+    Xc.deallocate();
+    yc.deallocate();
+    z.deallocate();
+    r.deallocate();
+    J.deallocate();
+  }
+  mean.deallocate();
+  return total > 0 ? residual / total : 0;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "flinalg/DenseMatrix.h"
+#include "flinalg/DenseVector.h"
+#include "graph/KNNGraph.h"
+#include "morsesmale/NNMSComplex.h"
+#include "dataset/Precision.h"
+
+#include <vector>
+
+/**
+ * Stability of the Morse-Smale complex for one knn and data smoothing setting.
+ */
+struct SweepSummary {
+  int knn;
+  Precision sigmaSmooth;
+  std::vector<Precision> persistence;    // scaled to [0,1] as by HDProcessor
+  std::vector<int> crystalCounts;        // crystals of each persistence level
+  unsigned int stableLevel;              // level held over the widest range of persistence
+  Precision stableGap;                   // that range, in scaled persistence
+  std::vector<Precision> regressionErrors; // per sigmaArg, see ParameterSweep::run
+};
+
+/**
+ * Agreement of the crystals of two settings that differ by one step in one
+ * parameter.
+ */
+struct SweepAgreement {
+  unsigned int first;                    // indices into SweepResult::summaries
+  unsigned int second;
+  Precision adjustedRand;                // of the partitions at the stable levels
+};
+
+struct SweepResult {
+  std::vector<SweepSummary> summaries;   // by knn, then sigmaSmooth
+  std::vector<SweepAgreement> agreements;
+};
+
+/**
+ * Grid search over the parameters of HDProcessor::processOnMetric for one
+ * field: knn, the data smoothing sigmaSmooth and the inverse regression
+ * bandwidth sigmaArg. One neighbor graph with the largest knn is built up
+ * front and every setting uses a prefix of it, so a setting gives the same
+ * complex as its own run. Settings are computed in parallel.
+ */
+class ParameterSweep {
+ public:
+  ParameterSweep(FortranLinalg::DenseMatrix<Precision> &distances, int maxKnn);
+  ParameterSweep(KNNGraph<Precision> &graph);
+
+  // neighbors of coordinates by the search of NNMSComplex, the defaults are
+  // those HDProcessor::process uses
+  static ParameterSweep fromSamples(FortranLinalg::DenseMatrix<Precision> &X, int maxKnn,
+                                    double eps = 0.01, NNSearch search = NNSearch::BruteForce);
+
+  SweepResult run(FortranLinalg::DenseVector<Precision> &field, const std::vector<int> &knns,
+                  const std::vector<Precision> &sigmaSmooths, const std::vector<Precision> &sigmaArgs,
+                  FortranLinalg::DenseMatrix<Precision> X = FortranLinalg::DenseMatrix<Precision>(),
+                  unsigned int regressionSamples = 50);
+
+  int maxKnn() { return KNN.M(); };
+  void deallocate();
+
+  static Precision adjustedRand(const std::vector<int> &a, const std::vector<int> &b);
+
+ private:
+  static Precision regressionError(FortranLinalg::DenseMatrix<Precision> &X, FortranLinalg::DenseVector<Precision> &field,
+                                   const std::vector<int> &partition, Precision sigma, unsigned int regressionSamples);
+
+  ParameterSweep() {};
+
+  // neighbors of each sample by increasing distance; the first knn rows are
+  // the neighbors of any smaller knn
+  FortranLinalg::DenseMatrix<int> KNN;
+  FortranLinalg::DenseMatrix<Precision> KNND;
+};
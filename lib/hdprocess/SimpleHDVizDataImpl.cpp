@@ -1,4 +1,5 @@
 #include "SimpleHDVizDataImpl.h"
+#include "Buckets.h"
 #include "dataset/ValueIndexPair.h"
 #include <stdexcept>
 
@@ -207,11 +208,15 @@ SimpleHDVizDataImpl::SimpleHDVizDataImpl(std::shared_ptr<HDProcessResult> result
     m_extrema[p].resize(num_crystals);
     m_extrema[p] = result->extrema[p];
 
-    // add each sample to its crystal
+    // add each sample to its crystal, using crystalsPartitions (to which crystal each sample belongs)
+    auto& partition = result->crystalPartitions[p];
+    Buckets members(num_samples, num_crystals, [&](unsigned int id) { return partition[id]; });
     m_crystals[p].resize(num_crystals);
-    for (auto id = 0; id < num_samples; id++) {
-      // use crystalsPartitions (to which crystal each sample belongs) to insert samples
-      m_crystals[p][result->crystalPartitions[p][id]].push_back(m_samples[id]);
+    for (auto c = 0; c < num_crystals; c++) {
+      m_crystals[p][c].reserve(members.size(c) + 2);
+      for (auto id = members.begin(c); id != members.end(c); id++) {
+        m_crystals[p][c].push_back(m_samples[*id]);
+      }
     }
 
     // sort crystal samples and add any that are missing
@@ -243,7 +248,8 @@ SimpleHDVizDataImpl::SimpleHDVizDataImpl(std::shared_ptr<HDProcessResult> result
       auto min_sample = crystal[0];
       auto max_sample = crystal[crystal.size() - 1];
 
-      // smallest to min
+      // smallest to min, inserted at once in increasing order
+      std::vector<ValueIndexPair> path;
       auto current = crystal[1];
       while (result->knng(1, current.idx) != -1 && result->knng(1, current.idx) != min_sample.idx) {
         // std::cout << current.idx << "'s sheerest neighbors (asc:dec): " << result->knng(1, current.idx)
@@ -251,18 +257,21 @@ SimpleHDVizDataImpl::SimpleHDVizDataImpl(std::shared_ptr<HDProcessResult> result
 
         // add current's neighbor of steepest descent and continue
         auto next = m_samples[result->knng(1, current.idx)];
-        crystal.insert(crystal.begin()+1, next);
+        path.push_back(next);
         current = next;
       }
+      crystal.insert(crystal.begin()+1, path.rbegin(), path.rend());
 
       // largest to max
+      path.clear();
       current = crystal[crystal.size() - 2];
       while (result->knng(0, current.idx) != -1 && result->knng(0, current.idx) != max_sample.idx) {
         // add current's neighbor of steepest ascent and continue
         auto next = m_samples[result->knng(0, current.idx)];
-        crystal.insert(crystal.end()-1, next);
+        path.push_back(next);
         current = next;
       }
+      crystal.insert(crystal.end()-1, path.begin(), path.end());
 
       // after augmentation to verify
       //printCrystal(crystal, p, c);
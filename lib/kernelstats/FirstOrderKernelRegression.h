@@ -4,12 +4,26 @@
 #include "flinalg/DenseVector.h"
 #include "flinalg/DenseMatrix.h"
 #include "flinalg/Linalg.h"
+#include "flinalg/SmallLeastSquares.h"
 #include "GaussianKernel.h"
 #include "metrics/Distance.h"
 #include "metrics/SquaredEuclideanMetric.h"
 
 #include <math.h>
-
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+/**
+ * Local linear regression of data over labels: evaluate fits the data of the
+ * knn labels nearest to x, weighted by the kernel, as an offset and a
+ * gradient. For one dimensional labels, as the inverse regressions of
+ * HDProcessor, the labels are kept sorted and the nearest are found by a
+ * binary search and a window grown around it, O(log n + knn) instead of
+ * O(n); all workspaces are allocated once, so evaluations do not allocate.
+ * The fits are solved by SmallLeastSquares, normal equations accumulated in
+ * double where they are well-conditioned and QR otherwise.
+ */
 
 template<typename TPrecision>
 class FirstOrderKernelRegression {      
@@ -19,20 +33,36 @@ class FirstOrderKernelRegression {
 	    if (knn > X.N()){ 
         knn = X.N(); 
       }
-	    A = FortranLinalg::DenseMatrix<TPrecision>(knn, 1+X.M());
-     	b = FortranLinalg::DenseMatrix<TPrecision>(knn, Y.M());
+      solver = FortranLinalg::SmallLeastSquares<TPrecision>(knn, 1+X.M(), Y.M());
+      a.resize(1+X.M());
+      sol = FortranLinalg::DenseMatrix<TPrecision>(1+X.M(), Y.M());
+      knnIndex = FortranLinalg::DenseVector<int>(knn);
+      knnDist = FortranLinalg::DenseVector<TPrecision>(knn);
+
+      if (X.M() == 1) {
+        order.resize(X.N());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](unsigned int i, unsigned int j) {
+            return X(0, i) < X(0, j);
+          });
+        sorted.resize(X.N());
+        for (unsigned int i = 0; i < X.N(); i++) {
+          sorted[i] = X(0, order[i]);
+        }
+      }
     };
 
 
     void cleanup(){
-      A.deallocate();
-      b.deallocate();
+      sol.deallocate();
+      knnIndex.deallocate();
+      knnDist.deallocate();
     };     
 
 
      void project( FortranLinalg::DenseVector<TPrecision> &x, FortranLinalg::DenseVector<TPrecision> &y, 
                    FortranLinalg::DenseVector<TPrecision> &out){
-       FortranLinalg::DenseMatrix<TPrecision> sol = ls(x);
+       ls(x);
        for(unsigned int i=0; i<Y.M(); i++){
            out(i) = sol(0, i);
        }
@@ -47,13 +77,12 @@ class FirstOrderKernelRegression {
            out(i) += dprod * sol(j+1, i);
          }
        }
-       sol.deallocate();
       
      };
 
       void evaluate( FortranLinalg::DenseVector<TPrecision> &x, FortranLinalg::Vector<TPrecision> &out,
 FortranLinalg::Matrix<TPrecision> &J, TPrecision *sse=NULL){
-        FortranLinalg::DenseMatrix<TPrecision> sol = ls(x, sse);
+        ls(x, sse);
         for(unsigned int i=0; i<Y.M(); i++){
           out(i) = sol(0, i);
         }     
@@ -62,7 +91,25 @@ FortranLinalg::Matrix<TPrecision> &J, TPrecision *sse=NULL){
             J(j, i) = sol(1+i, j);
           }
         }
-        sol.deallocate();
+      };
+
+      // evaluates at all columns of x, as the samples of a regression curve:
+      // the fits into the columns of out, the gradients into X.M() columns of
+      // J per sample and, if given, the residuals into the columns of sse
+      void evaluate( FortranLinalg::DenseMatrix<TPrecision> &x, FortranLinalg::DenseMatrix<TPrecision> &out,
+          FortranLinalg::DenseMatrix<TPrecision> &J, FortranLinalg::DenseMatrix<TPrecision> *sse=NULL){
+        for(unsigned int k=0; k < x.N(); k++){
+          FortranLinalg::DenseVector<TPrecision> xk(x.M(), x.data() + (size_t) k * x.M());
+          ls(xk, sse == NULL ? NULL : sse->data() + (size_t) k * Y.M());
+          for(unsigned int i=0; i<Y.M(); i++){
+            out(i, k) = sol(0, i);
+          }
+          for(unsigned int i=0; i< X.M(); i++){
+            for(unsigned int j=0; j< Y.M(); j++){
+              J(j, k * X.M() + i) = sol(1+i, j);
+            }
+          }
+        }
       };
 
 
@@ -74,40 +121,65 @@ FortranLinalg::Matrix<TPrecision> &J, TPrecision *sse=NULL){
 
     GaussianKernel<TPrecision> &kernel;
 
-    FortranLinalg::DenseMatrix<TPrecision> A;
-    FortranLinalg::DenseMatrix<TPrecision> b;
+    FortranLinalg::DenseMatrix<TPrecision> sol;
+
+    // workspaces of ls
+    FortranLinalg::SmallLeastSquares<TPrecision> solver;
+    std::vector<TPrecision> a;
+    FortranLinalg::DenseVector<int> knnIndex;
+    FortranLinalg::DenseVector<TPrecision> knnDist;
+
+    // one dimensional labels in increasing order and their samples
+    std::vector<unsigned int> order;
+    std::vector<TPrecision> sorted;
+
+    // knn nearest labels of one dimensional x, growing a window from where
+    // x would be inserted towards the nearer side
+    void sortedKNN(TPrecision x) {
+      long hi = std::lower_bound(sorted.begin(), sorted.end(), x) - sorted.begin();
+      long lo = hi - 1;
+      long n = sorted.size();
+      for(unsigned int i=0; i < knnIndex.N(); i++){
+        long next;
+        if(hi >= n || (lo >= 0 && x - sorted[lo] <= sorted[hi] - x)){
+          next = lo--;
+        }
+        else{
+          next = hi++;
+        }
+        knnIndex(i) = order[next];
+        knnDist(i) = (sorted[next] - x) * (sorted[next] - x);
+      }
+    };
 
-    FortranLinalg::DenseMatrix<TPrecision> ls(FortranLinalg::DenseVector<TPrecision> &x, 
-        TPrecision *sse=NULL) {
-      FortranLinalg::DenseVector<int> knn(A.M());
-      FortranLinalg::DenseVector<TPrecision> knnDist(A.M());
-      Distance<TPrecision>::computeKNN(X, x, knn, knnDist, sl2metric);
+    // fits the neighborhood of x into sol
+    void ls(FortranLinalg::DenseVector<TPrecision> &x, TPrecision *sse=NULL) {
+      if(X.M() == 1){
+        sortedKNN(x(0));
+      }
+      else{
+        Distance<TPrecision>::computeKNN(X, x, knnIndex, knnDist, sl2metric);
+      }
 
       TPrecision wsum = 0; 
-      for(unsigned int i=0; i < A.M(); i++){
-        unsigned int nn = knn(i);
+      solver.clear();
+      for(unsigned int i=0; i < knnIndex.N(); i++){
+        unsigned int nn = knnIndex(i);
         TPrecision w = kernel.f(knnDist(i));
-        A(i, 0) = w;
+        a[0] = 1;
         for(unsigned int j=0; j< X.M(); j++){
-          A(i, j+1) = (X(j, nn)-x(j)) * w; // Essentially get knnDist again and multiplying by w
-        }
-
-        for(unsigned int m = 0; m < Y.M(); m++){
-          b(i, m) = Y(m, nn) *w;
+          a[j+1] = X(j, nn)-x(j);
         }
+        solver.addRow(a.data(), w, Y.data() + (size_t) nn * Y.M());
         wsum += w*w;
       }
 
-      FortranLinalg::DenseMatrix<TPrecision> sol = FortranLinalg::Linalg<TPrecision>::LeastSquares(A, b, sse);
+      solver.solve(sol.data(), sse);
       if(sse != NULL){ 
-        for(int i=0; i<sol.N(); i++){
+        for(unsigned int i=0; i<sol.N(); i++){
           sse[i] /= wsum;
         }
       }
-
-      knn.deallocate();
-      knnDist.deallocate();
-      return sol;
     };
 };
 
@@ -2,10 +2,13 @@
 #define KERNELDENSITY_H
 
 
-#include "DenseVector.h"
-#include "DenseMatrix.h"
+#include "flinalg/DenseVector.h"
+#include "flinalg/DenseMatrix.h"
 #include "Kernel.h"
-#include "Linalg.h"
+#include "flinalg/Linalg.h"
+#include "SortedKernelDensity.h"
+
+#include <memory>
 
 template<typename TPrecision>
 class KernelDensity{
@@ -13,10 +16,14 @@ class KernelDensity{
   public:
     KernelDensity(FortranLinalg::DenseMatrix<TPrecision> &data, Kernel<TPrecision, TPrecision> &k)
                     :X(data), kernel(k){
+      sortSamples();
     };
 
     //returns unnormalized density
     double p(int j, int leaveout = -1 ){
+      if(sorted && leaveout < 0){
+        return sorted->p(X(0, j));
+      }
       TPrecision wsum = 0;
       for(int i=0; i < X.N(); i++){
         if(leaveout == i) continue;
@@ -28,6 +35,9 @@ class KernelDensity{
     //retunrs unnormalized density
     double p(FortranLinalg::DenseMatrix<TPrecision> &T, int index, bool leaveout = false){
       using namespace FortranLinalg;
+      if(sorted && !leaveout){
+        return sorted->p(T(0, index));
+      }
       TPrecision wsum = 0;
       for(unsigned int i=0; i < X.N(); i++){
         bool use = true;
@@ -55,6 +65,9 @@ class KernelDensity{
 
 
     double p(FortranLinalg::DenseVector<TPrecision> &x, int leaveout = -1){
+      if(sorted && leaveout < 0){
+        return sorted->p(x(0));
+      }
       TPrecision wsum = 0;
       for(unsigned int i=0; i < X.N(); i++){
         if(leaveout != i){
@@ -66,11 +79,23 @@ class KernelDensity{
 
     void setData(FortranLinalg::DenseMatrix<TPrecision> &data){
       X = data;
+      sortSamples();
     };
 
   private:
     FortranLinalg::DenseMatrix<TPrecision> X;
     Kernel<TPrecision, TPrecision> &kernel;
+    std::shared_ptr<SortedKernelDensity<TPrecision>> sorted;
+
+    //one dimensional samples under a Gaussian kernel are summed over sorted
+    //windows, exact up to the order of summation
+    void sortSamples(){
+      GaussianKernel<TPrecision> *gaussian = dynamic_cast<GaussianKernel<TPrecision> *>(&kernel);
+      sorted.reset();
+      if(X.M() == 1 && gaussian != NULL){
+        sorted = std::make_shared<SortedKernelDensity<TPrecision>>(X.data(), X.N(), *gaussian);
+      }
+    };
 };
 
 
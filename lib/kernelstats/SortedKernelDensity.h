@@ -0,0 +1,61 @@
+#ifndef SORTEDKERNELDENSITY_H
+#define SORTEDKERNELDENSITY_H
+
+#include "GaussianKernel.h"
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * Unnormalized Gaussian kernel density of one dimensional samples, as
+ * KernelDensity, summed over a window of the sorted samples. The window is
+ * grown from where x would be inserted towards the nearer side until the
+ * samples outside it, all weighted at most as the nearest of them, add less
+ * than tolerance times the sum so far. This bounds the error relative to the
+ * exact sum by tolerance; with tolerance 0 only samples whose kernel
+ * vanishes are skipped. Points near the samples cost O(log n + window)
+ * instead of O(n).
+ */
+template<typename TPrecision>
+class SortedKernelDensity {
+  public:
+    SortedKernelDensity(const TPrecision *samples, unsigned int n, GaussianKernel<TPrecision> &k,
+        TPrecision tolerance = 0) : sorted(samples, samples + n), kernel(k), tolerance(tolerance) {
+      std::sort(sorted.begin(), sorted.end());
+    };
+
+    //returns unnormalized density
+    double p(TPrecision x){
+      long n = sorted.size();
+      long hi = std::lower_bound(sorted.begin(), sorted.end(), x) - sorted.begin();
+      long lo = hi - 1;
+      double sum = 0;
+      while(lo >= 0 || hi < n){
+        TPrecision d;
+        if(hi >= n || (lo >= 0 && x - sorted[lo] <= sorted[hi] - x)){
+          d = x - sorted[lo--];
+        }
+        else{
+          d = sorted[hi++] - x;
+        }
+        TPrecision k = kernel.f(d*d);
+        if(k * (double) (n - (hi - lo - 1) + 1) <= tolerance * (sum + k)){
+          // k and all kernels outside are within the bound
+          break;
+        }
+        sum += k;
+      }
+      return sum;
+    };
+
+    unsigned int N(){
+      return sorted.size();
+    };
+
+  private:
+    std::vector<TPrecision> sorted;
+    GaussianKernel<TPrecision> &kernel;
+    TPrecision tolerance;
+};
+
+#endif
@@ -0,0 +1,192 @@
+#include "flinalg/DenseMatrix.h"
+#include "flinalg/DenseVector.h"
+#include "flinalg/Linalg.h"
+#include "flinalg/SmallLeastSquares.h"
+#include "kernelstats/FirstOrderKernelRegression.h"
+#include "kernelstats/GaussianKernel.h"
+#include "metrics/Distance.h"
+#include "metrics/SquaredEuclideanMetric.h"
+#include "dataset/Precision.h"
+#include <tclap/CmdLine.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace FortranLinalg;
+using Clock = std::chrono::steady_clock;
+
+double seconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// gelsd in place with the workspaces kept across fits, as the fits solved it
+// before SmallLeastSquares: b needs max(a.M(), a.N()) rows and holds the
+// solution in its first a.N() rows, a is overwritten
+void gelsdInPlace(DenseMatrix<Precision> &a, DenseMatrix<Precision> &b, std::vector<Precision> &s,
+                  std::vector<FL_INT> &iwork, std::vector<Precision> &work, Precision *sse) {
+  FL_INT m = a.M(), n = a.N(), nrhs = b.N(), ldb = b.M(), info = 0, rank = -1;
+  Precision rcond = -1;
+  auto solve = [&](Precision *workspace, FL_INT lwork) {
+    if (sizeof(Precision) == sizeof(double)) {
+      lapack::dgelsd_(&m, &n, &nrhs, (double *) a.data(), &m, (double *) b.data(), &ldb, (double *) s.data(),
+                      (double *) &rcond, &rank, (double *) workspace, &lwork, iwork.data(), &info);
+    } else {
+      lapack::sgelsd_(&m, &n, &nrhs, (float *) a.data(), &m, (float *) b.data(), &ldb, (float *) s.data(),
+                      (float *) &rcond, &rank, (float *) workspace, &lwork, iwork.data(), &info);
+    }
+  };
+  if (work.empty()) {
+    s.resize(std::min(m, n));
+    iwork.resize(100 * std::min(m, n));
+    Precision size = 0;
+    solve(&size, -1);
+    work.resize(std::max<FL_INT>(1, size));
+  }
+  solve(work.data(), work.size());
+  for (FL_INT i = 0; i < nrhs; i++) {
+    double sum = 0;
+    for (FL_INT j = n; j < m; j++) {
+      sum += (double) b(j, i) * b(j, i);
+    }
+    sse[i] = sum;
+  }
+}
+
+int main(int argc, char **argv) {
+  TCLAP::CmdLine cmd("Benchmark the local linear fits of FirstOrderKernelRegression, SmallLeastSquares "
+                     "against gelsd", ' ', "1");
+
+  TCLAP::ValueArg<int> nArg("n", "samples", "Number of samples of the crystal", false, 20000, "integer");
+  cmd.add(nArg);
+
+  TCLAP::ValueArg<int> dArg("d", "dim", "Dimension of the samples", false, 20, "integer");
+  cmd.add(dArg);
+
+  TCLAP::ValueArg<int> kArg("k", "knn", "Number of nearest neighbors of a fit", false, 1000, "integer");
+  cmd.add(kArg);
+
+  TCLAP::ValueArg<int> cArg("c", "curve", "Number of samples of the regression curve", false, 50, "integer");
+  cmd.add(cArg);
+
+  TCLAP::ValueArg<Precision> sArg("s", "sigma", "Bandwidth of the regression", false, 0.25, "float");
+  cmd.add(sArg);
+
+  try {
+    cmd.parse(argc, argv);
+  } catch (TCLAP::ArgException &e) {
+    std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+    return -1;
+  }
+
+  unsigned int n = nArg.getValue(), d = dArg.getValue(), curve = cArg.getValue();
+  unsigned int knn = std::min<unsigned int>(kArg.getValue(), n);
+  DenseMatrix<Precision> X(d, n), y(1, n);
+  for (unsigned int i = 0; i < n; i++) {
+    y(0, i) = std::rand() / (Precision) RAND_MAX;
+    for (unsigned int j = 0; j < d; j++) {
+      X(j, i) = std::sin(3 * y(0, i) + j) + 0.1 * std::rand() / (Precision) RAND_MAX;
+    }
+  }
+  GaussianKernel<Precision> kernel(sArg.getValue(), 1);
+
+  // neighborhoods of the curve samples, so only the solves are timed
+  SquaredEuclideanMetric<Precision> metric;
+  DenseMatrix<Precision> z(1, curve);
+  DenseMatrix<int> knnIndex(knn, curve);
+  DenseMatrix<Precision> knnDist(knn, curve);
+  for (unsigned int k = 0; k < curve; k++) {
+    z(0, k) = -0.1 + 1.2 * k / std::max(1u, curve - 1);
+    DenseVector<Precision> zk(1, z.data() + k);
+    DenseVector<int> index(knn, knnIndex.data() + (size_t) k * knn);
+    DenseVector<Precision> dist(knn, knnDist.data() + (size_t) k * knn);
+    Distance<Precision>::computeKNN(y, zk, index, dist, metric);
+  }
+
+  // previous path: weighted rows of each fit solved by gelsd
+  DenseMatrix<Precision> A(knn, 2), b(std::max(knn, 2u), d);
+  DenseMatrix<Precision> gelsd(2 * d, curve), gelsdSse(d, curve);
+  std::vector<Precision> s, work;
+  std::vector<FL_INT> iwork;
+  auto start = Clock::now();
+  for (unsigned int k = 0; k < curve; k++) {
+    for (unsigned int i = 0; i < knn; i++) {
+      unsigned int nn = knnIndex(i, k);
+      Precision w = kernel.f(knnDist(i, k));
+      A(i, 0) = w;
+      A(i, 1) = (y(0, nn) - z(0, k)) * w;
+      for (unsigned int j = 0; j < d; j++) {
+        b(i, j) = X(j, nn) * w;
+      }
+    }
+    gelsdInPlace(A, b, s, iwork, work, gelsdSse.data() + (size_t) k * d);
+    for (unsigned int j = 0; j < d; j++) {
+      gelsd(2 * j, k) = b(0, j);
+      gelsd(2 * j + 1, k) = b(1, j);
+    }
+  }
+  double tGelsd = seconds(start);
+
+  SmallLeastSquares<Precision> solver(knn, 2, d);
+  DenseMatrix<Precision> small(2 * d, curve), smallSse(d, curve);
+  Precision a[2];
+  unsigned int qr = 0;
+  start = Clock::now();
+  for (unsigned int k = 0; k < curve; k++) {
+    solver.clear();
+    for (unsigned int i = 0; i < knn; i++) {
+      unsigned int nn = knnIndex(i, k);
+      a[0] = 1;
+      a[1] = y(0, nn) - z(0, k);
+      solver.addRow(a, kernel.f(knnDist(i, k)), X.data() + (size_t) nn * d);
+    }
+    qr += !solver.solve(small.data() + (size_t) k * 2 * d, smallSse.data() + (size_t) k * d);
+  }
+  double tSmall = seconds(start);
+
+  // largest relative errors of the fits against gelsd in double precision
+  DenseMatrix<double> Ad(knn, 2), bd(std::max(knn, 2u), d);
+  double gelsdError = 0, smallError = 0;
+  for (unsigned int k = 0; k < curve; k++) {
+    for (unsigned int i = 0; i < knn; i++) {
+      unsigned int nn = knnIndex(i, k);
+      double w = kernel.f(knnDist(i, k));
+      Ad(i, 0) = w;
+      Ad(i, 1) = (double) (y(0, nn) - z(0, k)) * w;
+      for (unsigned int j = 0; j < d; j++) {
+        bd(i, j) = X(j, nn) * w;
+      }
+    }
+    DenseMatrix<double> exact = Linalg<double>::LeastSquares(Ad, bd);
+    for (unsigned int j = 0; j < d; j++) {
+      for (unsigned int i = 0; i < 2; i++) {
+        double scale = 1 + std::fabs(exact(i, j));
+        gelsdError = std::max(gelsdError, std::fabs(gelsd(2 * j + i, k) - exact(i, j)) / scale);
+        smallError = std::max(smallError, std::fabs(small(2 * j + i, k) - exact(i, j)) / scale);
+      }
+    }
+    exact.deallocate();
+  }
+  Ad.deallocate();
+  bd.deallocate();
+
+  // whole curve through the regression, neighbors included
+  FirstOrderKernelRegression<Precision> kr(X, y, kernel, knn);
+  DenseMatrix<Precision> R(d, curve), gradR(d, curve), Rsse(d, curve);
+  start = Clock::now();
+  kr.evaluate(z, R, gradR, &Rsse);
+  double tCurve = seconds(start);
+
+  std::cout << "n\td\tknn\tcurve\tgelsd(s)\tsmall(s)\tspeedup\tqr\tgelsd error\tsmall error\tcurve(s)" << std::endl;
+  std::cout << n << "\t" << d << "\t" << knn << "\t" << curve << "\t" << tGelsd << "\t" << tSmall << "\t"
+            << tGelsd / tSmall << "\t" << qr << "\t" << gelsdError << "\t" << smallError << "\t" << tCurve << std::endl;
+
+  kr.cleanup();
+  for (auto m : {&X, &y, &z, &knnDist, &A, &b, &gelsd, &gelsdSse, &small, &smallSse, &R, &gradR, &Rsse}) {
+    m->deallocate();
+  }
+  knnIndex.deallocate();
+  return 0;
+}
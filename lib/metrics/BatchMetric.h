@@ -0,0 +1,127 @@
+#ifndef BATCHMETRIC_H
+#define BATCHMETRIC_H
+
+#include "flinalg/DenseMatrix.h"
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+/**
+ * Statically dispatched metrics for the O(N^2) distance loops. Instead of a
+ * virtual call per pair through Vector/Matrix element accessors, a metric
+ * provides pair(x, y, d) on raw column pointers and BatchMetric derives the
+ * batch forms from it (CRTP): one query against many columns and a block of
+ * columns against another. The pair kernel is inlined into these loops and
+ * its reduction is vectorized by Eigen.
+ *
+ * Data is column-major with one sample per column, as in DenseMatrix.
+ */
+template <typename Derived, typename TPrecision>
+class BatchMetric {
+  public:
+    typedef Eigen::Matrix<TPrecision, Eigen::Dynamic, 1> EVector;
+    typedef Eigen::Map<const EVector> Column;
+
+    // out[j] = d(q, column j of X) for the n columns of the d x n matrix X
+    void toColumns(const TPrecision *q, const TPrecision *X, unsigned int d, unsigned int n,
+                   TPrecision *out) const {
+      for (unsigned int j = 0; j < n; j++) {
+        out[j] = derived().pair(q, X + (size_t) j * d, d);
+      }
+    };
+
+    // out(i, j) = d(column i of A, column j of B), column-major na x nb; A is
+    // swept in blocks that stay in cache while all columns of B pass by
+    void blockToBlock(const TPrecision *A, unsigned int na, const TPrecision *B, unsigned int nb,
+                      unsigned int d, TPrecision *out) const {
+      unsigned int block = std::max<size_t>(1, (64 << 10) / (std::max(1u, d) * sizeof(TPrecision)));
+      for (unsigned int i0 = 0; i0 < na; i0 += block) {
+        unsigned int i1 = std::min(na, i0 + block);
+        for (unsigned int j = 0; j < nb; j++) {
+          const TPrecision *y = B + (size_t) j * d;
+          for (unsigned int i = i0; i < i1; i++) {
+            out[i + (size_t) j * na] = derived().pair(A + (size_t) i * d, y, d);
+          }
+        }
+      }
+    };
+
+  protected:
+    const Derived &derived() const { return static_cast<const Derived &>(*this); };
+};
+
+
+template <typename TPrecision>
+class BatchSquaredEuclidean : public BatchMetric<BatchSquaredEuclidean<TPrecision>, TPrecision> {
+  public:
+    typedef typename BatchMetric<BatchSquaredEuclidean<TPrecision>, TPrecision>::Column Column;
+
+    TPrecision pair(const TPrecision *x, const TPrecision *y, unsigned int d) const {
+      return (Column(x, d) - Column(y, d)).squaredNorm();
+    };
+};
+
+
+template <typename TPrecision>
+class BatchEuclidean : public BatchMetric<BatchEuclidean<TPrecision>, TPrecision> {
+  public:
+    typedef typename BatchMetric<BatchEuclidean<TPrecision>, TPrecision>::Column Column;
+
+    TPrecision pair(const TPrecision *x, const TPrecision *y, unsigned int d) const {
+      return std::sqrt((Column(x, d) - Column(y, d)).squaredNorm());
+    };
+};
+
+
+template <typename TPrecision>
+class BatchL1 : public BatchMetric<BatchL1<TPrecision>, TPrecision> {
+  public:
+    typedef typename BatchMetric<BatchL1<TPrecision>, TPrecision>::Column Column;
+
+    TPrecision pair(const TPrecision *x, const TPrecision *y, unsigned int d) const {
+      return (Column(x, d) - Column(y, d)).cwiseAbs().sum();
+    };
+};
+
+
+/**
+ * d(x, y) = |P'(x - y)| for a d x k matrix P, the square root of the weight
+ * matrix as for MahalanobisMetric. The batch forms project both sides with
+ * one GEMM and reduce to Euclidean distances in the k dimensional space.
+ */
+template <typename TPrecision>
+class BatchMahalanobis : public BatchMetric<BatchMahalanobis<TPrecision>, TPrecision> {
+  public:
+    typedef Eigen::Matrix<TPrecision, Eigen::Dynamic, Eigen::Dynamic> EMatrix;
+    typedef Eigen::Map<const EMatrix> ConstMap;
+    typedef typename BatchMetric<BatchMahalanobis<TPrecision>, TPrecision>::Column Column;
+
+    // copies W
+    BatchMahalanobis(FortranLinalg::DenseMatrix<TPrecision> &W)
+          : Pt(ConstMap(W.data(), W.M(), W.N()).transpose()) {};
+
+    TPrecision pair(const TPrecision *x, const TPrecision *y, unsigned int d) const {
+      return std::sqrt((Pt * (Column(x, d) - Column(y, d))).squaredNorm());
+    };
+
+    void toColumns(const TPrecision *q, const TPrecision *X, unsigned int d, unsigned int n,
+                   TPrecision *out) const {
+      blockToBlock(q, 1, X, n, d, out);
+    };
+
+    void blockToBlock(const TPrecision *A, unsigned int na, const TPrecision *B, unsigned int nb,
+                      unsigned int d, TPrecision *out) const {
+      EMatrix PA = Pt * ConstMap(A, d, na);
+      EMatrix PB = Pt * ConstMap(B, d, nb);
+      euclidean.blockToBlock(PA.data(), na, PB.data(), nb, PA.rows(), out);
+    };
+
+  private:
+    EMatrix Pt;
+    BatchEuclidean<TPrecision> euclidean;
+};
+
+#endif
@@ -0,0 +1,316 @@
+#ifndef BLOCKEDDISTANCE_H
+#define BLOCKEDDISTANCE_H
+
+#include "metrics/HammingMetric.h"
+#include "metrics/SampleSource.h"
+#include "utils/Parallel.h"
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+
+/**
+ * Out-of-core pairwise distances between the samples of a SampleSource,
+ * written straight into the server's binary distance format (an N x N
+ * float32 .bin plus .bin.dims). The upper triangle is split into tiles of
+ * tileSize samples; for every tile pair both tiles are streamed from disk in
+ * chunks of dimensions small enough that the two tiles fit the memory budget,
+ * partial sums are accumulated in parallel and the finished tile and its
+ * mirror are written to their place in the output file. Memory therefore
+ * depends on the tile size and the budget only, not on N or D.
+ *
+ * With packed Hamming distances the samples are binary masks: each chunk is
+ * packed into 64-bit words as it is read and compared with popcount, so a
+ * budget holds 32 times more dimensions and the comparison is one
+ * instruction per 64 values.
+ */
+class BlockedDistance {
+  public:
+    // hamming is the fraction of differing coordinates and cosine is
+    // 1 - cos(angle), as sklearn's pairwise_distances computes them
+    enum class Type { Euclidean, L1, Hamming, Cosine };
+
+    static Type parseType(const std::string &name) {
+      if (name == "euclidean" || name == "l2") return Type::Euclidean;
+      if (name == "l1" || name == "manhattan" || name == "cityblock") return Type::L1;
+      if (name == "hamming") return Type::Hamming;
+      if (name == "cosine") return Type::Cosine;
+      throw std::runtime_error("unknown distance " + name);
+    };
+
+    BlockedDistance(Type type, unsigned int tileSize = 512, size_t memoryBudget = (size_t) 1 << 30,
+                    bool packed = false)
+          : type(type), tileSize(std::max(1u, tileSize)), memoryBudget(memoryBudget), packed(packed) {
+      if (packed && type != Type::Hamming) {
+        throw std::runtime_error("bit packed samples only support hamming distances");
+      }
+    };
+
+    // progress(done, total) is called after every finished tile pair
+    void compute(SampleSource &source, const std::string &filename,
+                 std::function<void(size_t, size_t)> progress = nullptr) {
+      n = source.N();
+      d = source.D();
+      if (packed) {
+        // whole words per chunk so packed chunks line up
+        chunkSize = 64 * std::max<size_t>(1, memoryBudget / (2 * (size_t) tileSize * sizeof(uint64_t)));
+      }
+      else {
+        chunkSize = std::max<size_t>(1, memoryBudget / (2 * (size_t) tileSize * sizeof(float)));
+      }
+      chunkSize = std::min(chunkSize, d);
+      size_t nChunks = (d + chunkSize - 1) / chunkSize;
+
+      int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0 || ::ftruncate(fd, (off_t) n * n * sizeof(float)) != 0) {
+        throw std::runtime_error("could not create " + filename);
+      }
+
+      unsigned int nTiles = (n + tileSize - 1) / tileSize;
+      size_t total = (size_t) nTiles * (nTiles + 1) / 2;
+      size_t done = 0;
+      Tile a, b, reference;
+      try {
+        for (unsigned int bi = 0; bi < nTiles; bi++) {
+          for (unsigned int bj = bi; bj < nTiles; bj++) {
+            unsigned int na = std::min(tileSize, n - bi * tileSize);
+            unsigned int nb = std::min(tileSize, n - bj * tileSize);
+            Eigen::MatrixXd acc = Eigen::MatrixXd::Zero(na, nb);
+            std::vector<double> normsA(na, 0), normsB(nb, 0);
+
+            for (size_t chunk = 0; chunk < nChunks; chunk++) {
+              const float *shift = nullptr;
+              if (type == Type::Euclidean) {
+                // coordinates are shifted by the first sample to limit
+                // cancellation in |x|^2 + |y|^2 - 2x'y
+                load(source, reference, 0, 1, chunk);
+                shift = reference.values.data();
+              }
+              load(source, a, bi * tileSize, na, chunk, shift);
+              Tile &other = bj == bi ? a : b;
+              if (bj != bi) {
+                load(source, b, bj * tileSize, nb, chunk, shift);
+              }
+              accumulate(a, other, acc, normsA, normsB);
+            }
+
+            std::vector<float> tile((size_t) na * nb);
+            finish(acc, normsA, normsB, bi == bj, tile);
+            store(fd, filename, tile, bi, bj, na, nb);
+            if (progress) {
+              progress(++done, total);
+            }
+          }
+        }
+      } catch (...) {
+        ::close(fd);
+        throw;
+      }
+      ::close(fd);
+
+      std::ofstream dims(filename + ".dims");
+      dims << n << " " << n << " float32";
+    };
+
+  private:
+    // samples of one tile restricted to one chunk of dimensions, one sample
+    // per column
+    struct Tile {
+      long first = -1;
+      long chunk = -1;
+      unsigned int count = 0;
+      size_t dims = 0;
+      std::vector<float> values;
+      // packed samples, words per sample
+      size_t words = 0;
+      std::vector<uint64_t> bits;
+    };
+
+    Type type;
+    unsigned int tileSize;
+    size_t memoryBudget;
+    bool packed;
+    unsigned int n;
+    size_t d, chunkSize;
+
+    // reads samples [first, first + count) for chunk, unless they are
+    // already loaded, and subtracts shift from each of them
+    void load(SampleSource &source, Tile &tile, unsigned int first, unsigned int count,
+              size_t chunk, const float *shift = nullptr) {
+      if (tile.first == first && tile.chunk == (long) chunk && tile.count == count) {
+        return;
+      }
+      size_t dimFirst = chunk * chunkSize;
+      size_t dims = std::min(chunkSize, d - dimFirst);
+      tile.first = first;
+      tile.chunk = chunk;
+      tile.count = count;
+      tile.dims = dims;
+      if (packed) {
+        tile.words = (dims + 63) / 64;
+        tile.bits.resize(tile.words * count);
+        Parallel::forEachChunk(0, count, [&](long i0, long i1) {
+            std::vector<float> values(dims);
+            for (long i = i0; i < i1; i++) {
+              source.read(first + i, first + i + 1, dimFirst, dimFirst + dims, values.data());
+              BitMatrix::pack(values.data(), dims, tile.bits.data() + i * tile.words);
+            }
+          }, 4);
+        return;
+      }
+      tile.values.resize(dims * count);
+      Parallel::forEachChunk(0, count, [&](long i0, long i1) {
+          source.read(first + i0, first + i1, dimFirst, dimFirst + dims, tile.values.data() + i0 * dims);
+          for (long i = i0; i < i1 && shift; i++) {
+            float *x = tile.values.data() + i * dims;
+            for (size_t k = 0; k < dims; k++) {
+              x[k] -= shift[k];
+            }
+          }
+        }, 4);
+    };
+
+    // adds the contribution of one chunk of dimensions to acc (na x nb) and,
+    // for the inner product based distances, to the squared norms
+    void accumulate(Tile &a, Tile &b, Eigen::MatrixXd &acc,
+                    std::vector<double> &normsA, std::vector<double> &normsB) {
+      typedef Eigen::Map<const Eigen::MatrixXf> Map;
+      Map A(a.values.data(), a.dims, a.count);
+      Map B(b.values.data(), b.dims, b.count);
+      bool inner = type == Type::Euclidean || type == Type::Cosine;
+
+      if (packed) {
+        // blocks of 16 x 64 samples keep both sides of countBlock in cache
+        Parallel::forEachChunk(0, a.count, [&](long i0, long i1) {
+            std::vector<uint64_t> counts;
+            for (unsigned int j0 = 0; j0 < b.count; j0 += 64) {
+              unsigned int nj = std::min(64u, b.count - j0);
+              counts.assign((i1 - i0) * nj, 0);
+              BitMatrix::countBlock(a.bits.data() + i0 * a.words, i1 - i0,
+                                    b.bits.data() + j0 * b.words, nj, a.words, counts.data());
+              for (unsigned int j = 0; j < nj; j++) {
+                for (long i = i0; i < i1; i++) {
+                  acc(i, j0 + j) += counts[(i - i0) + j * (i1 - i0)];
+                }
+              }
+            }
+          }, 16);
+        return;
+      }
+
+      Parallel::forEachChunk(0, a.count, [&](long i0, long i1) {
+          if (inner) {
+            acc.middleRows(i0, i1 - i0) += (A.middleCols(i0, i1 - i0).transpose() * B).cast<double>();
+            for (long i = i0; i < i1; i++) {
+              normsA[i] += A.col(i).squaredNorm();
+            }
+            return;
+          }
+          for (long i = i0; i < i1; i++) {
+            const float *x = &a.values[i * a.dims];
+            for (unsigned int j = 0; j < b.count; j++) {
+              const float *y = &b.values[(size_t) j * b.dims];
+              double sum = 0;
+              // float partial sums over short runs vectorize, the double
+              // total keeps long chunks accurate
+              for (size_t k0 = 0; k0 < a.dims; k0 += 1024) {
+                size_t k1 = std::min(a.dims, k0 + 1024);
+                float part = 0;
+                if (type == Type::L1) {
+                  for (size_t k = k0; k < k1; k++) {
+                    part += std::fabs(x[k] - y[k]);
+                  }
+                }
+                else {
+                  for (size_t k = k0; k < k1; k++) {
+                    part += x[k] != y[k];
+                  }
+                }
+                sum += part;
+              }
+              acc(i, j) += sum;
+            }
+          }
+        }, 16);
+
+      if (inner) {
+        for (unsigned int j = 0; j < b.count; j++) {
+          normsB[j] += B.col(j).squaredNorm();
+        }
+      }
+    };
+
+    void finish(Eigen::MatrixXd &acc, std::vector<double> &normsA, std::vector<double> &normsB,
+                bool diagonal, std::vector<float> &tile) {
+      long na = acc.rows();
+      long nb = acc.cols();
+      for (long j = 0; j < nb; j++) {
+        for (long i = 0; i < na; i++) {
+          double value = acc(i, j);
+          switch (type) {
+            case Type::Euclidean:
+              value = std::sqrt(std::max(0.0, normsA[i] + normsB[j] - 2 * value));
+              break;
+            case Type::Cosine: {
+              double norm = std::sqrt(normsA[i] * normsB[j]);
+              value = norm > 0 ? std::min(2.0, std::max(0.0, 1 - value / norm)) : 1;
+              break;
+            }
+            case Type::Hamming:
+              value /= d;
+              break;
+            default:
+              break;
+          }
+          tile[i + j * na] = diagonal && i == j ? 0 : (float) value;
+        }
+      }
+    };
+
+    // writes tile (rows of tile bi, columns of tile bj) and its transpose into
+    // the column-major output
+    void store(int fd, const std::string &filename, std::vector<float> &tile,
+               unsigned int bi, unsigned int bj, unsigned int na, unsigned int nb) {
+      size_t i0 = (size_t) bi * tileSize;
+      size_t j0 = (size_t) bj * tileSize;
+      for (unsigned int j = 0; j < nb; j++) {
+        write(fd, filename, &tile[(size_t) j * na], na, (j0 + j) * n + i0);
+      }
+      if (bi == bj) {
+        return;
+      }
+      std::vector<float> row(nb);
+      for (unsigned int i = 0; i < na; i++) {
+        for (unsigned int j = 0; j < nb; j++) {
+          row[j] = tile[i + (size_t) j * na];
+        }
+        write(fd, filename, row.data(), nb, (i0 + i) * n + j0);
+      }
+    };
+
+    static void write(int fd, const std::string &filename, const float *values, size_t count, size_t offset) {
+      const char *buffer = reinterpret_cast<const char *>(values);
+      size_t bytes = count * sizeof(float);
+      offset *= sizeof(float);
+      while (bytes > 0) {
+        ssize_t written = ::pwrite(fd, buffer, bytes, offset);
+        if (written <= 0) {
+          throw std::runtime_error("could not write " + filename);
+        }
+        buffer += written;
+        bytes -= written;
+        offset += written;
+      }
+    };
+};
+
+#endif
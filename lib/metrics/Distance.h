@@ -3,8 +3,17 @@
 
 #include "flinalg/DenseMatrix.h"
 #include "flinalg/DenseVector.h"
+#include "BatchMetric.h"
+#include "HammingMetric.h"
 #include "Metric.h"
 #include "utils/MinHeap.h"
+#include "utils/Parallel.h"
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
 
 
 template <typename TPrecision>
@@ -29,6 +38,140 @@ class Distance {
       }
     };
 
+    static FortranLinalg::DenseMatrix<TPrecision> computeEuclideanDistances(
+        FortranLinalg::DenseMatrix<TPrecision> &data, bool squared = false) {
+      FortranLinalg::DenseMatrix<TPrecision> distances(data.N(), data.N());
+      computeEuclideanDistances(data, distances, squared);
+      return distances;
+    };
+
+    // Pairwise (squared) Euclidean distances between the columns of data via
+    // |x|^2 + |y|^2 - 2x'y. The upper triangle is split into square tiles, each
+    // computed with one GEMM and mirrored into the lower triangle; tiles are
+    // processed in parallel. Data is centered first to limit cancellation and
+    // negative round-off is clamped to zero.
+    static void computeEuclideanDistances(FortranLinalg::DenseMatrix<TPrecision> &data,
+                                          FortranLinalg::DenseMatrix<TPrecision> &distances,
+                                          bool squared = false, unsigned int blockSize = 256) {
+      typedef Eigen::Matrix<TPrecision, Eigen::Dynamic, Eigen::Dynamic> EMatrix;
+      typedef Eigen::Matrix<TPrecision, Eigen::Dynamic, 1> EVector;
+
+      long n = data.N();
+      Eigen::Map<EMatrix> X(data.data(), data.M(), n);
+      Eigen::Map<EMatrix> D(distances.data(), n, n);
+
+      EMatrix Xc = X.colwise() - X.rowwise().mean();
+      EVector sq = Xc.colwise().squaredNorm().transpose();
+
+      long nBlocks = (n + blockSize - 1) / blockSize;
+      std::vector<std::pair<long, long>> tiles;
+      for (long bi = 0; bi < nBlocks; bi++) {
+        for (long bj = bi; bj < nBlocks; bj++) {
+          tiles.push_back(std::make_pair(bi, bj));
+        }
+      }
+
+      Parallel::forEach(0, tiles.size(), [&](long t) {
+          long i0 = tiles[t].first * blockSize;
+          long j0 = tiles[t].second * blockSize;
+          long ni = std::min<long>(blockSize, n - i0);
+          long nj = std::min<long>(blockSize, n - j0);
+
+          EMatrix block = TPrecision(-2) * (Xc.middleCols(i0, ni).transpose() * Xc.middleCols(j0, nj));
+          block.colwise() += sq.segment(i0, ni);
+          block.rowwise() += sq.segment(j0, nj).transpose();
+          block = block.cwiseMax(TPrecision(0));
+          if (!squared) {
+            block = block.cwiseSqrt();
+          }
+          if (i0 == j0) {
+            // keep diagonal tiles exactly symmetric
+            for (long j = 0; j < nj; j++) {
+              block(j, j) = 0;
+              for (long i = j + 1; i < ni; i++) {
+                block(i, j) = block(j, i);
+              }
+            }
+          }
+          D.block(i0, j0, ni, nj) = block;
+          D.block(j0, i0, nj, ni) = block.transpose();
+        });
+    };
+
+    // Pairwise normalized Hamming distances between the columns of data as
+    // binary masks (nonzero is set). The data is packed into 64-bit words and
+    // the upper triangle is processed in parallel tiles of 64 samples, each
+    // counted with popcount in cache sized blocks of words.
+    static FortranLinalg::DenseMatrix<TPrecision> computeHammingDistances(
+        FortranLinalg::DenseMatrix<TPrecision> &data, unsigned int blockSize = 64) {
+      BitMatrix bits(data);
+      FortranLinalg::DenseMatrix<TPrecision> distances(data.N(), data.N());
+      long n = data.N();
+      long nBlocks = (n + blockSize - 1) / blockSize;
+      std::vector<std::pair<long, long>> tiles;
+      for (long bi = 0; bi < nBlocks; bi++) {
+        for (long bj = bi; bj < nBlocks; bj++) {
+          tiles.push_back(std::make_pair(bi, bj));
+        }
+      }
+
+      Parallel::forEach(0, tiles.size(), [&](long t) {
+          long i0 = tiles[t].first * blockSize;
+          long j0 = tiles[t].second * blockSize;
+          long ni = std::min<long>(blockSize, n - i0);
+          long nj = std::min<long>(blockSize, n - j0);
+          std::vector<uint64_t> counts(ni * nj, 0);
+          BitMatrix::countBlock(bits.column(i0), ni, bits.column(j0), nj, bits.words(), counts.data());
+          for (long j = 0; j < nj; j++) {
+            for (long i = 0; i < ni; i++) {
+              TPrecision d = counts[i + j * ni] / (TPrecision) bits.D();
+              distances(i0 + i, j0 + j) = d;
+              distances(j0 + j, i0 + i) = d;
+            }
+          }
+        });
+      return distances;
+    };
+
+    // Pairwise distances between the columns of data under a statically
+    // dispatched metric; tiles of the upper triangle are computed with
+    // blockToBlock in parallel and mirrored.
+    template <typename TMetric>
+    static FortranLinalg::DenseMatrix<TPrecision> computeDistances(
+        FortranLinalg::DenseMatrix<TPrecision> &data, const BatchMetric<TMetric, TPrecision> &batchMetric,
+        unsigned int blockSize = 128) {
+      const TMetric &metric = static_cast<const TMetric &>(batchMetric);
+      long n = data.N();
+      unsigned int d = data.M();
+      FortranLinalg::DenseMatrix<TPrecision> distances(n, n);
+      long nBlocks = (n + blockSize - 1) / blockSize;
+      std::vector<std::pair<long, long>> tiles;
+      for (long bi = 0; bi < nBlocks; bi++) {
+        for (long bj = bi; bj < nBlocks; bj++) {
+          tiles.push_back(std::make_pair(bi, bj));
+        }
+      }
+
+      Parallel::forEach(0, tiles.size(), [&](long t) {
+          long i0 = tiles[t].first * blockSize;
+          long j0 = tiles[t].second * blockSize;
+          long ni = std::min<long>(blockSize, n - i0);
+          long nj = std::min<long>(blockSize, n - j0);
+          std::vector<TPrecision> block(ni * nj);
+          metric.blockToBlock(data.data() + i0 * d, ni, data.data() + j0 * d, nj, d, block.data());
+          for (long j = 0; j < nj; j++) {
+            for (long i = 0; i < ni; i++) {
+              distances(i0 + i, j0 + j) = block[i + j * ni];
+              distances(j0 + j, i0 + i) = block[i + j * ni];
+            }
+          }
+        });
+      for (long i = 0; i < n; i++) {
+        distances(i, i) = 0;
+      }
+      return distances;
+    };
+
     static void computeDistances(FortranLinalg::Matrix<TPrecision> &data,
                                  int index,  
                                  Metric<TPrecision> &metric, 
@@ -39,26 +182,24 @@ class Distance {
       }
     };
 
+    // k nearest neighbors (k = knn.M()) of every sample from its column of the
+    // distance matrix d, excluding the sample itself; when k equals the number
+    // of samples the last entry is the sample itself at distance max(). Rows
+    // are processed in parallel. Tied distances resolve exactly as the
+    // MinHeap extraction over the whole column always did.
+    static void findKNN(FortranLinalg::DenseMatrix<TPrecision> &d,
+        FortranLinalg::DenseMatrix<int> &knn, FortranLinalg::DenseMatrix<TPrecision> &dists) {
+      TPrecision **columns = d.getColumnAccessor();
+      selectKNN(d.N(), knn, dists, [columns](unsigned int i, unsigned int j) {
+          return columns[i][j];
+        });
+    };
+
     static void findKNN(FortranLinalg::Matrix<TPrecision> &d, 
         FortranLinalg::Matrix<int> &knn, FortranLinalg::Matrix<TPrecision> &dists) {
-      TPrecision *distances = new TPrecision[d.N()];
-
-      for (unsigned int i = 0; i < d.N(); i++){
-        // TODO: Replace with row extraction.
-        for (unsigned int j = 0; j < d.N(); j++){
-          if (i == j)
-            distances[j] = std::numeric_limits<TPrecision>::max();
-          else
-            distances[j] = d(j,i);
-        }
-      
-        MinHeap<TPrecision> minHeap(distances, d.N());
-        for (unsigned int j=0; j < knn.M(); j++){
-          knn(j, i) = minHeap.getRootIndex();
-          dists(j, i) = minHeap.extractRoot();
-        }
-      }
-      delete[] distances;
+      selectKNN(d.N(), knn, dists, [&d](unsigned int i, unsigned int j) {
+          return d(j, i);
+        });
     };
 
 
@@ -83,6 +224,54 @@ class Distance {
     };
 
 
+    // knn.M() nearest neighbors of every column of data under a statically
+    // dispatched metric, including the sample itself, ordered by (distance,
+    // index). Chunks of queries are compared against blocks of columns with
+    // blockToBlock, in parallel.
+    template <typename TMetric>
+    static void computeKNN(FortranLinalg::DenseMatrix<TPrecision> &data,
+        FortranLinalg::DenseMatrix<int> &knn, FortranLinalg::DenseMatrix<TPrecision> &dists,
+        const BatchMetric<TMetric, TPrecision> &batchMetric) {
+      typedef std::pair<TPrecision, int> Neighbor;
+      const TMetric &metric = static_cast<const TMetric &>(batchMetric);
+      unsigned int n = data.N();
+      unsigned int d = data.M();
+      unsigned int k = std::min(knn.M(), n);
+      const unsigned int queries = 32, columns = 512;
+
+      Parallel::forEachChunk(0, n, [&](long first, long last) {
+          unsigned int nq = last - first;
+          std::vector<std::vector<Neighbor>> heaps(nq);
+          std::vector<TPrecision> block((size_t) nq * columns);
+          for (unsigned int j0 = 0; j0 < n; j0 += columns) {
+            unsigned int nb = std::min(columns, n - j0);
+            metric.blockToBlock(data.data() + first * d, nq, data.data() + (size_t) j0 * d, nb, d, block.data());
+            for (unsigned int j = 0; j < nb; j++) {
+              for (unsigned int q = 0; q < nq; q++) {
+                Neighbor candidate(block[q + (size_t) j * nq], j0 + j);
+                std::vector<Neighbor> &heap = heaps[q];
+                if (heap.size() < k) {
+                  heap.push_back(candidate);
+                  std::push_heap(heap.begin(), heap.end());
+                }
+                else if (k > 0 && candidate < heap.front()) {
+                  std::pop_heap(heap.begin(), heap.end());
+                  heap.back() = candidate;
+                  std::push_heap(heap.begin(), heap.end());
+                }
+              }
+            }
+          }
+          for (unsigned int q = 0; q < nq; q++) {
+            std::sort_heap(heaps[q].begin(), heaps[q].end());
+            for (unsigned int j = 0; j < knn.M(); j++) {
+              knn(j, first + q) = j < k ? heaps[q][j].second : -1;
+              dists(j, first + q) = j < k ? heaps[q][j].first : std::numeric_limits<TPrecision>::max();
+            }
+          }
+        }, queries);
+    };
+
     static void computeKNN(FortranLinalg::Matrix<TPrecision> &data, int index,
         FortranLinalg::Vector<int> &knn, FortranLinalg::Vector<TPrecision> &dists, 
         Metric<TPrecision> &metric) {        
@@ -115,6 +304,74 @@ class Distance {
       }
       delete[] distances;
     };
+
+  private:
+    // Selects the k closest samples j != i for each sample i with a bounded
+    // max-heap of the k + 1 smallest (distance, index) pairs, i.e. O(n log k)
+    // per row instead of heapifying all n entries. Without ties among them the
+    // order is unique; a row with ties is selected again by the MinHeap over
+    // the whole column, with the sample itself at max(), whose tie order
+    // depends on the heap layout and is kept for compatibility.
+    template<typename Accessor>
+    static void selectKNN(unsigned int n, FortranLinalg::Matrix<int> &knn,
+        FortranLinalg::Matrix<TPrecision> &dists, Accessor distance) {
+      typedef std::pair<TPrecision, int> Neighbor;
+      unsigned int k = std::min(knn.M(), n > 0 ? n - 1 : 0);
+      unsigned int m = std::min(k + 1, n > 0 ? n - 1 : 0);
+
+      Parallel::forEachChunk(0, n, [&](long first, long last) {
+          std::vector<Neighbor> heap;
+          std::vector<TPrecision> column;
+          heap.reserve(m);
+          for (long i = first; i < last; i++) {
+            heap.clear();
+            for (unsigned int j = 0; j < n && m > 0; j++) {
+              if (j == i) {
+                continue;
+              }
+              Neighbor candidate(distance(i, j), j);
+              if (heap.size() < m) {
+                heap.push_back(candidate);
+                std::push_heap(heap.begin(), heap.end());
+              }
+              else if (candidate < heap.front()) {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.back() = candidate;
+                std::push_heap(heap.begin(), heap.end());
+              }
+            }
+            std::sort_heap(heap.begin(), heap.end());
+
+            // with every other sample selected, the sample itself at max()
+            // competes as well
+            bool tied = m == n - 1 && m > 0 && heap.back().first == std::numeric_limits<TPrecision>::max();
+            for (unsigned int j = 1; j < heap.size() && !tied; j++) {
+              tied = heap[j - 1].first == heap[j].first;
+            }
+            if (tied) {
+              column.resize(n);
+              for (unsigned int j = 0; j < n; j++) {
+                column[j] = j == i ? std::numeric_limits<TPrecision>::max() : distance(i, j);
+              }
+              MinHeap<TPrecision> minHeap(column.data(), n);
+              for (unsigned int j = 0; j < knn.M(); j++) {
+                knn(j, i) = j < n ? minHeap.getRootIndex() : i;
+                dists(j, i) = j < n ? minHeap.extractRoot() : std::numeric_limits<TPrecision>::max();
+              }
+              continue;
+            }
+
+            for (unsigned int j = 0; j < k; j++) {
+              knn(j, i) = heap[j].second;
+              dists(j, i) = heap[j].first;
+            }
+            for (unsigned int j = k; j < knn.M(); j++) {
+              knn(j, i) = i;
+              dists(j, i) = std::numeric_limits<TPrecision>::max();
+            }
+          }
+        }, 16);
+    };
 };
 
 #endif
@@ -0,0 +1,190 @@
+#ifndef HAMMINGMETRIC_H
+#define HAMMINGMETRIC_H
+
+#include "Metric.h"
+#include "flinalg/Matrix.h"
+#include "flinalg/Vector.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BITMATRIX_POPCNT_DISPATCH
+#endif
+
+
+/**
+ * Binary samples (segmentation masks) packed 64 values per word, one
+ * contiguous run of words per sample. A value is set if it is nonzero, so
+ * 0/1 and 0/255 masks pack the same. Differences are counted with popcount
+ * on the xor of two runs, i.e. one instruction per 64 values instead of 64
+ * float comparisons.
+ */
+class BitMatrix {
+  public:
+    // words per cache block in countBlock: 4KB per sample, so a 64 sample
+    // tile of each side stays in L2
+    static const size_t blockWords = 512;
+
+    BitMatrix() {};
+
+    BitMatrix(unsigned int n, size_t d) : n(n), d(d), nWords((d + 63) / 64), bits(nWords * n, 0) {};
+
+    template <typename TPrecision>
+    BitMatrix(FortranLinalg::Matrix<TPrecision> &X) : BitMatrix(X.N(), X.M()) {
+      std::vector<TPrecision> column(d);
+      for (unsigned int i = 0; i < n; i++) {
+        for (size_t k = 0; k < d; k++) {
+          column[k] = X(k, i);
+        }
+        pack(column.data(), d, this->column(i));
+      }
+    };
+
+    unsigned int N() const { return n; };
+    size_t D() const { return d; };
+    size_t words() const { return nWords; };
+
+    uint64_t *column(unsigned int i) { return bits.data() + (size_t) i * nWords; };
+    const uint64_t *column(unsigned int i) const { return bits.data() + (size_t) i * nWords; };
+
+    // packs count values into (count + 63) / 64 words, unused bits are zero
+    template <typename T>
+    static void pack(const T *values, size_t count, uint64_t *out) {
+      for (size_t w = 0; w * 64 < count; w++) {
+        size_t end = std::min<size_t>(64, count - w * 64);
+        const T *v = values + w * 64;
+        uint64_t word = 0;
+        for (size_t b = 0; b < end; b++) {
+          word |= (uint64_t) (v[b] != 0) << b;
+        }
+        out[w] = word;
+      }
+    };
+
+    static unsigned int popcount(uint64_t word) {
+      return __builtin_popcountll(word);
+    };
+
+    // number of differing bits of two runs of words, by the popcnt
+    // instruction where the processor has it; the build flags stay generic
+    static uint64_t differences(const uint64_t *a, const uint64_t *b, size_t words) {
+#ifdef BITMATRIX_POPCNT_DISPATCH
+      static const bool hasPopcnt = __builtin_cpu_supports("popcnt");
+      if (hasPopcnt) {
+        return differencesPopcnt(a, b, words);
+      }
+#endif
+      return countDifferences(a, b, words);
+    };
+
+    // counts(i + j * na) += differences of sample i of A and sample j of B
+    // (both runs of words per sample), sweeping the words in cache sized
+    // blocks so each block of B is reused for all samples of A
+    static void countBlock(const uint64_t *A, unsigned int na, const uint64_t *B, unsigned int nb,
+                           size_t words, uint64_t *counts) {
+      for (size_t w0 = 0; w0 < words; w0 += blockWords) {
+        size_t length = std::min(blockWords, words - w0);
+        for (unsigned int j = 0; j < nb; j++) {
+          const uint64_t *b = B + j * words + w0;
+          for (unsigned int i = 0; i < na; i++) {
+            counts[i + (size_t) j * na] += differences(A + i * words + w0, b, length);
+          }
+        }
+      }
+    };
+
+  private:
+    __attribute__((always_inline))
+    static inline uint64_t countDifferences(const uint64_t *a, const uint64_t *b, size_t words) {
+      uint64_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+      size_t w = 0;
+      for (; w + 4 <= words; w += 4) {
+        c0 += __builtin_popcountll(a[w] ^ b[w]);
+        c1 += __builtin_popcountll(a[w + 1] ^ b[w + 1]);
+        c2 += __builtin_popcountll(a[w + 2] ^ b[w + 2]);
+        c3 += __builtin_popcountll(a[w + 3] ^ b[w + 3]);
+      }
+      for (; w < words; w++) {
+        c0 += __builtin_popcountll(a[w] ^ b[w]);
+      }
+      return c0 + c1 + c2 + c3;
+    };
+
+#ifdef BITMATRIX_POPCNT_DISPATCH
+    __attribute__((target("popcnt")))
+    static uint64_t differencesPopcnt(const uint64_t *a, const uint64_t *b, size_t words) {
+      return countDifferences(a, b, words);
+    };
+#endif
+
+    unsigned int n = 0;
+    size_t d = 0;
+    size_t nWords = 0;
+    std::vector<uint64_t> bits;
+};
+
+
+/**
+ * Normalized Hamming distance between binary masks, the fraction of
+ * coordinates where exactly one of the two samples is nonzero (sklearn's
+ * "hamming" on 0/1 data). A metric constructed from a data matrix packs it
+ * once and answers distance(X, i, X, j) by popcount when X is that matrix or
+ * a copy sharing its storage, as NNMSComplex keeps; other arguments are
+ * compared value by value.
+ */
+template <typename TPrecision>
+class HammingMetric : public Metric<TPrecision> {
+  public:
+    HammingMetric() {};
+
+    HammingMetric(FortranLinalg::Matrix<TPrecision> &data) : bits(data) {
+      if (data.M() > 0 && data.N() > 0) {
+        packed = &data(0, 0);
+      }
+    };
+
+    virtual ~HammingMetric() {};
+
+    TPrecision distance(FortranLinalg::Vector<TPrecision> &x1, FortranLinalg::Vector<TPrecision> &x2) {
+      unsigned int count = 0;
+      for (unsigned int i = 0; i < x1.N(); i++) {
+        count += (x1(i) != 0) != (x2(i) != 0);
+      }
+      return count / (TPrecision) x1.N();
+    };
+
+    TPrecision distance(FortranLinalg::Matrix<TPrecision> &X, int i1,
+                        FortranLinalg::Matrix<TPrecision> &Y, int i2) {
+      if (isPacked(X) && isPacked(Y)) {
+        return BitMatrix::differences(bits.column(i1), bits.column(i2), bits.words()) / (TPrecision) bits.D();
+      }
+      unsigned int count = 0;
+      for (unsigned int i = 0; i < X.M(); i++) {
+        count += (X(i, i1) != 0) != (Y(i, i2) != 0);
+      }
+      return count / (TPrecision) X.M();
+    };
+
+    TPrecision distance(FortranLinalg::Matrix<TPrecision> &X, int i1,
+                        FortranLinalg::Vector<TPrecision> &x2) {
+      unsigned int count = 0;
+      for (unsigned int i = 0; i < X.M(); i++) {
+        count += (X(i, i1) != 0) != (x2(i) != 0);
+      }
+      return count / (TPrecision) X.M();
+    };
+
+    // true if X has the storage and shape of the packed matrix
+    bool isPacked(FortranLinalg::Matrix<TPrecision> &X) {
+      return packed != nullptr && X.M() == bits.D() && X.N() == bits.N() && &X(0, 0) == packed;
+    };
+
+  private:
+    // first value of the packed matrix, identifies its storage
+    const TPrecision *packed = nullptr;
+    BitMatrix bits;
+};
+
+#endif
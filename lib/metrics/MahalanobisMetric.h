@@ -2,7 +2,7 @@
 #define MAHALANOBISMETRIC_H
 
 #include "Metric.h"
-#include "Linalg.h"
+#include "flinalg/Linalg.h"
 
 
 template<typename TPrecision>
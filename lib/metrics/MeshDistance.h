@@ -0,0 +1,181 @@
+#ifndef MESHDISTANCE_H
+#define MESHDISTANCE_H
+
+#include "flinalg/DenseMatrix.h"
+#include "metrics/Distance.h"
+#include "utils/Parallel.h"
+
+#include <Eigen/Dense>
+#include <igl/procrustes.h>
+#include <igl/readOBJ.h>
+#include <tinyply/tinyply.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+/**
+ * Distances between corresponded meshes (same vertex count and order), the
+ * native replacement for data/distances/mesh_distances.py. Each mesh is one
+ * column of x, y, z vertex coordinates; the L2 distance between two columns
+ * is the vertex-to-vertex distance of the meshes and is computed with the
+ * blocked GEMM of Distance::computeEuclideanDistances. With Procrustes
+ * alignment all meshes are first rigidly (optionally with scaling) aligned
+ * to their common mean shape.
+ */
+template <typename TPrecision>
+class MeshDistance {
+  public:
+    // alignment runs in double, libigl's procrustes does not mix precisions
+    typedef Eigen::Matrix<double, Eigen::Dynamic, 3> Points;
+
+    // vertices of the given meshes (.ply or .obj), one mesh per column with
+    // x, y, z of each vertex in turn; files are read in parallel
+    static FortranLinalg::DenseMatrix<TPrecision> loadVertices(const std::vector<std::string> &files) {
+      if (files.empty()) {
+        throw std::runtime_error("no meshes to load");
+      }
+      std::vector<TPrecision> first;
+      readVertices(files[0], first);
+      FortranLinalg::DenseMatrix<TPrecision> V(first.size(), files.size());
+      std::copy(first.begin(), first.end(), V.data());
+
+      Parallel::forEach(1, files.size(), [&](long i) {
+          std::vector<TPrecision> vertices;
+          readVertices(files[i], vertices);
+          if (vertices.size() != V.M()) {
+            throw std::runtime_error(files[i] + " has " + std::to_string(vertices.size() / 3) +
+                                     " vertices, expected " + std::to_string(V.M() / 3));
+          }
+          std::copy(vertices.begin(), vertices.end(), V.data() + (size_t) i * V.M());
+        });
+      return V;
+    };
+
+    // x, y, z of every vertex; binary and ascii PLY through tinyply, OBJ
+    // through libigl
+    static void readVertices(const std::string &filename, std::vector<TPrecision> &vertices) {
+      std::string extension = filename.substr(filename.find_last_of('.') + 1);
+      std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+      if (extension == "ply") {
+        readPLY(filename, vertices);
+      }
+      else if (extension == "obj") {
+        Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> V;
+        Eigen::MatrixXi F;
+        if (!igl::readOBJ(filename, V, F) || V.cols() != 3) {
+          throw std::runtime_error("could not read vertices of " + filename);
+        }
+        vertices.assign(V.data(), V.data() + V.size());
+      }
+      else {
+        throw std::runtime_error("unsupported mesh format " + filename);
+      }
+    };
+
+    // aligns every column of V to the mean shape by generalized Procrustes
+    // analysis: translation and rotation (and a uniform scale if scaling),
+    // iterated until the mean shape changes by less than tol relative to its
+    // size. The mean is kept at the average size of the input meshes.
+    static void align(FortranLinalg::DenseMatrix<TPrecision> &V, bool scaling = false,
+                      unsigned int iterations = 10, double tol = 1e-6) {
+      long n = V.N();
+      long nv = V.M() / 3;
+      auto mesh = [&](long i) {
+        return Eigen::Map<Eigen::Matrix<TPrecision, Eigen::Dynamic, 3, Eigen::RowMajor>>(
+            V.data() + (size_t) i * V.M(), nv, 3);
+      };
+
+      std::vector<double> sizes(n);
+      Parallel::forEach(0, n, [&](long i) {
+          auto X = mesh(i);
+          X.rowwise() -= X.colwise().mean();
+          sizes[i] = X.norm();
+        });
+      double size = 0;
+      for (double s : sizes) {
+        size += s / n;
+      }
+
+      Points mean = mesh(0).template cast<double>();
+      for (unsigned int it = 0; it < iterations; it++) {
+        Parallel::forEach(0, n, [&](long i) {
+            auto X = mesh(i);
+            Points Xi = X.template cast<double>();
+            double scale;
+            Eigen::Matrix3d R;
+            Eigen::Vector3d t;
+            igl::procrustes(Xi, mean, scaling, false, scale, R, t);
+            X = ((scale * Xi * R).rowwise() + t.transpose()).template cast<TPrecision>();
+          });
+
+        Points next = Points::Zero(nv, 3);
+        for (long i = 0; i < n; i++) {
+          next += mesh(i).template cast<double>();
+        }
+        next /= n;
+        if (scaling && next.norm() > 0) {
+          next *= size / next.norm();
+        }
+        double change = (next - mean).norm();
+        mean = next;
+        if (change <= tol * std::max(size, 1e-30)) {
+          break;
+        }
+      }
+    };
+
+    // pairwise vertex L2 distances between the columns of V, after an
+    // optional Procrustes alignment (which modifies V)
+    static FortranLinalg::DenseMatrix<TPrecision> computeDistances(FortranLinalg::DenseMatrix<TPrecision> &V,
+                                                                   bool procrustes = false, bool scaling = false) {
+      if (procrustes) {
+        align(V, scaling);
+      }
+      return Distance<TPrecision>::computeEuclideanDistances(V);
+    };
+
+  private:
+    template <typename T>
+    static void copyVertices(const uint8_t *data, size_t count, std::vector<TPrecision> &vertices) {
+      vertices.resize(count * 3);
+      for (size_t i = 0; i < count * 3; i++) {
+        T value;
+        std::memcpy(&value, data + i * sizeof(T), sizeof(T));
+        vertices[i] = value;
+      }
+    };
+
+    static void readPLY(const std::string &filename, std::vector<TPrecision> &vertices) {
+      std::ifstream in(filename, std::ios::binary);
+      if (!in) {
+        throw std::runtime_error("could not open " + filename);
+      }
+      tinyply::PlyFile ply;
+      std::shared_ptr<tinyply::PlyData> data;
+      try {
+        ply.parse_header(in);
+        data = ply.request_properties_from_element("vertex", {"x", "y", "z"});
+        ply.read(in);
+      } catch (const std::exception &e) {
+        throw std::runtime_error("could not read vertices of " + filename + ": " + e.what());
+      }
+      if (data->t == tinyply::Type::FLOAT32) {
+        copyVertices<float>(data->buffer.get(), data->count, vertices);
+      }
+      else if (data->t == tinyply::Type::FLOAT64) {
+        copyVertices<double>(data->buffer.get(), data->count, vertices);
+      }
+      else {
+        throw std::runtime_error(filename + ": vertex coordinates are not float or double");
+      }
+    };
+};
+
+#endif
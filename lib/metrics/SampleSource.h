@@ -0,0 +1,307 @@
+#ifndef SAMPLESOURCE_H
+#define SAMPLESOURCE_H
+
+#include <lodepng.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+
+/**
+ * Samples streamed from disk in blocks, so distance computations never need
+ * the whole data set in memory. read() may be called concurrently for
+ * disjoint sample ranges.
+ */
+class SampleSource {
+  public:
+    virtual ~SampleSource() {};
+
+    virtual unsigned int N() = 0;
+    virtual size_t D() = 0;
+
+    // coordinates [dimFirst, dimLast) of samples [first, last), one sample
+    // per column of out
+    virtual void read(unsigned int first, unsigned int last,
+                      size_t dimFirst, size_t dimLast, float *out) = 0;
+
+  protected:
+    // positioned read of an open file, throws on short reads
+    static void readAt(int fd, char *buffer, size_t bytes, size_t offset, const std::string &filename) {
+      while (bytes > 0) {
+        ssize_t count = ::pread(fd, buffer, bytes, offset);
+        if (count <= 0) {
+          throw std::runtime_error("could not read " + filename);
+        }
+        buffer += count;
+        bytes -= count;
+        offset += count;
+      }
+    };
+};
+
+
+/**
+ * Samples stored as the columns of a float32 matrix in the server's binary
+ * format (filename plus filename.dims holding "rows cols float32").
+ */
+class MatrixFileSource : public SampleSource {
+  public:
+    MatrixFileSource(const std::string &filename) : filename(filename) {
+      std::ifstream dims(filename + ".dims");
+      std::string dtype;
+      dims >> d >> n >> dtype;
+      if (d == 0 || n == 0) {
+        throw std::runtime_error("could not read dimensions of " + filename);
+      }
+      if (dtype != "float32") {
+        throw std::runtime_error(filename + " is " + dtype + ", only float32 samples are supported");
+      }
+      fd = ::open(filename.c_str(), O_RDONLY);
+      if (fd < 0) {
+        throw std::runtime_error("could not open " + filename);
+      }
+    };
+
+    ~MatrixFileSource() {
+      ::close(fd);
+    };
+
+    unsigned int N() { return n; };
+    size_t D() { return d; };
+
+    void read(unsigned int first, unsigned int last, size_t dimFirst, size_t dimLast, float *out) {
+      size_t count = dimLast - dimFirst;
+      for (unsigned int i = first; i < last; i++) {
+        readAt(fd, reinterpret_cast<char *>(out + (i - first) * count), count * sizeof(float),
+               ((size_t) i * d + dimFirst) * sizeof(float), filename);
+      }
+    };
+
+  private:
+    std::string filename;
+    size_t d = 0;
+    unsigned int n = 0;
+    int fd;
+};
+
+
+/**
+ * One file per sample, listed in a text file (one path per line, relative to
+ * the list). Supported are grayscale PNG images, raw encoded NRRD volumes and
+ * headerless float32 .bin files; all samples must have the same size.
+ * Raw formats are read in place, PNG images are decoded whole on every read.
+ */
+class FileListSource : public SampleSource {
+  public:
+    FileListSource(const std::string &listFile) {
+      std::ifstream list(listFile);
+      if (!list) {
+        throw std::runtime_error("could not open " + listFile);
+      }
+      std::string base;
+      size_t slash = listFile.find_last_of('/');
+      if (slash != std::string::npos) {
+        base = listFile.substr(0, slash + 1);
+      }
+      std::string line;
+      while (std::getline(list, line)) {
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (!line.empty()) {
+          files.push_back(line[0] == '/' ? line : base + line);
+        }
+      }
+      if (files.empty()) {
+        throw std::runtime_error(listFile + " lists no samples");
+      }
+      d = describe(files[0]).count;
+    };
+
+    unsigned int N() { return files.size(); };
+    size_t D() { return d; };
+
+    void read(unsigned int first, unsigned int last, size_t dimFirst, size_t dimLast, float *out) {
+      size_t count = dimLast - dimFirst;
+      for (unsigned int i = first; i < last; i++) {
+        readSample(files[i], dimFirst, dimLast, out + (i - first) * count);
+      }
+    };
+
+  private:
+    enum class Format { PNG, NRRD, Raw };
+    enum class Type { UInt8, Int8, UInt16, Int16, UInt32, Int32, Float, Double };
+
+    struct Layout {
+      Format format;
+      Type type = Type::Float;
+      size_t count = 0;
+      size_t offset = 0;
+    };
+
+    std::vector<std::string> files;
+    size_t d;
+
+    static bool endsWith(const std::string &s, const std::string &suffix) {
+      return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+    };
+
+    static size_t typeSize(Type type) {
+      switch (type) {
+        case Type::UInt8: case Type::Int8: return 1;
+        case Type::UInt16: case Type::Int16: return 2;
+        case Type::UInt32: case Type::Int32: case Type::Float: return 4;
+        default: return 8;
+      }
+    };
+
+    static Type nrrdType(const std::string &name) {
+      if (name == "uchar" || name == "unsigned char" || name == "uint8" || name == "uint8_t") return Type::UInt8;
+      if (name == "signed char" || name == "int8" || name == "int8_t") return Type::Int8;
+      if (name == "ushort" || name == "unsigned short" || name == "unsigned short int" ||
+          name == "uint16" || name == "uint16_t") return Type::UInt16;
+      if (name == "short" || name == "short int" || name == "signed short" || name == "signed short int" ||
+          name == "int16" || name == "int16_t") return Type::Int16;
+      if (name == "uint" || name == "unsigned int" || name == "uint32" || name == "uint32_t") return Type::UInt32;
+      if (name == "int" || name == "signed int" || name == "int32" || name == "int32_t") return Type::Int32;
+      if (name == "float") return Type::Float;
+      if (name == "double") return Type::Double;
+      throw std::runtime_error("unsupported nrrd type " + name);
+    };
+
+    // format, element type, value count and data offset of a sample file
+    static Layout describe(const std::string &filename) {
+      Layout layout;
+      if (endsWith(filename, ".png")) {
+        layout.format = Format::PNG;
+        std::vector<unsigned char> pixels;
+        unsigned int w, h;
+        if (lodepng::decode(pixels, w, h, filename, LCT_GREY, 8)) {
+          throw std::runtime_error("could not decode " + filename);
+        }
+        layout.count = (size_t) w * h;
+      }
+      else if (endsWith(filename, ".nrrd")) {
+        layout.format = Format::NRRD;
+        std::ifstream in(filename, std::ios::binary);
+        std::string line;
+        if (!std::getline(in, line) || line.compare(0, 4, "NRRD") != 0) {
+          throw std::runtime_error(filename + " is not a nrrd file");
+        }
+        std::string encoding = "raw";
+        std::string endian = "little";
+        while (std::getline(in, line) && !line.empty() && line != "\r") {
+          size_t colon = line.find(':');
+          if (line[0] == '#' || colon == std::string::npos) {
+            continue;
+          }
+          std::string key = line.substr(0, colon);
+          size_t start = line.find_first_not_of(" \t", colon + 1);
+          std::string value = start == std::string::npos ? "" : line.substr(start);
+          value.erase(value.find_last_not_of(" \t\r") + 1);
+          if (key == "type") {
+            layout.type = nrrdType(value);
+          }
+          else if (key == "sizes") {
+            std::stringstream sizes(value);
+            size_t size;
+            layout.count = 1;
+            while (sizes >> size) {
+              layout.count *= size;
+            }
+          }
+          else if (key == "encoding") {
+            encoding = value;
+          }
+          else if (key == "endian") {
+            endian = value;
+          }
+          else if (key == "data file" || key == "datafile") {
+            throw std::runtime_error(filename + ": detached nrrd data is not supported");
+          }
+        }
+        if (encoding != "raw") {
+          throw std::runtime_error(filename + ": only raw encoded nrrd files can be streamed, not " + encoding);
+        }
+        if (endian != "little" && typeSize(layout.type) > 1) {
+          throw std::runtime_error(filename + ": big endian nrrd files are not supported");
+        }
+        layout.offset = in.tellg();
+      }
+      else {
+        layout.format = Format::Raw;
+        std::ifstream in(filename, std::ios::binary | std::ios::ate);
+        if (!in) {
+          throw std::runtime_error("could not open " + filename);
+        }
+        layout.count = (size_t) in.tellg() / sizeof(float);
+      }
+      return layout;
+    };
+
+    template <typename T>
+    static void convert(const char *values, size_t count, float *out) {
+      for (size_t i = 0; i < count; i++) {
+        T value;
+        std::memcpy(&value, values + i * sizeof(T), sizeof(T));
+        out[i] = (float) value;
+      }
+    };
+
+    void checkSize(const std::string &filename, size_t count) {
+      if (count != d) {
+        throw std::runtime_error(filename + " has " + std::to_string(count) +
+                                 " values, expected " + std::to_string(d));
+      }
+    };
+
+    void readSample(const std::string &filename, size_t dimFirst, size_t dimLast, float *out) {
+      if (endsWith(filename, ".png")) {
+        std::vector<unsigned char> pixels;
+        unsigned int w, h;
+        if (lodepng::decode(pixels, w, h, filename, LCT_GREY, 8)) {
+          throw std::runtime_error("could not decode " + filename);
+        }
+        checkSize(filename, (size_t) w * h);
+        std::copy(pixels.begin() + dimFirst, pixels.begin() + dimLast, out);
+        return;
+      }
+
+      Layout layout = describe(filename);
+      checkSize(filename, layout.count);
+      size_t count = dimLast - dimFirst;
+      int fd = ::open(filename.c_str(), O_RDONLY);
+      if (fd < 0) {
+        throw std::runtime_error("could not open " + filename);
+      }
+      size_t size = typeSize(layout.type);
+      std::vector<char> buffer(count * size);
+      try {
+        readAt(fd, buffer.data(), buffer.size(), layout.offset + dimFirst * size, filename);
+      } catch (...) {
+        ::close(fd);
+        throw;
+      }
+      ::close(fd);
+
+      switch (layout.type) {
+        case Type::UInt8: convert<uint8_t>(buffer.data(), count, out); break;
+        case Type::Int8: convert<int8_t>(buffer.data(), count, out); break;
+        case Type::UInt16: convert<uint16_t>(buffer.data(), count, out); break;
+        case Type::Int16: convert<int16_t>(buffer.data(), count, out); break;
+        case Type::UInt32: convert<uint32_t>(buffer.data(), count, out); break;
+        case Type::Int32: convert<int32_t>(buffer.data(), count, out); break;
+        case Type::Float: convert<float>(buffer.data(), count, out); break;
+        case Type::Double: convert<double>(buffer.data(), count, out); break;
+      }
+    };
+};
+
+#endif
@@ -1,10 +1,15 @@
 #ifndef WASSERSTEIN_H
 #define WASSERSTEIN_H
 
-#include "SVD.h"
+#include "flinalg/SVD.h"
 #include "SquaredEuclideanMetric.h"
+#include "utils/Parallel.h"
 
+#include <Eigen/Dense>
+#include <algorithm>
 #include <cmath>
+#include <stdexcept>
+#include <vector>
 
 template <typename TPrecision>
 class Wasserstein{
@@ -17,12 +22,12 @@ class Wasserstein{
     Wasserstein(){}; 
     ~Wasserstein(){};
 
-    TPrecision distance(FortranLinalg::DenseMatrix<TPrecision> U1,
-        FortranLinalg::DenseVector<TPrecision> S1,
-        FortranLinalg::DenseVector<TPrecision> C1,
-        FortranLinalg::DenseMatrix<TPrecision> U2,
-        FortranLinalg::DenseVector<TPrecision> S2,
-        FortranLinalg::DenseVector<TPrecision> C2){ 
+    TPrecision distance(FortranLinalg::DenseMatrix<TPrecision> &U1,
+        FortranLinalg::DenseVector<TPrecision> &S1,
+        FortranLinalg::DenseVector<TPrecision> &C1,
+        FortranLinalg::DenseMatrix<TPrecision> &U2,
+        FortranLinalg::DenseVector<TPrecision> &S2,
+        FortranLinalg::DenseVector<TPrecision> &C2){ 
       TPrecision md = metric.distance(C1, C2);
       TPrecision cd = covarianceDistSquared(U1, S1, U2, S2);
       return sqrt(md + cd);
@@ -31,10 +36,10 @@ class Wasserstein{
    
 
     //U eigenvectors, S variances of covariance matrices
-    TPrecision covarianceDistSquared(FortranLinalg::DenseMatrix<TPrecision> U1,
-        FortranLinalg::DenseVector<TPrecision> S1,
-        FortranLinalg::DenseMatrix<TPrecision> U2,
-        FortranLinalg::DenseVector<TPrecision> S2){
+    TPrecision covarianceDistSquared(FortranLinalg::DenseMatrix<TPrecision> &U1,
+        FortranLinalg::DenseVector<TPrecision> &S1,
+        FortranLinalg::DenseMatrix<TPrecision> &U2,
+        FortranLinalg::DenseVector<TPrecision> &S2){
         using namespace FortranLinalg;
       TPrecision ts1 = Linalg<TPrecision>::Sum(S1);
       TPrecision ts2 = Linalg<TPrecision>::Sum(S2);
@@ -88,8 +93,8 @@ class Wasserstein{
 
 
 
-    TPrecision covarianceDistSquared(FortranLinalg::DenseMatrix<TPrecision> Cov1,
-        FortranLinalg::DenseMatrix<TPrecision> Cov2){ 
+    TPrecision covarianceDistSquared(FortranLinalg::DenseMatrix<TPrecision> &Cov1,
+        FortranLinalg::DenseMatrix<TPrecision> &Cov2){ 
       using namespace FortranLinalg;
       
       SVD<TPrecision> svd1(Cov1);
@@ -106,7 +111,7 @@ class Wasserstein{
         svd2.U = U;
       }
   
-      TPrecision d = distance2(svd1.U, svd1.S, svd2.U, svd2.S);
+      TPrecision d = covarianceDistSquared(svd1.U, svd1.S, svd2.U, svd2.S);
 
       svd1.deallocate();
       svd2.deallocate();
@@ -121,10 +126,10 @@ class Wasserstein{
 
 
     //U eigenvectors, S variances of covariance matrices
-    FortranLinalg::DenseMatrix<TPrecision> covarianceMap(FortranLinalg::DenseMatrix<TPrecision> U1,
-        FortranLinalg::DenseVector<TPrecision> S1,
-        FortranLinalg::DenseMatrix<TPrecision> U2,
-        FortranLinalg::DenseVector<TPrecision> S2){
+    FortranLinalg::DenseMatrix<TPrecision> covarianceMap(FortranLinalg::DenseMatrix<TPrecision> &U1,
+        FortranLinalg::DenseVector<TPrecision> &S1,
+        FortranLinalg::DenseMatrix<TPrecision> &U2,
+        FortranLinalg::DenseVector<TPrecision> &S2){
       
       using namespace FortranLinalg;
       TPrecision ts1 = Linalg<TPrecision>::Sum(S1);
@@ -185,6 +190,126 @@ class Wasserstein{
 
 
 
-    
+    // Gaussian summary N(mean, U diag(S) U') of the columns of X listed in
+    // indices, keeping the rank largest variances (all if rank is 0). The
+    // eigenvectors come from the smaller of the d x d covariance and the
+    // n x n Gram matrix of the centered samples. Caller deallocates.
+    static void summarize(FortranLinalg::DenseMatrix<TPrecision> &X, const std::vector<unsigned int> &indices,
+        unsigned int rank, FortranLinalg::DenseVector<TPrecision> &mean,
+        FortranLinalg::DenseMatrix<TPrecision> &U, FortranLinalg::DenseVector<TPrecision> &S){
+      typedef Eigen::MatrixXd EMatrix;
+      unsigned int d = X.M();
+      unsigned int n = indices.size();
+      EMatrix Xc(d, n);
+      for(unsigned int j=0; j<n; j++){
+        Xc.col(j) = Eigen::Map<Eigen::Matrix<TPrecision, Eigen::Dynamic, 1>>(
+            X.data() + (size_t) indices[j] * d, d).template cast<double>();
+      }
+      Eigen::VectorXd m = n > 0 ? Eigen::VectorXd(Xc.rowwise().mean()) : Eigen::VectorXd::Zero(d);
+      Xc.colwise() -= m;
+
+      // eigenpairs in decreasing order, as variances of the samples
+      Eigen::VectorXd values;
+      EMatrix vectors;
+      double scale = 1.0 / std::max(1u, n - 1);
+      if(d <= n){
+        Eigen::SelfAdjointEigenSolver<EMatrix> eig(scale * Xc * Xc.transpose());
+        values = eig.eigenvalues().reverse();
+        vectors = eig.eigenvectors().rowwise().reverse();
+      }
+      else{
+        Eigen::SelfAdjointEigenSolver<EMatrix> eig(scale * Xc.transpose() * Xc);
+        values = eig.eigenvalues().reverse();
+        vectors = Xc * eig.eigenvectors().rowwise().reverse();
+        for(long i=0; i<vectors.cols(); i++){
+          double norm = vectors.col(i).norm();
+          vectors.col(i) /= norm > 0 ? norm : 1;
+        }
+      }
+
+      unsigned int k = 0;
+      unsigned int maxRank = rank == 0 ? values.size() : std::min<unsigned int>(rank, values.size());
+      while(k < maxRank && values(k) > 1e-12 * std::max(1.0, values(0))){
+        k++;
+      }
+      mean = FortranLinalg::DenseVector<TPrecision>(d);
+      U = FortranLinalg::DenseMatrix<TPrecision>(d, k);
+      S = FortranLinalg::DenseVector<TPrecision>(k);
+      for(unsigned int i=0; i<d; i++){
+        mean(i) = m(i);
+      }
+      for(unsigned int j=0; j<k; j++){
+        S(j) = values(j);
+        for(unsigned int i=0; i<d; i++){
+          U(i, j) = vectors(i, j);
+        }
+      }
+    };
+
+
+
+    // Wasserstein-2 distances between all pairs of Gaussian summaries
+    // N(means[i], U[i] diag(S[i]) U[i]'), U[i] with orthonormal columns. With
+    // B = U diag(sqrt(S)) the covariance term tr((C1^1/2 C2 C1^1/2)^1/2) is
+    // the sum of the singular values of B1'B2, so each B and trace is formed
+    // once and every row of the matrix is a single product against the
+    // stacked factors of the remaining summaries. Rows run in parallel.
+    static FortranLinalg::DenseMatrix<TPrecision> distances(
+        std::vector<FortranLinalg::DenseVector<TPrecision>> &means,
+        std::vector<FortranLinalg::DenseMatrix<TPrecision>> &U,
+        std::vector<FortranLinalg::DenseVector<TPrecision>> &S){
+      typedef Eigen::MatrixXd EMatrix;
+      unsigned int n = means.size();
+      if(U.size() != n || S.size() != n){
+        throw std::runtime_error("Wasserstein: means, eigenvectors and variances differ in count");
+      }
+      unsigned int d = n > 0 ? means[0].N() : 0;
+
+      // factors stacked column wise, summary i at columns offsets[i]
+      std::vector<long> offsets(n + 1, 0);
+      for(unsigned int i=0; i<n; i++){
+        if(means[i].N() != d || (U[i].N() > 0 && U[i].M() != d) || U[i].N() != S[i].N()){
+          throw std::runtime_error("Wasserstein: summary " + std::to_string(i) + " has inconsistent dimensions");
+        }
+        offsets[i + 1] = offsets[i] + U[i].N();
+      }
+      EMatrix B(d, offsets[n]);
+      EMatrix M(d, n);
+      std::vector<double> traces(n, 0);
+      for(unsigned int i=0; i<n; i++){
+        for(unsigned int j=0; j<U[i].N(); j++){
+          double s = std::max<double>(S[i](j), 0);
+          traces[i] += s;
+          for(unsigned int k=0; k<d; k++){
+            B(k, offsets[i] + j) = U[i](k, j) * std::sqrt(s);
+          }
+        }
+        for(unsigned int k=0; k<d; k++){
+          M(k, i) = means[i](k);
+        }
+      }
+
+      FortranLinalg::DenseMatrix<TPrecision> D(n, n);
+      Parallel::forEach(0, n, [&](long i) {
+          long ki = U[i].N();
+          EMatrix G = B.middleCols(offsets[i], ki).transpose() * B.rightCols(offsets[n] - offsets[i]);
+          for(unsigned int j=i; j<n; j++){
+            long kj = U[j].N();
+            double tc = 0;
+            if(ki > 0 && kj > 0){
+              auto Bij = G.middleCols(offsets[j] - offsets[i], kj);
+              EMatrix A = ki <= kj ? EMatrix(Bij * Bij.transpose()) : EMatrix(Bij.transpose() * Bij);
+              Eigen::SelfAdjointEigenSolver<EMatrix> eig(A, Eigen::EigenvaluesOnly);
+              for(long e=0; e<eig.eigenvalues().size(); e++){
+                tc += std::sqrt(std::max(0.0, eig.eigenvalues()(e)));
+              }
+            }
+            double d2 = (M.col(i) - M.col(j)).squaredNorm() + traces[i] + traces[j] - 2 * tc;
+            D(i, j) = D(j, i) = i == j ? 0 : std::sqrt(std::max(0.0, d2));
+          }
+        }, 1);
+      return D;
+    };
+
 };
 #endif
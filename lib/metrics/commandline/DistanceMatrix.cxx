@@ -0,0 +1,79 @@
+#include "metrics/BlockedDistance.h"
+#include "metrics/SampleSource.h"
+#include "utils/Parallel.h"
+#include <tclap/CmdLine.h>
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+
+using Clock = std::chrono::steady_clock;
+
+int main(int argc, char **argv) {
+  TCLAP::CmdLine cmd("Pairwise distances between samples streamed from disk, written in the server's binary distance format", ' ', "1");
+
+  TCLAP::ValueArg<std::string> matrixArg("i", "input", "Samples as the columns of a float32 .bin matrix (with .bin.dims)",
+      false, "", "filename");
+  cmd.add(matrixArg);
+
+  TCLAP::ValueArg<std::string> listArg("l", "list", "Text file listing one sample file (.png, raw .nrrd or float32 .bin) per line",
+      false, "", "filename");
+  cmd.add(listArg);
+
+  TCLAP::ValueArg<std::string> outArg("o", "output", "Output distance matrix (.bin, a .bin.dims is written next to it)",
+      true, "", "filename");
+  cmd.add(outArg);
+
+  TCLAP::ValueArg<std::string> metricArg("m", "metric", "euclidean, l1, hamming or cosine", false, "euclidean", "string");
+  cmd.add(metricArg);
+
+  TCLAP::ValueArg<int> tileArg("t", "tile", "Number of samples per tile", false, 512, "integer");
+  cmd.add(tileArg);
+
+  TCLAP::ValueArg<int> memoryArg("b", "budget", "Memory for the two sample tiles in MB, sets how many dimensions are read at once",
+      false, 1024, "integer");
+  cmd.add(memoryArg);
+
+  TCLAP::SwitchArg packedArg("p", "packed", "Samples are binary masks (nonzero is set): bit pack them and count hamming distances with popcount",
+      false);
+  cmd.add(packedArg);
+
+  try {
+    cmd.parse(argc, argv);
+  } catch (TCLAP::ArgException &e) {
+    std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+    return -1;
+  }
+
+  if (matrixArg.getValue().empty() == listArg.getValue().empty()) {
+    std::cerr << "error: specify exactly one of --input and --list" << std::endl;
+    return -1;
+  }
+
+  try {
+    std::unique_ptr<SampleSource> source;
+    if (!matrixArg.getValue().empty()) {
+      source.reset(new MatrixFileSource(matrixArg.getValue()));
+    }
+    else {
+      source.reset(new FileListSource(listArg.getValue()));
+    }
+    std::cout << source->N() << " samples of dimension " << source->D() << ", "
+              << Parallel::threadCount() << " threads" << std::endl;
+
+    BlockedDistance distance(BlockedDistance::parseType(metricArg.getValue()), tileArg.getValue(),
+                             (size_t) memoryArg.getValue() << 20, packedArg.getValue());
+    auto start = Clock::now();
+    distance.compute(*source, outArg.getValue(), [](size_t done, size_t total) {
+        std::cout << "tile pair " << done << " of " << total << "\r" << std::flush;
+      });
+    std::cout << std::endl << "done in "
+              << std::chrono::duration<double>(Clock::now() - start).count() << "s" << std::endl;
+  } catch (std::exception &e) {
+    std::cerr << "error: " << e.what() << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,110 @@
+#include "flinalg/DenseMatrix.h"
+#include "metrics/Distance.h"
+#include "utils/MinHeap.h"
+#include "utils/Parallel.h"
+#include "dataset/Precision.h"
+#include <tclap/CmdLine.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace FortranLinalg;
+using Clock = std::chrono::steady_clock;
+
+// Reference: full MinHeap over all n entries per row, serial (previous findKNN).
+void heapKNN(DenseMatrix<Precision> &d, DenseMatrix<int> &knn, DenseMatrix<Precision> &dists) {
+  Precision *distances = new Precision[d.N()];
+  for (unsigned int i = 0; i < d.N(); i++) {
+    for (unsigned int j = 0; j < d.N(); j++) {
+      distances[j] = (i == j) ? std::numeric_limits<Precision>::max() : d(j, i);
+    }
+    MinHeap<Precision> minHeap(distances, d.N());
+    for (unsigned int j = 0; j < knn.M(); j++) {
+      knn(j, i) = minHeap.getRootIndex();
+      dists(j, i) = minHeap.extractRoot();
+    }
+  }
+  delete[] distances;
+}
+
+double seconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+  TCLAP::CmdLine cmd("Benchmark k-nearest-neighbor selection from a distance matrix", ' ', "1");
+
+  TCLAP::ValueArg<std::string> nArg("n", "sizes", "Comma separated sample counts (an n x n float matrix is allocated)",
+      false, "1000,5000,10000,20000,50000", "list");
+  cmd.add(nArg);
+
+  TCLAP::ValueArg<int> kArg("k", "knn", "Number of nearest neighbors", false, 15, "integer");
+  cmd.add(kArg);
+
+  TCLAP::ValueArg<int> dArg("d", "dim", "Dimension of the random samples", false, 10, "integer");
+  cmd.add(dArg);
+
+  TCLAP::SwitchArg skipArg("s", "skip-reference", "Do not time the serial full-heap reference", false);
+  cmd.add(skipArg);
+
+  try {
+    cmd.parse(argc, argv);
+  } catch (TCLAP::ArgException &e) {
+    std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+    return -1;
+  }
+
+  std::vector<unsigned int> sizes;
+  std::stringstream ss(nArg.getValue());
+  for (std::string item; std::getline(ss, item, ',');) {
+    sizes.push_back(std::atoi(item.c_str()));
+  }
+
+  std::cout << "threads: " << Parallel::threadCount() << std::endl;
+  std::cout << "n\tk\treference(s)\tfindKNN(s)\tspeedup\tmismatches" << std::endl;
+  for (unsigned int n : sizes) {
+    int k = std::min<int>(kArg.getValue(), n - 1);
+    DenseMatrix<Precision> X(dArg.getValue(), n);
+    for (unsigned long i = 0; i < (unsigned long) X.M() * n; i++) {
+      X.data()[i] = std::rand() / (Precision) RAND_MAX;
+    }
+    DenseMatrix<Precision> D = Distance<Precision>::computeEuclideanDistances(X);
+    X.deallocate();
+
+    DenseMatrix<int> knn(k, n);
+    DenseMatrix<Precision> knnd(k, n);
+    auto start = Clock::now();
+    Distance<Precision>::findKNN(D, knn, knnd);
+    double tNew = seconds(start);
+
+    double tRef = 0;
+    int mismatches = 0;
+    if (!skipArg.getValue()) {
+      DenseMatrix<int> knnRef(k, n);
+      DenseMatrix<Precision> knndRef(k, n);
+      start = Clock::now();
+      heapKNN(D, knnRef, knndRef);
+      tRef = seconds(start);
+      // neighbors and distances must agree, ties included
+      for (unsigned int i = 0; i < n; i++) {
+        for (int j = 0; j < k; j++) {
+          mismatches += knn(j, i) != knnRef(j, i) || knnd(j, i) != knndRef(j, i);
+        }
+      }
+      knnRef.deallocate();
+      knndRef.deallocate();
+    }
+
+    std::cout << n << "\t" << k << "\t" << tRef << "\t" << tNew << "\t"
+              << (tRef > 0 ? tRef / tNew : 0) << "\t" << mismatches << std::endl;
+
+    D.deallocate();
+    knn.deallocate();
+    knnd.deallocate();
+  }
+
+  return 0;
+}
@@ -0,0 +1,76 @@
+#include "flinalg/DenseMatrix.h"
+#include "metrics/MeshDistance.h"
+#include "utils/IO.h"
+#include "utils/Parallel.h"
+#include <tclap/CmdLine.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace FortranLinalg;
+using Clock = std::chrono::steady_clock;
+
+int main(int argc, char **argv) {
+  TCLAP::CmdLine cmd("Vertex L2 distances between corresponded meshes, written in the server's binary distance format", ' ', "1");
+
+  TCLAP::ValueArg<std::string> listArg("l", "list", "Text file listing one mesh (.ply or .obj) per line, in sample order",
+      true, "", "filename");
+  cmd.add(listArg);
+
+  TCLAP::ValueArg<std::string> outArg("o", "output", "Output distance matrix (.bin, a .bin.dims is written next to it)",
+      true, "", "filename");
+  cmd.add(outArg);
+
+  TCLAP::ValueArg<std::string> verticesArg("v", "vertices", "Also write the (aligned) vertices, one mesh per column (.bin)",
+      false, "", "filename");
+  cmd.add(verticesArg);
+
+  TCLAP::SwitchArg procrustesArg("p", "procrustes", "Rigidly align all meshes to their mean shape first", false);
+  cmd.add(procrustesArg);
+
+  TCLAP::SwitchArg scalingArg("s", "scaling", "Allow a uniform scale in the Procrustes alignment", false);
+  cmd.add(scalingArg);
+
+  try {
+    cmd.parse(argc, argv);
+  } catch (TCLAP::ArgException &e) {
+    std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+    return -1;
+  }
+
+  try {
+    std::string listFile = listArg.getValue();
+    std::string base = listFile.find('/') == std::string::npos ? "" : listFile.substr(0, listFile.find_last_of('/') + 1);
+    std::vector<std::string> files;
+    for (auto &line : IO::readStringList(listFile)) {
+      line.erase(line.find_last_not_of(" \t\r") + 1);
+      if (!line.empty()) {
+        files.push_back(line[0] == '/' ? line : base + line);
+      }
+    }
+
+    auto start = Clock::now();
+    DenseMatrix<float> V = MeshDistance<float>::loadVertices(files);
+    std::cout << "loaded " << V.N() << " meshes of " << V.M() / 3 << " vertices in "
+              << std::chrono::duration<double>(Clock::now() - start).count() << "s ("
+              << Parallel::threadCount() << " threads)" << std::endl;
+
+    start = Clock::now();
+    DenseMatrix<float> D = MeshDistance<float>::computeDistances(V, procrustesArg.getValue(), scalingArg.getValue());
+    std::cout << "distances in " << std::chrono::duration<double>(Clock::now() - start).count() << "s" << std::endl;
+
+    IO::writeBinMatrix(outArg.getValue(), D.data(), D.M(), D.N());
+    if (!verticesArg.getValue().empty()) {
+      IO::writeBinMatrix(verticesArg.getValue(), V.data(), V.M(), V.N());
+    }
+    V.deallocate();
+    D.deallocate();
+  } catch (std::exception &e) {
+    std::cerr << "error: " << e.what() << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,124 @@
+#include "flinalg/DenseMatrix.h"
+#include "metrics/BatchMetric.h"
+#include "metrics/Distance.h"
+#include "metrics/EuclideanMetric.h"
+#include "metrics/L1Metric.h"
+#include "metrics/MahalanobisMetric.h"
+#include "metrics/SquaredEuclideanMetric.h"
+#include "utils/Parallel.h"
+#include <tclap/CmdLine.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace FortranLinalg;
+using Clock = std::chrono::steady_clock;
+
+double seconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Per pair cost of the virtual Metric path (the loop of
+// Distance::computeDistances, serial), of the serial batch path and of the
+// parallel batch Distance::computeDistances, with the largest difference
+// between the virtual and batch distances.
+template <typename TMetric>
+void run(const std::string &name, DenseMatrix<float> &X, Metric<float> &metric,
+         const BatchMetric<TMetric, float> &batch) {
+  unsigned int n = X.N();
+  double pairs = (double) n * n;
+
+  DenseMatrix<float> reference(n, n);
+  auto start = Clock::now();
+  for (unsigned int i = 0; i < n; i++) {
+    for (unsigned int j = 0; j < n; j++) {
+      reference(i, j) = metric.distance(X, i, X, j);
+    }
+  }
+  double tVirtual = seconds(start);
+
+  std::vector<float> block((size_t) n * n);
+  start = Clock::now();
+  static_cast<const TMetric &>(batch).blockToBlock(X.data(), n, X.data(), n, X.M(), block.data());
+  double tBatch = seconds(start);
+
+  start = Clock::now();
+  DenseMatrix<float> D = Distance<float>::computeDistances(X, batch);
+  double tParallel = seconds(start);
+
+  double error = 0;
+  for (size_t i = 0; i < (size_t) n * n; i++) {
+    error = std::max(error, (double) std::fabs(block[i] - reference.data()[i]));
+    error = std::max(error, (double) std::fabs(D.data()[i] - reference.data()[i]));
+  }
+
+  std::cout << name << "\t" << n << "\t" << X.M() << "\t" << 1e9 * tVirtual / pairs << "\t"
+            << 1e9 * tBatch / pairs << "\t" << 1e9 * tParallel / pairs << "\t"
+            << tVirtual / tBatch << "\t" << error << std::endl;
+  reference.deallocate();
+  D.deallocate();
+}
+
+int main(int argc, char **argv) {
+  TCLAP::CmdLine cmd("Benchmark the per pair cost of the virtual Metric against the batch metrics", ' ', "1");
+
+  TCLAP::ValueArg<std::string> nArg("n", "sizes", "Comma separated sample counts", false, "1000,4000", "list");
+  cmd.add(nArg);
+
+  TCLAP::ValueArg<std::string> dArg("d", "dims", "Comma separated sample dimensions", false, "3,16,128", "list");
+  cmd.add(dArg);
+
+  TCLAP::ValueArg<int> pArg("p", "projection", "Columns of the random Mahalanobis weight matrix", false, 8, "integer");
+  cmd.add(pArg);
+
+  try {
+    cmd.parse(argc, argv);
+  } catch (TCLAP::ArgException &e) {
+    std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+    return -1;
+  }
+
+  auto parseList = [](const std::string &list) {
+    std::vector<unsigned int> values;
+    std::stringstream ss(list);
+    for (std::string item; std::getline(ss, item, ',');) {
+      values.push_back(std::atoi(item.c_str()));
+    }
+    return values;
+  };
+
+  std::cout << "threads: " << Parallel::threadCount() << std::endl;
+  std::cout << "metric\tn\td\tvirtual(ns/pair)\tbatch(ns/pair)\tparallel batch(ns/pair)\tspeedup\tmax error" << std::endl;
+  for (unsigned int n : parseList(nArg.getValue())) {
+    for (unsigned int d : parseList(dArg.getValue())) {
+      DenseMatrix<float> X(d, n);
+      for (size_t i = 0; i < (size_t) d * n; i++) {
+        X.data()[i] = std::rand() / (float) RAND_MAX;
+      }
+      DenseMatrix<float> W(d, pArg.getValue());
+      for (size_t i = 0; i < (size_t) W.M() * W.N(); i++) {
+        W.data()[i] = std::rand() / (float) RAND_MAX;
+      }
+
+      EuclideanMetric<float> euclidean;
+      run("euclidean", X, euclidean, BatchEuclidean<float>());
+      SquaredEuclideanMetric<float> squared;
+      run("sqeuclidean", X, squared, BatchSquaredEuclidean<float>());
+      L1Metric<float> l1;
+      run("l1", X, l1, BatchL1<float>());
+      MahalanobisMetric<float> mahalanobis(W);
+      run("mahalanobis", X, mahalanobis, BatchMahalanobis<float>(W));
+
+      W.deallocate();
+      X.deallocate();
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,425 @@
+#ifndef INCREMENTALMSCOMPLEX_H
+#define INCREMENTALMSCOMPLEX_H
+
+#include "flinalg/DenseMatrix.h"
+#include "flinalg/DenseVector.h"
+#include "metrics/BatchMetric.h"
+#include "metrics/Distance.h"
+#include "utils/Parallel.h"
+#include "NNMSComplex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/**
+ * Morse-Smale complex of a growing set of samples, e.g. of an adaptive
+ * sampling campaign that adds a few runs at a time. The knn graph, the
+ * steepest ascending/descending neighbors and the extrema every sample flows
+ * to are kept, and inserting samples only updates them where they change:
+ *  - the knn of the new samples, and of the old samples that get a new
+ *    sample among their knn, from the distances to the new samples only;
+ *  - the steepest neighbors of the samples whose neighborhood (or, with
+ *    smoothing, the smoothed value of a neighbor) changed;
+ *  - the extrema of the samples whose steepest path passes through a sample
+ *    with a new steepest neighbor.
+ * complex() derives the persistence hierarchy from the flow without any
+ * neighbor search and equals the complex computed from scratch on all
+ * samples.
+ */
+template <typename TPrecision>
+class IncrementalMSComplex {
+  public:
+    // Squared Euclidean neighbors of the columns of X including the sample
+    // itself, as NNMSComplex(X, y, knn, smooth, eps, sigma2) with a brute
+    // force search; knn must not exceed the number of samples
+    static IncrementalMSComplex fromSamples(FortranLinalg::DenseMatrix<TPrecision> &X,
+                                            FortranLinalg::DenseVector<TPrecision> &y,
+                                            int knn, bool smooth = false, double sigma2 = 0) {
+      if (knn < 1 || knn > (int) X.N()) {
+        throw std::runtime_error("IncrementalMSComplex: knn must be in [1, " + std::to_string(X.N()) + "]");
+      }
+      IncrementalMSComplex complex(true, X.M(), knn, smooth, sigma2);
+      FortranLinalg::DenseMatrix<int> KNN(knn, X.N());
+      FortranLinalg::DenseMatrix<TPrecision> KNND(knn, X.N());
+      Distance<TPrecision>::computeKNN(X, KNN, KNND, BatchSquaredEuclidean<TPrecision>());
+      complex.X.assign(X.data(), X.data() + (size_t) X.M() * X.N());
+      complex.initialize(KNN, KNND, y);
+      KNN.deallocate();
+      KNND.deallocate();
+      return complex;
+    };
+
+    // Neighbors from a full distance matrix excluding the sample itself, as
+    // NNMSComplex(distances, y, knn, smooth, sigma2, true); knn must be
+    // smaller than the number of samples
+    static IncrementalMSComplex fromDistances(FortranLinalg::DenseMatrix<TPrecision> &distances,
+                                              FortranLinalg::DenseVector<TPrecision> &y,
+                                              int knn, bool smooth = false, double sigma2 = 0) {
+      if (knn < 1 || knn >= (int) distances.N()) {
+        throw std::runtime_error("IncrementalMSComplex: knn must be in [1, " + std::to_string(distances.N()) + ")");
+      }
+      IncrementalMSComplex complex(false, 0, knn, smooth, sigma2);
+      FortranLinalg::DenseMatrix<int> KNN(knn, distances.N());
+      FortranLinalg::DenseMatrix<TPrecision> KNND(knn, distances.N());
+      Distance<TPrecision>::findKNN(distances, KNN, KNND);
+      complex.initialize(KNN, KNND, y);
+      KNN.deallocate();
+      KNND.deallocate();
+      return complex;
+    };
+
+    unsigned int N() const { return y.size(); };
+    int k() const { return knn; };
+
+    // function value of every sample, as inserted
+    const std::vector<TPrecision> &values() const { return y; };
+
+    // Adds the columns of Xnew with function values ynew to a complex built
+    // fromSamples. Returns the number of samples whose steepest neighbors
+    // were recomputed.
+    unsigned int insertSamples(FortranLinalg::DenseMatrix<TPrecision> &Xnew, FortranLinalg::DenseVector<TPrecision> &ynew) {
+      if (!coordinates || Xnew.M() != dimension) {
+        throw std::runtime_error("IncrementalMSComplex: samples need a complex of samples of the same dimension");
+      }
+      if (Xnew.N() != ynew.N()) {
+        throw std::runtime_error("IncrementalMSComplex: " + std::to_string(Xnew.N()) + " samples with " +
+                                 std::to_string(ynew.N()) + " values");
+      }
+      unsigned int n0 = N();
+      X.insert(X.end(), Xnew.data(), Xnew.data() + (size_t) Xnew.M() * Xnew.N());
+      BatchSquaredEuclidean<TPrecision> metric;
+      // distances of the new samples to all samples, one column per new sample
+      std::vector<TPrecision> d((size_t) (n0 + Xnew.N()) * Xnew.N());
+      Parallel::forEach(0, Xnew.N(), [&](long j) {
+        metric.toColumns(X.data() + (size_t) (n0 + j) * dimension, X.data(), dimension, n0 + Xnew.N(),
+                         d.data() + (size_t) j * (n0 + Xnew.N()));
+      });
+      return insert(ynew, [&](unsigned int j, unsigned int i) { return d[(size_t) j * (n0 + Xnew.N()) + i]; });
+    };
+
+    // Adds samples with function values ynew to a complex built
+    // fromDistances. Column j of distances holds the distances of all
+    // N() + ynew.N() samples, the existing ones first, to new sample j.
+    // Returns the number of samples whose steepest neighbors were recomputed.
+    unsigned int insertDistances(FortranLinalg::DenseMatrix<TPrecision> &distances,
+                                 FortranLinalg::DenseVector<TPrecision> &ynew) {
+      if (coordinates) {
+        throw std::runtime_error("IncrementalMSComplex: distances need a complex of distances");
+      }
+      if (distances.N() != ynew.N() || distances.M() != N() + ynew.N()) {
+        throw std::runtime_error("IncrementalMSComplex: distances must be " + std::to_string(N() + ynew.N()) +
+                                 " x " + std::to_string(ynew.N()));
+      }
+      return insert(ynew, [&](unsigned int j, unsigned int i) { return distances(i, j); });
+    };
+
+    // Maps the function value y of every sample to scale * y + offset, e.g.
+    // when a normalized field is normalized over a new range. A positive
+    // scale keeps the order of all gradients, and smoothing is a weighted
+    // mean, so the flow is kept and nothing is recomputed.
+    void rescale(TPrecision scale, TPrecision offset) {
+      if (!(scale > 0)) {
+        throw std::runtime_error("IncrementalMSComplex: rescaling needs a positive scale");
+      }
+      for (auto *values : {&y, &ys}) {
+        for (auto &value : *values) {
+          value = scale * value + offset;
+        }
+      }
+    };
+
+    // Complex of all samples so far. It refers to function values owned by
+    // this object that stay valid until the next call.
+    std::unique_ptr<NNMSComplex<TPrecision>> complex() {
+      FortranLinalg::DenseMatrix<int> KNN(knn, N());
+      FortranLinalg::DenseMatrix<int> KNNG(2, N());
+      std::copy(neighbors.begin(), neighbors.end(), KNN.data());
+      std::copy(steepest.begin(), steepest.end(), KNNG.data());
+      complexValues.deallocate();
+      complexValues = FortranLinalg::DenseVector<TPrecision>(N());
+      std::copy(ys.begin(), ys.end(), complexValues.data());
+      std::unique_ptr<NNMSComplex<TPrecision>> msComplex(
+          new NNMSComplex<TPrecision>(KNN, complexValues, KNNG, root[0], root[1]));
+      KNN.deallocate();
+      KNNG.deallocate();
+      return msComplex;
+    };
+
+    void deallocate() {
+      complexValues.deallocate();
+    };
+
+  private:
+    IncrementalMSComplex(bool coordinates, unsigned int dimension, int knn, bool smooth, double sigma2)
+        : coordinates(coordinates), dimension(dimension), knn(knn), smooth(smooth), sigma2(sigma2) {};
+
+    typedef std::pair<TPrecision, int> Neighbor;
+
+    void initialize(FortranLinalg::DenseMatrix<int> &KNN, FortranLinalg::DenseMatrix<TPrecision> &KNND,
+                    FortranLinalg::DenseVector<TPrecision> &yin) {
+      if (yin.N() != KNN.N()) {
+        throw std::runtime_error("IncrementalMSComplex: field size differs from the number of samples");
+      }
+      unsigned int n = KNN.N();
+      neighbors.assign(KNN.data(), KNN.data() + (size_t) knn * n);
+      distances.assign(KNND.data(), KNND.data() + (size_t) knn * n);
+      y.assign(yin.data(), yin.data() + n);
+      ys = y;
+      reverse.assign(n, std::vector<size_t>());
+      for (size_t e = 0; e < neighbors.size(); e++) {
+        reverse[neighbors[e]].push_back(e);
+      }
+      steepest.assign(2 * (size_t) n, -1);
+      for (int e = 0; e < 2; e++) {
+        root[e].assign(n, -1);
+        upstream[e].assign(n, std::vector<int>());
+      }
+      std::vector<int> all(n);
+      for (unsigned int i = 0; i < n; i++) {
+        all[i] = i;
+      }
+      smoothRows(all);
+      updateFlow(all);
+    };
+
+    // Inserts the samples with values ynew given the distance(j, i) of new
+    // sample j to sample i, for all samples i including the new ones
+    template <typename DistanceFn>
+    unsigned int insert(FortranLinalg::DenseVector<TPrecision> &ynew, DistanceFn distance) {
+      unsigned int n0 = N();
+      unsigned int nNew = ynew.N();
+      unsigned int n = n0 + nNew;
+      y.insert(y.end(), ynew.data(), ynew.data() + nNew);
+      ys.insert(ys.end(), ynew.data(), ynew.data() + nNew);
+      neighbors.resize((size_t) knn * n);
+      distances.resize((size_t) knn * n);
+      reverse.resize(n);
+      steepest.resize(2 * (size_t) n, -1);
+      for (int e = 0; e < 2; e++) {
+        root[e].resize(n, -1);
+        upstream[e].resize(n);
+      }
+
+      // knn of the new samples, ordered by (distance, index) as by Distance
+      Parallel::forEach(n0, n, [&](long i) {
+        std::vector<Neighbor> heap;
+        for (unsigned int j = 0; j < n; j++) {
+          if (j == i && !coordinates) {
+            continue;
+          }
+          Neighbor candidate(distance(i - n0, j), j);
+          if ((int) heap.size() < knn) {
+            heap.push_back(candidate);
+            std::push_heap(heap.begin(), heap.end());
+          }
+          else if (candidate < heap.front()) {
+            std::pop_heap(heap.begin(), heap.end());
+            heap.back() = candidate;
+            std::push_heap(heap.begin(), heap.end());
+          }
+        }
+        std::sort_heap(heap.begin(), heap.end());
+        for (int k = 0; k < knn; k++) {
+          neighbors[(size_t) i * knn + k] = heap[k].second;
+          distances[(size_t) i * knn + k] = heap[k].first;
+        }
+      }, 16);
+
+      // existing samples that get a new sample among their knn; distances
+      // are symmetric so distance(j, i) is also the distance of i to j
+      std::vector<std::vector<int>> previous(n0);
+      Parallel::forEach(0, n0, [&](long i) {
+        int *row = neighbors.data() + (size_t) i * knn;
+        TPrecision *rowd = distances.data() + (size_t) i * knn;
+        for (unsigned int j = 0; j < nNew; j++) {
+          Neighbor candidate(distance(j, i), n0 + j);
+          if (!(candidate < Neighbor(rowd[knn - 1], row[knn - 1]))) {
+            continue;
+          }
+          if (previous[i].empty()) {
+            previous[i].assign(row, row + knn);
+          }
+          int k = knn - 1;
+          for (; k > 0 && candidate < Neighbor(rowd[k - 1], row[k - 1]); k--) {
+            row[k] = row[k - 1];
+            rowd[k] = rowd[k - 1];
+          }
+          row[k] = candidate.second;
+          rowd[k] = candidate.first;
+        }
+      }, 256);
+
+      // reverse edges of the changed rows: their old edges are dropped and
+      // all their edges added again, as slots may have moved
+      std::vector<int> changed;
+      std::vector<int> touched;
+      for (unsigned int i = 0; i < n; i++) {
+        if (i < n0 && previous[i].empty()) {
+          continue;
+        }
+        changed.push_back(i);
+        touched.push_back(i);
+        size_t first = (size_t) i * knn;
+        if (i < n0) {
+          for (int j : previous[i]) {
+            std::vector<size_t> &into = reverse[j];
+            into.erase(std::lower_bound(into.begin(), into.end(), first));
+            touched.push_back(j);
+          }
+        }
+        for (size_t e = first; e < first + knn; e++) {
+          std::vector<size_t> &into = reverse[neighbors[e]];
+          into.insert(std::lower_bound(into.begin(), into.end(), e), e);
+          touched.push_back(neighbors[e]);
+        }
+      }
+
+      // with smoothing the changed rows have new smoothed values, which
+      // changes the gradients of all their edges
+      if (smooth) {
+        smoothRows(changed);
+        for (int i : changed) {
+          for (size_t e = (size_t) i * knn; e < (size_t) (i + 1) * knn; e++) {
+            touched.push_back(neighbors[e]);
+          }
+          for (size_t e : reverse[i]) {
+            touched.push_back(e / knn);
+          }
+        }
+      }
+
+      std::sort(touched.begin(), touched.end());
+      touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+      updateFlow(touched);
+      return touched.size();
+    };
+
+    // smoothed values of the given rows, as NNMSComplex::runMS
+    void smoothRows(const std::vector<int> &rows) {
+      if (!smooth) {
+        return;
+      }
+      Parallel::forEach(0, rows.size(), [&](long r) {
+        int i = rows[r];
+        TPrecision value = 0;
+        double wsum = 0;
+        for (int k = 0; k < knn; k++) {
+          double w = exp( -distances[(size_t) i * knn + k] / sigma2 );
+          value += w * y[neighbors[(size_t) i * knn + k]];
+          wsum += w;
+        }
+        ys[i] = value / wsum;
+      }, 1024);
+    };
+
+    // Recomputes the steepest neighbors of the given samples and the
+    // extrema of all samples that flow through one that changed
+    void updateFlow(const std::vector<int> &rows) {
+      std::vector<int> next(2 * rows.size());
+      Parallel::forEach(0, rows.size(), [&](long r) {
+        int i = rows[r];
+        NNMSComplex<TPrecision>::steepestNeighbors(i, knn, reverse[i].data(), reverse[i].size(),
+            [&](size_t e) { return neighbors[e]; },
+            [&](size_t e) { return NNMSComplex<TPrecision>::edgeGradient(ys[e / knn], ys[neighbors[e]], distances[e]); },
+            next[2 * r], next[2 * r + 1]);
+      }, 1024);
+
+      std::vector<int> state(N(), 0);
+      std::vector<int> dirty;
+      std::vector<int> path;
+      for (int e = 0; e < 2; e++) {
+        dirty.clear();
+        for (unsigned int r = 0; r < rows.size(); r++) {
+          int i = rows[r];
+          int &current = steepest[2 * (size_t) i + e];
+          if (current == next[2 * r + e] && root[e][i] != -1) {
+            continue;
+          }
+          if (current != -1) {
+            std::vector<int> &up = upstream[e][current];
+            up.erase(std::find(up.begin(), up.end(), i));
+          }
+          current = next[2 * r + e];
+          if (current != -1) {
+            upstream[e][current].push_back(i);
+          }
+          dirty.push_back(i);
+        }
+
+        // samples whose path passes through a changed sample
+        for (int i : dirty) {
+          state[i] = 1;
+        }
+        for (size_t d = 0; d < dirty.size(); d++) {
+          for (int u : upstream[e][dirty[d]]) {
+            if (state[u] == 0) {
+              state[u] = 1;
+              dirty.push_back(u);
+            }
+          }
+        }
+
+        // follow each dirty path to a resolved sample or an extremum
+        for (int i : dirty) {
+          path.clear();
+          int s = i;
+          int end = -1;
+          while (state[s] == 1) {
+            state[s] = 2;
+            path.push_back(s);
+            int to = steepest[2 * (size_t) s + e];
+            if (to == -1) {
+              end = s;
+              break;
+            }
+            s = to;
+          }
+          if (end == -1) {
+            end = root[e][s];
+          }
+          for (int p : path) {
+            root[e][p] = end;
+            state[p] = 0;
+          }
+        }
+      }
+    };
+
+    // coordinates of the samples if built fromSamples
+    bool coordinates;
+    unsigned int dimension;
+    std::vector<TPrecision> X;
+
+    int knn;
+    bool smooth;
+    double sigma2;
+
+    // function values and their smoothed version the flow is computed on
+    std::vector<TPrecision> y;
+    std::vector<TPrecision> ys;
+
+    // knn of sample i and their distances at i * knn .. (i + 1) * knn, by
+    // increasing (distance, index)
+    std::vector<int> neighbors;
+    std::vector<TPrecision> distances;
+    // edges into each sample in increasing order, see NNMSComplex::reverseEdges
+    std::vector<std::vector<size_t>> reverse;
+
+    // steepest ascending and descending neighbor of sample i at 2 * i and
+    // 2 * i + 1, -1 at extrema
+    std::vector<int> steepest;
+    // maximum (0) and minimum (1) each sample flows to
+    std::vector<int> root[2];
+    // samples whose steepest ascending (0) or descending (1) neighbor is i
+    std::vector<std::vector<int>> upstream[2];
+
+    FortranLinalg::DenseVector<TPrecision> complexValues;
+};
+
+#endif
@@ -0,0 +1,262 @@
+#ifndef LANDMARKMSCOMPLEX_H
+#define LANDMARKMSCOMPLEX_H
+
+#include "flinalg/DenseMatrix.h"
+#include "flinalg/DenseVector.h"
+#include "metrics/BatchMetric.h"
+#include "utils/Parallel.h"
+#include "NNMSComplex.h"
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+enum class LandmarkSelection {
+  Farthest,  // farthest point sampling
+  Density    // farthest point sampling relative to the local sample spacing
+};
+
+/**
+ * Approximate Morse-Smale complex of many samples, for when the knn search
+ * over all samples or the regressions of their crystals are too costly. The
+ * complex is computed on a subset of landmarks, and every other sample
+ * follows the steepest ascent and descent to one of its nearest landmarks and
+ * from there the landmarks' steepest paths, ending up in the crystal of the
+ * maximum and minimum they reach.
+ *
+ * Landmarks start with the samples of the largest and smallest value and
+ * grow by farthest point sampling: the next landmark is the sample farthest
+ * from all landmarks, or, with Density, the sample whose distance relative
+ * to the distance to its knn-th neighbor among a strided subsample is
+ * largest, so dense regions get proportionally more landmarks. Distances are
+ * squared Euclidean as in NNMSComplex(X, y, knn, ...). Selecting the
+ * landmarks and the nearest landmarks of all samples costs O(N L d).
+ */
+template <typename TPrecision>
+class LandmarkMSComplex {
+  public:
+    LandmarkMSComplex(FortranLinalg::DenseMatrix<TPrecision> &X, FortranLinalg::DenseVector<TPrecision> &y,
+                      unsigned int nLandmarks, int knn, LandmarkSelection selection = LandmarkSelection::Farthest,
+                      bool smooth = false, double sigma2 = 0) {
+      if (X.N() != y.N() || X.N() == 0) {
+        throw std::runtime_error("LandmarkMSComplex: need a value for each of at least one sample");
+      }
+      knn = std::max(1, knn);
+      landmarks = selectLandmarks(X, y, nLandmarks, selection, knn);
+      landmarkOf.assign(X.N(), -1);
+      XL = FortranLinalg::DenseMatrix<TPrecision>(X.M(), landmarks.size());
+      yL = FortranLinalg::DenseVector<TPrecision>(landmarks.size());
+      for (unsigned int l = 0; l < landmarks.size(); l++) {
+        landmarkOf[landmarks[l]] = l;
+        std::copy(X.data() + (size_t) landmarks[l] * X.M(), X.data() + (size_t) (landmarks[l] + 1) * X.M(),
+                  XL.data() + (size_t) l * X.M());
+        yL(l) = y(landmarks[l]);
+      }
+      complex.reset(new NNMSComplex<TPrecision>(XL, yL, knn, smooth, 0.01, sigma2));
+      assign(X, y, knn);
+    };
+
+    unsigned int N() { return landmarkOf.size(); };
+    unsigned int landmarkCount() { return landmarks.size(); };
+
+    // sample index of each landmark
+    const std::vector<int> &getLandmarks() { return landmarks; };
+
+    // complex of the landmarks, its samples are the landmarks in order
+    NNMSComplex<TPrecision> &getComplex() { return *complex; };
+    FortranLinalg::DenseMatrix<TPrecision> &getLandmarkCoordinates() { return XL; };
+    FortranLinalg::DenseVector<TPrecision> &getLandmarkValues() { return yL; };
+
+    // nearest landmarks of each sample as sample indices, nearest first
+    FortranLinalg::DenseMatrix<int> &getNearestLandmarks() { return nearest; };
+
+    // steepest ascending (row 0) and descending (row 1) sample of each
+    // sample, -1 at the extrema; other samples step to a landmark and all
+    // paths continue over landmarks only
+    FortranLinalg::DenseMatrix<int> &getSteepest() { return steepest; };
+
+    // crystals at a level of the landmark complex as <max, min> sample
+    // pairs by crystal ID, and the crystal ID of every sample. IDs are those
+    // of the landmark complex at that level; samples whose maximum and
+    // minimum span no crystal there take the crystal of their nearest
+    // landmark.
+    void crystalsAt(unsigned int level, std::vector<std::pair<int, int>> &extrema, std::vector<int> &partition) {
+      auto &hierarchy = complex->getHierarchy();
+      std::vector<std::pair<int, int>> pairs;
+      std::vector<int> crystalIDs;
+      hierarchy.crystalsAt(level, pairs, crystalIDs);
+      auto &extremaIndex = hierarchy.getExtremaIndex();
+      auto &sampleCrystals = hierarchy.getSampleCrystals();
+
+      std::map<std::pair<int, int>, int> crystalOf;
+      extrema.resize(pairs.size());
+      for (unsigned int c = 0; c < pairs.size(); c++) {
+        crystalOf[pairs[c]] = c;
+        extrema[c] = std::make_pair(landmarks[extremaIndex[pairs[c].first]],
+                                    landmarks[extremaIndex[pairs[c].second]]);
+      }
+      partition.resize(N());
+      Parallel::forEach(0, N(), [&](long i) {
+        int max = pairs[crystalIDs[sampleCrystals[up[i]]]].first;
+        int min = pairs[crystalIDs[sampleCrystals[down[i]]]].second;
+        auto crystal = crystalOf.find(std::make_pair(max, min));
+        partition[i] = crystal != crystalOf.end() ? crystal->second
+                                                  : crystalIDs[sampleCrystals[landmarkOf[nearest(0, i)]]];
+      }, 4096);
+    };
+
+    void deallocate() {
+      if (complex) {
+        complex->cleanup();
+      }
+      XL.deallocate();
+      yL.deallocate();
+      nearest.deallocate();
+      steepest.deallocate();
+    };
+
+    static std::vector<int> selectLandmarks(FortranLinalg::DenseMatrix<TPrecision> &X,
+                                            FortranLinalg::DenseVector<TPrecision> &y, unsigned int nLandmarks,
+                                            LandmarkSelection selection, int knn) {
+      unsigned int n = X.N();
+      unsigned int d = X.M();
+      nLandmarks = std::max(1u, std::min(nLandmarks, n));
+      BatchSquaredEuclidean<TPrecision> metric;
+
+      // local spacing from a strided subsample
+      std::vector<TPrecision> scale(n, 1);
+      if (selection == LandmarkSelection::Density) {
+        unsigned int m = std::min(n, std::max(nLandmarks, 64u));
+        unsigned int stride = n / m;
+        FortranLinalg::DenseMatrix<TPrecision> S(d, m);
+        for (unsigned int j = 0; j < m; j++) {
+          std::copy(X.data() + (size_t) j * stride * d, X.data() + (size_t) (j * stride + 1) * d,
+                    S.data() + (size_t) j * d);
+        }
+        unsigned int k = std::min<unsigned int>(knn, m - 1);
+        Parallel::forEachChunk(0, n, [&](long first, long last) {
+          std::vector<TPrecision> distances(m);
+          for (long i = first; i < last; i++) {
+            metric.toColumns(X.data() + (size_t) i * d, S.data(), d, m, distances.data());
+            std::nth_element(distances.begin(), distances.begin() + k, distances.end());
+            scale[i] = std::max(distances[k], std::numeric_limits<TPrecision>::min());
+          }
+        }, 256);
+        S.deallocate();
+      }
+
+      std::vector<int> selected;
+      std::vector<TPrecision> distance(n, std::numeric_limits<TPrecision>::max());
+      auto add = [&](int s) {
+        selected.push_back(s);
+        Parallel::forEachChunk(0, n, [&](long first, long last) {
+          std::vector<TPrecision> distances(last - first);
+          metric.toColumns(X.data() + (size_t) s * d, X.data() + (size_t) first * d, d, last - first,
+                           distances.data());
+          for (long i = first; i < last; i++) {
+            distance[i] = std::min(distance[i], distances[i - first]);
+          }
+        }, 4096);
+      };
+      add(std::max_element(y.data(), y.data() + n) - y.data());
+      int smallest = std::min_element(y.data(), y.data() + n) - y.data();
+      if (nLandmarks > 1 && distance[smallest] > 0) {
+        add(smallest);
+      }
+      while (selected.size() < nLandmarks) {
+        int next = 0;
+        TPrecision farthest = -1;
+        for (unsigned int i = 0; i < n; i++) {
+          TPrecision score = distance[i] / scale[i];
+          if (score > farthest) {
+            farthest = score;
+            next = i;
+          }
+        }
+        if (distance[next] == 0) {
+          break; // all remaining samples coincide with landmarks
+        }
+        add(next);
+      }
+      return selected;
+    };
+
+  private:
+    // nearest landmarks of all samples and their steepest ascent and descent
+    // among them
+    void assign(FortranLinalg::DenseMatrix<TPrecision> &X, FortranLinalg::DenseVector<TPrecision> &y, int knn) {
+      unsigned int n = X.N();
+      unsigned int d = X.M();
+      unsigned int nl = landmarks.size();
+      unsigned int k = std::min<unsigned int>(knn, nl);
+      nearest = FortranLinalg::DenseMatrix<int>(k, n);
+      steepest = FortranLinalg::DenseMatrix<int>(2, n);
+      up.resize(n);
+      down.resize(n);
+      auto knng = complex->getSteepestAscDec();
+      BatchSquaredEuclidean<TPrecision> metric;
+      typedef std::pair<TPrecision, int> Neighbor;
+
+      Parallel::forEachChunk(0, n, [&](long first, long last) {
+        std::vector<TPrecision> distances(nl);
+        std::vector<Neighbor> neighbors(nl);
+        for (long i = first; i < last; i++) {
+          metric.toColumns(X.data() + (size_t) i * d, XL.data(), d, nl, distances.data());
+          for (unsigned int l = 0; l < nl; l++) {
+            neighbors[l] = Neighbor(distances[l], l);
+          }
+          std::partial_sort(neighbors.begin(), neighbors.begin() + k, neighbors.end());
+          for (unsigned int j = 0; j < k; j++) {
+            nearest(j, i) = landmarks[neighbors[j].second];
+          }
+
+          if (landmarkOf[i] != -1) {
+            int l = landmarkOf[i];
+            up[i] = l;
+            down[i] = l;
+            steepest(0, i) = knng(0, l) == -1 ? -1 : landmarks[knng(0, l)];
+            steepest(1, i) = knng(1, l) == -1 ? -1 : landmarks[knng(1, l)];
+            continue;
+          }
+
+          // as NNMSComplex::steepestNeighbors, the nearest landmark if none
+          // is higher (lower)
+          double ascent = 0;
+          double descent = 0;
+          up[i] = neighbors[0].second;
+          down[i] = neighbors[0].second;
+          for (unsigned int j = 0; j < k; j++) {
+            int l = neighbors[j].second;
+            double g = NNMSComplex<TPrecision>::edgeGradient(y(i), yL(l), neighbors[j].first);
+            if (ascent < g) {
+              ascent = g;
+              up[i] = l;
+            } else if (descent > g) {
+              descent = g;
+              down[i] = l;
+            }
+          }
+          steepest(0, i) = landmarks[up[i]];
+          steepest(1, i) = landmarks[down[i]];
+        }
+      }, 256);
+    };
+
+    std::vector<int> landmarks;
+    std::vector<int> landmarkOf;       // landmark of each sample, -1 if none
+    std::vector<int> up;               // landmark each sample ascends through
+    std::vector<int> down;             // landmark each sample descends through
+    FortranLinalg::DenseMatrix<TPrecision> XL;
+    FortranLinalg::DenseVector<TPrecision> yL;
+    FortranLinalg::DenseMatrix<int> nearest;
+    FortranLinalg::DenseMatrix<int> steepest;
+    std::unique_ptr<NNMSComplex<TPrecision>> complex;
+};
+
+#endif
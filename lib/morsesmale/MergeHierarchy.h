@@ -0,0 +1,232 @@
+#ifndef MERGEHIERARCHY_H
+#define MERGEHIERARCHY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+
+/**
+ * Merge tree of the extrema of a Morse-Smale complex, recorded once by the
+ * persistence simplification. Persistence level l is the complex after the
+ * first l merges, so level 0 is the unsimplified complex and level
+ * mergeCount() has a single maximum and minimum (for a connected graph).
+ *
+ * Extrema are numbered with the nMax maxima first, as in NNMSComplex.
+ * Crystals are the distinct <max, min> extrema pairs of the unsimplified
+ * complex in sorted order. The crystals, extrema and partitions of any level
+ * follow from the tree in time linear in extrema and crystals, without
+ * replaying the simplification.
+ */
+template <typename TPrecision>
+class MergeHierarchy {
+  public:
+    // Extremum first is absorbed by extremum second at the given persistence
+    struct Merge {
+      TPrecision persistence;
+      int first;
+      int second;
+    };
+
+    MergeHierarchy() : nMax(0) {};
+
+    MergeHierarchy(int nMax, const std::vector<int> &extremaIndex,
+                   const std::vector<std::pair<int, int>> &crystals, const std::vector<int> &sampleCrystals)
+          : nMax(nMax), extremaIndex(extremaIndex), crystals(crystals), sampleCrystals(sampleCrystals) {};
+
+    // appends the next merge; persistence must not decrease and first must
+    // still be a surviving extremum
+    void addMerge(TPrecision persistence, int first, int second) {
+      if (!merges.empty() && persistence < merges.back().persistence) {
+        throw std::runtime_error("MergeHierarchy: merges must be added in order of persistence");
+      }
+      merges.push_back(Merge{persistence, first, second});
+    };
+
+    unsigned int mergeCount() const { return merges.size(); };
+    unsigned int levelCount() const { return merges.size() + 1; };
+    unsigned int extremaCount() const { return extremaIndex.size(); };
+    unsigned int maximaCount() const { return nMax; };
+    unsigned int sampleCount() const { return sampleCrystals.size(); };
+    const std::vector<int> &getExtremaIndex() const { return extremaIndex; };
+    const std::vector<Merge> &getMerges() const { return merges; };
+
+    // persistence at which level + 1 is reached, max() for the last level
+    TPrecision persistence(unsigned int level) const {
+      return level < merges.size() ? merges[level].persistence : std::numeric_limits<TPrecision>::max();
+    };
+
+    // level of the complex with all merges of persistence below pLevel
+    unsigned int levelOf(TPrecision pLevel) const {
+      return std::lower_bound(merges.begin(), merges.end(), pLevel, [](const Merge &m, TPrecision p) {
+          return m.persistence < p;
+        }) - merges.begin();
+    };
+
+    // surviving extremum at the given level for every extremum
+    void extrema(unsigned int level, std::vector<int> &representative) const {
+      level = std::min<unsigned int>(level, merges.size());
+      representative.resize(extremaIndex.size());
+      for (unsigned int e = 0; e < representative.size(); e++) {
+        representative[e] = e;
+      }
+      // an absorbing extremum survives its merge, so walking the merges
+      // backwards resolves it before anything it absorbed
+      for (unsigned int m = level; m-- > 0;) {
+        representative[merges[m].first] = representative[merges[m].second];
+      }
+    };
+
+    // crystals at the given level as <max, min> extrema pairs by crystal ID,
+    // and the crystal ID of every unsimplified crystal. IDs are given in
+    // order of first appearance among the unsimplified crystals.
+    void crystalsAt(unsigned int level, std::vector<std::pair<int, int>> &pairs, std::vector<int> &crystalIDs) const {
+      std::vector<int> representative;
+      extrema(level, representative);
+      unsigned int n = crystals.size();
+
+      // counting sort by merged maximum, keeping the original order
+      std::vector<int> start(nMax + 1, 0);
+      for (unsigned int c = 0; c < n; c++) {
+        start[representative[crystals[c].first] + 1]++;
+      }
+      for (int b = 0; b < nMax; b++) {
+        start[b + 1] += start[b];
+      }
+      std::vector<int> order(n);
+      std::vector<int> next(start.begin(), start.end() - 1);
+      for (unsigned int c = 0; c < n; c++) {
+        order[next[representative[crystals[c].first]]++] = c;
+      }
+
+      // first crystal with each merged minimum within a maximum
+      std::vector<int> first(n);
+      std::vector<int> firstOfMin(extremaIndex.size(), -1);
+      for (int b = 0; b < nMax; b++) {
+        for (int i = start[b]; i < start[b + 1]; i++) {
+          int c = order[i];
+          int &f = firstOfMin[representative[crystals[c].second]];
+          if (f < 0) {
+            f = c;
+          }
+          first[c] = f;
+        }
+        for (int i = start[b]; i < start[b + 1]; i++) {
+          firstOfMin[representative[crystals[order[i]].second]] = -1;
+        }
+      }
+
+      pairs.clear();
+      crystalIDs.resize(n);
+      for (unsigned int c = 0; c < n; c++) {
+        if (first[c] == (int) c) {
+          crystalIDs[c] = pairs.size();
+          pairs.push_back(std::make_pair(representative[crystals[c].first], representative[crystals[c].second]));
+        }
+        else {
+          crystalIDs[c] = crystalIDs[first[c]];
+        }
+      }
+    };
+
+    // crystal ID of every sample at the given level
+    void partitions(unsigned int level, std::vector<int> &partition) const {
+      std::vector<std::pair<int, int>> pairs;
+      std::vector<int> crystalIDs;
+      crystalsAt(level, pairs, crystalIDs);
+      partition.resize(sampleCrystals.size());
+      for (unsigned int i = 0; i < sampleCrystals.size(); i++) {
+        partition[i] = crystalIDs[sampleCrystals[i]];
+      }
+    };
+
+    // crystal of the unsimplified complex of every sample
+    const std::vector<int> &getSampleCrystals() const { return sampleCrystals; };
+
+
+    // Binary form: magic, precision size and counts, then the extrema
+    // samples, crystals, sample crystals and merges as flat arrays
+    void write(std::ostream &out) const {
+      uint32_t header[7] = {magic, (uint32_t) sizeof(TPrecision), (uint32_t) nMax, (uint32_t) extremaIndex.size(),
+                            (uint32_t) crystals.size(), (uint32_t) sampleCrystals.size(), (uint32_t) merges.size()};
+      out.write(reinterpret_cast<const char *>(header), sizeof(header));
+      writeArray(out, extremaIndex.data(), extremaIndex.size());
+      for (auto &c : crystals) {
+        int32_t pair[2] = {c.first, c.second};
+        out.write(reinterpret_cast<const char *>(pair), sizeof(pair));
+      }
+      writeArray(out, sampleCrystals.data(), sampleCrystals.size());
+      for (auto &m : merges) {
+        int32_t pair[2] = {m.first, m.second};
+        out.write(reinterpret_cast<const char *>(&m.persistence), sizeof(TPrecision));
+        out.write(reinterpret_cast<const char *>(pair), sizeof(pair));
+      }
+      if (!out) {
+        throw std::runtime_error("MergeHierarchy: write failed");
+      }
+    };
+
+    static MergeHierarchy read(std::istream &in) {
+      uint32_t header[7];
+      in.read(reinterpret_cast<char *>(header), sizeof(header));
+      if (!in || header[0] != magic || header[1] != sizeof(TPrecision)) {
+        throw std::runtime_error("MergeHierarchy: not a merge hierarchy of this precision");
+      }
+      MergeHierarchy h;
+      h.nMax = header[2];
+      h.extremaIndex.resize(header[3]);
+      h.crystals.resize(header[4]);
+      h.sampleCrystals.resize(header[5]);
+      h.merges.resize(header[6]);
+      readArray(in, h.extremaIndex.data(), h.extremaIndex.size());
+      for (auto &c : h.crystals) {
+        int32_t pair[2];
+        in.read(reinterpret_cast<char *>(pair), sizeof(pair));
+        c = std::make_pair(pair[0], pair[1]);
+      }
+      readArray(in, h.sampleCrystals.data(), h.sampleCrystals.size());
+      for (auto &m : h.merges) {
+        int32_t pair[2];
+        in.read(reinterpret_cast<char *>(&m.persistence), sizeof(TPrecision));
+        in.read(reinterpret_cast<char *>(pair), sizeof(pair));
+        m.first = pair[0];
+        m.second = pair[1];
+      }
+      if (!in) {
+        throw std::runtime_error("MergeHierarchy: truncated input");
+      }
+      return h;
+    };
+
+  private:
+    static const uint32_t magic = 0x48534d44; // "DMSH"
+
+    static void writeArray(std::ostream &out, const int *data, size_t n) {
+      std::vector<int32_t> values(data, data + n);
+      out.write(reinterpret_cast<const char *>(values.data()), n * sizeof(int32_t));
+    };
+
+    static void readArray(std::istream &in, int *data, size_t n) {
+      std::vector<int32_t> values(n);
+      in.read(reinterpret_cast<char *>(values.data()), n * sizeof(int32_t));
+      std::copy(values.begin(), values.end(), data);
+    };
+
+    int nMax;
+    // sample of each extremum
+    std::vector<int> extremaIndex;
+    // <max, min> extrema of the unsimplified crystals, sorted
+    std::vector<std::pair<int, int>> crystals;
+    // index into crystals of each sample
+    std::vector<int> sampleCrystals;
+    // in order of persistence
+    std::vector<Merge> merges;
+};
+
+#endif
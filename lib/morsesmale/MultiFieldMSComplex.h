@@ -0,0 +1,84 @@
+#ifndef MULTIFIELDMSCOMPLEX_H
+#define MULTIFIELDMSCOMPLEX_H
+
+#include "flinalg/DenseMatrix.h"
+#include "flinalg/DenseVector.h"
+#include "graph/KNNGraph.h"
+#include "metrics/Distance.h"
+#include "utils/Parallel.h"
+#include "NNMSComplex.h"
+
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+
+/**
+ * Morse-Smale complexes of many functions on the same samples, e.g. all
+ * QoIs of a dataset. The knn graph only depends on the samples, so it and
+ * its reverse edge index are computed once and shared by the complexes of
+ * all fields, which are computed concurrently.
+ */
+template <typename TPrecision>
+class MultiFieldMSComplex {
+  public:
+    // neighbors from a full distance matrix, as NNMSComplex(distances, ...)
+    MultiFieldMSComplex(FortranLinalg::DenseMatrix<TPrecision> &distances, int knn) {
+      knn = std::min<int>(knn, distances.N());
+      KNN = FortranLinalg::DenseMatrix<int>(knn, distances.N());
+      KNND = FortranLinalg::DenseMatrix<TPrecision>(knn, distances.N());
+      Distance<TPrecision>::findKNN(distances, KNN, KNND);
+      NNMSComplex<TPrecision>::reverseEdges(KNN, reverseStart, reverse);
+    };
+
+    // neighbors from a sparse knn graph, as NNMSComplex(graph, ...), throws
+    // if the graph holds fewer than knn neighbors per sample
+    MultiFieldMSComplex(KNNGraph<TPrecision> &graph, int knn) {
+      graph.checkNeighbors(knn);
+      KNN = FortranLinalg::DenseMatrix<int>(knn, graph.N());
+      KNND = FortranLinalg::DenseMatrix<TPrecision>(knn, graph.N());
+      graph.select(KNN, KNND);
+      NNMSComplex<TPrecision>::reverseEdges(KNN, reverseStart, reverse);
+    };
+
+    unsigned int N() { return KNN.N(); };
+    unsigned int k() { return KNN.M(); };
+
+    // complex of each field. With at least as many fields as threads the
+    // fields are processed concurrently, otherwise one after the other with
+    // each complex parallel on its own.
+    std::vector<std::unique_ptr<NNMSComplex<TPrecision>>> compute(
+        std::vector<FortranLinalg::DenseVector<TPrecision>> &fields, bool smooth = false, double sigma2 = 0) {
+      for (auto &field : fields) {
+        if (field.N() != KNN.N()) {
+          throw std::runtime_error("MultiFieldMSComplex: field size differs from the number of samples");
+        }
+      }
+      std::vector<std::unique_ptr<NNMSComplex<TPrecision>>> complexes(fields.size());
+      auto computeField = [&](long f) {
+        complexes[f].reset(new NNMSComplex<TPrecision>(KNN, KNND, reverseStart, reverse, fields[f], smooth, sigma2));
+      };
+      if (fields.size() >= Parallel::threadCount()) {
+        Parallel::forEach(0, fields.size(), computeField);
+      }
+      else {
+        for (unsigned int f = 0; f < fields.size(); f++) {
+          computeField(f);
+        }
+      }
+      return complexes;
+    };
+
+    void deallocate() {
+      KNN.deallocate();
+      KNND.deallocate();
+    };
+
+  private:
+    FortranLinalg::DenseMatrix<int> KNN;
+    FortranLinalg::DenseMatrix<TPrecision> KNND;
+    std::vector<size_t> reverseStart;
+    std::vector<size_t> reverse;
+};
+
+#endif
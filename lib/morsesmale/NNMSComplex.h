@@ -11,31 +11,41 @@
 #include "flinalg/DenseMatrix.h"
 #include "flinalg/DenseVector.h"
 #include "flinalg/Linalg.h"
+#include "graph/HNSW.h"
+#include "graph/KDTree.h"
+#include "graph/KNNGraph.h"
 #include "metrics/Distance.h"
 #include "metrics/EuclideanMetric.h"
 #include "metrics/SquaredEuclideanMetric.h"
+#include "utils/Parallel.h"
+#include "MergeHierarchy.h"
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <limits>
-#include <list>
-#include <map>
+#include <queue>
+#include <tuple>
 #include <utility>
 #include <vector>
 
 
+// Nearest neighbor search used when the complex is built from coordinates
+enum class NNSearch {
+  // exact, O(N^2 d) but independent of the dimension
+  BruteForce,
+  // kd-tree, O(N log N) for low dimensional data; exact for eps = 0 and
+  // (1+eps)-approximate otherwise
+  KDTree,
+  // approximate HNSW graph index for high dimensional data
+  HNSW
+};
+
+
 template<typename TPrecision>
 class NNMSComplex {
   private:
-    typedef std::map<std::pair<int, int>, int> map_pi_i;
-    typedef map_pi_i::iterator map_pi_i_it;
-
-    typedef std::multimap<int, std::pair<int, int>> mmap_i_pi;
-    typedef mmap_i_pi::iterator mmap_i_pi_it;
-    
-    typedef typename std::map<std::pair<int, int>, TPrecision> map_pi_f;
-    typedef typename map_pi_f::iterator map_pi_f_it;
-    
-    typedef typename std::map<TPrecision, std::pair<int, int>, std::less<TPrecision>> map_f_pi;
-    typedef typename map_f_pi::iterator map_f_pi_it;
+    typedef typename MergeHierarchy<TPrecision>::Merge Merge;
 
 
     // Steepest ascending KNNG(0,) and descending KNNG(1, ) neighbors for each point    
@@ -53,19 +63,20 @@ class NNMSComplex {
     // Extrema ID for each point --- max extrema(0, ) and min extrema(1, )
     FortranLinalg::DenseMatrix<int> extrema;
 
-    // Map of crystals as <max, min> -> crystal ID    
-    map_pi_i crystals;
-    // Map after merging for reduced set of crystals
-    map_pi_i pcrystals;
-    
-    
-    // Inital persistencies for each crystal
-    map_f_pi persistence;
+    // Merge tree of the persistence simplification
+    MergeHierarchy<TPrecision> hierarchy;
+    // Crystal ID at the current persistence level for each crystal of the
+    // unsimplified complex
+    std::vector<int> crystalIDs;
+    // <max, min> extrema pairs of the crystals at the current persistence
+    // level, by crystal ID
+    std::vector<std::pair<int, int>> pcrystals;
 
     // Extrema ID to index into X
     FortranLinalg::DenseVector<int> extremaIndex;
 
-    // Extrema after merging of crystals e.g extrema(i) -> merge(extrema(i))
+    // Extrema after merging of crystals e.g extrema(i) -> merge(extrema(i)),
+    // a union-find forest whose roots are the surviving extrema
     FortranLinalg::DenseVector<int> merge;
 
     // Number of maxima, first nMax entries in extremaIndex are maxima
@@ -83,37 +94,36 @@ class NNMSComplex {
       return KNNG(1, index);
     };
 
+    // root of the merge chain of i, compressing the path on the way
     int followChain(int i){
-      while(merge(i) != i){
-        i = merge(i);
+      int root = i;
+      while(merge(root) != root){
+        root = merge(root);
+      }
+      while(merge(i) != root){
+        int next = merge(i);
+        merge(i) = root;
+        i = next;
       }
-      return i;
+      return root;
     };
 
-
-    //compute crystals based on merge chain
-    void mergeCrystals(){
-      //initalize simplified crystals to original crystal assignments
-      int nCrystals = 0;
-      //reassign crystals based on merge chain
-      pcrystals.clear();
-      for (map_pi_i_it it = crystals.begin(); it != crystals.end(); ++it) {
-        std::pair<int, int> p = (*it).first;
-        
-        
-        //follow merge chains for min and max
-        p.first = merge(p.first);
-        p.second = merge(p.second);
-        
-        //check if we created a new crystal otherwise assign to existing
-        //crystal
-        map_pi_i_it ito = pcrystals.find(p);
-        if(ito == pcrystals.end()){
-          pcrystals[p] = nCrystals;
-          nCrystals++;
+    // orders two extrema of the same kind such that p.first is the less
+    // significant one (lower maximum or higher minimum)
+    void orient(std::pair<int, int> &p){
+      if(p.first < nMax){
+        if( y(extremaIndex(p.first)) > y(extremaIndex(p.second)) ){ 
+          std::swap(p.second, p.first); 
+        }
+      }
+      else{
+        if( y(extremaIndex(p.first)) < y(extremaIndex(p.second)) ){ 
+          std::swap(p.second, p.first);
         }
       }
-   };
+    };
+
+
 
   public:
 
@@ -152,9 +162,56 @@ class NNMSComplex {
 
 
  
+    // Complex of a precomputed sparse knn graph, no distance matrix or
+    // coordinates needed. Throws std::runtime_error if the graph holds fewer
+    // than knn neighbors per sample.
+    NNMSComplex(KNNGraph<TPrecision> &graph,
+                FortranLinalg::DenseVector<TPrecision> &yin,
+                int knn, bool smooth = false, double sigma2=0) : y(yin) {
+      m_sampleCount = graph.N();
+      graph.checkNeighbors(knn);
+      KNN = FortranLinalg::DenseMatrix<int>(knn, m_sampleCount);
+      KNND = FortranLinalg::DenseMatrix<TPrecision>(knn, m_sampleCount);
+      graph.select(KNN, KNND);
+
+      runMS(smooth, sigma2);
+      KNND.deallocate();
+    };
+
+
+    // Complex over neighbors shared by several functions on the same
+    // samples, see MultiFieldMSComplex. knn is copied, knnd and the reverse
+    // edge index from reverseEdges(knn, ...) are only read.
+    NNMSComplex(FortranLinalg::DenseMatrix<int> &knn, FortranLinalg::DenseMatrix<TPrecision> &knnd,
+                const std::vector<size_t> &reverseStart, const std::vector<size_t> &reverse,
+                FortranLinalg::DenseVector<TPrecision> &yin, bool smooth = false, double sigma2=0) : y(yin) {
+      m_sampleCount = knn.N();
+      KNN = FortranLinalg::Linalg<int>::Copy(knn);
+      KNND = knnd;
+      runMS(smooth, sigma2, reverseStart, reverse);
+      KNND = FortranLinalg::DenseMatrix<TPrecision>();
+    };
+
+
+    // Complex of a flow maintained elsewhere, see IncrementalMSComplex: the
+    // knn graph, the steepest ascending and descending neighbor of each
+    // sample (rows of steepest, -1 at extrema) and the maximum and minimum
+    // each sample flows to. knn and steepest are copied, yin are the
+    // (smoothed) function values the flow was computed on.
+    NNMSComplex(FortranLinalg::DenseMatrix<int> &knn, FortranLinalg::DenseVector<TPrecision> &yin,
+                FortranLinalg::DenseMatrix<int> &steepest, const std::vector<int> &maxRoot,
+                const std::vector<int> &minRoot) : y(yin) {
+      m_sampleCount = knn.N();
+      KNN = FortranLinalg::Linalg<int>::Copy(knn);
+      KNNG = FortranLinalg::Linalg<int>::Copy(steepest);
+      buildHierarchy(maxRoot, minRoot);
+    };
+
+
     NNMSComplex(FortranLinalg::DenseMatrix<TPrecision> &Xin, 
                 FortranLinalg::DenseVector<TPrecision> &yin, 
-                int knn, bool smooth = false, double eps=0.01, double sigma2=0) : X(Xin), y(yin){
+                int knn, bool smooth = false, double eps=0.01, double sigma2=0,
+                NNSearch search = NNSearch::BruteForce) : X(Xin), y(yin){
       m_sampleCount = X.N();
       if (knn > (int) m_sampleCount) {
         knn = m_sampleCount;
@@ -163,9 +220,7 @@ class NNMSComplex {
       KNND = FortranLinalg::DenseMatrix<TPrecision>(knn, m_sampleCount);
 
       //Compute nearest neighbors
-      //ANNWrapper<TPrecision>::computeANN(X, KNN, KNND, eps);
-      SquaredEuclideanMetric<TPrecision> dist;
-      Distance<TPrecision>::computeKNN(X, KNN, KNND, dist);
+      computeKNN(X, KNN, KNND, eps, search);
 
       // std::cout << "KNND[" << KNND.M() << "," << KNND.N() << "]" << std::endl;
       // for (unsigned int i = 0; i < KNND.M() && i < 5; i++) {
@@ -182,42 +237,61 @@ class NNMSComplex {
     };
 
 
+    // Neighbors of the columns of X as the constructor from coordinates finds
+    // them, the sample itself included; eps only applies to NNSearch::KDTree
+    static void computeKNN(FortranLinalg::DenseMatrix<TPrecision> &X, FortranLinalg::DenseMatrix<int> &knn,
+                           FortranLinalg::DenseMatrix<TPrecision> &knnd, double eps = 0.01,
+                           NNSearch search = NNSearch::BruteForce) {
+      if (search == NNSearch::KDTree) {
+        KDTree<TPrecision>::computeKNN(X, knn, knnd, eps);
+      }
+      else if (search == NNSearch::HNSW) {
+        HNSW<TPrecision>::computeKNN(X, knn, knnd);
+      }
+      else {
+        Distance<TPrecision>::computeKNN(X, knn, knnd, BatchSquaredEuclidean<TPrecision>());
+      }
+    };
+
+
+    // Complex with the neighbors of the columns of Xin under any metric,
+    // e.g. a HammingMetric built from Xin for binary masks; the metric is
+    // evaluated for all pairs
+    NNMSComplex(FortranLinalg::DenseMatrix<TPrecision> &Xin,
+                FortranLinalg::DenseVector<TPrecision> &yin,
+                int knn, Metric<TPrecision> &metric, bool smooth = false, double sigma2=0)
+               : X(Xin), y(yin) {
+      m_sampleCount = X.N();
+      if (knn > (int) m_sampleCount) {
+        knn = m_sampleCount;
+      }
+      KNN = FortranLinalg::DenseMatrix<int>(knn, m_sampleCount);
+      KNND = FortranLinalg::DenseMatrix<TPrecision>(knn, m_sampleCount);
+      Distance<TPrecision>::computeKNN(X, KNN, KNND, metric);
+
+      runMS(smooth, sigma2);
+      KNND.deallocate();
+    };
+
+
 
     //Compute the MS crystals for the given persistence level. Neighboring
     //extrema with a absolute difference between saddle and lower exterma
     //smaller than pLevel, are recursively joined into a single extrema.  
     void mergePersistence(TPrecision pLevel){
       std::cout << "===mergePersistence "<< pLevel << std::endl;
-      //compute merge chain 
-      for(unsigned int i=0; i<merge.N(); i++){
-        merge(i) = i;
-      } 
-      
+      mergeLevel(hierarchy.levelOf(pLevel));
+    };
 
-  
-      for(map_f_pi_it it = persistence.begin(); it != persistence.end() && (*it).first < pLevel; ++it){
-        std::pair<int, int> p = (*it).second;        
-        p.first = followChain(p.first);
-        p.second = followChain(p.second);
-        if(p.first < nMax){
-          if( y(extremaIndex(p.first)) > y(extremaIndex(p.second)) ){ 
-            std::swap(p.second, p.first); 
-          }
-        }
-        else{
-          if( y(extremaIndex(p.first)) < y(extremaIndex(p.second)) ){ 
-            std::swap(p.second, p.first);
-          }
-        }
-        merge(p.first) = p.second;
-      }
+    //Compute the MS crystals after the first level merges, read from the
+    //merge hierarchy without replaying the simplification.
+    void mergeLevel(unsigned int level){
+      std::vector<int> representative;
+      hierarchy.extrema(level, representative);
       for(unsigned int i=0; i<merge.N(); i++){
-        merge(i) = followChain(i);
+        merge(i) = representative[i];
       }
-
-
-      //compute crystals based on merge chain
-      mergeCrystals();
+      hierarchy.crystalsAt(level, pcrystals, crystalIDs);
 
 #if 0
       int n = 0;
@@ -227,13 +301,9 @@ class NNMSComplex {
       }
       
       printf("pcrystals:\n");
-      for (map_pi_i_it it = pcrystals.begin(); it != pcrystals.end(); ++it) {
-        std::pair<int, int> p = (*it).first;
-        auto min_xid = p.second;
-        auto max_xid = p.first;
-        auto min_sid = extremaIndex(merge(min_xid));
-        auto max_sid = extremaIndex(merge(max_xid));
-        auto cid = (*it).second;
+      for (unsigned int cid = 0; cid < pcrystals.size(); cid++) {
+        auto min_sid = extremaIndex(pcrystals[cid].second);
+        auto max_sid = extremaIndex(pcrystals[cid].first);
         printf("pcrystal %d: min: %d, max: %d\n", cid, min_sid, max_sid);
       }
 #endif
@@ -244,18 +314,10 @@ class NNMSComplex {
   // (basically same as getCrystals below but takes into account the possibly merged extrema)
   std::vector<std::pair<int,int>> getExtrema() {
     std::vector<std::pair<int,int>> ret(pcrystals.size());
-    int cnt = 0;
-    for (map_pi_i_it it = pcrystals.begin(); it != pcrystals.end(); ++it) {
-      std::pair<int, int> p = (*it).first;
-      auto min_xid = p.second;
-      auto max_xid = p.first;
-      auto min_sid = extremaIndex(merge(min_xid));
-      auto max_sid = extremaIndex(merge(max_xid));
-      // auto min_sid = extremaIndex(min_xid);     // same as getCrystals below
-      // auto max_sid = extremaIndex(max_xid);
-      auto cid = (*it).second;
+    for (unsigned int cid = 0; cid < pcrystals.size(); cid++) {
+      auto min_sid = extremaIndex(pcrystals[cid].second);
+      auto max_sid = extremaIndex(pcrystals[cid].first);
       ret[cid] = std::pair<int,int>(max_sid, min_sid);
-      //assert(cid == cnt++);  // failed... cool, so crystal ids matter
     }
     return ret;
   }
@@ -273,8 +335,7 @@ class NNMSComplex {
 
     void getPartitions(FortranLinalg::DenseVector<int> &crys){
       for(unsigned int i = 0; i < m_sampleCount; i++){
-        std::pair<int, int> p( merge(extrema(0, i)), merge(extrema(1, i)) );
-        crys(i) = pcrystals[p];
+        crys(i) = crystalIDs[hierarchy.getSampleCrystals()[i]];
       }
     };
 
@@ -299,46 +360,44 @@ class NNMSComplex {
 
 
     void getCrystals(FortranLinalg::DenseMatrix<int> ce){
-     for(map_pi_i_it it = pcrystals.begin(); it != pcrystals.end(); ++it){
-        std::pair<int, int> p = (*it).first;
-        ce(0, (*it).second) = extremaIndex(p.first);
-        ce(1, (*it).second) = extremaIndex(p.second);
+      for(unsigned int c = 0; c < pcrystals.size(); c++){
+        ce(0, c) = extremaIndex(pcrystals[c].first);
+        ce(1, c) = extremaIndex(pcrystals[c].second);
       }
     };
 
 
 
     void getMax(FortranLinalg::DenseVector<int> vmaxs){
-     for(map_pi_i_it it = pcrystals.begin(); it != pcrystals.end(); ++it){
-        std::pair<int, int> p = (*it).first;
-        vmaxs((*it).second) = extremaIndex(p.first);
+      for(unsigned int c = 0; c < pcrystals.size(); c++){
+        vmaxs(c) = extremaIndex(pcrystals[c].first);
       }
     };
 
 
 
     void getMin(FortranLinalg::DenseVector<int> vmins){
-     for(map_pi_i_it it = pcrystals.begin(); it != pcrystals.end(); ++it){
-        std::pair<int, int> p = (*it).first;
-        vmins((*it).second) = extremaIndex(p.second);
+      for(unsigned int c = 0; c < pcrystals.size(); c++){
+        vmins(c) = extremaIndex(pcrystals[c].second);
       }
     };
 
     //get persistencies
     FortranLinalg::DenseVector<TPrecision> getPersistence(){
-      FortranLinalg::DenseVector<TPrecision> pers(persistence.size()+1);  // <ctc> why size + 1? Results change if not
+      FortranLinalg::DenseVector<TPrecision> pers(hierarchy.levelCount());  // <ctc> why size + 1? Results change if not
       getPersistence(pers);
       return pers;
     };
 
     void getPersistence(FortranLinalg::DenseVector<TPrecision> pers){
-      int index = 0;
-      for(map_f_pi_it it = persistence.begin(); it != persistence.end(); ++it, ++index){
-        pers(index) = (*it).first;
+      for(unsigned int level = 0; level < hierarchy.levelCount(); level++){
+        pers(level) = hierarchy.persistence(level);
       }
-      pers(index) = std::numeric_limits<TPrecision>::max();
     };
 
+    //merge tree of all persistence levels
+    const MergeHierarchy<TPrecision> &getHierarchy() { return hierarchy; }
+
     Eigen::MatrixXi getSteepestAscDec() {
       Eigen::MatrixXi knng(KNNG.N(), KNNG.M());
       Eigen::Map<Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::ColMajor>> map(KNNG.data(), KNNG.M(), KNNG.N());
@@ -360,14 +419,96 @@ class NNMSComplex {
 
     };
 
+    // Edges i -> j of the knn graph by target j: the entries i * knn.M() + k
+    // with knn(k, i) = j, in increasing order, are
+    // reverse[reverseStart[j]..reverseStart[j + 1])
+    static void reverseEdges(FortranLinalg::DenseMatrix<int> &knn, std::vector<size_t> &reverseStart,
+                             std::vector<size_t> &reverse) {
+      size_t nEdges = (size_t) knn.M() * knn.N();
+      reverseStart.assign(knn.N() + 1, 0);
+      for (size_t e = 0; e < nEdges; e++) {
+        reverseStart[knn.data()[e] + 1]++;
+      }
+      for (unsigned int j = 0; j < knn.N(); j++) {
+        reverseStart[j + 1] += reverseStart[j];
+      }
+      reverse.resize(nEdges);
+      std::vector<size_t> next(reverseStart.begin(), reverseStart.end() - 1);
+      for (size_t e = 0; e < nEdges; e++) {
+        reverse[next[knn.data()[e]]++] = e;
+      }
+    };
+
+    // Gradient along the knn edge from a sample with value yFrom to one with
+    // value yTo at the given knn distance
+    static double edgeGradient(TPrecision yFrom, TPrecision yTo, TPrecision distance) {
+      // Ross added this Dec 2020.  This prevents longer connections from dominating.
+      float gradient_exp = 1.0f + 1.0e-4;
+      double d = pow(distance, gradient_exp);   // prevents longer connections from dominating 
+      double g = yTo - yFrom;  // gradient computed
+      if (d == 0 ) {
+        return 0;
+      }
+      return g / d;  // d is distance between nodes, g is gradient, so we want to cache these steepest ascending/descending paths between nodes in order to use them to save the "extra" members of a crystal to show to the users 
+    };
+
+    // Steepest ascending (up) and descending (down) neighbor of sample i, -1
+    // if there is none. A neighbor is either a KNN of i or has i as a KNN:
+    // target(e) and gradient(e) give the target and gradient of the edge
+    // e = i * knn + k and reverse[0..nReverse) are the edges into i in
+    // increasing order. The candidates are seen in the order of a sequential
+    // sweep over all edges (i, k), so ties keep going to the first candidate.
+    template <typename Target, typename Gradient>
+    static void steepestNeighbors(long i, int knn, const size_t *reverse, size_t nReverse,
+                                  Target target, Gradient gradient, int &up, int &down) {
+      TPrecision ascent = 0;
+      TPrecision descent = 0;
+      up = -1;
+      down = -1;
+      auto update = [&](int j, double g) {
+        if (ascent < g) {
+          ascent = g;
+          up = j;
+        } else if (descent > g) {
+          descent = g;
+          down = j;
+        }
+      };
+      auto visitReverse = [&](size_t e) {
+        update(e / knn, -gradient(e));
+      };
+
+      size_t r = 0;
+      for (; r < nReverse && (long) (reverse[r] / knn) < i; r++) {
+        visitReverse(reverse[r]);
+      }
+      for (int k=0; k<knn; k++) {
+        size_t e = (size_t) i * knn + k;
+        update(target(e), gradient(e));
+        for (; r < nReverse && reverse[r] == e; r++) {
+          visitReverse(reverse[r]);
+        }
+      }
+      for (; r < nReverse; r++) {
+        visitReverse(reverse[r]);
+      }
+    };
+
 private:
     void runMS(bool smooth, double sigma2) {
+      std::vector<size_t> reverseStart, reverse;
+      reverseEdges(KNN, reverseStart, reverse);
+      runMS(smooth, sigma2, reverseStart, reverse);
+    };
+
+    void runMS(bool smooth, double sigma2, const std::vector<size_t> &reverseStart,
+               const std::vector<size_t> &reverse) {
       int knn = KNN.M();
 
       FortranLinalg::DenseVector<TPrecision> ys;
       if(smooth){
         ys = FortranLinalg::DenseVector<TPrecision>(y.N());
-        for(unsigned int i=0; i< ys.N(); i++){
+        Parallel::forEach(0, ys.N(), [&](long i){
           ys(i) = 0;
           double wsum = 0;
           for(int k=0; k<knn; k++){
@@ -376,7 +517,7 @@ private:
             wsum += w;
           }
           ys(i) /= wsum;//*(knn+1)/2;
-        }
+        }, 1024);
         //y.deallocate();
         y = ys;
       }
@@ -386,142 +527,95 @@ private:
 
 
       KNNG = FortranLinalg::DenseMatrix<int>(2, m_sampleCount);
-      FortranLinalg::Linalg<int>::Set(KNNG, -1);
-      FortranLinalg::DenseMatrix<TPrecision> G = FortranLinalg::DenseMatrix<TPrecision>(2, m_sampleCount);
-      FortranLinalg::Linalg<TPrecision>::Zero(G);
 
-      // Ross added this Dec 2020.  This prevents longer connections from dominating.
-      float gradient_exp = 1.0f + 1.0e-4;
+      // Gradient along each KNN edge
+      std::vector<double> gradient((size_t) knn * m_sampleCount);
+      Parallel::forEach(0, m_sampleCount, [&](long i){
+        for (int k=0; k<knn; k++) {
+          gradient[(size_t) i * knn + k] = edgeGradient(ys(i), ys(KNN(k, i)), KNND(k, i));
+        }
+      }, 1024);
 
       // Compute steepest asc/descending neighbors
-      for (unsigned int i = 0; i < m_sampleCount; i++) {
-        //std::cout << "neighbors of sample " << i << ": ";
-        for (unsigned int k=0; k<KNN.M(); k++) {
-          //std::cout << KNN(k,i) << " ";
-          int j = KNN(k, i);
-          double d = pow(KNND(k, i), gradient_exp);   // prevents longer connections from dominating 
-          double g = ys(j) - ys(i);  // gradient computed
-          if (d == 0 ) {
-            g = 0;
-          } else {
-            g = g / d;  // d is distance between nodes, g is gradient, so we want to cache these steepest ascending/descending paths between nodes in order to use them to save the "extra" members of a crystal to show to the users 
-          }
+      Parallel::forEach(0, m_sampleCount, [&](long i){
+        steepestNeighbors(i, knn, reverse.data() + reverseStart[i], reverseStart[i + 1] - reverseStart[i],
+                          [&](size_t e) { return KNN.data()[e]; }, [&](size_t e) { return gradient[e]; },
+                          KNNG(0, i), KNNG(1, i));
+      }, 1024);
 
-          if (G(0, i) < g) {
-            G(0, i) = g;
-            KNNG(0, i) = j;
-          } else if (G(1, i) > g) {
-            G(1, i) = g;
-            KNNG(1, i) = j;
-          }          
-          if (G(0, j) < -g) {
-            G(0, j) = -g;
-            KNNG(0, j) = i;
-          } else if(G(1, j) > -g) {
-            G(1, j) = -g;
-            KNNG(1, j) = i;
-          }
+      //compute for each point its minimum and maximum based on
+      //steepest ascent/descent
+      std::vector<int> root[2];
+      std::vector<int> jump(m_sampleCount);
+      for(int e=0; e<2; e++){
+        // Pointer jumping: after round r every sample points 2^r steps
+        // along its path or to the extremum at its end
+        root[e].resize(m_sampleCount);
+        Parallel::forEach(0, m_sampleCount, [&](long i){
+          int next = KNNG(e, i);
+          root[e][i] = next == -1 ? i : next;
+        }, 4096);
+        for (bool changed = true; changed;) {
+          std::atomic<bool> anyChanged(false);
+          Parallel::forEachChunk(0, m_sampleCount, [&](long first, long last){
+            bool chunkChanged = false;
+            for (long i = first; i < last; i++) {
+              jump[i] = root[e][root[e][i]];
+              chunkChanged |= jump[i] != root[e][i];
+            }
+            if (chunkChanged) {
+              anyChanged = true;
+            }
+          }, 4096);
+          root[e].swap(jump);
+          changed = anyChanged;
         }
-        //std::cout << "\n";
       }
 
-      // print each samples neighbors of steepest ascent/descent and its value
-      // std::cout << "idx asc dec val\n";
-      // for (int i=0; i<m_sampleCount; i++) {
-      //   printf("%02d %02d %02d %0.6f\n", i, ascending(i), descending(i), ys(i));
-      // }
-      
-      //if(smooth){
-      // ys.deallocate();
-      //}
+      buildHierarchy(root[0], root[1]);
+    };
 
-      //compute for each point its minimum and maximum based on
-      //steepest ascent/descent
+    // Numbers the extrema the samples flow to and records the persistence
+    // simplification of the complex they span
+    void buildHierarchy(const std::vector<int> &maxRoot, const std::vector<int> &minRoot) {
       extrema = FortranLinalg::DenseMatrix<int>(2, m_sampleCount); 
-      FortranLinalg::Linalg<int>::Set(extrema, -1);
 
-      std::list<int> extremaL;
-      std::list<int> path;
+      // Extrema are numbered in order of the first sample that flows to
+      // them, maxima first
+      std::vector<int> extremaL;
       int nExt = 0;
       nMax = 0;
-      std::vector<int> nPnts;
+      std::vector<int> id(m_sampleCount);
       for(int e=0; e<2; e++){
-        for(unsigned int i=0; i<extrema.N(); i++){
-          
-/*
-          int current = i;
-          int prev = current;
-          while(current != -1) {
-            prev = current;
-            if(e==0){
-              current = ascending(prev);
-            }
-            else{
-              current = descending(prev);
-            }
-          }
-          int ind = 0;
-          for(std::list<int>::iterator it = extremaL.begin();  it!=extremaL.end(); ++it){
-            if((*it) == prev){
-              break; 
-            }
-            ++ind;
-          }      
-          extrema(e, i) = ind;
-          if(ind == extremaL.size()){
-            extremaL.push_back(prev);  
+        const std::vector<int> &root = e == 0 ? maxRoot : minRoot;
+        std::fill(id.begin(), id.end(), -1);
+        for(unsigned int i=0; i<m_sampleCount; i++){
+          int &ext = id[root[i]];
+          if (ext == -1) {
+            extremaL.push_back(root[i]);
+            ext = nExt;
             nExt++;
-            if(e==0){
+            if (e==0) {
               nMax++;
             }
           }
-
-*/
-
-          if (extrema(e, i) == -1){
-            path.clear();
-            int prev = i;
-            while (prev != -1 && extrema(e, prev) == -1) {
-              path.push_back(prev);
-              if (e==0) {
-                prev = ascending(prev);
-              }
-              else {
-                prev = descending(prev);
-              }
-            }
-            int ext = -1;
-            if (prev == -1) {
-              int extIndex = path.back();
-              extremaL.push_back(extIndex);
-              ext = nExt;
-              nExt++;
-              if (e==0) {
-                //std::cout << i <<"th sample wins! gotta max: " << extIndex <<std::endl;
-                nMax++;
-              }
-            }
-            else {
-              ext = extrema(e, prev);
-            }
-            for (std::list<int>::iterator it = path.begin(); it!=path.end(); ++it) {
-              extrema(e, *it) = ext;
-            }   
-          }
-
+          extrema(e, i) = ext;
         }
       }
 
 
       // Setup crystals for zero peristence level
       //TODO Put samples belonging to crystal here? - Ask Kyli
-      int crystalID = 0;
+      std::vector<std::pair<int, int>> crystals(extrema.N());
       for(unsigned int i=0; i<extrema.N(); i++){
-        std::pair<int, int> id(extrema(0, i), extrema(1, i));
-        if(crystals.find(id) == crystals.end()){
-          crystals[id] = crystalID;
-          ++crystalID;
-        }
+        crystals[i] = std::make_pair(extrema(0, i), extrema(1, i));
+      }
+      std::sort(crystals.begin(), crystals.end());
+      crystals.erase(std::unique(crystals.begin(), crystals.end()), crystals.end());
+      std::vector<int> sampleCrystals(extrema.N());
+      for(unsigned int i=0; i<extrema.N(); i++){
+        sampleCrystals[i] = std::lower_bound(crystals.begin(), crystals.end(),
+            std::make_pair(extrema(0, i), extrema(1, i))) - crystals.begin();
       }
 
       // Persistence
@@ -532,19 +626,16 @@ private:
       extremaIndex = FortranLinalg::DenseVector<int>(nExt);
       merge = FortranLinalg::DenseVector<int>(nExt);
       int index = 0;
-      for(std::list<int>::iterator it = extremaL.begin(); it != extremaL.end(); ++it, ++index){
+      for(std::vector<int>::iterator it = extremaL.begin(); it != extremaL.end(); ++it, ++index){
         extremaIndex(index) = *it;
       }
-
-      // <ctc> printed same indices below and confirmed they are identical
-      // for(unsigned int i=0; i<extrema.N(); i++){      
-      //   printf("index %d: min: %d, max: %d \n", i, extremaIndex(extrema(1,i)), extremaIndex(extrema(0,i)));
-      // }
+      hierarchy = MergeHierarchy<TPrecision>(nMax, extremaL, crystals, sampleCrystals);
 
       // Inital persistencies
       // Store as pairs of extrema such thats p.first merges to p.second (e.g.
-      // p.second is the max/min with the larger/smaller function value
-      map_pi_f pinv;
+      // p.second is the max/min with the larger/smaller function value), the
+      // lowest saddle of each pair is kept
+      std::vector<Merge> saddles;
       for(int e=0; e<2; e++){
         for(unsigned int i=0; i < extrema.N(); i++){
           int e1 = extrema(e, i);
@@ -578,61 +669,52 @@ private:
                 pers = std::max(y(i), y(KNN(k, i))) - y(extremaIndex(p.first));
                 //pers = l2.distance(X, extremaIndex(e1), X, extremaIndex(e2) ); 
               }
-
-              map_pi_f_it it = pinv.find(p);
-              if(it!=pinv.end()){
-                TPrecision tmp = (*it).second;
-                if(pers < tmp){
-                  (*it).second = pers;
-                }
-              }
-              else{
-                pinv[p] = pers;
-              }
+              saddles.push_back(Merge{pers, p.first, p.second});
             }
           }
         }
       }
-      
-
-      for(map_pi_f_it it = pinv.begin(); it != pinv.end(); ++it){
-        persistence[(*it).second] = (*it).first;
-      }
+      std::sort(saddles.begin(), saddles.end(), [](const Merge &a, const Merge &b){
+          return std::tie(a.first, a.second, a.persistence) < std::tie(b.first, b.second, b.persistence);
+        });
+      saddles.erase(std::unique(saddles.begin(), saddles.end(), [](const Merge &a, const Merge &b){
+          return a.first == b.first && a.second == b.second;
+        }), saddles.end());
+      std::sort(saddles.begin(), saddles.end(), [](const Merge &a, const Merge &b){
+          return std::tie(a.persistence, a.first, a.second) < std::tie(b.persistence, b.first, b.second);
+        });
 
 
       // Compute final persistencies - Recursively merge smallest persistence
-      // Extrema and update remaining peristencies depending on the merge
+      // Extrema and update remaining peristencies depending on the merge.
+      // Pairs are processed by (persistence, insertion order), so pairs of
+      // equal persistence all take part in their sorted order.
       for(unsigned int i=0; i<merge.N(); i++){
         merge(i) = i;
       } 
       
-      map_f_pi ptmp;
-      map_pi_f pinv2;
-      while(!persistence.empty()){
-        map_f_pi_it it = persistence.begin(); 
-        std::pair<int, int> p = (*it).second;
+      typedef std::tuple<TPrecision, long, int, int> Entry;
+      std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+      long sequence = 0;
+      for(; sequence < (long) saddles.size(); sequence++){
+        const Merge &m = saddles[sequence];
+        queue.push(Entry(m.persistence, sequence, m.first, m.second));
+      }
+      saddles.clear();
+      saddles.shrink_to_fit();
+
+      while(!queue.empty()){
+        Entry top = queue.top();
+        queue.pop();
 	
         // Store old extrema merging pair and persistence
-        std::pair<int, int> pold = p;
-        double pers = (*it).first;
+        std::pair<int, int> pold(std::get<2>(top), std::get<3>(top));
+        double pers = std::get<0>(top);
 
         // Find new marging pair, based on possible previous merges
         // Make sure that p.first is the less significant extrema as before
-        p.first = followChain(p.first);
-        p.second = followChain(p.second);
-        if(p.first < nMax){
-          if( y(extremaIndex(p.first)) > y(extremaIndex(p.second)) ){ 
-            std::swap(p.second, p.first); 
-          }
-        }
-        else{
-          if( y(extremaIndex(p.first)) < y(extremaIndex(p.second)) ){ 
-            std::swap(p.second, p.first);
-          }
-        }
-        
-        // Remove current merge pair from list
-        persistence.erase(it);
+        std::pair<int, int> p(followChain(pold.first), followChain(pold.second));
+        orient(p);
 
         // Are the extrema already merged?
         if(p.first == p.second) continue;
@@ -649,21 +731,16 @@ private:
         if( diff > 0  ){
           // If the persistence increased insert into the persistence list and
           // merge possible other extrema with smaller persistence values first
-          double npers = pers + diff;
-          persistence[npers] = p;
+          TPrecision npers = pers + diff;
+          queue.push(Entry(npers, sequence++, p.first, p.second));
         }
-        // Otherwise merge the pair
+        // Otherwise merge the pair, p.first is a root so it was not merged
+        // before
         else{
-          // Check if the pair has not been previously merged
-          map_pi_f_it invIt = pinv2.find(p);
-          if(pinv2.end() == invIt){
-            merge(p.first) = p.second;
-            ptmp[pers] = p;
-            pinv2[p] = pers;
-          }
+          merge(p.first) = p.second;
+          hierarchy.addMerge(pers, p.first, p.second);
         }
       }
-      persistence = ptmp;
 
 #if 0
       printf("\nROUND 2... FIGHT!\n");
@@ -678,19 +755,15 @@ private:
       }
       
       printf("\nStarting crystals:\n");
-      for (map_pi_i_it it = crystals.begin(); it != crystals.end(); ++it) {
-        std::pair<int, int> p = (*it).first;
-        auto min_xid = p.second;
-        auto max_xid = p.first;
-        auto min_sid = extremaIndex(min_xid);
-        auto max_sid = extremaIndex(max_xid);
-        auto cid = (*it).second;
+      for (unsigned int cid = 0; cid < crystals.size(); cid++) {
+        auto min_sid = extremaIndex(crystals[cid].second);
+        auto max_sid = extremaIndex(crystals[cid].first);
         printf("crystal %d: min: %d, max: %d\n", cid, min_sid, max_sid);
       }
 #endif
 
       // Initialize to 0 persistence
-      mergePersistence(0);  
+      mergeLevel(0);
     };
 
 
@@ -3,6 +3,8 @@
 #include "dataset/Precision.h"
 #include <tclap/CmdLine.h>
 
+#include <fstream>
+
 
 int main(int argc, char **argv){
   using namespace FortranLinalg;
@@ -30,6 +32,17 @@ int main(int argc, char **argv){
       "float value");
   cmd.add(epsArg);
 
+  TCLAP::SwitchArg kdArg("t","kdtree","Use a kd-tree for the nearest neighbor "
+      "search, approximate for epsilon > 0", false);
+  TCLAP::SwitchArg hnswArg("","hnsw","Use an approximate HNSW index for the "
+      "nearest neighbor search", false);
+  cmd.add(kdArg);
+  cmd.add(hnswArg);
+
+  TCLAP::ValueArg<std::string> hArg("m","hierarchy","Write the merge hierarchy "
+      "of all persistence levels to this file", false, "", "filename");
+  cmd.add(hArg);
+
   try{
     cmd.parse( argc, argv );
   } 
@@ -46,7 +59,14 @@ int main(int argc, char **argv){
   int knn = knnArg.getValue();
   
 
-  NNMSComplex<Precision> msc(X, y, knn, false, eps);
+  NNSearch search = NNSearch::BruteForce;
+  if (kdArg.getValue()) {
+    search = NNSearch::KDTree;
+  }
+  else if (hnswArg.getValue()) {
+    search = NNSearch::HNSW;
+  }
+  NNMSComplex<Precision> msc(X, y, knn, false, eps, 0, search);
   msc.mergePersistence(plevel);
 
   DenseVector<int> crystals = msc.getPartitions();
@@ -64,6 +84,10 @@ int main(int argc, char **argv){
 
   LinalgIO<int>::writeVector("crystals.data", crystals);
   LinalgIO<int>::writeMatrix("extrema.data",    extrema);
+  if (!hArg.getValue().empty()) {
+    std::ofstream out(hArg.getValue().c_str(), std::ios::binary);
+    msc.getHierarchy().write(out);
+  }
    
   crystals.deallocate();
   extrema.deallocate();
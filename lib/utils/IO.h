@@ -12,6 +12,8 @@
 #include <sstream>
 #include <iomanip>
 #include <list>
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
 #include <sys/stat.h>
 
@@ -126,6 +128,20 @@ public:
     return std::move<Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>(M);
   }
 
+  /*
+   * Writes a column-major rows x cols matrix as filename plus filename.dims, the format readBinMatrix<T, Eigen::ColMajor> reads.
+   */
+  template<typename T>
+  static void writeBinMatrix(const std::string &filename, const T *data, unsigned rows, unsigned cols)
+  {
+    static_assert(std::is_same<T, float>::value || std::is_same<T, double>::value, "binary matrices are float32 or float64");
+    std::ofstream vals(filename, std::ios::binary);
+    if (!vals.is_open()) { throw(std::runtime_error("could not open binary file for writing matrix")); }
+    vals.write(reinterpret_cast<const char*>(data), sizeof(T) * rows * cols);
+    std::ofstream dims(filename + ".dims");
+    dims << rows << " " << cols << " " << (std::is_same<T, float>::value ? "float32" : "float64");
+  }
+
 };
 
 #endif
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Minimal fork-join helpers used by the compute kernels (distances, KNN, topology).
+ * Work items are handed out dynamically in chunks of `grain` so uneven items
+ * (e.g. triangular distance tiles) still balance across threads.
+ */
+class Parallel {
+ public:
+  // number of worker threads: the count set by setThreadCount, otherwise
+  // DSPACEX_NUM_THREADS as read on the first call, otherwise the hardware count
+  static unsigned int threadCount() {
+    unsigned int count = requestedCount().load();
+    if (count > 0) {
+      return count;
+    }
+    static const unsigned int defaultCount = [] {
+      const char *env = std::getenv("DSPACEX_NUM_THREADS");
+      int requested = env ? std::atoi(env) : 0;
+      return requested > 0 ? (unsigned int) requested : std::max(1u, std::thread::hardware_concurrency());
+    }();
+    return defaultCount;
+  }
+
+  // overrides the number of worker threads of the process, 0 restores the
+  // default of threadCount
+  static void setThreadCount(unsigned int count) {
+    requestedCount() = count;
+  }
+
+  // calls f(i) for every i in [begin, end), potentially concurrently
+  template<typename Function>
+  static void forEach(long begin, long end, Function f, long grain = 1) {
+    forEachChunk(begin, end, [&f](long first, long last) {
+        for (long i = first; i < last; i++) {
+          f(i);
+        }
+      }, grain);
+  }
+
+  // calls f(first, last) for consecutive chunks covering [begin, end); calls
+  // made from inside f run serially on the calling thread
+  template<typename Function>
+  static void forEachChunk(long begin, long end, Function f, long grain = 1) {
+    if (end <= begin) {
+      return;
+    }
+    grain = std::max(1L, grain);
+    long nChunks = (end - begin + grain - 1) / grain;
+    unsigned int nThreads = std::min<long>(threadCount(), nChunks);
+    if (nThreads <= 1 || nested()) {
+      f(begin, end);
+      return;
+    }
+
+    std::atomic<long> next(begin);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto worker = [&]() {
+      nested() = true;
+      try {
+        for (long first = next.fetch_add(grain); first < end; first = next.fetch_add(grain)) {
+          f(first, std::min(end, first + grain));
+        }
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        next = end;
+      }
+      nested() = false;
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int t = 1; t < nThreads; t++) {
+      threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+ private:
+  static std::atomic<unsigned int> &requestedCount() {
+    static std::atomic<unsigned int> count(0);
+    return count;
+  }
+
+  // whether this thread is running chunks of a forEachChunk call
+  static bool &nested() {
+    static thread_local bool inside = false;
+    return inside;
+  }
+};
@@ -4,27 +4,19 @@
 #include "DenseVectorSample.h"
 #include "flinalg/DenseMatrix.h"
 #include "hdprocess/HDGenericProcessor.h"
+#include "metrics/Distance.h"
 
 #include <Eigen/Dense>
 #include <limits>
 
 namespace HDProcess {
 
+/*
+ * Returns the Euclidean distances between the columns (samples) of x.
+ */
 template<typename T>
 FortranLinalg::DenseMatrix<T> computeDistanceMatrix(FortranLinalg::DenseMatrix<T> &x) {
-  std::vector<DenseVectorSample*> samples;
-  for (int j = 0; j < x.N(); j++) {
-    FortranLinalg::DenseVector<T> vector(x.M());
-    for (int i = 0; i < x.M(); i++) {
-      vector(i) = x(i, j);
-    }
-    DenseVectorSample *sample = new DenseVectorSample(vector);
-    samples.push_back(sample);
-  }
-
-  HDGenericProcessor<DenseVectorSample, DenseVectorEuclideanMetric> genericProcessor;
-  DenseVectorEuclideanMetric metric;
-  return genericProcessor.computeDistances(samples, metric);
+  return Distance<T>::computeEuclideanDistances(x);
 }
 
 } // HDProcess
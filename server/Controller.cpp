@@ -8,19 +8,26 @@
 #include "flinalg/LinalgIO.h"
 #include "hdprocess/HDGenericProcessor.h"
 #include "hdprocess/LegacyTopologyDataImpl.h"
+#include "hdprocess/ParameterSweep.h"
 #include "hdprocess/SimpleHDVizDataImpl.h"
 #include "hdprocess/TopologyData.h"
+#include "hdprocess/LandmarkAgreement.h"
+#include "dimred/MetricMDS.h"
+#include "metrics/Wasserstein.h"
+#include "morsesmale/MultiFieldMSComplex.h"
 #include <jsoncpp/json/json.h>
 #include "dataset/Precision.h"
 #include "dataset/ValueIndexPair.h"
 #include "serverlib/wst.h"
 #include "utils/DenseVectorSample.h"
+#include "utils/Parallel.h"
 #include "utils/loaders.h"
 #include "utils/utils.h"
 #include "pmodels/Model.h"
 #include "utils/Data.h"
 
 #include <cassert>
+#include <cctype>
 #include <algorithm>
 #include <cmath>
 #include <cstdlib>
@@ -51,6 +58,10 @@ using namespace std::placeholders;
 // Maximum number of directories from root path to seek config.yaml files
 const int MAX_DATASET_DEPTH = 6;
 
+// Metric of the Euclidean distances between geometry samples, the only one
+// the HNSW neighbor index answers
+const std::string GEOMETRY_METRIC = "euclidean";
+
 
 Controller::Controller(const std::string &datapath_) : datapath(datapath_) {
   configureCommandHandlers();
@@ -81,7 +92,12 @@ void Controller::configureCommandHandlers() {
   m_commandMap.insert({"fetchNodeColors", std::bind(&Controller::fetchNodeColors, this, _1, _2)});
   m_commandMap.insert({"fetchMorseSmaleRegression", std::bind(&Controller::fetchMorseSmaleRegression, this, _1, _2)});
   m_commandMap.insert({"fetchMorseSmaleExtrema", std::bind(&Controller::fetchMorseSmaleExtrema, this, _1, _2)});
+  m_commandMap.insert({"fetchMorseSmaleFieldSummary", std::bind(&Controller::fetchMorseSmaleFieldSummary, this, _1, _2)});
+  m_commandMap.insert({"fetchParameterSweep", std::bind(&Controller::fetchParameterSweep, this, _1, _2)});
+  m_commandMap.insert({"insertSamples", std::bind(&Controller::insertSamples, this, _1, _2)});
+  m_commandMap.insert({"fetchLandmarkAgreement", std::bind(&Controller::fetchLandmarkAgreement, this, _1, _2)});
   m_commandMap.insert({"fetchCrystal", std::bind(&Controller::fetchCrystal, this, _1, _2)});
+  m_commandMap.insert({"fetchCrystalDistances", std::bind(&Controller::fetchCrystalDistances, this, _1, _2)});
   m_commandMap.insert({"fetchParameter", std::bind(&Controller::fetchParameter, this, _1, _2)});
   m_commandMap.insert({"fetchQoi", std::bind(&Controller::fetchQoi, this, _1, _2)});
   m_commandMap.insert({"fetchThumbnails", std::bind(&Controller::fetchThumbnails, this, _1, _2)});
@@ -266,15 +282,75 @@ void Controller::fetchKNeighbors(const Json::Value &request, Json::Value &respon
   if (k < 0) return setError(response, "invalid knn");
 
   auto metric = request["metric"].asString();
+  bool geometryMetric = metric == GEOMETRY_METRIC && m_currentDataset->hasGeometryMatrix();
+  if (!m_currentDataset->hasDistanceMatrix(metric) && !m_currentDataset->hasNeighborGraph(metric) && !geometryMetric)
+    return setError(response, "invalid metric");
+
+  // Metrics given as a knn graph answer from the graph.
+  if (!m_currentDataset->hasDistanceMatrix(metric) && m_currentDataset->hasNeighborGraph(metric)) {
+    auto &graph = m_currentDataset->getNeighborGraph(metric);
+    if (k > (int) graph.k())
+      return setError(response, "knn exceeds the neighbors of the graph");
+    response["datasetId"] = m_currentDatasetId;
+    response["k"] = k;
+    response["approximate"] = false;
+    response["graph"] = Json::Value(Json::arrayValue);
+    for (unsigned i = 0; i < k; i++) {
+      Json::Value row = Json::Value(Json::arrayValue);
+      for (unsigned int j = 0; j < graph.N(); j++) {
+        row.append(graph.indices(i, j));
+      }
+      response["graph"].append(row);
+    }
+    return;
+  }
 
-  // TODO: cache results of this search if it takes too long to repeat
-  int n = m_currentDataset->getDistanceMatrix(metric).N();
-  auto KNN = FortranLinalg::DenseMatrix<int>(k, n);
-  auto KNND = FortranLinalg::DenseMatrix<Precision>(k, n);
-  Distance<Precision>::findKNN(m_currentDataset->getDistanceMatrix(metric), KNN, KNND);
+  // The Euclidean metric of the geometry without a distance matrix (or when
+  // asked to) searches through an HNSW index, built on first use and kept
+  // with the dataset.
+  bool approximate = request.isMember("approximate") ? request["approximate"].asBool()
+                                                     : !m_currentDataset->hasDistanceMatrix(metric);
+  if (approximate && !geometryMetric)
+    return setError(response, "approximate neighbors require the " + GEOMETRY_METRIC + " metric of a geometry matrix");
+  if (!approximate && !m_currentDataset->hasDistanceMatrix(metric))
+    return setError(response, "exact neighbors require a distance matrix for metric " + metric);
+
+  FortranLinalg::DenseMatrix<int> KNN;
+  FortranLinalg::DenseMatrix<Precision> KNND;
+  if (approximate) {
+    if (!m_currentNeighborIndex)
+      m_currentNeighborIndex.reset(new HNSW<Precision>(m_currentDataset->getGeometryMatrix()));
+    int n = m_currentNeighborIndex->size();
+    k = std::min(k, n - 1);
+
+    // the index returns each sample as its own nearest neighbor, drop it
+    // to match findKNN
+    auto selfKNN = FortranLinalg::DenseMatrix<int>(k + 1, n);
+    auto selfKNND = FortranLinalg::DenseMatrix<Precision>(k + 1, n);
+    m_currentNeighborIndex->computeKNN(selfKNN, selfKNND);
+    KNN = FortranLinalg::DenseMatrix<int>(k, n);
+    KNND = FortranLinalg::DenseMatrix<Precision>(k, n);
+    for (int i = 0; i < n; i++) {
+      for (int j = 0, o = 0; j < k; j++, o++) {
+        if (selfKNN(o, i) == i) o++;
+        KNN(j, i) = selfKNN(o, i);
+        KNND(j, i) = selfKNND(o, i);
+      }
+    }
+    selfKNN.deallocate();
+    selfKNND.deallocate();
+  }
+  else {
+    // TODO: cache results of this search if it takes too long to repeat
+    int n = m_currentDataset->getDistanceMatrix(metric).N();
+    KNN = FortranLinalg::DenseMatrix<int>(k, n);
+    KNND = FortranLinalg::DenseMatrix<Precision>(k, n);
+    Distance<Precision>::findKNN(m_currentDataset->getDistanceMatrix(metric), KNN, KNND);
+  }
 
   response["datasetId"] = m_currentDatasetId;
   response["k"] = k;
+  response["approximate"] = approximate;
   response["graph"] = Json::Value(Json::arrayValue);
   for (unsigned i = 0; i < KNN.M(); i++) {
     Json::Value row = Json::Value(Json::arrayValue);
@@ -283,6 +359,8 @@ void Controller::fetchKNeighbors(const Json::Value &request, Json::Value &respon
       response["graph"][i].append(KNN(i, j));
     }
   }
+  KNN.deallocate();
+  KNND.deallocate();
 }
 
 /**
@@ -631,6 +709,486 @@ void Controller::fetchCrystal(const Json::Value &request, Json::Value &response)
   response["crystalExtrema"].append(extrema.second); // min
 }
 
+/*
+ * Returns Wasserstein-2 distances between Gaussian summaries (sample mean and
+ * covariance, optionally truncated to the rank largest variances) of the
+ * crystals of a range of persistence levels. All crystals of the range form
+ * one matrix, so crystals compare within and across persistence levels.
+ */
+void Controller::fetchCrystalDistances(const Json::Value &request, Json::Value &response) {
+  if (!maybeLoadDataset(request, response))
+    return setError(response, "invalid datasetId");
+
+  if (!maybeProcessData(request, response))
+    return; // response will contain the error
+
+  if (!m_currentDataset->hasGeometryMatrix())
+    return setError(response, "crystal distances require a geometry matrix");
+
+  int minLevel = m_currentTopoData->getMinPersistenceLevel();
+  int maxLevel = m_currentTopoData->getMaxPersistenceLevel();
+  int first = request.isMember("minPersistence") ? request["minPersistence"].asInt() : minLevel;
+  int last = request.isMember("maxPersistence") ? request["maxPersistence"].asInt() : maxLevel;
+  if (first < minLevel || last > maxLevel || first > last)
+    return setError(response, "invalid persistence range");
+  int rank = request.isMember("rank") ? request["rank"].asInt() : 0;
+  if (rank < 0)
+    return setError(response, "invalid rank");
+
+  // (persistence, crystal) of every summary
+  auto &crystals = m_currentVizData->getAllCrystals();
+  std::vector<std::pair<int, int>> ids;
+  for (int p = first; p <= last; p++) {
+    for (int c = 0; c < crystals[p].size(); c++) {
+      ids.push_back({p, c});
+    }
+  }
+
+  auto &X = m_currentDataset->getGeometryMatrix();
+  std::vector<FortranLinalg::DenseVector<Precision>> means(ids.size());
+  std::vector<FortranLinalg::DenseMatrix<Precision>> U(ids.size());
+  std::vector<FortranLinalg::DenseVector<Precision>> S(ids.size());
+  Parallel::forEach(0, ids.size(), [&](long i) {
+    std::vector<unsigned int> indices;
+    for (auto vip: crystals[ids[i].first][ids[i].second]) {
+      indices.push_back(vip.idx);
+    }
+    Wasserstein<Precision>::summarize(X, indices, rank, means[i], U[i], S[i]);
+  });
+  auto D = Wasserstein<Precision>::distances(means, U, S);
+
+  response["datasetId"] = m_currentDatasetId;
+  response["rank"] = rank;
+  response["crystals"] = Json::Value(Json::arrayValue);
+  for (auto &id : ids) {
+    Json::Value crystal(Json::objectValue);
+    crystal["persistence"] = id.first;
+    crystal["crystalID"] = id.second;
+    crystal["numberOfSamples"] = static_cast<int>(crystals[id.first][id.second].size());
+    response["crystals"].append(crystal);
+  }
+  response["distances"] = Json::Value(Json::arrayValue);
+  for (unsigned int i = 0; i < D.M(); i++) {
+    Json::Value row(Json::arrayValue);
+    for (unsigned int j = 0; j < D.N(); j++) {
+      row.append(D(i, j));
+    }
+    response["distances"].append(row);
+  }
+
+  D.deallocate();
+  for (unsigned int i = 0; i < ids.size(); i++) {
+    means[i].deallocate();
+    U[i].deallocate();
+    S[i].deallocate();
+  }
+}
+
+/**
+ * Persistence of the Morse-Smale complexes of all fields of a category, the
+ * qois by default, computed together over one knn graph.
+ * Optional request fields: category, metric, knn, datasigma and normalize,
+ * defaulting to the current processing parameters.
+ */
+void Controller::fetchMorseSmaleFieldSummary(const Json::Value &request, Json::Value &response) {
+  if (!maybeLoadDataset(request, response))
+    return setError(response, "invalid datasetId");
+
+  auto category  = request.isMember("category")  ? Fieldtype(request["category"].asString()) : Fieldtype(Fieldtype::QoI);
+  auto metric    = request.isMember("metric")    ? request["metric"].asString()              : m_currentDistanceMetric;
+  auto knn       = request.isMember("knn")       ? request["knn"].asInt()                    : m_currentKNN;
+  auto datasigma = request.isMember("datasigma") ? request["datasigma"].asFloat()            : m_currentSmoothDataSigma;
+  auto normalize = request.isMember("normalize") ? request["normalize"].asBool()             : m_currentNormalize;
+
+  if (category != Fieldtype::QoI && category != Fieldtype::DesignParameter)
+    return setError(response, "invalid category");
+  if (!m_currentDataset->hasDistanceMatrix(metric) && !m_currentDataset->hasNeighborGraph(metric))
+    return setError(response, "invalid distance metric");
+  if (knn <= 0)
+    return setError(response, "knn must be > 0");
+  if (datasigma < 0)
+    return setError(response, "datasigma must be >= 0");
+
+  bool qois = category == Fieldtype::QoI;
+  auto names = qois ? m_currentDataset->getQoiNames() : m_currentDataset->getParameterNames();
+  std::vector<FortranLinalg::DenseVector<Precision>> fields;
+  for (unsigned int f = 0; f < names.size(); f++) {
+    fields.push_back(qois ? m_currentDataset->getQoiVector(f, normalize)
+                          : m_currentDataset->getParameterVector(f, normalize));
+  }
+
+  std::unique_ptr<MultiFieldMSComplex<Precision>> batch;
+  if (m_currentDataset->hasDistanceMatrix(metric)) {
+    batch.reset(new MultiFieldMSComplex<Precision>(m_currentDataset->getDistanceMatrix(metric), knn));
+  } else {
+    batch.reset(new MultiFieldMSComplex<Precision>(m_currentDataset->getNeighborGraph(metric), knn));
+  }
+  auto complexes = batch->compute(fields, datasigma > 0, datasigma * datasigma);
+
+  response["datasetId"] = m_currentDatasetId;
+  response["category"] = qois ? "qoi" : "parameter";
+  response["metric"] = metric;
+  response["k"] = static_cast<int>(batch->k());
+  response["fields"] = Json::Value(Json::arrayValue);
+  for (unsigned int f = 0; f < names.size(); f++) {
+    auto &hierarchy = complexes[f]->getHierarchy();
+    // scaled to [0,1] by the field range as by HDProcessor
+    Precision frange = FortranLinalg::Linalg<Precision>::Max(fields[f]) - FortranLinalg::Linalg<Precision>::Min(fields[f]);
+    Json::Value field(Json::objectValue);
+    field["fieldname"] = names[f];
+    field["persistence"] = Json::Value(Json::arrayValue);
+    field["complexSizes"] = Json::Value(Json::arrayValue);
+    std::vector<std::pair<int, int>> pairs;
+    std::vector<int> crystalIDs;
+    for (unsigned int level = 0; level < hierarchy.levelCount(); level++) {
+      bool last = level + 1 == hierarchy.levelCount();
+      field["persistence"].append(last || frange == 0 ? 1.0 : hierarchy.persistence(level) / frange);
+      hierarchy.crystalsAt(level, pairs, crystalIDs);
+      field["complexSizes"].append(static_cast<int>(pairs.size()));
+    }
+    response["fields"].append(field);
+    complexes[f]->cleanup();
+  }
+  batch->deallocate();
+}
+
+/**
+ * Stability of the decomposition of one field over a grid of knn, datasigma
+ * and curvesigma values, sharing one neighbor graph of the largest knn.
+ * Request fields: knns, datasigmas and curvesigmas (arrays, defaulting to the
+ * current value), and category, fieldname, metric and normalize (defaulting
+ * to the current field). Regression errors need a geometry matrix.
+ */
+void Controller::fetchParameterSweep(const Json::Value &request, Json::Value &response) {
+  if (!maybeLoadDataset(request, response))
+    return setError(response, "invalid datasetId");
+
+  auto category  = request.isMember("category")  ? Fieldtype(request["category"].asString()) : m_currentCategory;
+  auto fieldname = request.isMember("fieldname") ? request["fieldname"].asString()           : m_currentField;
+  auto metric    = request.isMember("metric")    ? request["metric"].asString()              : m_currentDistanceMetric;
+  auto normalize = request.isMember("normalize") ? request["normalize"].asBool()             : m_currentNormalize;
+  auto readList = [&request](const std::string &name, Precision current) {
+    std::vector<Precision> values;
+    for (auto &value : request[name]) {
+      values.push_back(value.asFloat());
+    }
+    if (values.empty()) {
+      values.push_back(current);
+    }
+    return values;
+  };
+  auto knnValues = readList("knns", m_currentKNN);
+  auto datasigmas = readList("datasigmas", m_currentSmoothDataSigma);
+  auto curvesigmas = readList("curvesigmas", m_currentSmoothCurveSigma);
+  std::vector<int> knns(knnValues.begin(), knnValues.end());
+
+  if (!category.valid() || !verifyFieldname(category, fieldname))
+    return setError(response, "invalid fieldname");
+  if (!m_currentDataset->hasDistanceMatrix(metric) && !m_currentDataset->hasNeighborGraph(metric))
+    return setError(response, "invalid distance metric");
+  for (auto knn : knns)
+    if (knn <= 0) return setError(response, "knns must be > 0");
+  for (auto sigma : datasigmas)
+    if (sigma < 0) return setError(response, "datasigmas must be >= 0");
+  for (auto sigma : curvesigmas)
+    if (sigma <= 0) return setError(response, "curvesigmas must be > 0");
+
+  auto fieldvals = m_currentDataset->getFieldvalues(fieldname, category, normalize);
+  auto field = FortranLinalg::DenseVector<Precision>(fieldvals.size(), fieldvals.data());
+  int maxKnn = *std::max_element(knns.begin(), knns.end());
+  std::unique_ptr<ParameterSweep> sweep;
+  if (m_currentDataset->hasDistanceMatrix(metric)) {
+    sweep.reset(new ParameterSweep(m_currentDataset->getDistanceMatrix(metric), maxKnn));
+  } else {
+    sweep.reset(new ParameterSweep(m_currentDataset->getNeighborGraph(metric)));
+  }
+  if (maxKnn > sweep->maxKnn()) {
+    auto available = sweep->maxKnn();
+    sweep->deallocate();
+    return setError(response, "knns exceed the " + std::to_string(available) + " neighbors of metric " + metric);
+  }
+
+  auto X = m_currentDataset->hasGeometryMatrix() ? m_currentDataset->getGeometryMatrix()
+                                                 : FortranLinalg::DenseMatrix<Precision>();
+  SweepResult result;
+  try {
+    result = sweep->run(field, knns, datasigmas, curvesigmas, X);
+  } catch (const std::exception &e) {
+    sweep->deallocate();
+    return setError(response, e.what());
+  }
+  sweep->deallocate();
+
+  response["datasetId"] = m_currentDatasetId;
+  response["fieldname"] = fieldname;
+  response["metric"] = metric;
+  response["curvesigmas"] = Json::Value(Json::arrayValue);
+  for (auto sigma : curvesigmas) {
+    response["curvesigmas"].append(sigma);
+  }
+  response["settings"] = Json::Value(Json::arrayValue);
+  for (auto &summary : result.summaries) {
+    Json::Value setting(Json::objectValue);
+    setting["knn"] = summary.knn;
+    setting["datasigma"] = summary.sigmaSmooth;
+    setting["persistence"] = Json::Value(Json::arrayValue);
+    setting["complexSizes"] = Json::Value(Json::arrayValue);
+    for (unsigned int level = 0; level < summary.persistence.size(); level++) {
+      setting["persistence"].append(summary.persistence[level]);
+      setting["complexSizes"].append(summary.crystalCounts[level]);
+    }
+    setting["stableLevel"] = summary.stableLevel;
+    setting["stableGap"] = summary.stableGap;
+    setting["regressionErrors"] = Json::Value(Json::arrayValue);
+    for (auto error : summary.regressionErrors) {
+      setting["regressionErrors"].append(error);
+    }
+    response["settings"].append(setting);
+  }
+  response["agreements"] = Json::Value(Json::arrayValue);
+  for (auto &agreement : result.agreements) {
+    Json::Value pair(Json::objectValue);
+    pair["first"] = agreement.first;
+    pair["second"] = agreement.second;
+    pair["adjustedRand"] = agreement.adjustedRand;
+    response["agreements"].append(pair);
+  }
+}
+
+/**
+ * Agreement of the landmark approximation of the decomposition of a field
+ * with its exact decomposition, both over the Euclidean distances of the
+ * geometry matrix. Request fields: landmarks, landmarkdensity, persistences
+ * (array of thresholds in [0,1], defaulting to 0.01, 0.05, 0.1 and 0.2), and
+ * category, fieldname, knn, datasigma and normalize (defaulting to the
+ * current values).
+ */
+void Controller::fetchLandmarkAgreement(const Json::Value &request, Json::Value &response) {
+  if (!maybeLoadDataset(request, response))
+    return setError(response, "invalid datasetId");
+
+  auto category  = request.isMember("category")  ? Fieldtype(request["category"].asString()) : m_currentCategory;
+  auto fieldname = request.isMember("fieldname") ? request["fieldname"].asString()           : m_currentField;
+  auto knn       = request.isMember("knn")       ? request["knn"].asInt()                    : m_currentKNN;
+  auto datasigma = request.isMember("datasigma") ? request["datasigma"].asFloat()            : m_currentSmoothDataSigma;
+  auto normalize = request.isMember("normalize") ? request["normalize"].asBool()             : m_currentNormalize;
+  auto landmarks = request.isMember("landmarks") ? request["landmarks"].asInt()              : m_currentLandmarks;
+  auto landmarkdensity = request.isMember("landmarkdensity") ? request["landmarkdensity"].asBool() : m_currentLandmarkDensity;
+  std::vector<Precision> persistences;
+  for (auto &value : request["persistences"]) {
+    persistences.push_back(value.asFloat());
+  }
+  if (persistences.empty()) {
+    persistences = {0.01, 0.05, 0.1, 0.2};
+  }
+
+  if (!category.valid() || !verifyFieldname(category, fieldname))
+    return setError(response, "invalid fieldname");
+  if (knn <= 0)
+    return setError(response, "knn must be > 0");
+  if (landmarks <= 0)
+    return setError(response, "landmarks must be > 0");
+  if (!m_currentDataset->hasGeometryMatrix())
+    return setError(response, "landmarks need the geometry of the samples");
+
+  auto fieldvals = m_currentDataset->getFieldvalues(fieldname, category, normalize);
+  auto field = FortranLinalg::DenseVector<Precision>(fieldvals.size(), fieldvals.data());
+  auto &geometry = m_currentDataset->getGeometryMatrix();
+  auto selection = landmarkdensity ? LandmarkSelection::Density : LandmarkSelection::Farthest;
+  std::vector<LandmarkAgreement> agreements;
+  try {
+    LandmarkMSComplex<Precision> approximate(geometry, field, landmarks, knn, selection,
+                                             datasigma > 0, datasigma * datasigma);
+    NNMSComplex<Precision> exact(geometry, field, knn, datasigma > 0, 0.01, datasigma * datasigma);
+    agreements = LandmarkAgreement::measure(exact, approximate, field, persistences);
+    exact.cleanup();
+    approximate.deallocate();
+  } catch (const std::exception &e) {
+    return setError(response, e.what());
+  }
+
+  response["datasetId"] = m_currentDatasetId;
+  response["fieldname"] = fieldname;
+  response["landmarks"] = landmarks;
+  response["agreements"] = Json::Value(Json::arrayValue);
+  for (auto &agreement : agreements) {
+    Json::Value level(Json::objectValue);
+    level["persistence"] = agreement.persistence;
+    level["exactCrystals"] = agreement.exactCrystals;
+    level["approximateCrystals"] = agreement.approximateCrystals;
+    level["adjustedRand"] = agreement.adjustedRand;
+    level["extremaError"] = agreement.extremaError;
+    response["agreements"].append(level);
+  }
+}
+
+/**
+ * Adds samples to the loaded dataset, e.g. new runs of an adaptive sampling
+ * campaign, and updates the current decomposition incrementally: the knn
+ * graph, steepest paths and extrema only change around the new samples, and
+ * the regressions of crystals whose samples did not change are reused. The
+ * first call after processing builds the incremental state once.
+ * Request fields, one entry per new sample:
+ *   parameters, qois: arrays of values in the order of the dataset's names
+ *   distances: object with for each distance metric the array of distances
+ *              to all samples, the existing ones first
+ *   geometry: array of coordinates, if the dataset has a geometry matrix
+ * New samples are placed at their nearest existing sample in the space of
+ * the regression curves, as Dataset::appendSamples places them in its
+ * embeddings, and field values are not perturbed by noise. When the new
+ * samples change the range of a normalized field, the complex is rescaled
+ * and only the crystal regressions are recomputed.
+ */
+void Controller::insertSamples(const Json::Value &request, Json::Value &response) {
+  if (!maybeLoadDataset(request, response))
+    return setError(response, "invalid datasetId");
+
+  if (!maybeProcessData(request, response))
+    return; // response will contain the error
+
+  auto metric = m_currentDistanceMetric;
+  if (!m_currentDataset->hasDistanceMatrix(metric))
+    return setError(response, "insertSamples needs a distance matrix for metric " + metric);
+  if (m_currentLandmarks > 0)
+    return setError(response, "insertSamples needs the exact complex (landmarks = 0)");
+
+  // new samples, one column each
+  unsigned int n0 = m_currentDataset->numberOfSamples();
+  unsigned int n = request["parameters"].size();
+  auto readColumns = [n](const Json::Value &rows, unsigned int m, FortranLinalg::DenseMatrix<Precision> &columns) {
+    if (rows.size() != n)
+      return false;
+    for (unsigned int j = 0; j < n; j++) {
+      if (rows[j].size() != m)
+        return false;
+    }
+    columns = FortranLinalg::DenseMatrix<Precision>(m, n);
+    for (unsigned int j = 0; j < n; j++) {
+      for (unsigned int i = 0; i < m; i++) {
+        columns(i, j) = rows[j][i].asFloat();
+      }
+    }
+    return true;
+  };
+  if (n == 0)
+    return setError(response, "no samples to insert");
+  FortranLinalg::DenseMatrix<Precision> parameters, qois, geometry;
+  std::map<std::string, FortranLinalg::DenseMatrix<Precision>> distances;
+  auto deallocate = [&]() {
+    parameters.deallocate();
+    qois.deallocate();
+    geometry.deallocate();
+    for (auto &d : distances) {
+      d.second.deallocate();
+    }
+  };
+  bool valid = readColumns(request["parameters"], m_currentDataset->getParameterNames().size(), parameters) &&
+               readColumns(request["qois"], m_currentDataset->getQoiNames().size(), qois);
+  for (auto &name : m_currentDataset->getDistanceMetricNames()) {
+    if (valid && m_currentDataset->hasDistanceMatrix(name)) {
+      valid = readColumns(request["distances"][name], n0 + n, distances[name]);
+    }
+  }
+  if (valid && m_currentDataset->hasGeometryMatrix()) {
+    valid = readColumns(request["geometry"], m_currentDataset->getGeometryMatrix().M(), geometry);
+  }
+  if (!valid) {
+    deallocate();
+    return setError(response, "each new sample needs its parameters, qois, distances for every metric and geometry");
+  }
+
+  // field values before the new samples, to detect a changed normalization
+  auto before = m_currentDataset->getFieldvalues(m_currentField, m_currentCategory, m_currentNormalize);
+  std::vector<Precision> previous(before.data(), before.data() + before.size());
+  try {
+    m_currentDataset->appendSamples(parameters, qois, distances, geometry);
+  } catch (const std::exception &e) {
+    deallocate();
+    return setError(response, e.what());
+  }
+  auto fieldvals = m_currentDataset->getFieldvalues(m_currentField, m_currentCategory, m_currentNormalize);
+  auto field = FortranLinalg::DenseVector<Precision>(fieldvals.size(), fieldvals.data());
+  auto &D = m_currentDataset->getDistanceMatrix(metric);
+  bool smooth = m_currentSmoothDataSigma > 0;
+  double sigma2 = m_currentSmoothDataSigma * m_currentSmoothDataSigma;
+
+  // normalizing over a larger range maps the values of the existing samples
+  // by a positive affine map, found from those that had the extreme values
+  bool rescaled = false;
+  Precision scale = 1, offset = 0;
+  if (m_incrementalComplex && !std::equal(previous.begin(), previous.end(), field.data())) {
+    auto extremes = std::minmax_element(previous.begin(), previous.end());
+    unsigned int low = extremes.first - previous.begin(), high = extremes.second - previous.begin();
+    scale = (field(high) - field(low)) / (previous[high] - previous[low]);
+    offset = field(low) - scale * previous[low];
+    rescaled = scale > 0 && std::isfinite(scale);
+    if (!rescaled)
+      clearIncrementalState();
+  }
+
+  // build the incremental state if there is none
+  bool rebuilt = !m_incrementalComplex;
+  unsigned int updated = n0 + n;
+  try {
+    if (rebuilt) {
+      clearIncrementalState();
+      m_incrementalComplex.reset(new IncrementalMSComplex<Precision>(
+          IncrementalMSComplex<Precision>::fromDistances(D, field, m_currentKNN, smooth, sigma2)));
+      m_incrementalProcessor.reset(new HDProcessor());
+      MetricMDS<Precision> mds;
+      auto dd = FortranLinalg::Linalg<Precision>::Copy(D);
+      m_incrementalLayout = mds.embed(dd, 3);
+      dd.deallocate();
+    }
+    else {
+      if (rescaled) {
+        // the flow is kept, the regressions are of the old values
+        m_incrementalComplex->rescale(scale, offset);
+        m_incrementalProcessor.reset(new HDProcessor());
+      }
+      FortranLinalg::DenseVector<Precision> fieldNew(n, field.data() + n0);
+      updated = m_incrementalComplex->insertDistances(distances.at(metric), fieldNew);
+
+      // new samples at their nearest existing sample
+      FortranLinalg::DenseMatrix<Precision> layout(m_incrementalLayout.M(), n0 + n);
+      std::copy(m_incrementalLayout.data(), m_incrementalLayout.data() + (size_t) layout.M() * n0, layout.data());
+      for (unsigned int j = 0; j < n; j++) {
+        Precision *column = D.data() + (size_t) (n0 + j) * D.M();
+        unsigned int nearest = std::min_element(column, column + n0) - column;
+        for (unsigned int d = 0; d < layout.M(); d++) {
+          layout(d, n0 + j) = m_incrementalLayout(d, nearest);
+        }
+      }
+      m_incrementalLayout.deallocate();
+      m_incrementalLayout = layout;
+    }
+
+    auto complex = m_incrementalComplex->complex();
+    m_currentVizData.reset(new SimpleHDVizDataImpl(m_incrementalProcessor->processComplex(
+        *complex, m_incrementalLayout, field, m_currentKNN, m_currentNumCurvepoints,
+        m_currentPersistenceDepth, m_currentSmoothCurveSigma)));
+    complex->cleanup();
+    m_currentTopoData.reset(new LegacyTopologyDataImpl(m_currentVizData));
+  } catch (const std::exception &e) {
+    deallocate();
+    clearIncrementalState();
+    m_currentVizData = nullptr;
+    m_currentTopoData = nullptr;
+    return setError(response, e.what());
+  }
+  deallocate();
+  m_currentDistanceMatrix = D;
+  m_currentNeighborIndex = nullptr;
+
+  response["datasetId"] = m_currentDatasetId;
+  response["numberOfSamples"] = m_currentDataset->numberOfSamples();
+  response["updatedSamples"] = updated;
+  response["rebuilt"] = rebuilt;
+  response["rescaled"] = rescaled;
+  response["minPersistenceLevel"] = m_currentTopoData->getMinPersistenceLevel();
+  response["maxPersistenceLevel"] = m_currentTopoData->getMaxPersistenceLevel();
+}
+
 void Controller::fetchEmbeddingsList(const Json::Value &request, Json::Value &response) {
   if (!maybeLoadDataset(request, response))
     return setError(response, "invalid datasetId");
@@ -1037,10 +1595,118 @@ bool Controller::loadDataset(int datasetId) {
   // clear current computation results
   m_currentVizData = nullptr;
   m_currentTopoData = nullptr;
+  m_currentNeighborIndex = nullptr;
+  clearIncrementalState();
+
+  m_appliedAppendBatches.clear();
+  m_appendLogScanned = 0;
 
   return true;
 }
 
+/*
+ * Orders append log batch filenames with runs of digits compared by their
+ * value, so batch9.yaml precedes batch10.yaml.
+ */
+static bool precedesBatch(const std::string &a, const std::string &b) {
+  size_t i = 0, j = 0;
+  while (i < a.size() && j < b.size()) {
+    if (std::isdigit((unsigned char) a[i]) && std::isdigit((unsigned char) b[j])) {
+      size_t aEnd = i, bEnd = j;
+      while (aEnd < a.size() && std::isdigit((unsigned char) a[aEnd])) aEnd++;
+      while (bEnd < b.size() && std::isdigit((unsigned char) b[bEnd])) bEnd++;
+      auto aDigits = a.substr(i, aEnd - i), bDigits = b.substr(j, bEnd - j);
+      aDigits.erase(0, std::min(aDigits.find_first_not_of('0'), aDigits.size()));
+      bDigits.erase(0, std::min(bDigits.find_first_not_of('0'), bDigits.size()));
+      if (aDigits.size() != bDigits.size())
+        return aDigits.size() < bDigits.size();
+      if (aDigits != bDigits)
+        return aDigits < bDigits;
+      i = aEnd;
+      j = bEnd;
+    }
+    else if (a[i] != b[j]) {
+      return a[i] < b[j];
+    }
+    else {
+      i++;
+      j++;
+    }
+  }
+  // a prefix precedes, names differing only in leading zeros keep a fixed order
+  if (a.size() - i != b.size() - j)
+    return a.size() - i < b.size() - j;
+  return a < b;
+}
+
+/**
+ * Appends the batches written to the append log of a live dataset that were
+ * not applied yet, in the order of their filenames with numbers compared by
+ * value. Writers should create each batch under another name and rename it
+ * to *.yaml once complete. The directory is only listed again once it has
+ * been modified. A batch that fails to load is reported and stops the scan,
+ * since later batches are written against the samples before it; it is
+ * retried with them once the directory changes. Results computed before the new
+ * samples are dropped so the next request recomputes them, while the rest
+ * of the dataset stays loaded.
+ */
+void Controller::applyAppendLog() {
+  if (!m_currentDataset || !m_currentDataset->hasAppendLog())
+    return;
+
+  // a modification in the second of the last scan may have been missed
+  boost::filesystem::path logPath(m_currentDataset->getAppendLogPath());
+  boost::system::error_code error;
+  auto modified = boost::filesystem::last_write_time(logPath, error);
+  if (error || modified < m_appendLogScanned)
+    return;
+  m_appendLogScanned = std::time(nullptr);
+
+  std::vector<boost::filesystem::path> batches;
+  for (auto &entry : boost::filesystem::directory_iterator(logPath, error)) {
+    auto path = entry.path();
+    if (boost::filesystem::is_regular_file(path) && path.extension() == ".yaml" &&
+        m_appliedAppendBatches.count(path.filename().string()) == 0) {
+      batches.push_back(path);
+    }
+  }
+  std::sort(batches.begin(), batches.end(), [](const boost::filesystem::path &a, const boost::filesystem::path &b) {
+    return precedesBatch(a.filename().string(), b.filename().string());
+  });
+
+  int appended = 0;
+  for (auto &batch : batches) {
+    try {
+      appended += DatasetLoader::appendBatch(*m_currentDataset, batch.string());
+    } catch (const std::exception &e) {
+      std::cout << "  " << batch.string() << " --> [ FAILED TO APPEND ] " << e.what() << std::endl;
+      break;
+    }
+    m_appliedAppendBatches.insert(batch.filename().string());
+  }
+
+  if (appended > 0) {
+    std::cout << "appended " << appended << " samples to " << m_currentDataset->getName() << ", now "
+              << m_currentDataset->numberOfSamples() << std::endl;
+    m_currentVizData = nullptr;
+    m_currentTopoData = nullptr;
+    m_currentNeighborIndex = nullptr;
+    clearIncrementalState();
+  }
+}
+
+/**
+ * Drops the state kept by insertSamples for the current processing.
+ */
+void Controller::clearIncrementalState() {
+  if (m_incrementalComplex) {
+    m_incrementalComplex->deallocate();
+  }
+  m_incrementalComplex = nullptr;
+  m_incrementalProcessor = nullptr;
+  m_incrementalLayout.deallocate();
+}
+
 /**
  * Checks if the requested dataset is loaded.
  * If not, loads the dataset and sets state.
@@ -1060,6 +1726,7 @@ bool Controller::maybeLoadDataset(const Json::Value &request, Json::Value &respo
     setError(response, "dataset failed to load");
     return false;
   }
+  applyAppendLog();
 
   return true;
 }
@@ -1069,7 +1736,7 @@ bool Controller::maybeLoadDataset(const Json::Value &request, Json::Value &respo
  */
 bool Controller::verifyProcessDataParams(Fieldtype category, std::string fieldname, int knn, std::string metric,
                                          int curvepoints, double datasigma, double curvesigma, bool addnoise, int depth,
-                                         bool normalize, Json::Value &response) {
+                                         bool normalize, int landmarks, Json::Value &response) {
 
   // category of the passed fieldname (design param or qoi)
   if (!category.valid()) {
@@ -1083,8 +1750,8 @@ bool Controller::verifyProcessDataParams(Fieldtype category, std::string fieldna
     return false;
   }
 
-  // metric of distance matrix
-  if (!m_currentDataset->hasDistanceMatrix(metric)) {
+  // metric of distance matrix or knn graph
+  if (!m_currentDataset->hasDistanceMatrix(metric) && !m_currentDataset->hasNeighborGraph(metric)) {
     setError(response, "invalid distance metric");
     return false;
   }  
@@ -1105,6 +1772,12 @@ bool Controller::verifyProcessDataParams(Fieldtype category, std::string fieldna
   } else if (curvepoints < 3) {
     setError(response, "regression curves must have at least 3 points");
     return false;
+  } else if (landmarks < 0) {
+    setError(response, "landmarks must be >= 0");
+    return false;
+  } else if (landmarks > 0 && !m_currentDataset->hasGeometryMatrix()) {
+    setError(response, "landmarks need the geometry of the samples");
+    return false;
   }
 
   return true;
@@ -1126,12 +1799,15 @@ bool Controller::maybeProcessData(const Json::Value &request, Json::Value &respo
   auto addnoise    = request.isMember("noise")       ? request["noise"].asBool()                 : m_currentAddNoise;
   auto depth       = request.isMember("depth")       ? request["depth"].asInt()                  : m_currentPersistenceDepth;
   auto normalize   = request.isMember("normalize")   ? request["normalize"].asBool()             : m_currentNormalize;
+  auto landmarks   = request.isMember("landmarks")   ? request["landmarks"].asInt()              : m_currentLandmarks;
+  auto landmarkdensity = request.isMember("landmarkdensity") ? request["landmarkdensity"].asBool() : m_currentLandmarkDensity;
 
   if (!verifyProcessDataParams(category, fieldname, knn, metric, curvepoints, datasigma,
-                               curvesigma, addnoise, depth, normalize, response))
+                               curvesigma, addnoise, depth, normalize, landmarks, response))
     return false; // response will contain the error
 
-  if (!processData(category, fieldname, knn, metric, curvepoints, datasigma, curvesigma, addnoise, depth, normalize)) {
+  if (!processData(category, fieldname, knn, metric, curvepoints, datasigma, curvesigma, addnoise, depth, normalize,
+                   landmarks, landmarkdensity)) {
     setError(response, "failed to process data");
     return false;
   }
@@ -1142,7 +1818,7 @@ bool Controller::maybeProcessData(const Json::Value &request, Json::Value &respo
 /// Avoid regeneration of data if parameters haven't changed
 bool Controller::processDataParamsChanged(Fieldtype category, std::string fieldname, int knn, std::string metric,
                                           int num_samples, double datasigma, double curvesigma, bool add_noise,
-                                          int num_persistences, bool normalize) {
+                                          int num_persistences, bool normalize, int landmarks, bool landmarkdensity) {
   return !(m_currentCategory        == category &&
            m_currentField           == fieldname &&
            m_currentKNN             == knn &&
@@ -1152,7 +1828,9 @@ bool Controller::processDataParamsChanged(Fieldtype category, std::string fieldn
            m_currentSmoothCurveSigma== curvesigma &&
            m_currentAddNoise        == add_noise &&
            m_currentPersistenceDepth== num_persistences &&
-           m_currentNormalize       == normalize);
+           m_currentNormalize       == normalize &&
+           m_currentLandmarks       == landmarks &&
+           m_currentLandmarkDensity == landmarkdensity);
 }
 
 /**
@@ -1165,10 +1843,10 @@ bool Controller::processDataParamsChanged(Fieldtype category, std::string fieldn
  */
 bool Controller::processData(Fieldtype category, std::string fieldname, int knn, std::string metric,
                              int num_samples, double datasigma, double curvesigma, bool add_noise,
-                             int num_persistences, bool normalize) {
+                             int num_persistences, bool normalize, int landmarks, bool landmarkdensity) {
   if (m_currentTopoData &&
       !processDataParamsChanged(category, fieldname, knn, metric, num_samples, datasigma, curvesigma,
-                                add_noise, num_persistences, normalize)) {
+                                add_noise, num_persistences, normalize, landmarks, landmarkdensity)) {
     return true;
   }
 
@@ -1185,9 +1863,21 @@ bool Controller::processData(Fieldtype category, std::string fieldname, int knn,
   // clear current computation results
   m_currentVizData = nullptr;
   m_currentTopoData = nullptr;
-
-  // load or generate the distance matrix 
-  if (m_currentDataset->hasDistanceMatrix(metric)) {
+  clearIncrementalState();
+
+  // metrics given only as a knn graph are processed without any distance matrix
+  bool useGraph = !m_currentDataset->hasDistanceMatrix(metric) && m_currentDataset->hasNeighborGraph(metric);
+
+  // load or generate the distance matrix, landmarks need neither
+  if (landmarks > 0) {
+    m_currentDistanceMatrix = FortranLinalg::DenseMatrix<Precision>();
+  } else if (useGraph) {
+    if (knn > (int) m_currentDataset->getNeighborGraph(metric).k()) {
+      std::cerr << "processData failed: knn exceeds the " << m_currentDataset->getNeighborGraph(metric).k()
+                << " neighbors of the graph for metric " << metric << "\n";
+      return false;
+    }
+  } else if (m_currentDataset->hasDistanceMatrix(metric)) {
     m_currentDistanceMatrix = m_currentDataset->getDistanceMatrix(metric);
   } else if (m_currentDataset->hasGeometryMatrix()) {
     auto geometrysMatrix = m_currentDataset->getGeometryMatrix();
@@ -1199,15 +1889,31 @@ bool Controller::processData(Fieldtype category, std::string fieldname, int knn,
 
   HDGenericProcessor<DenseVectorSample, DenseVectorEuclideanMetric> genericProcessor;
   try {
-    m_currentVizData.reset(new SimpleHDVizDataImpl(
-      genericProcessor.processOnMetric(m_currentDistanceMatrix,
-                                       FortranLinalg::DenseVector<Precision>(fieldvals.size(), fieldvals.data()),
-                                       knn,              /* k nearest neighbors to consider */
-                                       num_samples,      /* points along each crystal regression curve */
-                                       num_persistences, /* generate this many at most; -1 generates all of 'em */
-                                       add_noise,        /* adds very slight noise to field values */
-                                       curvesigma,       /* soften crystal regression curves */
-                                       datasigma)));     /* smooth data to compute topology */
+    auto field = FortranLinalg::DenseVector<Precision>(fieldvals.size(), fieldvals.data());
+    if (landmarks > 0) {
+      // Euclidean distances of the geometry instead of the metric, no noise
+      auto &geometry = m_currentDataset->getGeometryMatrix();
+      auto selection = landmarkdensity ? LandmarkSelection::Density : LandmarkSelection::Farthest;
+      LandmarkMSComplex<Precision> complex(geometry, field, landmarks, knn, selection,
+                                           datasigma > 0, datasigma * datasigma);
+      m_currentVizData.reset(new SimpleHDVizDataImpl(
+        genericProcessor.processLandmarks(complex, geometry, field, knn, num_samples, num_persistences, curvesigma)));
+      complex.deallocate();
+    } else if (useGraph) {
+      m_currentVizData.reset(new SimpleHDVizDataImpl(
+        genericProcessor.processOnGraph(m_currentDataset->getNeighborGraph(metric), field,
+                                        knn, num_samples, num_persistences, add_noise, curvesigma, datasigma)));
+    } else {
+      m_currentVizData.reset(new SimpleHDVizDataImpl(
+        genericProcessor.processOnMetric(m_currentDistanceMatrix,
+                                         field,
+                                         knn,              /* k nearest neighbors to consider */
+                                         num_samples,      /* points along each crystal regression curve */
+                                         num_persistences, /* generate this many at most; -1 generates all of 'em */
+                                         add_noise,        /* adds very slight noise to field values */
+                                         curvesigma,       /* soften crystal regression curves */
+                                         datasigma)));     /* smooth data to compute topology */
+    }
     m_currentTopoData.reset(new LegacyTopologyDataImpl(m_currentVizData));
   } catch (const char *err) {
     std::cerr << "Controller::processData: processOnMetric failed: " << err << std::endl;
@@ -1228,6 +1934,8 @@ bool Controller::processData(Fieldtype category, std::string fieldname, int knn,
   m_currentAddNoise = add_noise;
   m_currentPersistenceDepth = num_persistences;
   m_currentNormalize = normalize;
+  m_currentLandmarks = landmarks;
+  m_currentLandmarkDensity = landmarkdensity;
   
   std::cout << "computation complete (" << duration_cast<milliseconds>(Clock::now() - start).count() << " ms)\n";
 
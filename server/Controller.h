@@ -2,12 +2,17 @@
 
 #include "dataset/Dataset.h"
 #include "hdprocess/HDProcessResult.h"
+#include "hdprocess/HDProcessor.h"
 #include "hdprocess/HDVizData.h"
 #include "hdprocess/TopologyData.h"
 #include "dataset/Fieldtype.h"
+#include "graph/HNSW.h"
+#include "morsesmale/IncrementalMSComplex.h"
 
 #include <jsoncpp/json/json.h>
+#include <ctime>
 #include <map>
+#include <set>
 #include <functional>
 
 namespace dspacex {
@@ -44,19 +49,23 @@ class Controller {
 
   bool maybeLoadDataset(const Json::Value &request, Json::Value &response);
   bool loadDataset(int datasetId);
+  void applyAppendLog();
   bool verifyProcessDataParams(Fieldtype category, std::string fieldname, int knn, std::string metric,
                                int curvepoints, double datasigma, double curvesigma, bool addnoise, int depth,
-                               bool normalize, Json::Value &response);
+                               bool normalize, int landmarks, Json::Value &response);
   bool processDataParamsChanged(Fieldtype category, std::string fieldname, int knn, std::string metric,
                                 int num_samples, double datasigma, double curvesigma, bool add_noise,
-                                int num_persistences, bool normalize);
+                                int num_persistences, bool normalize, int landmarks, bool landmarkdensity);
   bool maybeProcessData(const Json::Value &request, Json::Value &response);
   bool processData(Fieldtype category, std::string fieldname, int knn, std::string metric,
                    int num_samples = 55, double datasigma = 0.01, double curvesigma = 0.5,
                    bool add_noise = true /* duplicate values risk erroroneous M-S */,
                    int num_persistences = -1 /* generates all persistence levels */,
-                   bool normalize = true /* scale normalize field values */);
+                   bool normalize = true /* scale normalize field values */,
+                   int landmarks = 0 /* approximate the complex on this many landmarks, 0 for exact */,
+                   bool landmarkdensity = false /* choose landmarks relative to the local sample spacing */);
   int getPersistence(const Json::Value &request, Json::Value &response);
+  void clearIncrementalState();
 
   // Command Handlers
   void fetchDatasetList(const Json::Value &request, Json::Value &response);
@@ -68,7 +77,12 @@ class Controller {
   void exportMorseSmaleDecomposition(const Json::Value &request, Json::Value &response);
   void fetchMorseSmaleRegression(const Json::Value &request, Json::Value &response);
   void fetchMorseSmaleExtrema(const Json::Value &request, Json::Value &response);
+  void fetchMorseSmaleFieldSummary(const Json::Value &request, Json::Value &response);
+  void fetchParameterSweep(const Json::Value &request, Json::Value &response);
+  void insertSamples(const Json::Value &request, Json::Value &response);
+  void fetchLandmarkAgreement(const Json::Value &request, Json::Value &response);
   void fetchCrystal(const Json::Value &request, Json::Value &response);
+  void fetchCrystalDistances(const Json::Value &request, Json::Value &response);
   void fetchEmbeddingsList(const Json::Value &request, Json::Value &response);
   void fetchSingleEmbedding(const Json::Value &request, Json::Value &response);
   void fetchNodeColors(const Json::Value &request, Json::Value &response);
@@ -90,12 +104,26 @@ class Controller {
   FortranLinalg::DenseMatrix<Precision> m_currentDistanceMatrix;
   std::shared_ptr<HDVizData> m_currentVizData;
   std::unique_ptr<TopologyData> m_currentTopoData;
+  std::unique_ptr<HNSW<Precision>> m_currentNeighborIndex;
+
+  // state of the current processing kept for insertSamples, created by its
+  // first call: the complex, the processor keeping the crystal regressions
+  // and the coordinates they were regressed in
+  std::unique_ptr<IncrementalMSComplex<Precision>> m_incrementalComplex;
+  std::unique_ptr<HDProcessor> m_incrementalProcessor;
+  FortranLinalg::DenseMatrix<Precision> m_incrementalLayout;
+
   std::string datapath;
 
   // current loaded dataset
   std::unique_ptr<dspacex::Dataset> m_currentDataset;
   int m_currentDatasetId{-1};
 
+  // append log of the current dataset: filenames of the batches appended, and
+  // when it was last scanned (seconds since epoch)
+  std::set<std::string> m_appliedAppendBatches;
+  std::time_t m_appendLogScanned{0};
+
   // current processing state
   std::string m_currentField;
   Fieldtype m_currentCategory{Fieldtype::Unknown};
@@ -107,6 +135,8 @@ class Controller {
   bool m_currentAddNoise{true};
   int m_currentPersistenceDepth{20};
   bool m_currentNormalize{true};
+  int m_currentLandmarks{0};
+  bool m_currentLandmarkDensity{false};
 };
 
 } // dspacex
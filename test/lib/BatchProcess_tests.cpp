@@ -0,0 +1,182 @@
+#include "gtest/gtest.h"
+#include "flinalg/DenseMatrix.h"
+#include "flinalg/DenseVector.h"
+#include "flinalg/LinalgIO.h"
+#include "hdprocess/BatchProcess.h"
+#include "utils/Parallel.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Declarations
+//---------------------------------------------------------------------
+
+// a fresh directory holding a domain, two fields and a manifest of jobs on them
+std::string writeBatch(const std::string &manifest) {
+  char directory[] = "/tmp/BatchProcess_testsXXXXXX";
+  std::string root = mkdtemp(directory);
+  FortranLinalg::DenseMatrix<Precision> X(2, 10);
+  FortranLinalg::DenseVector<Precision> a(10), b(10);
+  for (unsigned int i = 0; i < 10; i++) {
+    X(0, i) = i;
+    X(1, i) = -(Precision) i;
+    a(i) = i;
+    b(i) = 2 * i;
+  }
+  FortranLinalg::LinalgIO<Precision>::writeMatrix(root + "/X.data", X);
+  FortranLinalg::LinalgIO<Precision>::writeVector(root + "/a.data", a);
+  FortranLinalg::LinalgIO<Precision>::writeVector(root + "/b.data", b);
+  X.deallocate();
+  a.deallocate();
+  b.deallocate();
+  std::ofstream(root + "/manifest.txt") << manifest;
+  return root;
+}
+
+// sum of the field and of the first coordinate, written to the job's output
+void writeSums(const BatchJob &job, FortranLinalg::DenseMatrix<Precision> &x, FortranLinalg::DenseVector<Precision> &y) {
+  Precision ySum = 0, xSum = 0;
+  for (unsigned int i = 0; i < y.N(); i++) {
+    ySum += y(i);
+    xSum += x(0, i);
+  }
+  // inputs are private to the job
+  y(0) = 1000;
+  std::ofstream(job.output + "/sums.txt") << ySum << " " << xSum << " " << job.intParameter("knn", 0);
+}
+
+std::vector<Precision> readSums(const std::string &path) {
+  std::ifstream file(path);
+  std::vector<Precision> sums(3, -1);
+  file >> sums[0] >> sums[1] >> sums[2];
+  return sums;
+}
+
+//---------------------------------------------------------------------
+// Tests
+//---------------------------------------------------------------------
+
+TEST(BatchProcess, readManifest) {
+  std::string root = writeBatch("# name domain function parameters\n"
+                                "\n"
+                                "first X.data.hdr a.data.hdr knn=15 sigma=0.5 random\n"
+                                "second /abs/X.data.hdr b.data.hdr\n");
+  auto jobs = BatchProcess::readManifest(root + "/manifest.txt", root + "/out");
+  ASSERT_EQ(jobs.size(), 2u);
+  EXPECT_EQ(jobs[0].name, "first");
+  EXPECT_EQ(jobs[0].domain, root + "/X.data.hdr");
+  EXPECT_EQ(jobs[0].function, root + "/a.data.hdr");
+  EXPECT_EQ(jobs[0].output, root + "/out/first");
+  EXPECT_EQ(jobs[0].intParameter("knn", 0), 15);
+  EXPECT_FLOAT_EQ(jobs[0].precisionParameter("sigma", 0), 0.5);
+  EXPECT_TRUE(jobs[0].flag("random"));
+  EXPECT_EQ(jobs[1].domain, "/abs/X.data.hdr");
+  EXPECT_EQ(jobs[1].intParameter("knn", 7), 7);
+  EXPECT_FALSE(jobs[1].flag("random"));
+
+  std::ofstream(root + "/duplicate.txt") << "first X.data.hdr a.data.hdr\nfirst X.data.hdr b.data.hdr\n";
+  EXPECT_THROW(BatchProcess::readManifest(root + "/duplicate.txt", root), std::runtime_error);
+  std::ofstream(root + "/short.txt") << "first X.data.hdr\n";
+  EXPECT_THROW(BatchProcess::readManifest(root + "/short.txt", root), std::runtime_error);
+}
+
+TEST(BatchProcess, runsJobsInWorkersAndResumes) {
+  std::string root = writeBatch("a X.data.hdr a.data.hdr knn=3\n"
+                                "b X.data.hdr b.data.hdr knn=4\n"
+                                "a2 X.data.hdr a.data.hdr knn=5\n"
+                                "broken X.data.hdr b.data.hdr fail\n"
+                                "missing X.data.hdr nothing.data.hdr\n");
+  auto jobs = BatchProcess::readManifest(root + "/manifest.txt", root + "/out");
+  auto task = [](const BatchJob &job, FortranLinalg::DenseMatrix<Precision> &x,
+                 FortranLinalg::DenseVector<Precision> &y) {
+    if (job.flag("fail")) {
+      throw std::runtime_error("failing on purpose");
+    }
+    writeSums(job, x, y);
+  };
+
+  BatchProcess batch(jobs, 2, 1);
+  BatchSummary summary = batch.run(task);
+  EXPECT_EQ(summary.completed, 3u);
+  EXPECT_EQ(summary.skipped, 0u);
+  EXPECT_EQ(summary.failed, std::vector<std::string>({"missing", "broken"}));
+  EXPECT_EQ(readSums(root + "/out/a/sums.txt"), std::vector<Precision>({45, 45, 3}));
+  EXPECT_EQ(readSums(root + "/out/b/sums.txt"), std::vector<Precision>({90, 45, 4}));
+  EXPECT_EQ(readSums(root + "/out/a2/sums.txt"), std::vector<Precision>({45, 45, 5}));
+  EXPECT_TRUE(BatchProcess::isComplete(jobs[0]));
+  EXPECT_FALSE(BatchProcess::isComplete(jobs[3]));
+
+  // only the failed jobs run again
+  BatchProcess resumed(jobs, 2, 1);
+  summary = resumed.run(task);
+  EXPECT_EQ(summary.completed, 0u);
+  EXPECT_EQ(summary.skipped, 3u);
+  EXPECT_EQ(summary.failed.size(), 2u);
+}
+
+TEST(BatchProcess, boundsWorkerMemory) {
+  std::string root = writeBatch("small X.data.hdr a.data.hdr\n"
+                                "large X.data.hdr a.data.hdr large\n");
+  auto jobs = BatchProcess::readManifest(root + "/manifest.txt", root + "/out");
+  BatchProcess batch(jobs, 2, 1, (size_t) 512 << 20);
+  BatchSummary summary = batch.run([](const BatchJob &job, FortranLinalg::DenseMatrix<Precision> &x,
+                                      FortranLinalg::DenseVector<Precision> &y) {
+    if (job.flag("large")) {
+      std::vector<char> memory((size_t) 1 << 30, 1);
+      y(0) = memory.back();
+    }
+    writeSums(job, x, y);
+  });
+  EXPECT_EQ(summary.completed, 1u);
+  EXPECT_EQ(summary.failed, std::vector<std::string>({"large"}));
+}
+
+TEST(BatchProcess, workersUseTheirThreadBudget) {
+  std::string root = writeBatch("a X.data.hdr a.data.hdr\n");
+  auto jobs = BatchProcess::readManifest(root + "/manifest.txt", root + "/out");
+  // the count the workers inherit, cached before forking
+  Parallel::setThreadCount(7);
+  BatchProcess batch(jobs, 1, 3);
+  BatchSummary summary = batch.run([](const BatchJob &job, FortranLinalg::DenseMatrix<Precision> &x,
+                                      FortranLinalg::DenseVector<Precision> &y) {
+    std::ofstream(job.output + "/threads.txt") << Parallel::threadCount();
+  });
+  Parallel::setThreadCount(0);
+  EXPECT_EQ(summary.completed, 1u);
+  unsigned int threads = 0;
+  std::ifstream(root + "/out/a/threads.txt") >> threads;
+  EXPECT_EQ(threads, 3u);
+}
+
+TEST(BatchProcess, workersMapOnlyTheirInputs) {
+  std::string root = writeBatch("a X.data.hdr a.data.hdr\n"
+                                "b X.data.hdr b.data.hdr\n");
+  auto jobs = BatchProcess::readManifest(root + "/manifest.txt", root + "/out");
+  BatchProcess batch(jobs, 1, 1);
+  BatchSummary summary = batch.run([](const BatchJob &job, FortranLinalg::DenseMatrix<Precision> &x,
+                                      FortranLinalg::DenseVector<Precision> &y) {
+    // the fields mapped in this worker, the shared domain aside
+    std::ifstream maps("/proc/self/maps");
+    std::ofstream mapped(job.output + "/mapped.txt");
+    std::string line;
+    while (std::getline(maps, line)) {
+      size_t slash = line.find_last_of('/');
+      if (slash != std::string::npos && line.compare(slash + 1, std::string::npos, "X.data") != 0 &&
+          line.find("/BatchProcess_tests") != std::string::npos) {
+        mapped << line.substr(slash + 1) << std::endl;
+      }
+    }
+  });
+  EXPECT_EQ(summary.completed, 2u);
+  for (std::string name : {"a", "b"}) {
+    std::ifstream file(root + "/out/" + name + "/mapped.txt");
+    std::vector<std::string> mapped;
+    for (std::string line; std::getline(file, line);) {
+      mapped.push_back(line);
+    }
+    EXPECT_EQ(mapped, std::vector<std::string>({name + ".data"}));
+  }
+}
@@ -0,0 +1,149 @@
+#include "gtest/gtest.h"
+#include "metrics/BlockedDistance.h"
+#include "metrics/SampleSource.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Declarations
+//---------------------------------------------------------------------
+
+// count x dim samples, one sample per row of the returned values
+std::vector<float> randomValues(unsigned int dim, unsigned int count, bool binary) {
+  std::vector<float> values((size_t) dim * count);
+  std::srand(31);
+  for (auto &v : values) {
+    v = binary ? std::rand() % 2 : 3 + std::rand() / (float) RAND_MAX;
+  }
+  return values;
+}
+
+std::string writeSamples(const std::vector<float> &values, unsigned int dim, unsigned int count) {
+  std::string filename = testing::TempDir() + "blocked_samples.bin";
+  std::ofstream bin(filename, std::ios::binary);
+  bin.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(float));
+  std::ofstream dims(filename + ".dims");
+  dims << dim << " " << count << " float32";
+  return filename;
+}
+
+std::vector<float> readDistances(const std::string &filename, unsigned int count) {
+  std::ifstream dims(filename + ".dims");
+  unsigned int rows = 0, cols = 0;
+  std::string dtype;
+  dims >> rows >> cols >> dtype;
+  EXPECT_EQ(rows, count);
+  EXPECT_EQ(cols, count);
+  EXPECT_EQ(dtype, "float32");
+  std::vector<float> distances((size_t) count * count);
+  std::ifstream bin(filename, std::ios::binary);
+  bin.read(reinterpret_cast<char *>(distances.data()), distances.size() * sizeof(float));
+  return distances;
+}
+
+double reference(BlockedDistance::Type type, const float *x, const float *y, unsigned int dim) {
+  double sum = 0, xx = 0, yy = 0;
+  for (unsigned int k = 0; k < dim; k++) {
+    switch (type) {
+      case BlockedDistance::Type::Euclidean: sum += (x[k] - y[k]) * (x[k] - y[k]); break;
+      case BlockedDistance::Type::L1: sum += std::fabs(x[k] - y[k]); break;
+      case BlockedDistance::Type::Hamming: sum += x[k] != y[k]; break;
+      case BlockedDistance::Type::Cosine: sum += x[k] * y[k]; xx += x[k] * x[k]; yy += y[k] * y[k]; break;
+    }
+  }
+  switch (type) {
+    case BlockedDistance::Type::Euclidean: return std::sqrt(sum);
+    case BlockedDistance::Type::Hamming: return sum / dim;
+    case BlockedDistance::Type::Cosine: return 1 - sum / std::sqrt(xx * yy);
+    default: return sum;
+  }
+}
+
+//---------------------------------------------------------------------
+// Tests
+//---------------------------------------------------------------------
+
+TEST(BlockedDistance, matchesBruteForce) {
+  unsigned int dim = 70, count = 230;
+  for (bool binary : {false, true}) {
+    auto values = randomValues(dim, count, binary);
+    std::string samples = writeSamples(values, dim, count);
+    for (auto type : {BlockedDistance::Type::Euclidean, BlockedDistance::Type::L1,
+                      BlockedDistance::Type::Hamming, BlockedDistance::Type::Cosine}) {
+      // ragged tiles and a budget of 16 dimensions per chunk
+      MatrixFileSource source(samples);
+      BlockedDistance distance(type, 50, 2 * 50 * 16 * sizeof(float));
+      std::string output = testing::TempDir() + "blocked_distances.bin";
+      distance.compute(source, output);
+
+      auto D = readDistances(output, count);
+      for (unsigned int j = 0; j < count; j++) {
+        for (unsigned int i = 0; i < count; i++) {
+          double expected = i == j ? 0 : reference(type, &values[i * dim], &values[j * dim], dim);
+          ASSERT_NEAR(D[i + (size_t) j * count], expected, 1e-4) << i << " " << j;
+        }
+      }
+    }
+  }
+}
+
+TEST(BlockedDistance, readsNrrdAndRawSampleFiles) {
+  unsigned int dim = 4 * 5 * 3, count = 12;
+  auto values = randomValues(dim, count, true);
+  std::string listFile = testing::TempDir() + "blocked_list.txt";
+  std::ofstream list(listFile);
+  for (unsigned int i = 0; i < count; i++) {
+    std::string name = "blocked_sample" + std::to_string(i) + (i % 2 ? ".nrrd" : ".bin");
+    std::ofstream file(testing::TempDir() + name, std::ios::binary);
+    if (i % 2) {
+      file << "NRRD0004\n# mask\ntype: unsigned char\ndimension: 3\nsizes: 4 5 3\nencoding: raw\n\n";
+      for (unsigned int k = 0; k < dim; k++) {
+        file.put((char) values[i * dim + k]);
+      }
+    }
+    else {
+      file.write(reinterpret_cast<const char *>(&values[i * dim]), dim * sizeof(float));
+    }
+    list << name << "\n";
+  }
+  list.close();
+
+  FileListSource source(listFile);
+  ASSERT_EQ(source.N(), count);
+  ASSERT_EQ(source.D(), dim);
+  BlockedDistance distance(BlockedDistance::Type::Hamming, 5);
+  std::string output = testing::TempDir() + "blocked_distances.bin";
+  distance.compute(source, output);
+
+  auto D = readDistances(output, count);
+  for (unsigned int j = 0; j < count; j++) {
+    for (unsigned int i = 0; i < count; i++) {
+      double expected = reference(BlockedDistance::Type::Hamming, &values[i * dim], &values[j * dim], dim);
+      ASSERT_NEAR(D[i + (size_t) j * count], expected, 1e-6);
+    }
+  }
+}
+
+TEST(BlockedDistance, packedHammingMatchesUnpacked) {
+  // 150 values per sample: chunks of 64 values and a partial last word
+  unsigned int dim = 150, count = 97;
+  auto values = randomValues(dim, count, true);
+  std::string samples = writeSamples(values, dim, count);
+  std::string unpackedFile = testing::TempDir() + "blocked_unpacked.bin";
+  std::string packedFile = testing::TempDir() + "blocked_packed.bin";
+
+  MatrixFileSource source(samples);
+  BlockedDistance(BlockedDistance::Type::Hamming, 20).compute(source, unpackedFile);
+  BlockedDistance(BlockedDistance::Type::Hamming, 20, 2 * 20 * sizeof(uint64_t), true).compute(source, packedFile);
+
+  auto expected = readDistances(unpackedFile, count);
+  auto D = readDistances(packedFile, count);
+  for (size_t i = 0; i < D.size(); i++) {
+    ASSERT_FLOAT_EQ(D[i], expected[i]);
+  }
+  ASSERT_THROW(BlockedDistance(BlockedDistance::Type::L1, 20, 1 << 20, true), std::runtime_error);
+}
@@ -2,6 +2,9 @@
 #include "DatasetLoader.h"
 #include "Dataset.h"
 
+#include <cstdlib>
+#include <fstream>
+
 const std::string kExampleDirPath = std::string(EXAMPLE_DATA_DIR);   
 
 //---------------------------------------------------------------------
@@ -17,3 +20,53 @@ TEST(DatasetLoader, loadDataset_csv) {
   std::string filePath = kExampleDirPath + "/cantilever_beam/config.yaml";
   std::unique_ptr<dspacex::Dataset> dataset = dspacex::DatasetLoader::loadDataset(filePath);
 }
+
+TEST(DatasetLoader, appendBatch) {
+  char dir[] = "/tmp/dspacex_append_XXXXXX";
+  ASSERT_NE(mkdtemp(dir), nullptr);
+  std::string root(dir);
+  auto write = [&](const std::string &name, const std::string &contents) {
+    std::ofstream(root + "/" + name) << contents;
+  };
+  write("config.yaml", "name: live\n"
+                       "samples:\n  count: 3\n"
+                       "parameters:\n  file: parameters.csv\n"
+                       "qois:\n  file: qois.csv\n"
+                       "distances:\n  - metric: euclidean\n    file: distances.csv\n"
+                       "appendLog:\n  directory: appends\n");
+  write("parameters.csv", "x,y\n0,0\n1,0\n3,0\n");
+  write("qois.csv", "f\n1\n2\n3\n");
+  write("distances.csv", "0,1,3\n1,0,2\n3,2,0\n");
+
+  // the batch lists its fields in another order than the dataset
+  write("batch.yaml", "samples:\n  count: 1\n"
+                      "parameters:\n  file: batch_parameters.csv\n"
+                      "qois:\n  file: batch_qois.csv\n"
+                      "distances:\n  - metric: euclidean\n    file: batch_distances.csv\n");
+  write("batch_parameters.csv", "y,x\n0,6\n");
+  write("batch_qois.csv", "f\n4\n");
+  write("batch_distances.csv", "6,5,3,0\n");
+
+  auto dataset = dspacex::DatasetLoader::loadDataset(root + "/config.yaml");
+  EXPECT_TRUE(dataset->hasAppendLog());
+  EXPECT_EQ(dataset->getAppendLogPath(), root + "/appends");
+
+  EXPECT_EQ(dspacex::DatasetLoader::appendBatch(*dataset, root + "/batch.yaml"), 1);
+  EXPECT_EQ(dataset->numberOfSamples(), 4);
+  EXPECT_FLOAT_EQ(dataset->getParameterVector(0)(3), 6);
+  EXPECT_FLOAT_EQ(dataset->getParameterVector(1)(3), 0);
+  EXPECT_FLOAT_EQ(dataset->getQoiVector(0)(3), 4);
+  auto &D = dataset->getDistanceMatrix("euclidean");
+  ASSERT_EQ(D.N(), 4);
+  EXPECT_FLOAT_EQ(D(0, 3), 6);
+  EXPECT_FLOAT_EQ(D(3, 1), 5);
+  EXPECT_FLOAT_EQ(D(2, 1), 2);
+
+  // a batch missing a field leaves the dataset as it was
+  write("bad.yaml", "samples:\n  count: 1\n"
+                    "parameters:\n  file: batch_qois.csv\n"
+                    "qois:\n  file: batch_qois.csv\n"
+                    "distances:\n  - metric: euclidean\n    file: batch_distances.csv\n");
+  EXPECT_THROW(dspacex::DatasetLoader::appendBatch(*dataset, root + "/bad.yaml"), std::runtime_error);
+  EXPECT_EQ(dataset->numberOfSamples(), 4);
+}
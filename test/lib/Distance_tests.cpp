@@ -0,0 +1,262 @@
+#include "gtest/gtest.h"
+#include "flinalg/DenseMatrix.h"
+#include "metrics/Distance.h"
+#include "metrics/EuclideanMetric.h"
+#include "metrics/HammingMetric.h"
+#include "metrics/L1Metric.h"
+#include "metrics/MahalanobisMetric.h"
+#include "metrics/SquaredEuclideanMetric.h"
+#include "morsesmale/NNMSComplex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <utility>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Declarations
+//---------------------------------------------------------------------
+
+template <typename T>
+FortranLinalg::DenseMatrix<T> randomSamples(unsigned int dim, unsigned int count, T offset = 0) {
+  FortranLinalg::DenseMatrix<T> X(dim, count);
+  std::srand(17);
+  for (unsigned int j = 0; j < count; j++) {
+    for (unsigned int i = 0; i < dim; i++) {
+      X(i, j) = offset + std::rand() / (T) RAND_MAX;
+    }
+  }
+  return X;
+}
+
+// batch distances against the virtual per pair metric
+template <typename TMetric>
+void expectBatchMatches(FortranLinalg::DenseMatrix<double> &X, const BatchMetric<TMetric, double> &batch,
+                        Metric<double> &metric) {
+  auto expected = Distance<double>::computeDistances(X, metric);
+  auto D = Distance<double>::computeDistances(X, batch, 50);
+  for (unsigned int i = 0; i < X.N(); i++) {
+    for (unsigned int j = 0; j < X.N(); j++) {
+      ASSERT_NEAR(D(i, j), expected(i, j), 1e-10 * std::max(1.0, expected(i, j)));
+      ASSERT_EQ(D(i, j), D(j, i));
+    }
+  }
+
+  std::vector<double> row(X.N());
+  static_cast<const TMetric &>(batch).toColumns(X.data() + 3 * X.M(), X.data(), X.M(), X.N(), row.data());
+  for (unsigned int j = 0; j < X.N(); j++) {
+    ASSERT_NEAR(row[j], expected(3, j), 1e-10 * std::max(1.0, expected(3, j)));
+  }
+  D.deallocate();
+  expected.deallocate();
+}
+
+//---------------------------------------------------------------------
+// Tests
+//---------------------------------------------------------------------
+
+TEST(Distance, euclideanDistancesMatchMetric) {
+  // sample count deliberately not a multiple of the tile size
+  auto X = randomSamples<double>(37, 301);
+  EuclideanMetric<double> metric;
+  auto expected = Distance<double>::computeDistances(X, metric);
+  FortranLinalg::DenseMatrix<double> D(X.N(), X.N());
+  Distance<double>::computeEuclideanDistances(X, D, false, 64);
+
+  for (unsigned int i = 0; i < X.N(); i++) {
+    ASSERT_EQ(D(i, i), 0);
+    for (unsigned int j = 0; j < X.N(); j++) {
+      ASSERT_NEAR(D(i, j), expected(i, j), 1e-10);
+      ASSERT_EQ(D(i, j), D(j, i));
+    }
+  }
+  X.deallocate();
+  D.deallocate();
+  expected.deallocate();
+}
+
+TEST(Distance, squaredEuclideanDistancesFloat) {
+  // large common offset exercises the centering that keeps float accurate
+  auto X = randomSamples<float>(16, 130, 1000.f);
+  SquaredEuclideanMetric<float> metric;
+  auto D = Distance<float>::computeEuclideanDistances(X, true);
+
+  for (unsigned int i = 0; i < X.N(); i++) {
+    for (unsigned int j = 0; j < X.N(); j++) {
+      float expected = metric.distance(X, i, X, j);
+      ASSERT_GE(D(i, j), 0);
+      ASSERT_NEAR(D(i, j), expected, 1e-3 * std::max(1.f, expected));
+    }
+  }
+  X.deallocate();
+  D.deallocate();
+}
+
+TEST(Distance, batchMetricsMatchVirtualMetrics) {
+  auto X = randomSamples<double>(19, 173);
+  EuclideanMetric<double> euclidean;
+  expectBatchMatches(X, BatchEuclidean<double>(), euclidean);
+  SquaredEuclideanMetric<double> squared;
+  expectBatchMatches(X, BatchSquaredEuclidean<double>(), squared);
+  L1Metric<double> l1;
+  expectBatchMatches(X, BatchL1<double>(), l1);
+
+  auto W = randomSamples<double>(19, 7);
+  MahalanobisMetric<double> mahalanobis(W);
+  expectBatchMatches(X, BatchMahalanobis<double>(W), mahalanobis);
+  W.deallocate();
+  X.deallocate();
+}
+
+TEST(Distance, batchKNNMatchesMetricKNN) {
+  auto X = randomSamples<double>(9, 1100);
+  unsigned int k = 12;
+  FortranLinalg::DenseMatrix<int> knn(k, X.N()), expectedKnn(k, X.N());
+  FortranLinalg::DenseMatrix<double> dists(k, X.N()), expectedDists(k, X.N());
+  SquaredEuclideanMetric<double> metric;
+  Distance<double>::computeKNN(X, expectedKnn, expectedDists, metric);
+  Distance<double>::computeKNN(X, knn, dists, BatchSquaredEuclidean<double>());
+
+  for (unsigned int i = 0; i < X.N(); i++) {
+    ASSERT_EQ(knn(0, i), (int) i);
+    for (unsigned int j = 0; j < k; j++) {
+      ASSERT_NEAR(dists(j, i), expectedDists(j, i), 1e-12);
+      ASSERT_NEAR(dists(j, i), metric.distance(X, knn(j, i), X, i), 1e-12);
+      if (j > 0) {
+        ASSERT_LE(dists(j - 1, i), dists(j, i));
+      }
+    }
+  }
+  X.deallocate();
+  knn.deallocate();
+  dists.deallocate();
+  expectedKnn.deallocate();
+  expectedDists.deallocate();
+}
+
+TEST(Distance, findKNNKeepsHeapTieOrder) {
+  // integer coordinates on a line produce many exactly tied distances
+  unsigned int n = 97;
+  FortranLinalg::DenseMatrix<float> X(1, n);
+  for (unsigned int j = 0; j < n; j++) {
+    X(0, j) = (j * 7) % 13;
+  }
+  auto D = Distance<float>::computeEuclideanDistances(X);
+
+  // the full MinHeap extraction over each column, with the sample itself at
+  // max(), as findKNN always selected
+  std::vector<float> column(n);
+  for (unsigned int k : {1u, 6u, 40u, n - 1, n}) {
+    FortranLinalg::DenseMatrix<int> knn(k, n);
+    FortranLinalg::DenseMatrix<float> knnd(k, n);
+    Distance<float>::findKNN(D, knn, knnd);
+    for (unsigned int i = 0; i < n; i++) {
+      for (unsigned int j = 0; j < n; j++) {
+        column[j] = i == j ? std::numeric_limits<float>::max() : D(j, i);
+      }
+      MinHeap<float> heap(column.data(), n);
+      for (unsigned int j = 0; j < k; j++) {
+        ASSERT_EQ(knn(j, i), heap.getRootIndex()) << "k " << k << " sample " << i << " rank " << j;
+        ASSERT_EQ(knnd(j, i), heap.extractRoot());
+      }
+    }
+    knn.deallocate();
+    knnd.deallocate();
+  }
+  X.deallocate();
+  D.deallocate();
+}
+
+TEST(Distance, findKNNAllSamplesPutsSelfLast) {
+  auto X = randomSamples<double>(3, 12);
+  auto D = Distance<double>::computeEuclideanDistances(X);
+  FortranLinalg::DenseMatrix<int> knn(X.N(), X.N());
+  FortranLinalg::DenseMatrix<double> knnd(X.N(), X.N());
+  Distance<double>::findKNN(D, knn, knnd);
+
+  for (unsigned int i = 0; i < X.N(); i++) {
+    ASSERT_EQ(knn(X.N() - 1, i), (int) i);
+    ASSERT_EQ(knnd(X.N() - 1, i), std::numeric_limits<double>::max());
+    for (unsigned int j = 1; j + 1 < X.N(); j++) {
+      ASSERT_LE(knnd(j - 1, i), knnd(j, i));
+    }
+  }
+  X.deallocate();
+  D.deallocate();
+  knn.deallocate();
+  knnd.deallocate();
+}
+
+TEST(Distance, hammingDistancesOfPackedMasks) {
+  // 200 values per sample leave a partially filled last word
+  unsigned int dim = 200, n = 150;
+  FortranLinalg::DenseMatrix<float> X(dim, n);
+  std::srand(5);
+  for (unsigned int j = 0; j < n; j++) {
+    for (unsigned int i = 0; i < dim; i++) {
+      X(i, j) = std::rand() % 3 == 0 ? 255 : 0;
+    }
+  }
+  auto D = Distance<float>::computeHammingDistances(X, 32);
+  HammingMetric<float> unpacked;
+  HammingMetric<float> packed(X);
+
+  for (unsigned int i = 0; i < n; i++) {
+    ASSERT_EQ(D(i, i), 0);
+    for (unsigned int j = 0; j < n; j++) {
+      unsigned int count = 0;
+      for (unsigned int k = 0; k < dim; k++) {
+        count += X(k, i) != X(k, j);
+      }
+      ASSERT_FLOAT_EQ(D(i, j), count / (float) dim);
+      ASSERT_FLOAT_EQ(packed.distance(X, i, X, j), D(i, j));
+      ASSERT_FLOAT_EQ(unpacked.distance(X, i, X, j), D(i, j));
+    }
+  }
+  X.deallocate();
+  D.deallocate();
+}
+
+TEST(Distance, packedHammingMetricComplex) {
+  unsigned int dim = 64 * 3 + 5, n = 300;
+  FortranLinalg::DenseMatrix<double> X(dim, n);
+  FortranLinalg::DenseVector<double> y(n);
+  std::srand(11);
+  for (unsigned int j = 0; j < n; j++) {
+    // masks of increasing size with random holes, so neighbors are meaningful
+    unsigned int size = j * dim / n;
+    for (unsigned int i = 0; i < dim; i++) {
+      X(i, j) = i < size && std::rand() % 8 != 0;
+    }
+    y(j) = std::sin(j / 20.0) + j / (double) n;
+  }
+  // the packed metric must give the same complex as value by value comparison
+  HammingMetric<double> packed(X);
+  HammingMetric<double> unpacked;
+  // NNMSComplex evaluates the metric on its own copy of X, which shares the
+  // packed storage, so the popcount path is taken; a deep copy is not packed
+  FortranLinalg::DenseMatrix<double> shared = X;
+  FortranLinalg::DenseMatrix<double> deep = FortranLinalg::Linalg<double>::Copy(X);
+  ASSERT_TRUE(packed.isPacked(shared));
+  ASSERT_FALSE(packed.isPacked(deep));
+  ASSERT_FALSE(unpacked.isPacked(X));
+  deep.deallocate();
+  NNMSComplex<double> fromPacked(X, y, 10, packed);
+  NNMSComplex<double> fromUnpacked(X, y, 10, unpacked);
+  fromPacked.mergePersistence(0.05);
+  fromUnpacked.mergePersistence(0.05);
+  auto expected = fromUnpacked.getPartitions();
+  auto partitions = fromPacked.getPartitions();
+
+  for (unsigned int i = 0; i < n; i++) {
+    ASSERT_EQ(partitions(i), expected(i));
+  }
+  expected.deallocate();
+  partitions.deallocate();
+  fromPacked.cleanup();
+  fromUnpacked.cleanup();
+  X.deallocate();
+  y.deallocate();
+}
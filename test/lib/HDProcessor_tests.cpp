@@ -0,0 +1,125 @@
+#include "gtest/gtest.h"
+#include "flinalg/DenseMatrix.h"
+#include "flinalg/DenseVector.h"
+#include "hdprocess/Buckets.h"
+#include "hdprocess/HDProcessor.h"
+#include "utils/Parallel.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Declarations
+//---------------------------------------------------------------------
+
+// three dimensional samples and two fields on them
+void samples(unsigned int n, FortranLinalg::DenseMatrix<Precision> &X, FortranLinalg::DenseVector<Precision> &a,
+             FortranLinalg::DenseVector<Precision> &b) {
+  X = FortranLinalg::DenseMatrix<Precision>(3, n);
+  a = FortranLinalg::DenseVector<Precision>(n);
+  b = FortranLinalg::DenseVector<Precision>(n);
+  std::srand(23);
+  for (unsigned int i = 0; i < n; i++) {
+    for (unsigned int d = 0; d < 3; d++) {
+      X(d, i) = std::rand() / (Precision) RAND_MAX;
+    }
+    a(i) = std::sin(6 * X(0, i)) * std::sin(6 * X(1, i)) + 0.1 * X(2, i);
+    b(i) = std::cos(5 * X(1, i)) - X(0, i) * X(2, i);
+  }
+}
+
+void expectSame(FortranLinalg::DenseMatrix<Precision> &expected, FortranLinalg::DenseMatrix<Precision> &actual) {
+  ASSERT_EQ(expected.M(), actual.M());
+  ASSERT_EQ(expected.N(), actual.N());
+  for (size_t i = 0; i < (size_t) expected.M() * expected.N(); i++) {
+    ASSERT_EQ(expected.data()[i], actual.data()[i]);
+  }
+}
+
+void expectSame(FortranLinalg::DenseVector<Precision> &expected, FortranLinalg::DenseVector<Precision> &actual) {
+  ASSERT_EQ(expected.N(), actual.N());
+  for (unsigned int i = 0; i < expected.N(); i++) {
+    ASSERT_EQ(expected(i), actual(i));
+  }
+}
+
+// regressions, densities and layouts of all levels are equal
+void expectSameResult(HDProcessResult &expected, HDProcessResult &actual) {
+  ASSERT_EQ(expected.R.size(), actual.R.size());
+  ASSERT_EQ(expected.minLevel(0), actual.minLevel(0));
+  for (unsigned int level = expected.minLevel(0); level < expected.R.size(); level++) {
+    EXPECT_EQ(expected.crystalPartitions[level], actual.crystalPartitions[level]);
+    ASSERT_EQ(expected.R[level].size(), actual.R[level].size());
+    expectSame(expected.extremaWidths[level], actual.extremaWidths[level]);
+    expectSame(expected.PCAExtremaLayout[level], actual.PCAExtremaLayout[level]);
+    expectSame(expected.IsoExtremaLayout[level], actual.IsoExtremaLayout[level]);
+    for (unsigned int crystal = 0; crystal < expected.R[level].size(); crystal++) {
+      expectSame(expected.R[level][crystal], actual.R[level][crystal]);
+      expectSame(expected.gradR[level][crystal], actual.gradR[level][crystal]);
+      expectSame(expected.spdf[level][crystal], actual.spdf[level][crystal]);
+      expectSame(expected.PCALayout[level][crystal], actual.PCALayout[level][crystal]);
+      expectSame(expected.IsoLayout[level][crystal], actual.IsoLayout[level][crystal]);
+    }
+  }
+}
+
+//---------------------------------------------------------------------
+// Tests
+//---------------------------------------------------------------------
+
+TEST(HDProcessor, processorsRunConcurrently) {
+  FortranLinalg::DenseMatrix<Precision> X;
+  FortranLinalg::DenseVector<Precision> a, b;
+  samples(1000, X, a, b);
+  std::unique_ptr<HDProcessResult> expectedA = HDProcessor().process(X, a, 15, 20, 10, false, 0.25, 0);
+  std::unique_ptr<HDProcessResult> expectedB = HDProcessor().process(X, b, 15, 20, 10, false, 0.25, 0);
+
+  std::unique_ptr<HDProcessResult> resultA, resultB;
+  std::thread first([&]() { resultA = HDProcessor().process(X, a, 15, 20, 10, false, 0.25, 0); });
+  std::thread second([&]() { resultB = HDProcessor().process(X, b, 15, 20, 10, false, 0.25, 0); });
+  first.join();
+  second.join();
+  expectSameResult(*expectedA, *resultA);
+  expectSameResult(*expectedB, *resultB);
+}
+
+TEST(HDProcessor, processesFieldsInSequence) {
+  FortranLinalg::DenseMatrix<Precision> X;
+  FortranLinalg::DenseVector<Precision> a, b;
+  samples(1000, X, a, b);
+  HDProcessor processor;
+  processor.process(X, a, 15, 20, 10, false, 0.25, 0);
+  std::unique_ptr<HDProcessResult> result = processor.process(X, b, 15, 20, 10, false, 0.25, 0);
+  std::unique_ptr<HDProcessResult> expected = HDProcessor().process(X, b, 15, 20, 10, false, 0.25, 0);
+  expectSameResult(*expected, *result);
+}
+
+// crystals are regressed in parallel, but the result is the same for any
+// number of threads
+TEST(HDProcessor, resultDoesNotDependOnThreadCount) {
+  FortranLinalg::DenseMatrix<Precision> X;
+  FortranLinalg::DenseVector<Precision> a, b;
+  samples(1000, X, a, b);
+  Parallel::setThreadCount(1);
+  std::unique_ptr<HDProcessResult> expected = HDProcessor().process(X, a, 15, 20, 10, false, 0.25, 0.05);
+  for (unsigned int threads : {2, 3, 8}) {
+    Parallel::setThreadCount(threads);
+    ASSERT_EQ(Parallel::threadCount(), threads);
+    std::unique_ptr<HDProcessResult> result = HDProcessor().process(X, a, 15, 20, 10, false, 0.25, 0.05);
+    expectSameResult(*expected, *result);
+  }
+  Parallel::setThreadCount(0);
+}
+
+TEST(Buckets, groupsIndicesByKey) {
+  std::vector<int> partition = {2, 0, 2, 3, 0, 2};
+  Buckets buckets(partition.size(), 5, [&](unsigned int i) { return partition[i]; });
+  ASSERT_EQ(buckets.keys(), 5u);
+  std::vector<std::vector<unsigned int>> expected = {{1, 4}, {}, {0, 2, 5}, {3}, {}};
+  for (unsigned int key = 0; key < buckets.keys(); key++) {
+    EXPECT_EQ(std::vector<unsigned int>(buckets.begin(key), buckets.end(key)), expected[key]);
+    EXPECT_EQ(buckets.size(key), expected[key].size());
+  }
+}
@@ -0,0 +1,171 @@
+#include "gtest/gtest.h"
+#include "flinalg/DenseMatrix.h"
+#include "graph/HNSW.h"
+#include "graph/HNSWNeighborhood.h"
+#include "metrics/Distance.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Declarations
+//---------------------------------------------------------------------
+
+// samples scattered around a few centers, so neighborhoods are meaningful
+// in high dimensions
+template <typename T>
+FortranLinalg::DenseMatrix<T> clusteredSamples(unsigned int dim, unsigned int count) {
+  FortranLinalg::DenseMatrix<T> X(dim, count);
+  std::srand(29);
+  std::vector<T> centers(dim * 8);
+  for (auto &c : centers) {
+    c = std::rand() / (T) RAND_MAX;
+  }
+  for (unsigned int j = 0; j < count; j++) {
+    for (unsigned int i = 0; i < dim; i++) {
+      X(i, j) = centers[(j % 8) * dim + i] + 0.2 * std::rand() / (T) RAND_MAX;
+    }
+  }
+  return X;
+}
+
+template <typename T>
+double recall(FortranLinalg::DenseMatrix<T> &X, FortranLinalg::DenseMatrix<int> &knn) {
+  auto D = Distance<T>::computeEuclideanDistances(X, true);
+  unsigned int k = knn.M();
+  unsigned int found = 0;
+  for (unsigned int i = 0; i < X.N(); i++) {
+    std::vector<std::pair<T, int>> exact;
+    for (unsigned int j = 0; j < X.N(); j++) {
+      exact.push_back(std::make_pair(D(j, i), (int) j));
+    }
+    std::partial_sort(exact.begin(), exact.begin() + k, exact.end());
+    for (unsigned int j = 0; j < k; j++) {
+      for (unsigned int l = 0; l < k; l++) {
+        if (knn(l, i) == exact[j].second) {
+          found++;
+          break;
+        }
+      }
+    }
+  }
+  D.deallocate();
+  return found / (double) (k * X.N());
+}
+
+//---------------------------------------------------------------------
+// Tests
+//---------------------------------------------------------------------
+
+TEST(HNSW, highDimensionalRecall) {
+  unsigned int k = 10;
+  auto X = clusteredSamples<float>(256, 3000);
+  FortranLinalg::DenseMatrix<int> knn(k, X.N());
+  FortranLinalg::DenseMatrix<float> knnd(k, X.N());
+  HNSW<float>::computeKNN(X, knn, knnd);
+
+  EXPECT_GT(recall(X, knn), 0.95);
+  for (unsigned int i = 0; i < X.N(); i++) {
+    ASSERT_EQ(knn(0, i), (int) i);
+    for (unsigned int j = 1; j < k; j++) {
+      ASSERT_LE(knnd(j - 1, i), knnd(j, i));
+    }
+  }
+  X.deallocate();
+  knn.deallocate();
+  knnd.deallocate();
+}
+
+TEST(HNSW, saveAndLoadGiveSameNeighbors) {
+  unsigned int k = 5;
+  auto X = clusteredSamples<double>(32, 800);
+  HNSWParameters params;
+  params.M = 8;
+  params.efSearch = 20;
+  HNSW<double> index(X, params);
+  std::string filename = "hnsw_tests.index";
+  index.save(filename);
+  HNSW<double> loaded(filename);
+  std::remove(filename.c_str());
+
+  ASSERT_EQ(loaded.size(), X.N());
+  ASSERT_EQ(loaded.dimension(), X.M());
+  ASSERT_EQ(loaded.parameters().efSearch, 20u);
+  FortranLinalg::DenseMatrix<int> knn(k, X.N()), knnLoaded(k, X.N());
+  FortranLinalg::DenseMatrix<double> knnd(k, X.N()), knndLoaded(k, X.N());
+  index.computeKNN(knn, knnd);
+  loaded.computeKNN(knnLoaded, knndLoaded);
+  for (unsigned int i = 0; i < X.N(); i++) {
+    for (unsigned int j = 0; j < k; j++) {
+      ASSERT_EQ(knn(j, i), knnLoaded(j, i));
+      ASSERT_EQ(knnd(j, i), knndLoaded(j, i));
+    }
+  }
+  ASSERT_THROW(HNSW<float> wrongPrecision(filename), std::runtime_error);
+  X.deallocate();
+  knn.deallocate();
+  knnd.deallocate();
+  knnLoaded.deallocate();
+  knndLoaded.deallocate();
+}
+
+TEST(HNSW, loadRejectsOutOfRangeLinks) {
+  auto X = clusteredSamples<double>(4, 50);
+  HNSW<double> index(X);
+  std::string filename = "hnsw_tests_corrupt.index";
+  index.save(filename);
+  // the file ends with the base layer links of the last node
+  std::FILE *file = std::fopen(filename.c_str(), "r+b");
+  int link = X.N() + 5;
+  std::fseek(file, -(long) sizeof(int), SEEK_END);
+  std::fwrite(&link, sizeof(int), 1, file);
+  std::fclose(file);
+  ASSERT_THROW(HNSW<double> corrupt(filename), std::runtime_error);
+  std::remove(filename.c_str());
+  X.deallocate();
+}
+
+TEST(HNSW, queriesOnIndicesOfDifferentSizes) {
+  unsigned int k = 4;
+  auto large = clusteredSamples<double>(8, 400);
+  auto small = clusteredSamples<double>(8, 60);
+  HNSW<double> largeIndex(large), smallIndex(small);
+  FortranLinalg::DenseMatrix<int> knn(k, small.N());
+  FortranLinalg::DenseMatrix<double> knnd(k, small.N());
+  smallIndex.computeKNN(knn, knnd);
+  // alternating queries share this thread's visited list
+  std::vector<int> indices(k);
+  std::vector<double> dists(k);
+  for (unsigned int i = 0; i < small.N(); i++) {
+    largeIndex.knn(&large(0, i), k, indices.data(), dists.data());
+    ASSERT_EQ(indices[0], (int) i);
+    smallIndex.knn(&small(0, i), k, indices.data(), dists.data());
+    for (unsigned int j = 0; j < k; j++) {
+      ASSERT_EQ(indices[j], knn(j, i));
+    }
+  }
+  large.deallocate();
+  small.deallocate();
+  knn.deallocate();
+  knnd.deallocate();
+}
+
+TEST(HNSW, neighborhoodIsSymmetric) {
+  auto X = clusteredSamples<double>(16, 300);
+  HNSWNeighborhood<double> nh(6);
+  auto adj = nh.generateNeighborhood(X);
+
+  for (unsigned int i = 0; i < adj.N(); i++) {
+    auto *entries = adj.getEntries(i);
+    ASSERT_GE(entries->size(), 5u);
+    for (auto &entry : *entries) {
+      ASSERT_NE(entry.first, i);
+      ASSERT_EQ(adj(entry.first, i), entry.second);
+    }
+  }
+  X.deallocate();
+  adj.deallocate();
+}
@@ -0,0 +1,122 @@
+#include "gtest/gtest.h"
+#include "flinalg/DenseMatrix.h"
+#include "graph/KDTree.h"
+#include "metrics/Distance.h"
+#include "morsesmale/NNMSComplex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Declarations
+//---------------------------------------------------------------------
+
+template <typename T>
+FortranLinalg::DenseMatrix<T> randomPoints(unsigned int dim, unsigned int count) {
+  FortranLinalg::DenseMatrix<T> X(dim, count);
+  std::srand(23);
+  for (unsigned int j = 0; j < count; j++) {
+    for (unsigned int i = 0; i < dim; i++) {
+      X(i, j) = std::rand() / (T) RAND_MAX;
+    }
+  }
+  return X;
+}
+
+//---------------------------------------------------------------------
+// Tests
+//---------------------------------------------------------------------
+
+TEST(KDTree, exactMatchesBruteForce) {
+  unsigned int k = 10;
+  auto X = randomPoints<float>(3, 2000);
+  auto D = Distance<float>::computeEuclideanDistances(X, true);
+  FortranLinalg::DenseMatrix<int> knn(k, X.N());
+  FortranLinalg::DenseMatrix<float> knnd(k, X.N());
+  KDTree<float>::computeKNN(X, knn, knnd);
+
+  for (unsigned int i = 0; i < X.N(); i++) {
+    std::vector<std::pair<float, int>> expected;
+    for (unsigned int j = 0; j < X.N(); j++) {
+      expected.push_back(std::make_pair(D(j, i), (int) j));
+    }
+    std::sort(expected.begin(), expected.end());
+    ASSERT_EQ(knn(0, i), (int) i);
+    for (unsigned int j = 0; j < k; j++) {
+      ASSERT_EQ(knn(j, i), expected[j].second);
+      ASSERT_NEAR(knnd(j, i), expected[j].first, 1e-6);
+    }
+  }
+  X.deallocate();
+  D.deallocate();
+  knn.deallocate();
+  knnd.deallocate();
+}
+
+TEST(KDTree, approximateWithinBound) {
+  unsigned int k = 8;
+  double eps = 0.5;
+  auto X = randomPoints<double>(4, 1500);
+  auto D = Distance<double>::computeEuclideanDistances(X, true);
+  FortranLinalg::DenseMatrix<int> knn(k, X.N());
+  FortranLinalg::DenseMatrix<double> knnd(k, X.N());
+  KDTree<double>::computeKNN(X, knn, knnd, eps);
+
+  for (unsigned int i = 0; i < X.N(); i++) {
+    std::vector<double> expected(D.data() + (size_t) i * X.N(), D.data() + (size_t) (i + 1) * X.N());
+    std::sort(expected.begin(), expected.end());
+    for (unsigned int j = 0; j < k; j++) {
+      // reported distances are true distances and within (1+eps) of the exact ones
+      ASSERT_NEAR(knnd(j, i), D(knn(j, i), i), 1e-12);
+      ASSERT_LE(knnd(j, i), (1 + eps) * (1 + eps) * expected[j] + 1e-12);
+    }
+  }
+  X.deallocate();
+  D.deallocate();
+  knn.deallocate();
+  knnd.deallocate();
+}
+
+TEST(KDTree, queryPadsMissingNeighbors) {
+  auto X = randomPoints<double>(2, 5);
+  KDTree<double> tree(X, 2);
+  double query[2] = {0.5, 0.5};
+  int indices[7];
+  double dists[7];
+  tree.knn(query, 7, indices, dists);
+
+  for (unsigned int j = 1; j < 5; j++) {
+    ASSERT_LE(dists[j - 1], dists[j]);
+  }
+  ASSERT_EQ(indices[5], -1);
+  ASSERT_EQ(indices[6], -1);
+  X.deallocate();
+}
+
+TEST(KDTree, complexMatchesBruteForceSearch) {
+  auto X = randomPoints<double>(2, 500);
+  FortranLinalg::DenseVector<double> y(X.N());
+  for (unsigned int i = 0; i < X.N(); i++) {
+    y(i) = std::sin(6 * X(0, i)) * std::cos(5 * X(1, i));
+  }
+
+  NNMSComplex<double> bruteForce(X, y, 15, false, 0, 0, NNSearch::BruteForce);
+  NNMSComplex<double> kdTree(X, y, 15, false, 0, 0, NNSearch::KDTree);
+  bruteForce.mergePersistence(0.1);
+  kdTree.mergePersistence(0.1);
+  auto expected = bruteForce.getPartitions();
+  auto partitions = kdTree.getPartitions();
+
+  for (unsigned int i = 0; i < X.N(); i++) {
+    ASSERT_EQ(partitions(i), expected(i));
+  }
+  expected.deallocate();
+  partitions.deallocate();
+  bruteForce.cleanup();
+  kdTree.cleanup();
+  X.deallocate();
+  y.deallocate();
+}
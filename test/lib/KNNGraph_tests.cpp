@@ -0,0 +1,138 @@
+#include "gtest/gtest.h"
+#include "dimred/LandmarkIsomap.h"
+#include "flinalg/DenseMatrix.h"
+#include "graph/KNNGraph.h"
+#include "metrics/Distance.h"
+#include "morsesmale/NNMSComplex.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+
+//---------------------------------------------------------------------
+// Declarations
+//---------------------------------------------------------------------
+
+FortranLinalg::DenseMatrix<double> planeSamples(unsigned int count) {
+  FortranLinalg::DenseMatrix<double> X(2, count);
+  std::srand(31);
+  for (unsigned int j = 0; j < count; j++) {
+    X(0, j) = std::rand() / (double) RAND_MAX;
+    X(1, j) = std::rand() / (double) RAND_MAX;
+  }
+  return X;
+}
+
+//---------------------------------------------------------------------
+// Tests
+//---------------------------------------------------------------------
+
+TEST(KNNGraph, dropsSelfAndSortsColumns) {
+  // columns 0 and 2 list themselves, columns 1 and 3 are one neighbor longer
+  FortranLinalg::DenseMatrix<int> knn(3, 4);
+  FortranLinalg::DenseMatrix<double> knnd(3, 4);
+  int indices[12] = {0, 1, 2,   3, 0, 2,   2, 1, 0,   0, 1, 2};
+  double dists[12] = {0, 1, 2,   3, 1, 2,   0, 3, 2,   5, 4, 6};
+  for (unsigned int i = 0; i < 12; i++) {
+    knn.data()[i] = indices[i];
+    knnd.data()[i] = dists[i];
+  }
+  KNNGraph<double> graph(knn, knnd);
+
+  ASSERT_EQ(graph.k(), 2u);
+  int expected[8] = {1, 2,   0, 2,   0, 1,   1, 0};
+  for (unsigned int i = 0; i < 8; i++) {
+    ASSERT_EQ(graph.indices.data()[i], expected[i]);
+  }
+  ASSERT_EQ(graph.distances(1, 1), 2);
+  ASSERT_EQ(graph.distances(0, 3), 4);
+  graph.deallocate();
+}
+
+TEST(KNNGraph, rejectsOutOfRangeNeighbors) {
+  FortranLinalg::DenseMatrix<int> knn(1, 2);
+  FortranLinalg::DenseMatrix<double> knnd(1, 2);
+  knn(0, 0) = 1;
+  knn(0, 1) = 2;
+  ASSERT_THROW(KNNGraph<double>(knn, knnd), std::runtime_error);
+}
+
+TEST(KNNGraph, complexMatchesDistanceMatrixComplex) {
+  auto X = planeSamples(400);
+  FortranLinalg::DenseVector<double> y(X.N());
+  for (unsigned int i = 0; i < X.N(); i++) {
+    y(i) = std::sin(7 * X(0, i)) + std::cos(6 * X(1, i));
+  }
+  auto D = Distance<double>::computeEuclideanDistances(X);
+  FortranLinalg::DenseMatrix<int> knn(20, X.N());
+  FortranLinalg::DenseMatrix<double> knnd(20, X.N());
+  Distance<double>::findKNN(D, knn, knnd);
+  KNNGraph<double> graph(knn, knnd);
+
+  NNMSComplex<double> dense(D, y, 12, false, 0, true);
+  NNMSComplex<double> sparse(graph, y, 12);
+  // more neighbors than the graph holds are not silently dropped
+  ASSERT_THROW(NNMSComplex<double>(graph, y, 21), std::runtime_error);
+  dense.mergePersistence(0.2);
+  sparse.mergePersistence(0.2);
+  auto expected = dense.getPartitions();
+  auto partitions = sparse.getPartitions();
+  for (unsigned int i = 0; i < X.N(); i++) {
+    ASSERT_EQ(partitions(i), expected(i));
+  }
+  expected.deallocate();
+  partitions.deallocate();
+  dense.cleanup();
+  sparse.cleanup();
+  graph.deallocate();
+  D.deallocate();
+  X.deallocate();
+  y.deallocate();
+}
+
+TEST(KNNGraph, fromSamplesMatchesDistanceMatrix) {
+  auto X = planeSamples(300);
+  auto D = Distance<double>::computeEuclideanDistances(X);
+  auto graph = KNNGraph<double>::fromSamples(X, 8);
+
+  ASSERT_EQ(graph.k(), 8u);
+  for (unsigned int i = 0; i < X.N(); i++) {
+    for (unsigned int j = 0; j < graph.k(); j++) {
+      ASSERT_NE(graph.indices(j, i), (int) i);
+      ASSERT_NEAR(graph.distances(j, i), D(graph.indices(j, i), i), 1e-12);
+    }
+  }
+  graph.deallocate();
+  D.deallocate();
+  X.deallocate();
+}
+
+TEST(LandmarkIsomap, unrollsACurve) {
+  // samples along a quarter circle, the geodesic coordinate is the angle
+  unsigned int n = 200;
+  FortranLinalg::DenseMatrix<double> X(2, n);
+  for (unsigned int j = 0; j < n; j++) {
+    double a = 1.5 * j / n;
+    X(0, j) = std::cos(a);
+    X(1, j) = std::sin(a);
+  }
+  auto graph = KNNGraph<double>::fromSamples(X, 4);
+  auto adj = graph.adjacency();
+  LandmarkIsomap<double> isomap(20);
+  auto E = isomap.embedAdj(adj, 2);
+
+  ASSERT_EQ(isomap.getLandmarks().size(), 20u);
+  // leading coordinate is the last row; it must be linear in the angle
+  double sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+  for (unsigned int j = 0; j < n; j++) {
+    double x = j, e = E(1, j);
+    sx += x; sy += e; sxx += x * x; syy += e * e; sxy += x * e;
+  }
+  double corr = (n * sxy - sx * sy) / std::sqrt((n * sxx - sx * sx) * (n * syy - sy * sy));
+  EXPECT_GT(std::fabs(corr), 0.999);
+
+  E.deallocate();
+  adj.deallocate();
+  graph.deallocate();
+  X.deallocate();
+}
@@ -0,0 +1,74 @@
+#include "gtest/gtest.h"
+#include "flinalg/DenseMatrix.h"
+#include "flinalg/DenseVector.h"
+#include "kernelstats/GaussianKernel.h"
+#include "kernelstats/KernelDensity.h"
+#include "kernelstats/SortedKernelDensity.h"
+
+#include <cstdlib>
+
+//---------------------------------------------------------------------
+// Declarations
+//---------------------------------------------------------------------
+
+// clustered one dimensional samples with repeated values
+FortranLinalg::DenseMatrix<float> samples(unsigned int n) {
+  FortranLinalg::DenseMatrix<float> y(1, n);
+  std::srand(7);
+  for (unsigned int i = 0; i < n; i++) {
+    y(0, i) = (i % 3) + 0.2f * std::rand() / (float) RAND_MAX;
+    if (i % 10 == 0) {
+      y(0, i) = 1.5f;
+    }
+  }
+  return y;
+}
+
+//---------------------------------------------------------------------
+// Tests
+//---------------------------------------------------------------------
+
+// the density over the sorted window is within tolerance of the sum over all
+// samples, also far from them
+TEST(SortedKernelDensity, boundsErrorRelativeToSum) {
+  FortranLinalg::DenseMatrix<float> y = samples(2000);
+  GaussianKernel<float> kernel(0.05, 1);
+  for (float tolerance : {0.f, 1e-6f, 1e-3f, 0.1f}) {
+    SortedKernelDensity<float> kd(y.data(), y.N(), kernel, tolerance);
+    for (float x : {-1.f, 0.f, 0.13f, 0.6f, 1.5f, 2.1f, 2.5f, 4.f}) {
+      double exact = 0;
+      for (unsigned int i = 0; i < y.N(); i++) {
+        exact += kernel.f((x - y(0, i)) * (x - y(0, i)));
+      }
+      double p = kd.p(x);
+      EXPECT_LE(p, exact * (1 + 1e-5)) << "tolerance " << tolerance << " x " << x;
+      EXPECT_GE(p, exact * (1 - tolerance - 1e-5)) << "tolerance " << tolerance << " x " << x;
+    }
+  }
+  y.deallocate();
+}
+
+// one dimensional samples under a Gaussian kernel take the sorted path
+TEST(KernelDensity, oneDimensionalMatchesSum) {
+  FortranLinalg::DenseMatrix<float> y = samples(500), y2(2, 500);
+  for (unsigned int i = 0; i < y.N(); i++) {
+    y2(0, i) = y(0, i);
+    y2(1, i) = 0;
+  }
+  GaussianKernel<float> kernel(0.1, 1), kernel2(0.1, 2);
+  KernelDensity<float> kd(y, kernel), kd2(y2, kernel2);
+  FortranLinalg::DenseVector<float> x(1), x2(2);
+  x2(1) = 0;
+  for (float value : {-0.5f, 0.05f, 1.f, 1.5f, 2.15f, 3.f}) {
+    x(0) = x2(0) = value;
+    EXPECT_NEAR(kd.p(x), kd2.p(x2), 1e-4 * kd2.p(x2)) << "x " << value;
+  }
+  for (int j : {0, 10, 77}) {
+    EXPECT_NEAR(kd.p(j), kd2.p(j), 1e-4 * kd2.p(j)) << "sample " << j;
+    EXPECT_NEAR(kd.p(j, j), kd2.p(j, j), 1e-4 * kd2.p(j, j)) << "sample " << j;
+  }
+  y.deallocate();
+  y2.deallocate();
+  x.deallocate();
+  x2.deallocate();
+}
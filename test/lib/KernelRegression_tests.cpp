@@ -0,0 +1,197 @@
+#include "gtest/gtest.h"
+#include "flinalg/DenseMatrix.h"
+#include "flinalg/DenseVector.h"
+#include "flinalg/Linalg.h"
+#include "flinalg/SmallLeastSquares.h"
+#include "kernelstats/FirstOrderKernelRegression.h"
+#include "kernelstats/GaussianKernel.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Declarations
+//---------------------------------------------------------------------
+
+// solves w * [a, b] by SmallLeastSquares and by gelsd in double precision
+void expectSameAsGelsd(FortranLinalg::DenseMatrix<float> &a, FortranLinalg::DenseVector<float> &w,
+                       FortranLinalg::DenseMatrix<float> &b, bool cholesky) {
+  unsigned int m = a.M(), n = a.N(), nrhs = b.N();
+  FortranLinalg::SmallLeastSquares<float> solver(m, n, nrhs);
+  std::vector<float> row(n), rhs(nrhs);
+  std::vector<std::vector<float>> rhsRows(m);
+  FortranLinalg::DenseMatrix<double> A(m, n), B(m, nrhs);
+  for (unsigned int i = 0; i < m; i++) {
+    for (unsigned int j = 0; j < n; j++) {
+      row[j] = a(i, j);
+      A(i, j) = (double) w(i) * a(i, j);
+    }
+    for (unsigned int c = 0; c < nrhs; c++) {
+      rhsRows[i].push_back(b(i, c));
+      B(i, c) = (double) w(i) * b(i, c);
+    }
+    solver.addRow(row.data(), w(i), rhsRows[i].data());
+  }
+  std::vector<float> x(n * nrhs), sse(nrhs);
+  EXPECT_EQ(solver.solve(x.data(), sse.data()), cholesky);
+
+  FortranLinalg::DenseMatrix<double> expected = FortranLinalg::Linalg<double>::LeastSquares(A, B);
+  for (unsigned int c = 0; c < nrhs; c++) {
+    for (unsigned int j = 0; j < n; j++) {
+      EXPECT_NEAR(x[c * n + j], expected(j, c), 1e-4 * (1 + std::fabs(expected(j, c))));
+    }
+    // residual of the gelsd solution, which gelsd itself only reports for
+    // full rank problems
+    double expectedSse = 0;
+    for (unsigned int i = 0; i < m; i++) {
+      double e = (double) w(i) * b(i, c);
+      for (unsigned int j = 0; j < n; j++) {
+        e -= (double) w(i) * a(i, j) * expected(j, c);
+      }
+      expectedSse += e * e;
+    }
+    EXPECT_NEAR(sse[c], expectedSse, 1e-4 * (1 + expectedSse));
+  }
+  expected.deallocate();
+  A.deallocate();
+  B.deallocate();
+}
+
+//---------------------------------------------------------------------
+// Tests
+//---------------------------------------------------------------------
+
+// well-conditioned problems are solved by Cholesky, others by QR giving the
+// minimum norm solution of rank deficient problems as gelsd does
+TEST(SmallLeastSquares, matchesGelsd) {
+  unsigned int m = 40, n = 3, nrhs = 5;
+  FortranLinalg::DenseMatrix<float> a(m, n), b(m, nrhs);
+  FortranLinalg::DenseVector<float> w(m);
+  std::srand(5);
+  for (unsigned int i = 0; i < m; i++) {
+    w(i) = 0.1f + std::rand() / (float) RAND_MAX;
+    a(i, 0) = 1;
+    a(i, 1) = std::rand() / (float) RAND_MAX - 0.5f;
+    a(i, 2) = std::rand() / (float) RAND_MAX - 0.5f;
+    for (unsigned int c = 0; c < nrhs; c++) {
+      b(i, c) = c * a(i, 1) - a(i, 2) + std::rand() / (float) RAND_MAX;
+    }
+  }
+  expectSameAsGelsd(a, w, b, true);
+
+  // nearly collinear columns
+  for (unsigned int i = 0; i < m; i++) {
+    a(i, 2) = a(i, 1) + 1e-5f * (i % 3);
+  }
+  expectSameAsGelsd(a, w, b, false);
+
+  // rank deficient, a duplicated column
+  for (unsigned int i = 0; i < m; i++) {
+    a(i, 2) = a(i, 1);
+  }
+  expectSameAsGelsd(a, w, b, false);
+
+  // fewer rows than unknowns
+  FortranLinalg::DenseMatrix<float> a2(2, n), b2(2, nrhs);
+  for (unsigned int i = 0; i < 2; i++) {
+    a2(i, 0) = a(i, 0);
+    a2(i, 1) = a(i, 1);
+    a2(i, 2) = 3 * i - 1.f;
+    for (unsigned int c = 0; c < nrhs; c++) {
+      b2(i, c) = b(i, c);
+    }
+  }
+  expectSameAsGelsd(a2, w, b2, false);
+
+  a.deallocate();
+  b.deallocate();
+  a2.deallocate();
+  b2.deallocate();
+  w.deallocate();
+}
+
+// the sorted window of one dimensional labels finds the same neighbors as
+// the search over all labels, used here for labels with a constant second
+// dimension
+TEST(FirstOrderKernelRegression, sortedLabelsMatchSearch) {
+  unsigned int n = 500, d = 4;
+  FortranLinalg::DenseMatrix<float> data(d, n), labels(1, n), labels2(2, n);
+  std::srand(11);
+  for (unsigned int i = 0; i < n; i++) {
+    labels(0, i) = labels2(0, i) = std::rand() / (float) RAND_MAX;
+    labels2(1, i) = 0;
+    for (unsigned int j = 0; j < d; j++) {
+      data(j, i) = labels(0, i) * j + 0.1f * std::rand() / (float) RAND_MAX;
+    }
+  }
+
+  for (int knn : {1, 30, 2000}) {
+    GaussianKernel<float> kernel(0.2, 1);
+    FirstOrderKernelRegression<float> sorted(data, labels, kernel, knn);
+    FirstOrderKernelRegression<float> search(data, labels2, kernel, knn);
+    FortranLinalg::DenseVector<float> z(1), z2(2), r(d), r2(d), sse(d), sse2(d);
+    FortranLinalg::DenseMatrix<float> J(d, 1), J2(d, 2);
+    for (float x : {-0.5f, 0.f, 0.3f, 0.77f, 1.f, 1.5f}) {
+      z(0) = z2(0) = x;
+      z2(1) = 0;
+      sorted.evaluate(z, r, J, sse.data());
+      search.evaluate(z2, r2, J2, sse2.data());
+      for (unsigned int j = 0; j < d; j++) {
+        EXPECT_NEAR(r(j), r2(j), 1e-4) << "knn " << knn << " x " << x;
+        EXPECT_NEAR(J(j, 0), J2(j, 0), 1e-3) << "knn " << knn << " x " << x;
+        EXPECT_NEAR(sse(j), sse2(j), 1e-4) << "knn " << knn << " x " << x;
+      }
+    }
+    sorted.cleanup();
+    search.cleanup();
+    for (auto v : {&z, &z2, &r, &r2, &sse, &sse2}) v->deallocate();
+    J.deallocate();
+    J2.deallocate();
+  }
+}
+
+// evaluating all samples of a curve at once gives the fits of evaluating
+// them one at a time
+TEST(FirstOrderKernelRegression, evaluatesCurveAtOnce) {
+  unsigned int n = 300, d = 3, samples = 25;
+  FortranLinalg::DenseMatrix<float> data(d, n), labels(1, n);
+  std::srand(17);
+  for (unsigned int i = 0; i < n; i++) {
+    // repeated labels leave the fits of one neighbor rank deficient
+    labels(0, i) = (i % 100) / 100.f;
+    for (unsigned int j = 0; j < d; j++) {
+      data(j, i) = labels(0, i) * labels(0, i) * j + 0.1f * std::rand() / (float) RAND_MAX;
+    }
+  }
+
+  for (int knn : {1, 3, 50, 1000}) {
+    GaussianKernel<float> kernel(0.1, 1);
+    FirstOrderKernelRegression<float> kr(data, labels, kernel, knn);
+    FortranLinalg::DenseMatrix<float> z(1, samples), R(d, samples), gradR(d, samples), sse(d, samples);
+    for (unsigned int k = 0; k < samples; k++) {
+      z(0, k) = -0.1f + 1.2f * k / (samples - 1);
+    }
+    kr.evaluate(z, R, gradR, &sse);
+
+    FortranLinalg::DenseVector<float> zk(1), r(d), s(d);
+    FortranLinalg::DenseMatrix<float> J(d, 1);
+    for (unsigned int k = 0; k < samples; k++) {
+      zk(0) = z(0, k);
+      kr.evaluate(zk, r, J, s.data());
+      for (unsigned int j = 0; j < d; j++) {
+        EXPECT_FLOAT_EQ(R(j, k), r(j)) << "knn " << knn << " sample " << k;
+        EXPECT_FLOAT_EQ(gradR(j, k), J(j, 0)) << "knn " << knn << " sample " << k;
+        EXPECT_FLOAT_EQ(sse(j, k), s(j)) << "knn " << knn << " sample " << k;
+        EXPECT_TRUE(std::isfinite(R(j, k)) && std::isfinite(gradR(j, k)));
+      }
+    }
+    kr.cleanup();
+    for (auto m : {&z, &R, &gradR, &sse, &J}) m->deallocate();
+    zk.deallocate();
+    r.deallocate();
+    s.deallocate();
+  }
+  data.deallocate();
+  labels.deallocate();
+}
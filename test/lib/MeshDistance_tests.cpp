@@ -0,0 +1,111 @@
+#include "gtest/gtest.h"
+#include "flinalg/DenseMatrix.h"
+#include "metrics/MeshDistance.h"
+
+#include <Eigen/Geometry>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Declarations
+//---------------------------------------------------------------------
+
+typedef Eigen::Matrix<double, Eigen::Dynamic, 3> Points;
+
+// random rigid motions (and scales) of one random shape, with a little
+// per vertex noise
+std::vector<Points> randomMeshes(unsigned int count, unsigned int vertices, double noise, bool scale) {
+  std::srand(3);
+  auto random = []() { return std::rand() / (double) RAND_MAX; };
+  Points base(vertices, 3);
+  for (unsigned int i = 0; i < vertices; i++) {
+    base.row(i) << random(), 2 * random(), 3 * random();
+  }
+  std::vector<Points> meshes;
+  for (unsigned int m = 0; m < count; m++) {
+    Eigen::Matrix3d R = Eigen::AngleAxisd(6 * random(), Eigen::Vector3d(random(), random(), random()).normalized())
+                            .toRotationMatrix();
+    Eigen::RowVector3d t(10 * random(), -5 * random(), random());
+    double s = scale ? 0.5 + random() : 1;
+    Points X = base;
+    for (unsigned int i = 0; i < vertices; i++) {
+      X.row(i) += noise * Eigen::RowVector3d(random(), random(), random());
+    }
+    meshes.push_back(((s * X * R).rowwise() + t).eval());
+  }
+  return meshes;
+}
+
+// alternately as ascii PLY and OBJ, returns the file names
+std::vector<std::string> writeMeshes(const std::vector<Points> &meshes) {
+  std::vector<std::string> files;
+  for (unsigned int m = 0; m < meshes.size(); m++) {
+    std::string name = testing::TempDir() + "mesh" + std::to_string(m) + (m % 2 ? ".obj" : ".ply");
+    std::ofstream file(name);
+    file.precision(17);
+    if (m % 2 == 0) {
+      file << "ply\nformat ascii 1.0\nelement vertex " << meshes[m].rows()
+           << "\nproperty double x\nproperty double y\nproperty double z\nend_header\n";
+    }
+    for (long i = 0; i < meshes[m].rows(); i++) {
+      file << (m % 2 ? "v " : "") << meshes[m](i, 0) << " " << meshes[m](i, 1) << " " << meshes[m](i, 2) << "\n";
+    }
+    files.push_back(name);
+  }
+  return files;
+}
+
+//---------------------------------------------------------------------
+// Tests
+//---------------------------------------------------------------------
+
+TEST(MeshDistance, loadsPlyAndObjVertices) {
+  auto meshes = randomMeshes(6, 40, 0.1, false);
+  auto V = MeshDistance<double>::loadVertices(writeMeshes(meshes));
+  ASSERT_EQ(V.M(), 3 * 40u);
+  ASSERT_EQ(V.N(), 6u);
+
+  auto D = MeshDistance<double>::computeDistances(V);
+  for (unsigned int a = 0; a < meshes.size(); a++) {
+    for (unsigned int i = 0; i < 40; i++) {
+      for (unsigned int k = 0; k < 3; k++) {
+        ASSERT_DOUBLE_EQ(V(3 * i + k, a), meshes[a](i, k));
+      }
+    }
+    for (unsigned int b = 0; b < meshes.size(); b++) {
+      ASSERT_NEAR(D(a, b), (meshes[a] - meshes[b]).norm(), 1e-8);
+    }
+  }
+  V.deallocate();
+  D.deallocate();
+}
+
+TEST(MeshDistance, procrustesRemovesRigidMotion) {
+  auto meshes = randomMeshes(8, 30, 0, false);
+  auto V = MeshDistance<double>::loadVertices(writeMeshes(meshes));
+  auto D = MeshDistance<double>::computeDistances(V, true);
+  for (unsigned int i = 0; i < D.M() * D.N(); i++) {
+    ASSERT_NEAR(D.data()[i], 0, 1e-6);
+  }
+  V.deallocate();
+  D.deallocate();
+
+  // scaled copies only coincide when scaling is allowed
+  meshes = randomMeshes(8, 30, 0, true);
+  V = MeshDistance<double>::loadVertices(writeMeshes(meshes));
+  D = MeshDistance<double>::computeDistances(V, true, true);
+  for (unsigned int i = 0; i < D.M() * D.N(); i++) {
+    ASSERT_NEAR(D.data()[i], 0, 1e-6);
+  }
+  V.deallocate();
+  D.deallocate();
+}
+
+TEST(MeshDistance, mismatchedVertexCountsThrow) {
+  auto meshes = randomMeshes(3, 20, 0, false);
+  meshes[2].conservativeResize(19, 3);
+  ASSERT_THROW(MeshDistance<float>::loadVertices(writeMeshes(meshes)), std::runtime_error);
+}
@@ -0,0 +1,481 @@
+#include "gtest/gtest.h"
+#include "flinalg/DenseMatrix.h"
+#include "flinalg/DenseVector.h"
+#include "morsesmale/IncrementalMSComplex.h"
+#include "morsesmale/LandmarkMSComplex.h"
+#include "morsesmale/MultiFieldMSComplex.h"
+#include "morsesmale/NNMSComplex.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <set>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Declarations
+//---------------------------------------------------------------------
+
+// samples on a line with integer function values, so that many saddles
+// have exactly the same persistence
+void tiedLine(unsigned int n, FortranLinalg::DenseMatrix<double> &X, FortranLinalg::DenseVector<double> &y) {
+  X = FortranLinalg::DenseMatrix<double>(1, n);
+  y = FortranLinalg::DenseVector<double>(n);
+  for (unsigned int i = 0; i < n; i++) {
+    X(0, i) = i;
+    y(i) = (i * 7919) % 13 + 1e-6 * i;
+  }
+}
+
+//---------------------------------------------------------------------
+// Tests
+//---------------------------------------------------------------------
+
+TEST(NNMSComplex, tiedPersistenceMergesAllExtrema) {
+  FortranLinalg::DenseMatrix<double> X;
+  FortranLinalg::DenseVector<double> y;
+  tiedLine(400, X, y);
+  NNMSComplex<double> complex(X, y, 4, false, 0.0, 0.0);
+
+  // every merge removes one extremum until a single maximum and minimum are
+  // left, including merges of equal persistence
+  auto persistence = complex.getPersistence();
+  ASSERT_GT(complex.getNAllExtrema(), 10);
+  ASSERT_EQ(persistence.N() - 1, complex.getNAllExtrema() - 2);
+  for (unsigned int i = 1; i < persistence.N(); i++) {
+    ASSERT_LE(persistence(i - 1), persistence(i));
+  }
+
+  complex.mergePersistence(persistence(persistence.N() - 1));
+  ASSERT_EQ(complex.getNCrystals(), 1);
+  persistence.deallocate();
+  complex.cleanup();
+  X.deallocate();
+  y.deallocate();
+}
+
+TEST(NNMSComplex, partitionsMatchCrystalsAtEveryLevel) {
+  FortranLinalg::DenseMatrix<double> X;
+  FortranLinalg::DenseVector<double> y;
+  tiedLine(300, X, y);
+  NNMSComplex<double> complex(X, y, 6, false, 0.0, 0.0);
+
+  auto persistence = complex.getPersistence();
+  int previous = complex.getNCrystals() + 1;
+  for (unsigned int level = 0; level < persistence.N(); level++) {
+    complex.mergePersistence(persistence(level));
+    auto partitions = complex.getPartitions();
+    auto crystals = complex.getCrystals();
+    auto extrema = complex.getExtrema();
+    ASSERT_LE(complex.getNCrystals(), previous);
+    previous = complex.getNCrystals();
+
+    // crystal IDs are dense, distinct extrema pairs and agree with getExtrema
+    std::set<std::pair<int, int>> pairs;
+    for (int c = 0; c < complex.getNCrystals(); c++) {
+      ASSERT_EQ(extrema[c], std::make_pair(crystals(0, c), crystals(1, c)));
+      pairs.insert(extrema[c]);
+    }
+    ASSERT_EQ((int) pairs.size(), complex.getNCrystals());
+    std::set<int> used;
+    for (unsigned int i = 0; i < partitions.N(); i++) {
+      ASSERT_GE(partitions(i), 0);
+      ASSERT_LT(partitions(i), complex.getNCrystals());
+      ASSERT_GE(y(crystals(0, partitions(i))), y(i));
+      ASSERT_LE(y(crystals(1, partitions(i))), y(i));
+      used.insert(partitions(i));
+    }
+    ASSERT_EQ((int) used.size(), complex.getNCrystals());
+    partitions.deallocate();
+    crystals.deallocate();
+  }
+  persistence.deallocate();
+  complex.cleanup();
+  X.deallocate();
+  y.deallocate();
+}
+
+TEST(NNMSComplex, hierarchyLevelsMatchMergePersistence) {
+  FortranLinalg::DenseMatrix<double> X;
+  FortranLinalg::DenseVector<double> y;
+  tiedLine(300, X, y);
+  NNMSComplex<double> complex(X, y, 6, false, 0.0, 0.0);
+  const MergeHierarchy<double> &hierarchy = complex.getHierarchy();
+  ASSERT_EQ(hierarchy.sampleCount(), X.N());
+  ASSERT_EQ((int) hierarchy.extremaCount(), complex.getNAllExtrema());
+
+  // round trip through the serialized form
+  std::stringstream stream;
+  hierarchy.write(stream);
+  MergeHierarchy<double> restored = MergeHierarchy<double>::read(stream);
+  ASSERT_EQ(restored.mergeCount(), hierarchy.mergeCount());
+
+  auto persistence = complex.getPersistence();
+  ASSERT_EQ(persistence.N(), hierarchy.levelCount());
+  for (unsigned int level = 0; level < hierarchy.levelCount(); level++) {
+    ASSERT_EQ(persistence(level), hierarchy.persistence(level));
+
+    // the level reached by a persistence threshold
+    complex.mergePersistence(persistence(level));
+    auto partitions = complex.getPartitions();
+    std::vector<int> partition;
+    restored.partitions(hierarchy.levelOf(persistence(level)), partition);
+    for (unsigned int i = 0; i < partitions.N(); i++) {
+      ASSERT_EQ(partitions(i), partition[i]);
+    }
+    partitions.deallocate();
+
+    // every level, including those of tied persistence
+    complex.mergeLevel(level);
+    auto crystals = complex.getCrystals();
+    ASSERT_EQ(complex.getNCrystals() + 0u, crystals.N());
+    std::vector<int> representative;
+    restored.extrema(level, representative);
+    std::set<int> surviving;
+    for (int e : representative) {
+      surviving.insert(restored.getExtremaIndex()[e]);
+    }
+    ASSERT_EQ(surviving.size(), hierarchy.extremaCount() - level);
+    for (unsigned int c = 0; c < crystals.N(); c++) {
+      ASSERT_TRUE(surviving.count(crystals(0, c)));
+      ASSERT_TRUE(surviving.count(crystals(1, c)));
+    }
+    crystals.deallocate();
+  }
+
+  std::stringstream truncated(stream.str().substr(0, 10));
+  ASSERT_THROW(MergeHierarchy<double>::read(truncated), std::runtime_error);
+  persistence.deallocate();
+  complex.cleanup();
+  X.deallocate();
+  y.deallocate();
+}
+
+TEST(NNMSComplex, steepestPathsEndAtCrystalExtrema) {
+  FortranLinalg::DenseMatrix<double> X(2, 2000);
+  FortranLinalg::DenseVector<double> y(X.N());
+  std::srand(3);
+  for (unsigned int i = 0; i < X.N(); i++) {
+    X(0, i) = std::rand() / (double) RAND_MAX;
+    X(1, i) = std::rand() / (double) RAND_MAX;
+    y(i) = std::sin(9 * X(0, i)) * std::cos(7 * X(1, i));
+  }
+  NNMSComplex<double> complex(X, y, 8, false, 0.0, 0.0);
+  complex.mergeLevel(0);
+  auto knng = complex.getSteepestAscDec();
+  auto partitions = complex.getPartitions();
+  auto crystals = complex.getCrystals();
+
+  ASSERT_EQ(knng.cols(), (int) X.N());
+  for (unsigned int i = 0; i < X.N(); i++) {
+    for (int e = 0; e < 2; e++) {
+      int end = i;
+      for (int next = knng(e, end); next != -1; next = knng(e, end)) {
+        ASSERT_TRUE(e == 0 ? y(next) > y(end) : y(next) < y(end));
+        end = next;
+      }
+      ASSERT_EQ(end, crystals(e, partitions(i)));
+    }
+  }
+  partitions.deallocate();
+  crystals.deallocate();
+  complex.cleanup();
+  X.deallocate();
+  y.deallocate();
+}
+
+TEST(NNMSComplex, multiFieldMatchesSingleFieldComplexes) {
+  FortranLinalg::DenseMatrix<double> X(3, 600);
+  std::srand(11);
+  for (unsigned int i = 0; i < X.N(); i++) {
+    for (unsigned int d = 0; d < X.M(); d++) {
+      X(d, i) = std::rand() / (double) RAND_MAX;
+    }
+  }
+  EuclideanMetric<double> metric;
+  auto distances = Distance<double>::computeDistances(X, metric);
+  std::vector<FortranLinalg::DenseVector<double>> fields;
+  for (unsigned int f = 0; f < 9; f++) {
+    fields.push_back(FortranLinalg::DenseVector<double>(X.N()));
+    for (unsigned int i = 0; i < X.N(); i++) {
+      fields[f](i) = std::sin((f + 2) * X(0, i) + f * X(1, i)) + X(2, i) * f;
+    }
+  }
+
+  for (bool smooth : {false, true}) {
+    MultiFieldMSComplex<double> batch(distances, 10);
+    auto complexes = batch.compute(fields, smooth, 0.05);
+    ASSERT_EQ(complexes.size(), fields.size());
+    for (unsigned int f = 0; f < fields.size(); f++) {
+      NNMSComplex<double> single(distances, fields[f], 10, smooth, 0.05, true);
+      auto expected = single.getPersistence();
+      auto persistence = complexes[f]->getPersistence();
+      ASSERT_EQ(persistence.N(), expected.N());
+      for (unsigned int level = 0; level < expected.N(); level++) {
+        ASSERT_EQ(persistence(level), expected(level));
+      }
+      for (unsigned int level = 0; level < expected.N(); level += 3) {
+        single.mergeLevel(level);
+        complexes[f]->mergeLevel(level);
+        ASSERT_EQ(complexes[f]->getExtrema(), single.getExtrema());
+        auto partitions = complexes[f]->getPartitions();
+        auto expectedPartitions = single.getPartitions();
+        for (unsigned int i = 0; i < X.N(); i++) {
+          ASSERT_EQ(partitions(i), expectedPartitions(i));
+        }
+        partitions.deallocate();
+        expectedPartitions.deallocate();
+      }
+      expected.deallocate();
+      persistence.deallocate();
+      single.cleanup();
+      complexes[f]->cleanup();
+    }
+    batch.deallocate();
+  }
+
+  std::vector<FortranLinalg::DenseVector<double>> wrongSize(1, FortranLinalg::DenseVector<double>(5));
+  MultiFieldMSComplex<double> batch(distances, 10);
+  ASSERT_THROW(batch.compute(wrongSize), std::runtime_error);
+  batch.deallocate();
+  wrongSize[0].deallocate();
+  for (auto &field : fields) {
+    field.deallocate();
+  }
+  distances.deallocate();
+  X.deallocate();
+}
+
+// the complex after inserting samples in batches equals the one of all samples
+void expectSameComplex(NNMSComplex<double> &expected, NNMSComplex<double> &actual) {
+  auto persistence = actual.getPersistence();
+  auto expectedPersistence = expected.getPersistence();
+  ASSERT_EQ(persistence.N(), expectedPersistence.N());
+  for (unsigned int level = 0; level < persistence.N(); level++) {
+    ASSERT_EQ(persistence(level), expectedPersistence(level));
+  }
+  for (unsigned int level = 0; level < persistence.N(); level += 2) {
+    expected.mergeLevel(level);
+    actual.mergeLevel(level);
+    ASSERT_EQ(actual.getExtrema(), expected.getExtrema());
+    auto partitions = actual.getPartitions();
+    auto expectedPartitions = expected.getPartitions();
+    for (unsigned int i = 0; i < partitions.N(); i++) {
+      ASSERT_EQ(partitions(i), expectedPartitions(i));
+    }
+    partitions.deallocate();
+    expectedPartitions.deallocate();
+  }
+  ASSERT_EQ(actual.getSteepestAscDec(), expected.getSteepestAscDec());
+  persistence.deallocate();
+  expectedPersistence.deallocate();
+}
+
+TEST(NNMSComplex, incrementalInsertionMatchesRecompute) {
+  FortranLinalg::DenseMatrix<double> X(2, 900);
+  FortranLinalg::DenseVector<double> y(X.N());
+  std::srand(5);
+  for (unsigned int i = 0; i < X.N(); i++) {
+    X(0, i) = std::rand() / (double) RAND_MAX;
+    X(1, i) = std::rand() / (double) RAND_MAX;
+    y(i) = std::sin(8 * X(0, i)) * std::cos(6 * X(1, i)) + 0.1 * X(1, i);
+  }
+  EuclideanMetric<double> metric;
+  auto distances = Distance<double>::computeDistances(X, metric);
+  const std::vector<unsigned int> sizes = {500, 510, 511, 700, 900};
+
+  for (bool smooth : {false, true}) {
+    FortranLinalg::DenseMatrix<double> X0(2, sizes[0], X.data());
+    FortranLinalg::DenseVector<double> y0(sizes[0], y.data());
+    auto fromSamples = IncrementalMSComplex<double>::fromSamples(X0, y0, 8, smooth, 0.01);
+    FortranLinalg::DenseMatrix<double> D0(sizes[0], sizes[0]);
+    for (unsigned int j = 0; j < sizes[0]; j++) {
+      for (unsigned int i = 0; i < sizes[0]; i++) {
+        D0(i, j) = distances(i, j);
+      }
+    }
+    auto fromDistances = IncrementalMSComplex<double>::fromDistances(D0, y0, 8, smooth, 0.01);
+    D0.deallocate();
+
+    for (unsigned int b = 1; b < sizes.size(); b++) {
+      unsigned int n0 = sizes[b - 1];
+      unsigned int n = sizes[b];
+      FortranLinalg::DenseMatrix<double> Xnew(2, n - n0, X.data() + 2 * n0);
+      FortranLinalg::DenseVector<double> ynew(n - n0, y.data() + n0);
+      FortranLinalg::DenseMatrix<double> Dnew(n, n - n0);
+      for (unsigned int j = 0; j < Dnew.N(); j++) {
+        for (unsigned int i = 0; i < n; i++) {
+          Dnew(i, j) = distances(i, n0 + j);
+        }
+      }
+      // a small batch only revisits the neighborhood of the new samples
+      unsigned int updated = fromSamples.insertSamples(Xnew, ynew);
+      fromDistances.insertDistances(Dnew, ynew);
+      ASSERT_EQ(fromSamples.N(), n);
+      if (n - n0 == 1) {
+        ASSERT_LT(updated, 100u);
+      }
+
+      FortranLinalg::DenseMatrix<double> Xn(2, n, X.data());
+      FortranLinalg::DenseVector<double> yn(n, y.data());
+      FortranLinalg::DenseMatrix<double> Dn(n, n);
+      for (unsigned int j = 0; j < n; j++) {
+        for (unsigned int i = 0; i < n; i++) {
+          Dn(i, j) = distances(i, j);
+        }
+      }
+      NNMSComplex<double> expectedSamples(Xn, yn, 8, smooth, 0.0, 0.01);
+      auto samplesComplex = fromSamples.complex();
+      expectSameComplex(expectedSamples, *samplesComplex);
+      NNMSComplex<double> expectedDistances(Dn, yn, 8, smooth, 0.01, true);
+      auto distancesComplex = fromDistances.complex();
+      expectSameComplex(expectedDistances, *distancesComplex);
+
+      expectedSamples.cleanup();
+      samplesComplex->cleanup();
+      expectedDistances.cleanup();
+      distancesComplex->cleanup();
+      Dn.deallocate();
+      Dnew.deallocate();
+    }
+
+    FortranLinalg::DenseMatrix<double> wrong(3, 1);
+    FortranLinalg::DenseVector<double> one(1);
+    ASSERT_THROW(fromSamples.insertSamples(wrong, one), std::runtime_error);
+    ASSERT_THROW(fromSamples.insertDistances(wrong, one), std::runtime_error);
+    wrong.deallocate();
+    one.deallocate();
+    fromSamples.deallocate();
+    fromDistances.deallocate();
+  }
+  distances.deallocate();
+  X.deallocate();
+  y.deallocate();
+}
+
+TEST(NNMSComplex, incrementalRescaleMatchesRecompute) {
+  FortranLinalg::DenseMatrix<double> X(2, 400);
+  FortranLinalg::DenseVector<double> y(X.N()), scaled(X.N());
+  std::srand(7);
+  for (unsigned int i = 0; i < X.N(); i++) {
+    X(0, i) = std::rand() / (double) RAND_MAX;
+    X(1, i) = std::rand() / (double) RAND_MAX;
+    // integers, so the rescaled values are exact
+    y(i) = std::round(100 * std::sin(8 * X(0, i)) * std::cos(6 * X(1, i)));
+    scaled(i) = 0.25 * y(i) + 3;
+  }
+  auto incremental = IncrementalMSComplex<double>::fromSamples(X, y, 8);
+  incremental.rescale(0.25, 3);
+  ASSERT_EQ(incremental.values(), std::vector<double>(scaled.data(), scaled.data() + scaled.N()));
+  NNMSComplex<double> expected(X, scaled, 8, false, 0.0, 0.0);
+  auto complex = incremental.complex();
+  expectSameComplex(expected, *complex);
+  ASSERT_THROW(incremental.rescale(0, 1), std::runtime_error);
+
+  expected.cleanup();
+  complex->cleanup();
+  incremental.deallocate();
+  X.deallocate();
+  y.deallocate();
+  scaled.deallocate();
+}
+
+TEST(NNMSComplex, landmarksOfAllSamplesMatchComplex) {
+  unsigned int n = 300;
+  FortranLinalg::DenseMatrix<double> X(2, n);
+  FortranLinalg::DenseVector<double> y(n);
+  srand(17);
+  for (unsigned int i = 0; i < n; i++) {
+    X(0, i) = rand() / (double) RAND_MAX;
+    X(1, i) = rand() / (double) RAND_MAX;
+    y(i) = std::sin(7 * X(0, i)) * std::cos(5 * X(1, i)) + X(0, i);
+  }
+
+  for (auto selection : {LandmarkSelection::Farthest, LandmarkSelection::Density}) {
+    LandmarkMSComplex<double> landmarks(X, y, n, 8, selection);
+    ASSERT_EQ(landmarks.landmarkCount(), n);
+    std::set<int> distinct(landmarks.getLandmarks().begin(), landmarks.getLandmarks().end());
+    ASSERT_EQ(distinct.size(), n);
+
+    // every sample flows to the same maximum and minimum at every level
+    NNMSComplex<double> complex(X, y, 8, false, 0.0, 0.0);
+    auto &hierarchy = complex.getHierarchy();
+    ASSERT_EQ(landmarks.getComplex().getHierarchy().levelCount(), hierarchy.levelCount());
+    std::vector<std::pair<int, int>> pairs, extrema;
+    std::vector<int> crystalIDs, partition, landmarkPartition;
+    for (unsigned int level = 0; level < hierarchy.levelCount(); level++) {
+      hierarchy.crystalsAt(level, pairs, crystalIDs);
+      hierarchy.partitions(level, partition);
+      landmarks.crystalsAt(level, extrema, landmarkPartition);
+      ASSERT_EQ(extrema.size(), pairs.size());
+      for (unsigned int i = 0; i < n; i++) {
+        auto &p = pairs[partition[i]];
+        auto &e = extrema[landmarkPartition[i]];
+        ASSERT_EQ(e.first, hierarchy.getExtremaIndex()[p.first]);
+        ASSERT_EQ(e.second, hierarchy.getExtremaIndex()[p.second]);
+      }
+    }
+    complex.cleanup();
+    landmarks.deallocate();
+  }
+  X.deallocate();
+  y.deallocate();
+}
+
+TEST(NNMSComplex, landmarksApproximateComplex) {
+  unsigned int n = 3000;
+  FortranLinalg::DenseMatrix<double> X(2, n);
+  FortranLinalg::DenseVector<double> y(n);
+  srand(23);
+  for (unsigned int i = 0; i < n; i++) {
+    X(0, i) = rand() / (double) RAND_MAX;
+    X(1, i) = rand() / (double) RAND_MAX;
+    y(i) = std::sin(6 * X(0, i)) * std::sin(6 * X(1, i));
+  }
+  NNMSComplex<double> complex(X, y, 10, false, 0.0, 0.0);
+  auto &hierarchy = complex.getHierarchy();
+  std::vector<std::pair<int, int>> pairs, extrema;
+  std::vector<int> crystalIDs, partition, landmarkPartition;
+
+  for (auto selection : {LandmarkSelection::Farthest, LandmarkSelection::Density}) {
+    LandmarkMSComplex<double> landmarks(X, y, 400, 10, selection);
+    ASSERT_EQ(landmarks.landmarkCount(), 400u);
+
+    // paths of steepest ascent and descent end at landmark extrema
+    auto &steepest = landmarks.getSteepest();
+    for (unsigned int i = 0; i < n; i++) {
+      for (int e = 0; e < 2; e++) {
+        int current = i;
+        for (unsigned int steps = 0; steepest(e, current) != -1; steps++) {
+          ASSERT_LT(steps, n);
+          ASSERT_TRUE(e == 0 ? y(steepest(e, current)) >= y(current) || current == (int) i
+                             : y(steepest(e, current)) <= y(current) || current == (int) i);
+          current = steepest(e, current);
+        }
+      }
+    }
+
+    // after removing the noise, almost all samples reach extrema of the same
+    // value as in the exact complex
+    double threshold = 0.2;
+    unsigned int level = hierarchy.levelOf(threshold);
+    hierarchy.crystalsAt(level, pairs, crystalIDs);
+    hierarchy.partitions(level, partition);
+    landmarks.crystalsAt(landmarks.getComplex().getHierarchy().levelOf(threshold), extrema, landmarkPartition);
+    unsigned int agree = 0;
+    for (unsigned int i = 0; i < n; i++) {
+      auto &p = pairs[partition[i]];
+      auto &e = extrema[landmarkPartition[i]];
+      if (std::fabs(y(hierarchy.getExtremaIndex()[p.first]) - y(e.first)) < 0.05 &&
+          std::fabs(y(hierarchy.getExtremaIndex()[p.second]) - y(e.second)) < 0.05) {
+        agree++;
+      }
+    }
+    ASSERT_GT(agree, 0.9 * n);
+    landmarks.deallocate();
+  }
+  complex.cleanup();
+  X.deallocate();
+  y.deallocate();
+}
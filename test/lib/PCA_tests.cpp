@@ -0,0 +1,86 @@
+#include "gtest/gtest.h"
+#include "flinalg/DenseMatrix.h"
+#include "flinalg/Linalg.h"
+#include "dimred/PCA.h"
+
+#include <cmath>
+#include <random>
+
+//---------------------------------------------------------------------
+// Declarations
+//---------------------------------------------------------------------
+
+typedef PCA<float>::Solver Solver;
+
+// samples of a noisy curve with a decaying spectrum as columns
+FortranLinalg::DenseMatrix<float> curveSamples(unsigned int m, unsigned int n) {
+  FortranLinalg::DenseMatrix<float> X(m, n);
+  std::mt19937 generator(3);
+  std::normal_distribution<float> noise(0, 0.3f);
+  for (unsigned int j = 0; j < n; j++) {
+    float t = j / (float) n;
+    for (unsigned int i = 0; i < m; i++) {
+      X(i, j) = 3 * std::sin(3 * t + i) + 1.5f * std::cos(7 * t + 2 * i) + 0.7f * std::sin(13 * t + 0.5f * i) +
+                noise(generator);
+    }
+  }
+  return X;
+}
+
+// the randomized leading components and projections match those of the
+// covariance eigensystem up to sign
+void expectSameComponents(unsigned int m, unsigned int n, unsigned int ndims) {
+  FortranLinalg::DenseMatrix<float> X = curveSamples(m, n);
+  FortranLinalg::DenseMatrix<float> Xc = FortranLinalg::Linalg<float>::Copy(X);
+  FortranLinalg::DenseMatrix<float> Xr = FortranLinalg::Linalg<float>::Copy(X);
+  PCA<float> covariance(Xc, ndims, true, Solver::Covariance);
+  PCA<float> randomized(Xr, ndims, true, Solver::Randomized);
+  EXPECT_EQ(randomized.covariance.N(), 0u);
+  ASSERT_EQ(covariance.ev.M(), randomized.ev.M());
+  ASSERT_EQ(covariance.ev.N(), ndims);
+  ASSERT_EQ(randomized.ev.N(), ndims);
+
+  FortranLinalg::DenseMatrix<float> Lc = covariance.project(X, true);
+  FortranLinalg::DenseMatrix<float> Lr = randomized.project(X);
+  for (unsigned int c = 0; c < ndims; c++) {
+    double dot = 0;
+    for (unsigned int i = 0; i < m; i++) {
+      dot += covariance.ev(i, c) * randomized.ev(i, c);
+    }
+    EXPECT_NEAR(std::fabs(dot), 1, 1e-4) << m << " x " << n << " component " << c;
+    EXPECT_NEAR(randomized.ew(c), covariance.ew(c), 1e-4 * covariance.ew(c));
+    float sign = dot < 0 ? -1 : 1;
+    for (unsigned int j = 0; j < n; j++) {
+      EXPECT_NEAR(sign * Lr(c, j), Lc(c, j), 1e-3 * (1 + std::fabs(Lc(c, j))));
+    }
+  }
+  covariance.cleanup();
+  randomized.cleanup();
+  for (auto M : {&X, &Xc, &Xr, &Lc, &Lr}) M->deallocate();
+}
+
+//---------------------------------------------------------------------
+// Tests
+//---------------------------------------------------------------------
+
+// with more dimensions than samples the covariance path reduces the gram
+// matrix of the samples instead
+TEST(PCA, randomizedMatchesCovariance) {
+  expectSameComponents(60, 1000, 2);
+  expectSameComponents(1000, 60, 2);
+  expectSameComponents(400, 400, 3);
+}
+
+TEST(PCA, choosesRandomizedForLargeData) {
+  EXPECT_EQ(PCA<float>::chooseSolver(20, 100000, 2), Solver::Covariance);
+  EXPECT_EQ(PCA<float>::chooseSolver(100000, 50, 2), Solver::Covariance);
+  EXPECT_EQ(PCA<float>::chooseSolver(2000, 2000, 2), Solver::Randomized);
+  EXPECT_EQ(PCA<float>::chooseSolver(2000, 2000, 1000), Solver::Covariance);
+
+  // small data takes the covariance path when left to choose
+  FortranLinalg::DenseMatrix<float> X = curveSamples(5, 200);
+  PCA<float> pca(X, 2);
+  EXPECT_EQ(pca.covariance.N(), 5u);
+  pca.cleanup();
+  X.deallocate();
+}
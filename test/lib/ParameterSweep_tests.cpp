@@ -0,0 +1,113 @@
+#include "gtest/gtest.h"
+#include "flinalg/DenseMatrix.h"
+#include "flinalg/DenseVector.h"
+#include "flinalg/Linalg.h"
+#include "hdprocess/ParameterSweep.h"
+#include "metrics/Distance.h"
+#include "metrics/EuclideanMetric.h"
+#include "morsesmale/NNMSComplex.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Declarations
+//---------------------------------------------------------------------
+
+// two dimensional samples of a function with a few bumps
+void bumps(unsigned int n, FortranLinalg::DenseMatrix<Precision> &X, FortranLinalg::DenseVector<Precision> &y) {
+  X = FortranLinalg::DenseMatrix<Precision>(2, n);
+  y = FortranLinalg::DenseVector<Precision>(n);
+  std::srand(17);
+  for (unsigned int i = 0; i < n; i++) {
+    X(0, i) = std::rand() / (Precision) RAND_MAX;
+    X(1, i) = std::rand() / (Precision) RAND_MAX;
+    y(i) = std::sin(7 * X(0, i)) * std::cos(5 * X(1, i)) + 0.01 * std::rand() / (Precision) RAND_MAX;
+  }
+}
+
+//---------------------------------------------------------------------
+// Tests
+//---------------------------------------------------------------------
+
+TEST(ParameterSweep, settingsMatchSingleRuns) {
+  FortranLinalg::DenseMatrix<Precision> X;
+  FortranLinalg::DenseVector<Precision> y;
+  bumps(500, X, y);
+  EuclideanMetric<Precision> metric;
+  auto distances = Distance<Precision>::computeDistances(X, metric);
+
+  std::vector<int> knns = {6, 10, 15};
+  std::vector<Precision> sigmaSmooths = {0, 0.05};
+  ParameterSweep sweep(distances, 15);
+  SweepResult result = sweep.run(y, knns, sigmaSmooths, {0.05f, 0.2f}, X);
+  ASSERT_EQ(result.summaries.size(), knns.size() * sigmaSmooths.size());
+  // (knn, smooth) neighbors: 3 x 1 along sigmaSmooth and 2 x 2 along knn
+  ASSERT_EQ(result.agreements.size(), 7u);
+
+  for (unsigned int c = 0; c < result.summaries.size(); c++) {
+    SweepSummary &summary = result.summaries[c];
+    ASSERT_EQ(summary.knn, knns[c / sigmaSmooths.size()]);
+    ASSERT_EQ(summary.sigmaSmooth, sigmaSmooths[c % sigmaSmooths.size()]);
+
+    Precision sigma = summary.sigmaSmooth;
+    NNMSComplex<Precision> single(distances, y, summary.knn, sigma > 0, sigma * sigma, true);
+    auto persistence = single.getPersistence();
+    ASSERT_EQ(summary.persistence.size(), persistence.N());
+    ASSERT_EQ(summary.persistence.back(), 1);
+    Precision frange = FortranLinalg::Linalg<Precision>::Max(y) - FortranLinalg::Linalg<Precision>::Min(y);
+    for (unsigned int level = 0; level < persistence.N(); level++) {
+      if (level + 1 < persistence.N()) {
+        ASSERT_EQ(summary.persistence[level], persistence(level) / frange);
+      }
+      single.mergeLevel(level);
+      ASSERT_EQ(summary.crystalCounts[level], single.getNCrystals());
+      if (level > 0 && level + 1 < persistence.N()) {
+        ASSERT_LE(summary.persistence[level] - summary.persistence[level - 1], summary.stableGap);
+      }
+    }
+    ASSERT_LT(summary.stableLevel + 1, std::max<size_t>(2, persistence.N()));
+
+    ASSERT_EQ(summary.regressionErrors.size(), 2u);
+    for (Precision error : summary.regressionErrors) {
+      ASSERT_GE(error, 0);
+      ASSERT_LT(error, 1);
+    }
+    persistence.deallocate();
+    single.cleanup();
+  }
+  for (auto &agreement : result.agreements) {
+    ASSERT_LT(agreement.first, agreement.second);
+    ASSERT_LE(agreement.adjustedRand, 1);
+  }
+
+  ASSERT_THROW(sweep.run(y, {16}, {0}, {}), std::runtime_error);
+
+  // coordinates, with the sample itself among its neighbors
+  ParameterSweep samples = ParameterSweep::fromSamples(X, 12);
+  SweepResult fromSamples = samples.run(y, {12}, {0}, {});
+  NNMSComplex<Precision> single(X, y, 12, false, 0.0, 0.0);
+  ASSERT_EQ(fromSamples.summaries[0].crystalCounts[0], single.getNCrystals());
+  ASSERT_EQ(fromSamples.summaries[0].persistence.size(), single.getHierarchy().levelCount());
+  ASSERT_TRUE(fromSamples.summaries[0].regressionErrors.empty());
+  single.cleanup();
+  samples.deallocate();
+  sweep.deallocate();
+  distances.deallocate();
+  X.deallocate();
+  y.deallocate();
+}
+
+TEST(ParameterSweep, adjustedRandIndex) {
+  std::vector<int> a = {0, 0, 0, 1, 1, 1, 2, 2};
+  std::vector<int> relabeled = {2, 2, 2, 0, 0, 0, 1, 1};
+  ASSERT_FLOAT_EQ(ParameterSweep::adjustedRand(a, relabeled), 1);
+  ASSERT_FLOAT_EQ(ParameterSweep::adjustedRand(a, a), 1);
+
+  // contingency table [[2 1 0] [0 2 1] [0 0 2]]: (3 - 49/28) / (7 - 49/28)
+  std::vector<int> b = {0, 0, 1, 1, 1, 2, 2, 2};
+  ASSERT_NEAR(ParameterSweep::adjustedRand(a, b), 1.25 / 5.25, 1e-6);
+  std::vector<int> single(8, 0);
+  ASSERT_FLOAT_EQ(ParameterSweep::adjustedRand(a, single), 0);
+}
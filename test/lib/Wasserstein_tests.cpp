@@ -0,0 +1,159 @@
+#include "gtest/gtest.h"
+#include "flinalg/DenseMatrix.h"
+#include "flinalg/DenseVector.h"
+#include "metrics/Wasserstein.h"
+
+#include <Eigen/Dense>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Declarations
+//---------------------------------------------------------------------
+
+typedef Eigen::MatrixXd EMatrix;
+
+EMatrix covariance(FortranLinalg::DenseMatrix<double> &U, FortranLinalg::DenseVector<double> &S, unsigned int d) {
+  EMatrix C = EMatrix::Zero(d, d);
+  for (unsigned int j = 0; j < U.N(); j++) {
+    Eigen::Map<Eigen::VectorXd> u(U.data() + j * d, d);
+    C += S(j) * u * u.transpose();
+  }
+  return C;
+}
+
+// the textbook form with matrix square roots of the full covariances
+double referenceDistance(FortranLinalg::DenseVector<double> &m1, FortranLinalg::DenseMatrix<double> &U1,
+                         FortranLinalg::DenseVector<double> &S1, FortranLinalg::DenseVector<double> &m2,
+                         FortranLinalg::DenseMatrix<double> &U2, FortranLinalg::DenseVector<double> &S2) {
+  unsigned int d = m1.N();
+  EMatrix C1 = covariance(U1, S1, d), C2 = covariance(U2, S2, d);
+  Eigen::SelfAdjointEigenSolver<EMatrix> root1(C1);
+  // clamped, C1 is only positive semidefinite
+  EMatrix R1 = root1.eigenvectors() * root1.eigenvalues().cwiseMax(0).cwiseSqrt().asDiagonal() *
+               root1.eigenvectors().transpose();
+  Eigen::SelfAdjointEigenSolver<EMatrix> cross(R1 * C2 * R1, Eigen::EigenvaluesOnly);
+  double tc = cross.eigenvalues().cwiseMax(0).cwiseSqrt().sum();
+  double md = (Eigen::Map<Eigen::VectorXd>(m1.data(), d) - Eigen::Map<Eigen::VectorXd>(m2.data(), d)).squaredNorm();
+  return std::sqrt(std::max(0.0, md + C1.trace() + C2.trace() - 2 * tc));
+}
+
+// random point clouds of varying size, some with fewer samples than
+// dimensions, summarized at the given rank
+void randomSummaries(unsigned int d, unsigned int count, unsigned int rank,
+                     std::vector<FortranLinalg::DenseVector<double>> &means,
+                     std::vector<FortranLinalg::DenseMatrix<double>> &U,
+                     std::vector<FortranLinalg::DenseVector<double>> &S) {
+  std::srand(5);
+  for (unsigned int c = 0; c < count; c++) {
+    unsigned int n = 2 + (c * 7) % (2 * d);
+    FortranLinalg::DenseMatrix<double> X(d, n);
+    std::vector<unsigned int> indices;
+    for (unsigned int j = 0; j < n; j++) {
+      for (unsigned int i = 0; i < d; i++) {
+        X(i, j) = c + (i + 1) * std::rand() / (double) RAND_MAX;
+      }
+      indices.push_back(j);
+    }
+    means.emplace_back();
+    U.emplace_back();
+    S.emplace_back();
+    Wasserstein<double>::summarize(X, indices, rank, means.back(), U.back(), S.back());
+    X.deallocate();
+  }
+}
+
+void deallocate(std::vector<FortranLinalg::DenseVector<double>> &means,
+                std::vector<FortranLinalg::DenseMatrix<double>> &U,
+                std::vector<FortranLinalg::DenseVector<double>> &S) {
+  for (unsigned int i = 0; i < means.size(); i++) {
+    means[i].deallocate();
+    U[i].deallocate();
+    S[i].deallocate();
+  }
+}
+
+//---------------------------------------------------------------------
+// Tests
+//---------------------------------------------------------------------
+
+TEST(Wasserstein, summarizeRecoversSampleCovariance) {
+  unsigned int d = 6;
+  std::vector<FortranLinalg::DenseVector<double>> means;
+  std::vector<FortranLinalg::DenseMatrix<double>> U;
+  std::vector<FortranLinalg::DenseVector<double>> S;
+  FortranLinalg::DenseMatrix<double> X(d, 40);
+  std::vector<unsigned int> all, few;
+  std::srand(9);
+  for (unsigned int j = 0; j < X.N(); j++) {
+    for (unsigned int i = 0; i < d; i++) {
+      X(i, j) = std::rand() / (double) RAND_MAX;
+    }
+    all.push_back(j);
+    if (j % 10 == 0) few.push_back(j);
+  }
+
+  // covariance path (d <= n) and Gram path (d > n)
+  for (auto &indices : {all, few}) {
+    means.emplace_back();
+    U.emplace_back();
+    S.emplace_back();
+    Wasserstein<double>::summarize(X, indices, 0, means.back(), U.back(), S.back());
+
+    EMatrix Xs(d, indices.size());
+    for (unsigned int j = 0; j < indices.size(); j++) {
+      Xs.col(j) = Eigen::Map<Eigen::VectorXd>(X.data() + indices[j] * d, d);
+    }
+    Eigen::VectorXd m = Xs.rowwise().mean();
+    Xs.colwise() -= m;
+    EMatrix expected = Xs * Xs.transpose() / (indices.size() - 1.0);
+
+    ASSERT_LE(U.back().N(), std::min<unsigned int>(d, indices.size() - 1));
+    ASSERT_NEAR((covariance(U.back(), S.back(), d) - expected).norm(), 0, 1e-10);
+    for (unsigned int i = 0; i < d; i++) {
+      ASSERT_NEAR(means.back()(i), m(i), 1e-12);
+    }
+  }
+  X.deallocate();
+  deallocate(means, U, S);
+}
+
+TEST(Wasserstein, distancesMatchReference) {
+  unsigned int d = 7;
+  for (unsigned int rank : {0u, 3u}) {
+    std::vector<FortranLinalg::DenseVector<double>> means;
+    std::vector<FortranLinalg::DenseMatrix<double>> U;
+    std::vector<FortranLinalg::DenseVector<double>> S;
+    randomSummaries(d, 15, rank, means, U, S);
+    // a point mass
+    means.push_back(FortranLinalg::DenseVector<double>(d));
+    for (unsigned int i = 0; i < d; i++) means.back()(i) = i;
+    U.push_back(FortranLinalg::DenseMatrix<double>(d, 0));
+    S.push_back(FortranLinalg::DenseVector<double>(0));
+
+    auto D = Wasserstein<double>::distances(means, U, S);
+    Wasserstein<double> pairwise;
+    for (unsigned int i = 0; i < means.size(); i++) {
+      ASSERT_EQ(D(i, i), 0);
+      for (unsigned int j = 0; j < means.size(); j++) {
+        double expected = referenceDistance(means[i], U[i], S[i], means[j], U[j], S[j]);
+        ASSERT_NEAR(D(i, j), expected, 1e-6 * std::max(1.0, expected));
+        ASSERT_EQ(D(i, j), D(j, i));
+        if (i != j && U[i].N() > 0 && U[j].N() > 0) {
+          ASSERT_NEAR(pairwise.distance(U[i], S[i], means[i], U[j], S[j], means[j]), expected,
+                      1e-6 * std::max(1.0, expected));
+        }
+      }
+    }
+    D.deallocate();
+    deallocate(means, U, S);
+  }
+}
+
+TEST(Wasserstein, inconsistentSummariesThrow) {
+  std::vector<FortranLinalg::DenseVector<double>> means(2);
+  std::vector<FortranLinalg::DenseMatrix<double>> U(2);
+  std::vector<FortranLinalg::DenseVector<double>> S(1);
+  ASSERT_THROW(Wasserstein<double>::distances(means, U, S), std::runtime_error);
+}